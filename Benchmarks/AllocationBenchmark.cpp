@@ -0,0 +1,265 @@
+//  Message allocation benchmark
+//  Counts the heap allocations a connection makes per message once it has settled into a steady stream, such as the middle
+//  of a file transfer. Every message is composed like a file chunk, framed and queued by the sending socket, flushed with a
+//  gathered write, decoded off the receiving socket and handed over as a transport message, then read and checked. Global
+//  operator new is replaced to count every allocation, and the buffer pool's own counters show how many of its requests
+//  reached the heap. Once warm the path should report zero heap allocations per message. Linux only, like the framing benchmark.
+//
+//  Example: AllocationBenchmark --min-size 1K --max-size 1M --min-time 1 --format json --output allocation.json
+
+#include "BenchmarkHarness.h"
+
+#include "Engine/MemoryManager.h"
+#include "Engine/Socket.h"
+#include "Engine/FrameDecoder.h"
+#include "Engine/MessageTransport.h"
+#include "Engine/SimpleSHA256.h"
+
+#include <new>
+
+constexpr uint64_t ALLOCATION_BATCH_BYTES		= 1024 * 1024;		//  Roughly how much each operation sends, whatever the message size
+constexpr uint64_t ALLOCATION_MAX_BATCH_COUNT	= 256;
+constexpr uint64_t ALLOCATION_CLEAN_PASSES		= 64;				//  Passes in a row that mustn't allocate before measuring starts
+constexpr uint64_t ALLOCATION_MAX_WARM_UP_PASSES	= 1024;
+constexpr unsigned char ALLOCATION_MESSAGE_ID	= 200;
+constexpr int ALLOCATION_SOCKET_BUFFER_BYTES		= 64 * 1024;
+
+//  Every allocation made through global operator new, on any thread
+static std::atomic<uint64_t> HeapAllocationCount(0);
+
+void* operator new(size_t size)
+{
+	HeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	auto data = malloc(size ? size : 1);
+	if (data == nullptr) throw std::bad_alloc();
+	return data;
+}
+void* operator new[](size_t size) { return operator new(size); }
+
+//  Once the replacements are inlined, GCC sees a block from operator new handed to free and warns. Here that is the pairing,
+//  as the new above takes its blocks from malloc.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* data) noexcept { free(data); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+void operator delete[](void* data) noexcept { operator delete(data); }
+void operator delete(void* data, size_t) noexcept { operator delete(data); }
+void operator delete[](void* data, size_t) noexcept { operator delete(data); }
+
+
+//  Both ends of a loopback TCP connection, each one a Socket the way the server and client hold them
+class LoopbackConnection
+{
+private:
+	int ListenHandle;
+	Socket* SendSocket;
+	Socket* ReceiveSocket;
+
+public:
+	LoopbackConnection() : ListenHandle(-1), SendSocket(nullptr), ReceiveSocket(nullptr) {}
+	~LoopbackConnection()
+	{
+		delete SendSocket;
+		delete ReceiveSocket;
+		if (ListenHandle >= 0) close(ListenHandle);
+	}
+
+	bool Open(int framingVersion)
+	{
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		socklen_t addressLength = sizeof(address);
+
+		ListenHandle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((ListenHandle < 0) || (bind(ListenHandle, (sockaddr*)&address, sizeof(address)) != 0) || (listen(ListenHandle, 1) != 0)) return false;
+		if (getsockname(ListenHandle, (sockaddr*)&address, &addressLength) != 0) return false;
+
+		auto sendHandle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((sendHandle < 0) || (connect(sendHandle, (sockaddr*)&address, sizeof(address)) != 0)) return false;
+		auto receiveHandle = accept(ListenHandle, nullptr, nullptr);
+		if (receiveHandle < 0) return false;
+
+		//  Both ends are non-blocking, so a single thread can keep sending and receiving in turn
+		SendSocket = new Socket(sendHandle);
+		ReceiveSocket = new Socket(receiveHandle);
+		for (auto socket : { SendSocket, ReceiveSocket }) { socket->setsync(1); socket->setnagle(false); socket->setframing(framingVersion); }
+
+		//  Small socket buffers, so any large message goes out in parts from the send queue on every pass, as it would over a real
+		//  link. Left to the loopback's own sizes, that happens only now and then, and the first time could fall in the measurement.
+		for (auto socket : { SendSocket, ReceiveSocket }) socket->setbuffersizes(ALLOCATION_SOCKET_BUFFER_BYTES, ALLOCATION_SOCKET_BUFFER_BYTES);
+		return true;
+	}
+
+	inline Socket* GetSendSocket() { return SendSocket; }
+	inline Socket* GetReceiveSocket() { return ReceiveSocket; }
+};
+
+
+//  One connection's worth of state for a stream of chunk messages, kept from one operation to the next like a real connection's
+class ChunkStream
+{
+private:
+	LoopbackConnection Connection;
+	FrameDecoder Decoder;
+	SocketBuffer OutgoingMessage;
+	SocketBuffer IncomingMessage;
+	std::vector<unsigned char> ChunkData;
+	unsigned char ChunkDigest[SHA256::DIGEST_SIZE];
+	uint64_t ChunkIndex;
+	uint64_t MessagesPerBatch;
+	uint64_t MessagesChecked;
+
+	//  The FILE_PORTION layout: portion index, chunk index, chunk size, a 4 character checksum, then the chunk itself
+	void WriteChunk()
+	{
+		char checksum4[4];
+		SHA256::DigestToHex(ChunkDigest, checksum4, 2);
+
+		OutgoingMessage.clear();
+		OutgoingMessage.writechar(ALLOCATION_MESSAGE_ID);
+		OutgoingMessage.writelint(0);
+		OutgoingMessage.writelint(ChunkIndex++);
+		OutgoingMessage.writelint(uint64_t(ChunkData.size()));
+		OutgoingMessage.writeint(4);
+		OutgoingMessage.writechars(checksum4, 4);
+		OutgoingMessage.writechars((char*)ChunkData.data(), int(ChunkData.size()));
+		Connection.GetSendSocket()->sendmessage(nullptr, 0, &OutgoingMessage);
+	}
+
+	//  Reads a chunk the way FileReceiveTask does, in place, and checks its checksum without building any strings
+	void ReadChunk(TransportMessage& message)
+	{
+		auto& buffer = message.Buffer;
+		buffer.readlint();
+		buffer.readlint();
+		auto chunkSize = buffer.readlint();
+		auto checksumSize = buffer.readint();
+		if ((checksumSize != 4) || (buffer.bytesleft() < 4 + int(chunkSize))) return;
+
+		char checksum4[4];
+		SHA256::DigestToHex(ChunkDigest, checksum4, 2);
+		if (memcmp(checksum4, buffer.m_BufferData + buffer.m_ReadPosition, 4) == 0) ++MessagesChecked;
+	}
+
+	//  Takes every whole frame off the receiving end, as Server::ReceiveMessages and the transport inboxes do
+	uint64_t ReceiveChunks()
+	{
+		uint64_t received = 0;
+		if (Connection.GetReceiveSocket()->receiveframes(&Decoder) <= 0) return 0;
+		while (Decoder.PopFrame(IncomingMessage))
+		{
+			auto messageID = (unsigned char)(IncomingMessage.readchar());
+			auto message = (IncomingMessage.m_BufferUtilizedCount > FRAME_DIRECT_THRESHOLD) ? TransportMessage::Take(messageID, IncomingMessage) : TransportMessage::Create(messageID, IncomingMessage);
+			ReadChunk(*message);
+			++received;
+		}
+		return received;
+	}
+
+public:
+	ChunkStream() : ChunkIndex(0), MessagesPerBatch(0), MessagesChecked(0) {}
+
+	bool Open(uint64_t chunkSize)
+	{
+		auto framingVersion = (chunkSize + 64 > uint64_t(FRAME_LEGACY_MAX_MESSAGE_SIZE)) ? FRAMING_VERSION_LARGE : FRAMING_VERSION_LEGACY;
+		if (!Connection.Open(framingVersion)) return false;
+		Decoder.SetFramingVersion(framingVersion);
+
+		ChunkData.resize(size_t(chunkSize));
+		for (size_t i = 0; i < ChunkData.size(); ++i) ChunkData[i] = (unsigned char)(i * 31);
+		SHA256 chunkHasher;
+		chunkHasher.update(ChunkData.data(), ChunkData.size());
+		chunkHasher.final(ChunkDigest);
+
+		MessagesPerBatch = std::clamp<uint64_t>(ALLOCATION_BATCH_BYTES / chunkSize, 1, ALLOCATION_MAX_BATCH_COUNT);
+		return true;
+	}
+
+	//  Sends one batch of chunks, flushing once a pass like MainProcess does, and receives them all
+	void SendBatch()
+	{
+		uint64_t sent = 0;
+		uint64_t received = 0;
+		while (received < MessagesPerBatch)
+		{
+			auto sendSocket = Connection.GetSendSocket();
+			while ((sent < MessagesPerBatch) && !sendSocket->getsendqueue().GetBackpressure()) { WriteChunk(); ++sent; }
+			sendSocket->flushsend();
+			received += ReceiveChunks();
+		}
+	}
+
+	inline uint64_t GetMessagesPerBatch() const { return MessagesPerBatch; }
+	inline uint64_t GetMessagesChecked() const { return MessagesChecked; }
+	inline uint64_t GetBatchBytes() const { return MessagesPerBatch * uint64_t(ChunkData.size()); }
+};
+
+
+int main(int argc, char* argv[])
+{
+	Benchmark::Options options;
+	options.MinSize = 1024;
+	options.MaxSize = 1024 * 1024;
+	if (!Benchmark::ParseOptions(argc, argv, options)) return 1;
+	options.MaxSize = std::min<uint64_t>(options.MaxSize, FRAME_MAX_MESSAGE_SIZE / 2);
+	options.MinSize = std::min<uint64_t>(options.MinSize, options.MaxSize);
+
+	Benchmark::PrintHeader(options);
+
+	auto allocationsFound = false;
+	for (auto size : Benchmark::GetSizes(options))
+	{
+		if (!Benchmark::MatchesFilter(options, "chunk_stream")) continue;
+
+		ChunkStream stream;
+		if (!stream.Open(size)) { fprintf(stderr, "Could not open a loopback connection\n"); return 1; }
+
+		//  A few passes in, the send queue's deque first needs a second node and two received messages are first alive at once, so one
+		//  pass isn't enough to reach the most the stream ever has in flight. Warm up until a long run of passes takes nothing from the
+		//  heap. Measure() runs one more untimed pass of its own; only what comes after counts.
+		uint64_t warmUpPasses = 0;
+		uint64_t cleanPasses = 0;
+		while ((cleanPasses < ALLOCATION_CLEAN_PASSES) && (warmUpPasses < ALLOCATION_MAX_WARM_UP_PASSES))
+		{
+			auto heapBefore = HeapAllocationCount.load();
+			stream.SendBatch();
+			++warmUpPasses;
+			cleanPasses = (HeapAllocationCount.load() == heapBefore) ? (cleanPasses + 1) : 0;
+		}
+
+		uint64_t heapAllocations = 0;
+		uint64_t poolHeapAllocations = 0;
+		uint64_t poolAllocations = 0;
+		uint64_t measuredOperations = 0;
+		auto warmedUp = false;
+		auto result = Benchmark::Measure(options, "allocation", "chunk_stream", stream.GetBatchBytes(), false, [&]()
+		{
+			auto heapBefore = HeapAllocationCount.load();
+			auto poolHeapBefore = BufferPool::GetHeapAllocations();
+			auto poolBefore = BufferPool::GetPoolAllocations();
+			stream.SendBatch();
+			if (!warmedUp) { warmedUp = true; return; }
+
+			heapAllocations += HeapAllocationCount.load() - heapBefore;
+			poolHeapAllocations += BufferPool::GetHeapAllocations() - poolHeapBefore;
+			poolAllocations += BufferPool::GetPoolAllocations() - poolBefore;
+			++measuredOperations;
+		});
+		Benchmark::PrintResult(options, result);
+
+		auto messageCount = double(std::max<uint64_t>(measuredOperations * stream.GetMessagesPerBatch(), 1));
+		fprintf(stderr, "%llu byte chunks: %.3f heap allocations per message (%.3f by the buffer pool), %.1f pooled, %llu of %llu checksums matched\n",
+			(unsigned long long)(size), double(heapAllocations) / messageCount, double(poolHeapAllocations) / messageCount, double(poolAllocations) / messageCount,
+			(unsigned long long)(stream.GetMessagesChecked()), (unsigned long long)(stream.GetMessagesPerBatch() * (result.Operations + warmUpPasses + 1)));
+		if (heapAllocations != 0) allocationsFound = true;
+	}
+
+	//  A non-zero exit means the steady state allocated, so scripts can treat it as a regression
+	return allocationsFound ? 2 : 0;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+//  A small, dependency-free harness shared by the benchmark executables. Every result is emitted as one line of
+//  CSV or JSON, so runs can be diffed and compared by scripts without scraping human readable output.
+
+constexpr auto BENCHMARK_DEFAULT_MIN_TIME		= 0.25;						//  Seconds each measurement is repeated for, at minimum
+constexpr auto BENCHMARK_COLD_CACHE_SIZE		= (64 * 1024 * 1024);		//  Bytes walked between iterations to evict the caches
+
+namespace Benchmark
+{
+	enum OutputFormat { FORMAT_CSV, FORMAT_JSON };
+
+	struct Options
+	{
+		uint64_t MinSize = 8;
+		uint64_t MaxSize = 64 * 1024 * 1024;
+		std::vector<int> ThreadCounts = { 1 };
+		std::string Filter = "";
+		double MinTime = BENCHMARK_DEFAULT_MIN_TIME;
+		bool ColdCache = true;
+		bool WarmCache = true;
+		OutputFormat Format = FORMAT_CSV;
+		FILE* Output = stdout;
+	};
+
+	struct Result
+	{
+		std::string Suite;
+		std::string Name;
+		std::string Cache;
+		int Threads;
+		uint64_t Bytes;
+		uint64_t Operations;
+		double Seconds;
+
+		inline double GetMegabytesPerSecond() const { return (Seconds <= 0.0) ? 0.0 : (double(Bytes) * double(Operations) / (1024.0 * 1024.0)) / Seconds; }
+		inline double GetNanosecondsPerOperation() const { return (Operations == 0) ? 0.0 : (Seconds * 1000000000.0) / (double(Operations) / double(Threads)); }
+	};
+
+	inline double Now() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+	//  Parses sizes such as "64", "16K", "8M" or "1G" into bytes
+	inline uint64_t ParseSize(std::string sizeString)
+	{
+		if (sizeString.empty()) return 0;
+		uint64_t multiplier = 1;
+		switch (toupper(sizeString.back()))
+		{
+		case 'K':	multiplier = 1024;							sizeString.pop_back();	break;
+		case 'M':	multiplier = 1024 * 1024;					sizeString.pop_back();	break;
+		case 'G':	multiplier = 1024 * 1024 * 1024;			sizeString.pop_back();	break;
+		}
+		return uint64_t(strtoull(sizeString.c_str(), nullptr, 10)) * multiplier;
+	}
+
+	//  Powers of eight from the minimum to the maximum size, always including the maximum itself
+	inline std::vector<uint64_t> GetSizes(const Options& options)
+	{
+		std::vector<uint64_t> sizes;
+		for (uint64_t size = options.MinSize; size < options.MaxSize; size *= 8) sizes.push_back(size);
+		sizes.push_back(options.MaxSize);
+		return sizes;
+	}
+
+	inline bool ParseOptions(int argc, char* argv[], Options& options)
+	{
+		for (auto i = 1; i < argc; ++i)
+		{
+			std::string argument = argv[i];
+			auto hasValue = (i + 1 < argc);
+
+			if (argument == "--min-size" && hasValue) options.MinSize = std::max<uint64_t>(ParseSize(argv[++i]), 1);
+			else if (argument == "--max-size" && hasValue) options.MaxSize = ParseSize(argv[++i]);
+			else if (argument == "--min-time" && hasValue) options.MinTime = atof(argv[++i]);
+			else if (argument == "--filter" && hasValue) options.Filter = argv[++i];
+			else if (argument == "--cold-only") options.WarmCache = false;
+			else if (argument == "--warm-only") options.ColdCache = false;
+			else if (argument == "--format" && hasValue)
+			{
+				std::string format = argv[++i];
+				options.Format = (format == "json") ? FORMAT_JSON : FORMAT_CSV;
+			}
+			else if (argument == "--output" && hasValue)
+			{
+				options.Output = fopen(argv[++i], "w");
+				if (options.Output == nullptr) { fprintf(stderr, "Could not open %s for writing\n", argv[i]); return false; }
+			}
+			else if (argument == "--threads" && hasValue)
+			{
+				//  A comma separated list, where 0 means every hardware thread
+				options.ThreadCounts.clear();
+				std::string threadList = argv[++i];
+				size_t start = 0;
+				while (start <= threadList.length())
+				{
+					auto end = threadList.find(',', start);
+					if (end == std::string::npos) end = threadList.length();
+					auto count = atoi(threadList.substr(start, end - start).c_str());
+					options.ThreadCounts.push_back((count <= 0) ? std::max<int>(int(std::thread::hardware_concurrency()), 1) : count);
+					start = end + 1;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "Usage: %s [--min-size N] [--max-size N] [--threads 1,2,0] [--min-time SECONDS] [--filter NAME] [--cold-only|--warm-only] [--format csv|json] [--output FILE]\n", argv[0]);
+				fprintf(stderr, "Sizes accept K, M and G suffixes. A thread count of 0 means every hardware thread.\n");
+				return false;
+			}
+		}
+
+		if (options.MaxSize < options.MinSize) options.MaxSize = options.MinSize;
+		return true;
+	}
+
+	inline bool MatchesFilter(const Options& options, const std::string& name)
+	{
+		return options.Filter.empty() || (name.find(options.Filter) != std::string::npos);
+	}
+
+	inline void PrintHeader(const Options& options)
+	{
+		if (options.Format == FORMAT_CSV) fprintf(options.Output, "suite,name,cache,threads,bytes,operations,seconds,mb_per_s,ns_per_op\n");
+		fflush(options.Output);
+	}
+
+	inline void PrintResult(const Options& options, const Result& result)
+	{
+		if (options.Format == FORMAT_CSV)
+		{
+			fprintf(options.Output, "%s,%s,%s,%d,%llu,%llu,%.6f,%.3f,%.1f\n", result.Suite.c_str(), result.Name.c_str(), result.Cache.c_str(), result.Threads,
+				(unsigned long long)(result.Bytes), (unsigned long long)(result.Operations), result.Seconds, result.GetMegabytesPerSecond(), result.GetNanosecondsPerOperation());
+		}
+		else
+		{
+			fprintf(options.Output, "{\"suite\":\"%s\",\"name\":\"%s\",\"cache\":\"%s\",\"threads\":%d,\"bytes\":%llu,\"operations\":%llu,\"seconds\":%.6f,\"mb_per_s\":%.3f,\"ns_per_op\":%.1f}\n",
+				result.Suite.c_str(), result.Name.c_str(), result.Cache.c_str(), result.Threads,
+				(unsigned long long)(result.Bytes), (unsigned long long)(result.Operations), result.Seconds, result.GetMegabytesPerSecond(), result.GetNanosecondsPerOperation());
+		}
+		fflush(options.Output);
+	}
+
+	//  Where EvictCaches() leaves what it read, so the walk can't be optimized away
+	inline volatile unsigned char EvictionSink = 0;
+
+	//  Walks a buffer larger than the last level cache, so the next operation starts with its tables and input evicted
+	inline void EvictCaches()
+	{
+		static std::vector<unsigned char> evictionBuffer(BENCHMARK_COLD_CACHE_SIZE, 1);
+		unsigned char accumulator = 0;
+		for (size_t i = 0; i < evictionBuffer.size(); i += 64) { evictionBuffer[i] += 1; accumulator ^= evictionBuffer[i]; }
+		EvictionSink = accumulator;
+	}
+
+	//  Runs the operation until the minimum time has passed. Warm runs time a batch after one untimed warm-up pass.
+	//  Cold runs evict the caches before every iteration and only time the operation itself.
+	inline Result Measure(const Options& options, std::string suite, std::string name, uint64_t bytes, bool cold, const std::function<void()>& operation)
+	{
+		Result result = { suite, name, cold ? "cold" : "warm", 1, bytes, 0, 0.0 };
+
+		if (!cold) operation();
+
+		auto deadline = Now() + options.MinTime;
+		do
+		{
+			if (cold) EvictCaches();
+			auto start = Now();
+			operation();
+			result.Seconds += Now() - start;
+			++result.Operations;
+		} while (Now() < deadline);
+
+		return result;
+	}
+
+	//  Runs one operation instance per thread, all released together, and reports the aggregate throughput.
+	//  Each thread repeats its operation the number of times a single thread managed within the minimum time.
+	inline Result MeasureThreaded(const Options& options, std::string suite, std::string name, uint64_t bytes, int threadCount, const std::function<std::function<void()>(int)>& createOperation)
+	{
+		std::vector<std::function<void()>> operations;
+		for (auto i = 0; i < threadCount; ++i) operations.push_back(createOperation(i));
+
+		//  Calibrate on the first instance, so every thread does the same amount of work
+		uint64_t iterations = 0;
+		operations[0]();
+		auto deadline = Now() + options.MinTime;
+		do { operations[0](); ++iterations; } while (Now() < deadline);
+
+		std::atomic<int> readyCount(0);
+		std::atomic<bool> released(false);
+		std::vector<std::thread> threads;
+		for (auto i = 0; i < threadCount; ++i)
+		{
+			threads.push_back(std::thread([&, i]()
+			{
+				++readyCount;
+				while (!released) std::this_thread::yield();
+				for (uint64_t j = 0; j < iterations; ++j) operations[i]();
+			}));
+		}
+
+		while (readyCount < threadCount) std::this_thread::yield();
+		auto start = Now();
+		released = true;
+		for (auto& thread : threads) thread.join();
+
+		return Result{ suite, name, "warm", threadCount, bytes, iterations * uint64_t(threadCount), Now() - start };
+	}
+}
@@ -0,0 +1,182 @@
+//  Message framing benchmark
+//  Measures how fast a connection's incoming messages can be taken off a socket, comparing the per-message path (peek the
+//  length, peek the message, then read the two separately) with the frame decoder (read whatever has arrived in large
+//  blocks, then take every whole frame out of the ring). A writer thread streams batches of framed messages over a loopback
+//  TCP connection, and each operation receives one batch. Linux only, as it drives the POSIX socket backend directly.
+//  Messages too large for the legacy 2 byte header are sent in the large framing, and only the frame decoder takes those.
+//
+//  Example: FramingBenchmark --min-size 16 --max-size 4M --min-time 1 --format json --output framing.json
+
+#include "BenchmarkHarness.h"
+
+#include "Engine/MemoryManager.h"
+#include "Engine/Socket.h"
+#include "Engine/FrameDecoder.h"
+
+constexpr uint64_t FRAMING_BATCH_BYTES			= 1024 * 1024;		//  Roughly how much each batch sends, whatever the message size
+constexpr uint64_t FRAMING_MAX_MESSAGE_SIZE		= FRAME_MAX_MESSAGE_SIZE;
+constexpr uint64_t FRAMING_MAX_PEEK_SIZE		= 8193;				//  The per-message path peeks into a fixed 8 KB buffer
+constexpr int FRAMING_RECEIVE_BUFFER_SIZE		= 4 * 1024 * 1024;
+
+//  Both ends of a loopback TCP connection, with a thread on the sending end that writes one batch each time it's asked
+class LoopbackStream
+{
+private:
+	int ListenHandle;
+	int SendHandle;
+	Socket* ReceiveSocket;
+
+	std::vector<char> Batch;
+	std::atomic<uint64_t> BatchesRequested;
+	std::atomic<bool> Running;
+	std::thread Writer;
+
+	void WriterLoop()
+	{
+		uint64_t batchesSent = 0;
+		while (Running)
+		{
+			if (BatchesRequested == batchesSent) { std::this_thread::yield(); continue; }
+
+			size_t sent = 0;
+			while (sent < Batch.size())
+			{
+				auto result = send(SendHandle, Batch.data() + sent, Batch.size() - sent, MSG_NOSIGNAL);
+				if (result <= 0) { Running = false; return; }
+				sent += size_t(result);
+			}
+			++batchesSent;
+		}
+	}
+
+public:
+	LoopbackStream() : ListenHandle(-1), SendHandle(-1), ReceiveSocket(nullptr), BatchesRequested(0), Running(false) {}
+	~LoopbackStream()
+	{
+		Running = false;
+		if (Writer.joinable()) Writer.join();
+		delete ReceiveSocket;
+		if (SendHandle >= 0) close(SendHandle);
+		if (ListenHandle >= 0) close(ListenHandle);
+	}
+
+	//  Connects the two ends over an ephemeral port, and sets the receiving end non-blocking like the server's connections
+	bool Open()
+	{
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		socklen_t addressLength = sizeof(address);
+
+		//  The per-message path only takes a message once all of it is waiting. With the default receive buffer it was seen to
+		//  stall for good with half a message queued, so give the receiving end (which inherits this) plenty of room.
+		ListenHandle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		int receiveBufferSize = FRAMING_RECEIVE_BUFFER_SIZE;
+		if (ListenHandle >= 0) setsockopt(ListenHandle, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+		if ((ListenHandle < 0) || (bind(ListenHandle, (sockaddr*)&address, sizeof(address)) != 0) || (listen(ListenHandle, 1) != 0)) return false;
+		if (getsockname(ListenHandle, (sockaddr*)&address, &addressLength) != 0) return false;
+
+		SendHandle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((SendHandle < 0) || (connect(SendHandle, (sockaddr*)&address, sizeof(address)) != 0)) return false;
+
+		auto receiveHandle = accept(ListenHandle, nullptr, nullptr);
+		if (receiveHandle < 0) return false;
+		ReceiveSocket = new Socket(receiveHandle);
+		ReceiveSocket->setsync(1);
+		ReceiveSocket->setnagle(false);
+		return true;
+	}
+
+	//  Builds a batch of framed messages, each the given size, and starts the writer. Returns the number of messages per batch.
+	uint64_t Start(uint64_t messageSize, int framingVersion)
+	{
+		char header[FRAME_HEADER_MAX_SIZE];
+		auto headerSize = EncodeFrameHeader(framingVersion, int(messageSize), header);
+		auto messageCount = std::max<uint64_t>(FRAMING_BATCH_BYTES / (messageSize + uint64_t(headerSize)), 1);
+		Batch.clear();
+		for (uint64_t i = 0; i < messageCount; ++i)
+		{
+			Batch.insert(Batch.end(), header, header + headerSize);
+			Batch.insert(Batch.end(), size_t(messageSize), char(i));
+		}
+
+		Running = true;
+		Writer = std::thread(&LoopbackStream::WriterLoop, this);
+		return messageCount;
+	}
+
+	inline void RequestBatch() { ++BatchesRequested; }
+	inline bool GetRunning() const { return Running; }
+	inline Socket* GetReceiveSocket() { return ReceiveSocket; }
+	inline uint64_t GetBatchBytes() const { return uint64_t(Batch.size()); }
+};
+
+
+//  Receives one batch a message at a time, as Socket::receivemessage did for every connection before the frame decoder
+void ReceiveBatchPerMessage(LoopbackStream& stream, SocketBuffer& message, uint64_t messageCount)
+{
+	stream.RequestBatch();
+	uint64_t received = 0;
+	while ((received < messageCount) && stream.GetRunning())
+		if (stream.GetReceiveSocket()->receivemessage(&message) > 0) ++received;
+}
+
+//  Receives one batch through a frame decoder, taking every whole frame out after each block read
+void ReceiveBatchDecoded(LoopbackStream& stream, FrameDecoder& decoder, SocketBuffer& message, uint64_t messageCount, uint64_t& receiveCalls)
+{
+	stream.RequestBatch();
+	uint64_t received = 0;
+	while ((received < messageCount) && stream.GetRunning())
+	{
+		if (stream.GetReceiveSocket()->receiveframes(&decoder) <= 0) continue;
+		++receiveCalls;
+		while (decoder.PopFrame(message)) ++received;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Benchmark::Options options;
+	options.MaxSize = FRAMING_MAX_PEEK_SIZE - 1;
+	if (!Benchmark::ParseOptions(argc, argv, options)) return 1;
+	options.MaxSize = std::min<uint64_t>(options.MaxSize, FRAMING_MAX_MESSAGE_SIZE);
+	options.MinSize = std::min<uint64_t>(options.MinSize, options.MaxSize);
+
+	Benchmark::PrintHeader(options);
+
+	for (auto size : Benchmark::GetSizes(options))
+	{
+		if ((size < FRAMING_MAX_PEEK_SIZE) && Benchmark::MatchesFilter(options, "per_message"))
+		{
+			LoopbackStream stream;
+			if (!stream.Open()) { fprintf(stderr, "Could not open a loopback connection\n"); return 1; }
+			auto messageCount = stream.Start(size, FRAMING_VERSION_LEGACY);
+
+			SocketBuffer message;
+			auto result = Benchmark::Measure(options, "framing", "per_message", stream.GetBatchBytes(), false, [&]() { ReceiveBatchPerMessage(stream, message, messageCount); });
+			Benchmark::PrintResult(options, result);
+		}
+
+		if (Benchmark::MatchesFilter(options, "frame_decoder"))
+		{
+			LoopbackStream stream;
+			if (!stream.Open()) { fprintf(stderr, "Could not open a loopback connection\n"); return 1; }
+			auto framingVersion = (size > uint64_t(FRAME_LEGACY_MAX_MESSAGE_SIZE)) ? FRAMING_VERSION_LARGE : FRAMING_VERSION_LEGACY;
+			auto messageCount = stream.Start(size, framingVersion);
+
+			FrameDecoder decoder;
+			decoder.SetFramingVersion(framingVersion);
+			SocketBuffer message;
+			uint64_t receiveCalls = 0;
+			auto result = Benchmark::Measure(options, "framing", "frame_decoder", stream.GetBatchBytes(), false, [&]() { ReceiveBatchDecoded(stream, decoder, message, messageCount, receiveCalls); });
+			Benchmark::PrintResult(options, result);
+
+			//  How many messages each pass took off the socket, where the per-message path takes one
+			auto messagesPerReceive = double(messageCount * (result.Operations + 1)) / double(std::max<uint64_t>(receiveCalls, 1));
+			fprintf(stderr, "%llu byte messages: %.1f per frame decoder receive\n", (unsigned long long)(size), messagesPerReceive);
+		}
+	}
+
+	return 0;
+}
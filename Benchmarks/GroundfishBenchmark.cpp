@@ -0,0 +1,165 @@
+//  Groundfish and hashing benchmark suite
+//  Measures the code that touches every byte of a transfer: Groundfish encryption and decryption (in memory and through
+//  the file tasks), sha256 and md5. Builds without SDL, OpenGL or Winsock so it can run on any Linux box.
+//
+//  Example: GroundfishBenchmark --max-size 1G --threads 1,2,0 --format json --output groundfish.json
+
+#include "BenchmarkHarness.h"
+
+#include <string>
+#include <filesystem>
+#include <memory>
+
+//  Groundfish reports file task failures through the debug console, so route those lines to stderr
+struct BenchmarkConsole { void AddDebugConsoleLine(std::string line) { fprintf(stderr, "%s\n", line.c_str()); } };
+BenchmarkConsole benchmarkConsole;
+BenchmarkConsole* debugConsole = &benchmarkConsole;
+
+#include "Groundfish.h"
+#include "Engine/SimpleSHA256.h"
+#include "Engine/SimpleMD5.h"
+
+static volatile unsigned char benchmarkSink = 0;
+
+std::vector<unsigned char> CreateRandomData(uint64_t size)
+{
+	std::vector<unsigned char> data(size);
+	for (uint64_t i = 0; i < size; ++i) data[i] = (unsigned char)(rand() % 256);
+	return data;
+}
+
+void WriteFile(std::string fileName, const std::vector<unsigned char>& data)
+{
+	std::ofstream file(fileName, std::ios_base::binary | std::ios_base::trunc);
+	file.write((const char*)data.data(), data.size());
+	file.close();
+}
+
+//  Runs the cold and warm single thread measurements, then every requested thread count above one
+void RunBenchmark(const Benchmark::Options& options, std::string name, uint64_t size, const std::function<std::function<void()>(int)>& createOperation)
+{
+	if (!Benchmark::MatchesFilter(options, name)) return;
+
+	auto operation = createOperation(0);
+	if (options.ColdCache) Benchmark::PrintResult(options, Benchmark::Measure(options, "groundfish", name, size, true, operation));
+	if (options.WarmCache) Benchmark::PrintResult(options, Benchmark::Measure(options, "groundfish", name, size, false, operation));
+
+	for (auto threadCount : options.ThreadCounts)
+	{
+		if (threadCount <= 1) continue;
+		Benchmark::PrintResult(options, Benchmark::MeasureThreaded(options, "groundfish", name, size, threadCount, createOperation));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Benchmark::Options options;
+	if (!Benchmark::ParseOptions(argc, argv, options)) return 1;
+
+	//  Work in a scratch folder, since creating a word list saves it to the working directory
+	auto workingFolder = std::filesystem::temp_directory_path() / "NewProvidenceBenchmark";
+	std::filesystem::create_directories(workingFolder);
+	auto originalFolder = std::filesystem::current_path();
+	std::filesystem::current_path(workingFolder);
+
+	srand(1);
+	Groundfish::CreateWordList(Groundfish::CurrentWordList);
+
+	fprintf(stderr, "SHA256 transform: %s\n", SHA256::GetTransformName());
+	Benchmark::PrintHeader(options);
+
+	for (auto size : Benchmark::GetSizes(options))
+	{
+		//  Groundfish stores message lengths as an int, so in-memory encryption stops at 2 GB
+		auto input = CreateRandomData(size);
+		auto encrypted = (size < uint64_t(INT32_MAX)) ? Groundfish::Encrypt((const char*)input.data(), int(size), 0, 7) : EncryptedData();
+
+		if (!encrypted.empty())
+		{
+			RunBenchmark(options, "encrypt", size, [&](int) -> std::function<void()>
+			{
+				return [&]() { auto output = Groundfish::Encrypt((const char*)input.data(), int(size), 0, 7); benchmarkSink = output.back(); };
+			});
+
+			RunBenchmark(options, "decrypt", size, [&](int) -> std::function<void()>
+			{
+				return [&]() { auto output = Groundfish::Decrypt(encrypted.data()); benchmarkSink = output.back(); };
+			});
+		}
+
+		//  The file tasks read and write real files, one output per thread, so this includes the file system cost
+		if (Benchmark::MatchesFilter(options, "file_encrypt") || Benchmark::MatchesFilter(options, "file_decrypt") || Benchmark::MatchesFilter(options, "sha256_file"))
+		{
+			WriteFile("input.bin", input);
+			Groundfish::EncryptAndMoveFile("input.bin", "input.encrypted", 0, 7);
+		}
+
+		RunBenchmark(options, "file_encrypt", size, [&](int threadIndex) -> std::function<void()>
+		{
+			auto outputName = "encrypt_" + std::to_string(threadIndex) + ".out";
+			return [=]() { FileEncryptTask task("benchmark", "input.bin", outputName, 0, 7); while (!task.Update()) {} };
+		});
+
+		RunBenchmark(options, "file_decrypt", size, [&](int threadIndex) -> std::function<void()>
+		{
+			auto outputName = "decrypt_" + std::to_string(threadIndex) + ".out";
+			return [=]() { FileDecryptTask task("benchmark", "input.encrypted", outputName, false); while (!task.Update()) {} };
+		});
+
+		RunBenchmark(options, "sha256", size, [&](int) -> std::function<void()>
+		{
+			return [&]()
+			{
+				unsigned char digest[SHA256::DIGEST_SIZE];
+				SHA256 context;
+				context.init();
+				context.update(input.data(), size_t(size));
+				context.final(digest);
+				benchmarkSink = digest[0];
+			};
+		});
+
+		RunBenchmark(options, "sha256_file", size, [&](int) -> std::function<void()>
+		{
+			return [&]() { benchmarkSink = sha256File("input.bin")[0]; };
+		});
+
+		//  The transfer checksum path: every FILE_CHUNK_SIZE piece of the buffer hashed as its own message
+		RunBenchmark(options, "sha256_multibuffer", size, [&](int) -> std::function<void()>
+		{
+			auto chunkCount = size_t((size + 1023) / 1024);
+			auto chunkPointers = std::make_shared<std::vector<const unsigned char*>>(chunkCount);
+			auto chunkLengths = std::make_shared<std::vector<uint64_t>>(chunkCount);
+			auto chunkDigests = std::make_shared<std::vector<unsigned char>>(chunkCount * SHA256::DIGEST_SIZE);
+			for (size_t i = 0; i < chunkCount; ++i)
+			{
+				(*chunkPointers)[i] = input.data() + (i * 1024);
+				(*chunkLengths)[i] = std::min<uint64_t>(1024, size - (i * 1024));
+			}
+
+			return [=]()
+			{
+				sha256MultiBuffer(chunkPointers->data(), chunkLengths->data(), chunkCount, (unsigned char(*)[SHA256::DIGEST_SIZE])chunkDigests->data());
+				benchmarkSink = (*chunkDigests)[0];
+			};
+		});
+
+		RunBenchmark(options, "md5", size, [&](int) -> std::function<void()>
+		{
+			return [&]()
+			{
+				MD5 context;
+				context.update(input.data(), MD5::size_type(size));
+				context.finalize();
+				benchmarkSink = context.hexdigest()[0];
+			};
+		});
+	}
+
+	std::filesystem::current_path(originalFolder);
+	std::error_code error;
+	std::filesystem::remove_all(workingFolder, error);
+
+	if (options.Output != stdout) fclose(options.Output);
+	return 0;
+}
@@ -0,0 +1,208 @@
+//  Pacing benchmark
+//  Measures what pacing a transfer does to the queue in front of the slowest link on its path. A file is sent with the real
+//  FileSendTask and FileReceiveTask over a simulated path: a bottleneck link with a deep queue in front of it (as a home router
+//  has), and a fixed propagation delay each way. Every few milliseconds a small probe message joins the bottleneck queue, as
+//  a ping, a chat message or anyone else's traffic would, and the time it waits there is its queueing delay.
+//  Every file is sent unpaced, paced at the estimated bandwidth, and paced at half of it. The sizes given with --min-size and
+//  --max-size are the file sizes sent, and each result's mb_per_s is the transfer's throughput. The probes' queueing delays
+//  and the pacer's estimates of the path go to stderr. The transfers run in real time, so a large file takes a while.
+//
+//  Example: PacingBenchmark --min-size 4M --max-size 32M --format json --output pacing.json
+
+#include "BenchmarkHarness.h"
+
+#include "Engine/MemoryManager.h"
+
+#include <string>
+#include <filesystem>
+#include <memory>
+#include <deque>
+
+//  Groundfish reports file task failures through the debug console, so route those lines to stderr
+struct BenchmarkConsole { void AddDebugConsoleLine(std::string line) { fprintf(stderr, "%s\n", line.c_str()); } };
+BenchmarkConsole benchmarkConsole;
+BenchmarkConsole* debugConsole = &benchmarkConsole;
+
+#include "FileSendAndReceive.h"
+
+constexpr double PACING_LINK_RATE			= 4.0 * 1024.0 * 1024.0;	//  Bytes per second through the bottleneck
+constexpr double PACING_LINK_DELAY			= 0.02;						//  Seconds of propagation delay each way
+constexpr double PACING_LINK_QUEUE_BYTES	= 2.0 * 1024.0 * 1024.0;	//  Bytes the bottleneck queues before the sender is held back
+constexpr double PACING_PROBE_INTERVAL		= 0.005;
+constexpr int PACING_PROBE_SIZE				= 64;
+constexpr double PACING_STEP_SLEEP			= 0.0002;					//  Seconds slept between passes of the simulation
+
+
+//  One direction of the simulated path. Messages queue for the bottleneck in the order they're sent, go through it at its rate,
+//  and are handed to the receiver once the propagation delay has passed. A full queue holds the sender back, as a full socket would.
+class SimulatedLink : public MessageTransport
+{
+private:
+	struct InFlightMessage
+	{
+		double ArrivalTime;
+		std::unique_ptr<TransportMessage> Message;
+	};
+
+	std::deque<InFlightMessage> InFlight;
+	std::function<void(std::unique_ptr<TransportMessage>)> ReceiveCallback;
+	double LinkFreeTime;
+
+	inline double GetQueuedBytes(double now) const { return std::max<double>(LinkFreeTime - now, 0.0) * PACING_LINK_RATE; }
+
+public:
+	SimulatedLink() : LinkFreeTime(0.0) {}
+
+	inline void SetReceiveCallback(const std::function<void(std::unique_ptr<TransportMessage>)>& callback) { ReceiveCallback = callback; }
+
+	TransportSendResult SendMessagePacket(SocketBuffer& message) override
+	{
+		auto now = AsyncScheduler::GetNow();
+		if (GetQueuedBytes(now) + double(message.m_BufferUtilizedCount) > PACING_LINK_QUEUE_BYTES) return TRANSPORT_WOULD_BLOCK;
+
+		LinkFreeTime = std::max<double>(LinkFreeTime, now) + (double(message.m_BufferUtilizedCount) / PACING_LINK_RATE);
+		message.m_ReadPosition = 0;
+		auto messageID = (unsigned char)(message.readchar());
+		InFlight.push_back(InFlightMessage{ LinkFreeTime + PACING_LINK_DELAY, TransportMessage::Create(messageID, message) });
+		return TRANSPORT_SENT;
+	}
+
+	//  Queues a probe behind everything already waiting, and returns how long it waits before the bottleneck starts on it
+	double SendProbe()
+	{
+		auto now = AsyncScheduler::GetNow();
+		auto queueingDelay = std::max<double>(LinkFreeTime - now, 0.0);
+		LinkFreeTime = std::max<double>(LinkFreeTime, now) + (double(PACING_PROBE_SIZE) / PACING_LINK_RATE);
+		return queueingDelay;
+	}
+
+	void DeliverArrived()
+	{
+		auto now = AsyncScheduler::GetNow();
+		while (!InFlight.empty() && (InFlight.front().ArrivalTime <= now))
+		{
+			auto message = std::move(InFlight.front().Message);
+			InFlight.pop_front();
+			ReceiveCallback(std::move(message));
+		}
+	}
+};
+
+
+struct TransferStatistics
+{
+	std::vector<double> ProbeDelays;
+	double BottleneckBandwidth = 0.0;
+	double MinRtt = 0.0;
+	bool Complete = false;
+
+	inline double GetPercentile(double percentile) const
+	{
+		if (ProbeDelays.empty()) return 0.0;
+		auto sorted = ProbeDelays;
+		std::sort(sorted.begin(), sorted.end());
+		return sorted[std::min<size_t>(size_t(percentile * double(sorted.size())), sorted.size() - 1)];
+	}
+
+	inline double GetMean() const
+	{
+		auto total = 0.0;
+		for (auto delay : ProbeDelays) total += delay;
+		return ProbeDelays.empty() ? 0.0 : (total / double(ProbeDelays.size()));
+	}
+};
+
+
+//  Sends the source file across a fresh simulated path with the given pacing cap, probing the bottleneck queue until it's done
+Benchmark::Result MeasureTransfer(std::string name, uint64_t fileSize, double capFraction, TransferStatistics& statistics)
+{
+	auto toReceiver = std::make_shared<SimulatedLink>();
+	auto toSender = std::make_shared<SimulatedLink>();
+	std::remove("pacing_destination.bin");
+
+	FileSendTask sender("pacing_destination.bin", "benchmark", "pacing_source.bin", HostedFileType(0), HostedFileSubtype(0), toReceiver);
+	sender.SetPacingCap(capFraction);
+	std::unique_ptr<FileReceiveTask> receiver;
+	auto received = false;
+
+	toReceiver->SetReceiveCallback([&](std::unique_ptr<TransportMessage> message)
+	{
+		if (message->MessageID == MESSAGE_ID_FILE_SEND_INIT)
+		{
+			receiver = std::make_unique<FileReceiveTask>("pacing_destination.bin", "benchmark", "", HostedFileType(0), HostedFileSubtype(0), fileSize, FILE_CHUNK_SIZE, FILE_CHUNK_BUFFER_COUNT, "pacing_destination.tmp", toSender);
+			receiver->StartFileReceive([&]() { received = true; });
+		}
+		else if (receiver != nullptr) receiver->Deliver(std::move(message));
+	});
+	toSender->SetReceiveCallback([&](std::unique_ptr<TransportMessage> message) { sender.Deliver(std::move(message)); });
+
+	//  Give up on a transfer taking many times longer than the link needs, so a broken one can't hang the run
+	auto startTime = AsyncScheduler::GetNow();
+	auto timeout = 30.0 + (20.0 * double(fileSize) / PACING_LINK_RATE);
+	auto nextProbeTime = startTime;
+	sender.StartFileSend();
+	while (!(received && sender.GetFileTransferComplete()) && (AsyncScheduler::GetNow() - startTime < timeout))
+	{
+		asyncScheduler.Update();
+		jobSystem.ProcessCompletedJobs();
+		if (AsyncScheduler::GetNow() >= nextProbeTime)
+		{
+			statistics.ProbeDelays.push_back(toReceiver->SendProbe());
+			nextProbeTime += PACING_PROBE_INTERVAL;
+		}
+		toReceiver->DeliverArrived();
+		toSender->DeliverArrived();
+		std::this_thread::sleep_for(std::chrono::duration<double>(PACING_STEP_SLEEP));
+	}
+
+	Benchmark::Result result = { "pacing", name, "warm", 1, fileSize, 1, AsyncScheduler::GetNow() - startTime };
+	statistics.BottleneckBandwidth = sender.GetPacer().GetBottleneckBandwidth();
+	statistics.MinRtt = sender.GetPacer().GetMinRtt();
+	statistics.Complete = received && std::filesystem::exists("pacing_destination.bin") && (std::filesystem::file_size("pacing_destination.bin") == fileSize);
+	return result;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Benchmark::Options options;
+	options.MinSize = 16 * 1024 * 1024;
+	options.MaxSize = 16 * 1024 * 1024;
+	if (!Benchmark::ParseOptions(argc, argv, options)) return 1;
+
+	//  Work in a scratch folder, since the transfer writes its files to the working directory
+	auto workingFolder = std::filesystem::temp_directory_path() / "NewProvidenceBenchmark";
+	std::filesystem::create_directories(workingFolder);
+	std::filesystem::current_path(workingFolder);
+
+	fprintf(stderr, "Simulated link: %.1f MB/s, %.0f ms each way, %.1f MB queue\n", PACING_LINK_RATE / (1024.0 * 1024.0), PACING_LINK_DELAY * 1000.0, PACING_LINK_QUEUE_BYTES / (1024.0 * 1024.0));
+	Benchmark::PrintHeader(options);
+
+	const std::pair<std::string, double> pacingCaps[] = { { "unpaced", 0.0 }, { "paced", 1.0 }, { "paced_half", 0.5 } };
+	auto failedCount = 0;
+	srand(1);
+	for (auto fileSize : Benchmark::GetSizes(options))
+	{
+		{
+			std::ofstream sourceFile("pacing_source.bin", std::ios_base::binary | std::ios_base::trunc);
+			for (uint64_t i = 0; i < fileSize; ++i) sourceFile.put(char(rand() % 256));
+		}
+
+		for (auto& pacingCap : pacingCaps)
+		{
+			if (!Benchmark::MatchesFilter(options, pacingCap.first)) continue;
+
+			TransferStatistics statistics;
+			Benchmark::PrintResult(options, MeasureTransfer(pacingCap.first, fileSize, pacingCap.second, statistics));
+			fprintf(stderr, "%s, %llu bytes: queueing delay mean %.1f ms, median %.1f ms, p95 %.1f ms, max %.1f ms; estimated bottleneck %.2f MB/s, min RTT %.1f ms\n",
+				pacingCap.first.c_str(), (unsigned long long)(fileSize), statistics.GetMean() * 1000.0, statistics.GetPercentile(0.5) * 1000.0, statistics.GetPercentile(0.95) * 1000.0,
+				statistics.GetPercentile(1.0) * 1000.0, statistics.BottleneckBandwidth / (1024.0 * 1024.0), statistics.MinRtt * 1000.0);
+			if (!statistics.Complete) { fprintf(stderr, "%s, %llu bytes: the transfer didn't complete\n", pacingCap.first.c_str(), (unsigned long long)(fileSize)); ++failedCount; }
+		}
+	}
+
+	jobSystem.Shutdown();
+
+	//  A non-zero exit means a transfer failed, so scripts can treat it as a regression
+	return (failedCount != 0) ? 2 : 0;
+}
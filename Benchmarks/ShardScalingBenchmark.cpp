@@ -0,0 +1,291 @@
+//  Shard scaling benchmark
+//  Measures how a server's message throughput grows with the number of event loop shards handling its connections. A small
+//  echo server is built from the same pieces as the real one: an EventLoopGroup of shards, each with its own WinsockWrapper,
+//  and connections handed out between them as they're accepted. Every message is framed, decoded off the socket, hashed with
+//  SHA-256 (standing in for the per-message crypto), and answered with its digest through the shard's send queue. Client
+//  threads over loopback each send a batch of messages on their own connection and wait for every digest to come back.
+//  The thread counts given with --threads are the shard counts measured. Linux only, like the framing benchmark.
+//
+//  Example: ShardScalingBenchmark --threads 1,2,4,8 --min-size 256 --max-size 16K --min-time 2 --format json --output shards.json
+
+#include "BenchmarkHarness.h"
+
+#include "Engine/MemoryManager.h"
+#include "Engine/WinsockWrapper.h"
+#include "Engine/EventLoopGroup.h"
+#include "Engine/SimpleSHA256.h"
+
+#include <unordered_map>
+
+constexpr int SHARD_SCALING_CONNECTIONS				= 32;
+constexpr uint64_t SHARD_SCALING_BATCH_BYTES		= 4 * 1024 * 1024;	//  Roughly how much each operation sends across every connection
+constexpr uint64_t SHARD_SCALING_MAX_BATCH_COUNT	= 256;				//  Messages each connection sends per operation, at most
+constexpr int SHARD_SCALING_REPLY_SIZE				= 2 + int(SHA256::DIGEST_SIZE);
+
+
+//  One shard of the echo server. Only ever touched from its own thread, once it's started.
+class EchoShard
+{
+private:
+	struct EchoConnection
+	{
+		int				SocketID;
+		FrameDecoder	Decoder;
+		SocketBuffer	Message;
+		SocketBuffer	Reply;
+	};
+
+	WinsockWrapper Network;
+	std::unordered_map<int, std::unique_ptr<EchoConnection>> Connections;
+	std::vector<int> ReadySockets;
+	uint64_t MessagesHandled;
+
+public:
+	EchoShard() : MessagesHandled(0) { Network.WinsockInitialize(); }
+
+	void AddConnection(Socket* socket)
+	{
+		auto connection = std::make_unique<EchoConnection>();
+		connection->SocketID = Network.AddSocket(socket);
+		Network.WatchSocket(connection->SocketID);
+		Connections[connection->SocketID] = std::move(connection);
+	}
+
+	//  Reads every ready connection, answers each whole message with its digest, and sends the lot
+	bool Update()
+	{
+		Network.UpdateReadySockets(ReadySockets);
+		for (auto socketID : ReadySockets)
+		{
+			auto connectionIter = Connections.find(socketID);
+			if (connectionIter == Connections.end()) continue;
+
+			auto& connection = *(*connectionIter).second;
+			if (Network.ReceiveFrames(socketID, &connection.Decoder) <= 0) continue;
+			while (connection.Decoder.PopFrame(connection.Message))
+			{
+				unsigned char digest[SHA256::DIGEST_SIZE];
+				SHA256 hasher;
+				hasher.update((const unsigned char*)connection.Message.m_BufferData, size_t(connection.Message.m_BufferUtilizedCount));
+				hasher.final(digest);
+
+				connection.Reply.clear();
+				connection.Reply.writechars((const char*)digest, int(SHA256::DIGEST_SIZE));
+				Network.SendMessageBuffer(socketID, "", 0, &connection.Reply);
+				++MessagesHandled;
+			}
+		}
+
+		Network.FlushSendQueues();
+		return !ReadySockets.empty();
+	}
+
+	void Shutdown()
+	{
+		for (auto& connection : Connections) Network.CloseSocket(connection.first);
+		Connections.clear();
+		Network.WinsockShutdown();
+	}
+
+	inline uint64_t GetMessagesHandled() const { return MessagesHandled; }
+};
+
+
+//  The client end of one connection, on a thread of its own, sending a batch each time it's released and checking the replies
+class EchoClient
+{
+private:
+	int Handle;
+	std::vector<char> Batch;
+	std::vector<char> Replies;
+	unsigned char ExpectedDigest[SHA256::DIGEST_SIZE];
+	uint64_t MessagesPerBatch;
+	uint64_t MismatchedReplies;
+
+public:
+	EchoClient() : Handle(-1), MessagesPerBatch(0), MismatchedReplies(0) {}
+	~EchoClient() { if (Handle >= 0) close(Handle); }
+
+	bool Open(const sockaddr_in& address, uint64_t messageSize, uint64_t messagesPerBatch, int clientIndex)
+	{
+		Handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((Handle < 0) || (connect(Handle, (const sockaddr*)&address, sizeof(address)) != 0)) return false;
+		int noDelay = 1;
+		setsockopt(Handle, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		//  Every message on a connection is the same, so the digest each reply should carry is worked out once
+		std::vector<unsigned char> payload(static_cast<size_t>(messageSize));
+		for (size_t i = 0; i < payload.size(); ++i) payload[i] = (unsigned char)(i * 31 + clientIndex);
+		SHA256 hasher;
+		hasher.update(payload.data(), payload.size());
+		hasher.final(ExpectedDigest);
+
+		char header[FRAME_HEADER_MAX_SIZE];
+		auto headerSize = EncodeFrameHeader(FRAMING_VERSION_LEGACY, int(messageSize), header);
+		MessagesPerBatch = messagesPerBatch;
+		for (uint64_t i = 0; i < MessagesPerBatch; ++i)
+		{
+			Batch.insert(Batch.end(), header, header + headerSize);
+			Batch.insert(Batch.end(), payload.begin(), payload.end());
+		}
+		Replies.resize(size_t(MessagesPerBatch) * SHARD_SCALING_REPLY_SIZE);
+		return true;
+	}
+
+	//  Sends the whole batch, then reads back a digest for every message. The replies are small enough to wait in the
+	//  socket's buffer while the batch is still going out.
+	bool SendBatch()
+	{
+		for (size_t sent = 0; sent < Batch.size();)
+		{
+			auto result = send(Handle, Batch.data() + sent, Batch.size() - sent, MSG_NOSIGNAL);
+			if (result <= 0) return false;
+			sent += size_t(result);
+		}
+		for (size_t received = 0; received < Replies.size();)
+		{
+			auto result = recv(Handle, Replies.data() + received, Replies.size() - received, 0);
+			if (result <= 0) return false;
+			received += size_t(result);
+		}
+
+		for (uint64_t i = 0; i < MessagesPerBatch; ++i)
+			if (memcmp(Replies.data() + i * SHARD_SCALING_REPLY_SIZE + 2, ExpectedDigest, SHA256::DIGEST_SIZE) != 0) ++MismatchedReplies;
+		return true;
+	}
+
+	inline uint64_t GetMismatchedReplies() const { return MismatchedReplies; }
+};
+
+
+//  The echo server and its clients for one shard count and message size
+class ShardScalingRun
+{
+private:
+	int ListenHandle;
+	EventLoopGroup ShardLoops;
+	std::vector<std::unique_ptr<EchoShard>> Shards;
+	std::vector<std::unique_ptr<EchoClient>> Clients;
+	std::vector<std::thread> ClientThreads;
+
+	//  Each operation raises the generation, and every client thread sends one batch and counts itself done
+	std::atomic<uint64_t> Generation;
+	std::atomic<int> ClientsDone;
+	std::atomic<bool> ClientsFailed;
+	std::atomic<bool> Stopping;
+
+	void ClientLoop(EchoClient* client)
+	{
+		uint64_t lastGeneration = 0;
+		while (true)
+		{
+			auto generation = Generation.load();
+			if (Stopping) return;
+			if (generation == lastGeneration) { std::this_thread::yield(); continue; }
+
+			lastGeneration = generation;
+			if (!client->SendBatch()) ClientsFailed = true;
+			++ClientsDone;
+		}
+	}
+
+public:
+	ShardScalingRun() : ListenHandle(-1), Generation(0), ClientsDone(0), ClientsFailed(false), Stopping(false) {}
+	~ShardScalingRun()
+	{
+		Stopping = true;
+		for (auto& thread : ClientThreads) if (thread.joinable()) thread.join();
+		Clients.clear();
+		ShardLoops.Stop();
+		if (ListenHandle >= 0) close(ListenHandle);
+	}
+
+	bool Open(int shardCount, uint64_t messageSize, uint64_t messagesPerBatch)
+	{
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		socklen_t addressLength = sizeof(address);
+
+		ListenHandle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((ListenHandle < 0) || (bind(ListenHandle, (sockaddr*)&address, sizeof(address)) != 0) || (listen(ListenHandle, SHARD_SCALING_CONNECTIONS) != 0)) return false;
+		if (getsockname(ListenHandle, (sockaddr*)&address, &addressLength) != 0) return false;
+
+		for (auto i = 0; i < shardCount; ++i) Shards.push_back(std::make_unique<EchoShard>());
+		ShardLoops.Start(shardCount, [this](int shardIndex) { return Shards[shardIndex]->Update(); }, [this](int shardIndex) { Shards[shardIndex]->Shutdown(); });
+
+		//  Connections are dealt out to the shards in turn, as the server does with its least busy shard
+		for (auto i = 0; i < SHARD_SCALING_CONNECTIONS; ++i)
+		{
+			auto client = std::make_unique<EchoClient>();
+			if (!client->Open(address, messageSize, messagesPerBatch, i)) return false;
+
+			auto acceptedHandle = accept(ListenHandle, nullptr, nullptr);
+			if (acceptedHandle < 0) return false;
+			//  Non-blocking with TCP_NODELAY set (which is what setnagle(true) sets), as the server's listening socket passes on
+			MANAGE_MEMORY_NEW("WinsockWrapper", sizeof(Socket));
+			auto socket = new Socket(acceptedHandle);
+			socket->setsync(1);
+			socket->setnagle(true);
+
+			auto shard = Shards[i % shardCount].get();
+			ShardLoops.Post(i % shardCount, [shard, socket]() { shard->AddConnection(socket); });
+			Clients.push_back(std::move(client));
+		}
+
+		for (auto& client : Clients) ClientThreads.push_back(std::thread(&ShardScalingRun::ClientLoop, this, client.get()));
+		return true;
+	}
+
+	//  One operation: every connection sends its batch and has every reply back
+	void RunBatch()
+	{
+		ClientsDone = 0;
+		++Generation;
+		while ((ClientsDone < SHARD_SCALING_CONNECTIONS) && !ClientsFailed) std::this_thread::yield();
+	}
+
+	inline bool GetFailed() const { return ClientsFailed; }
+	inline uint64_t GetMismatchedReplies() const { uint64_t mismatched = 0; for (auto& client : Clients) mismatched += client->GetMismatchedReplies(); return mismatched; }
+};
+
+
+int main(int argc, char* argv[])
+{
+	Benchmark::Options options;
+	options.MinSize = 256;
+	options.MaxSize = 16 * 1024;
+	options.ThreadCounts.clear();
+	for (auto shardCount = 1; shardCount <= std::max<int>(int(std::thread::hardware_concurrency()), 2); shardCount *= 2) options.ThreadCounts.push_back(shardCount);
+	if (!Benchmark::ParseOptions(argc, argv, options)) return 1;
+	options.MaxSize = std::min<uint64_t>(options.MaxSize, FRAME_LEGACY_MAX_MESSAGE_SIZE);
+	options.MinSize = std::min<uint64_t>(options.MinSize, options.MaxSize);
+
+	Benchmark::PrintHeader(options);
+
+	auto failed = false;
+	for (auto size : Benchmark::GetSizes(options))
+	{
+		if (!Benchmark::MatchesFilter(options, "echo_sha256")) continue;
+
+		auto messagesPerBatch = std::clamp<uint64_t>(SHARD_SCALING_BATCH_BYTES / (size * SHARD_SCALING_CONNECTIONS), 1, SHARD_SCALING_MAX_BATCH_COUNT);
+		auto messagesPerOperation = messagesPerBatch * SHARD_SCALING_CONNECTIONS;
+		for (auto shardCount : options.ThreadCounts)
+		{
+			ShardScalingRun run;
+			if (!run.Open(shardCount, size, messagesPerBatch)) { fprintf(stderr, "Could not open the loopback connections\n"); return 1; }
+
+			auto result = Benchmark::Measure(options, "shard_scaling", "echo_sha256", size * messagesPerOperation, false, [&]() { run.RunBatch(); });
+			result.Threads = shardCount;
+			Benchmark::PrintResult(options, result);
+
+			auto messagesPerSecond = double(messagesPerOperation * result.Operations) / std::max<double>(result.Seconds, 0.000001);
+			fprintf(stderr, "%llu byte messages, %d shards: %.0f messages/s over %d connections, %llu mismatched replies\n",
+				(unsigned long long)(size), shardCount, messagesPerSecond, SHARD_SCALING_CONNECTIONS, (unsigned long long)(run.GetMismatchedReplies()));
+			if (run.GetFailed() || (run.GetMismatchedReplies() != 0)) failed = true;
+		}
+	}
+
+	return failed ? 2 : 0;
+}
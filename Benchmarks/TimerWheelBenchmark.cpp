@@ -0,0 +1,207 @@
+//  Timer wheel benchmark
+//  Measures the engine's timer wheel against the structures a scheduler would otherwise use, with every timer in millisecond
+//  ticks and a given number of timers armed at once (10K by default, a busy server's ping and idle timers). The sizes given
+//  with --min-size and --max-size are the timer counts measured, and each result's ns_per_op is per timer action:
+//    rearm   every timer is cancelled and armed again further out, as hearing from a connection pushes its ping back
+//    tick    the clock moves on a millisecond at a time with the timers due 1 to 60 seconds out, re-armed as they fire
+//    expire  a batch of timers is armed across the next second, and the clock is moved through it until all have fired
+//  The wheel is compared with an ordered set, which can cancel in O(log n), and with the binary heap the async scheduler used
+//  before, which can't cancel at all and so only appears in the tests with no cancelling.
+//
+//  Example: TimerWheelBenchmark --min-size 1K --max-size 1M --min-time 1 --format json --output timers.json
+
+#include "BenchmarkHarness.h"
+
+#include "Engine/TimerWheel.h"
+
+#include <set>
+#include <queue>
+
+constexpr uint64_t TIMER_MIN_DELAY_TICKS		= 1000;		//  Ticks from now the tick and rearm tests arm their timers, at least
+constexpr uint64_t TIMER_MAX_DELAY_TICKS		= 60000;	//  and at most
+constexpr uint64_t TIMER_EXPIRE_SPREAD_TICKS	= 1000;		//  Ticks the expire test spreads its timers over
+constexpr uint64_t TIMER_START_TICK				= 1000000;
+
+
+//  A fixed sequence of delays, so every structure is given the same timers
+class DelaySequence
+{
+private:
+	uint64_t State;
+
+public:
+	DelaySequence() : State(0x9E3779B97F4A7C15ull) {}
+
+	inline uint64_t Next(uint64_t minimum, uint64_t maximum)
+	{
+		State = State * 6364136223846793005ull + 1442695040888963407ull;
+		return minimum + ((State >> 33) % (maximum - minimum + 1));
+	}
+};
+
+
+//  Timers kept in an ordered set of (deadline, timer), so any one of them can be found and cancelled
+class SetTimers
+{
+private:
+	std::set<std::pair<uint64_t, uint32_t>> Timers;
+	std::vector<uint64_t> Deadlines;
+	uint64_t CurrentTick;
+
+public:
+	explicit SetTimers(size_t count) : Deadlines(count, 0), CurrentTick(TIMER_START_TICK) {}
+
+	inline void Arm(uint32_t timer, uint64_t deadline) { Deadlines[timer] = deadline; Timers.emplace(deadline, timer); }
+	inline void Cancel(uint32_t timer) { Timers.erase(std::make_pair(Deadlines[timer], timer)); }
+	inline uint64_t GetCurrentTick() const { return CurrentTick; }
+
+	template <typename CallbackType>
+	inline void Advance(uint64_t tick, CallbackType&& callback)
+	{
+		CurrentTick = tick;
+		while (!Timers.empty() && (Timers.begin()->first <= tick))
+		{
+			auto timer = Timers.begin()->second;
+			Timers.erase(Timers.begin());
+			callback(timer);
+		}
+	}
+};
+
+
+//  Timers kept in a binary heap, as the async scheduler kept them before the wheel. There's no way to cancel one.
+class HeapTimers
+{
+private:
+	std::priority_queue<std::pair<uint64_t, uint32_t>, std::vector<std::pair<uint64_t, uint32_t>>, std::greater<std::pair<uint64_t, uint32_t>>> Timers;
+	uint64_t CurrentTick;
+
+public:
+	HeapTimers() : CurrentTick(TIMER_START_TICK) {}
+
+	inline void Arm(uint32_t timer, uint64_t deadline) { Timers.emplace(deadline, timer); }
+	inline uint64_t GetCurrentTick() const { return CurrentTick; }
+
+	template <typename CallbackType>
+	inline void Advance(uint64_t tick, CallbackType&& callback)
+	{
+		CurrentTick = tick;
+		while (!Timers.empty() && (Timers.top().first <= tick))
+		{
+			auto timer = Timers.top().second;
+			Timers.pop();
+			callback(timer);
+		}
+	}
+};
+
+
+//  The engine's timer wheel, with the handle of each timer kept so it can be cancelled
+class WheelTimers
+{
+private:
+	TimerWheel<uint32_t> Wheel;
+	std::vector<TimerHandle> Handles;
+
+public:
+	explicit WheelTimers(size_t count) : Wheel(TIMER_START_TICK), Handles(count, INVALID_TIMER_HANDLE) {}
+
+	inline void Arm(uint32_t timer, uint64_t deadline) { Handles[timer] = Wheel.Arm(deadline, timer); }
+	inline void Cancel(uint32_t timer) { Wheel.Cancel(Handles[timer]); }
+	inline uint64_t GetCurrentTick() const { return Wheel.GetCurrentTick(); }
+
+	template <typename CallbackType>
+	inline void Advance(uint64_t tick, CallbackType&& callback) { Wheel.Advance(tick, [&](uint32_t timer) { callback(timer); }); }
+};
+
+
+//  Re-arms every timer once per operation, and moves the clock on a tick
+template <typename TimersType>
+Benchmark::Result MeasureRearm(const Benchmark::Options& options, std::string name, uint64_t timerCount, TimersType& timers)
+{
+	DelaySequence delays;
+	for (uint32_t timer = 0; timer < timerCount; ++timer) timers.Arm(timer, timers.GetCurrentTick() + delays.Next(TIMER_MIN_DELAY_TICKS, TIMER_MAX_DELAY_TICKS));
+
+	auto result = Benchmark::Measure(options, "timers", name, 0, false, [&]()
+	{
+		for (uint32_t timer = 0; timer < timerCount; ++timer)
+		{
+			timers.Cancel(timer);
+			timers.Arm(timer, timers.GetCurrentTick() + delays.Next(TIMER_MIN_DELAY_TICKS, TIMER_MAX_DELAY_TICKS));
+		}
+		timers.Advance(timers.GetCurrentTick() + 1, [&](uint32_t timer) { timers.Arm(timer, timers.GetCurrentTick() + delays.Next(TIMER_MIN_DELAY_TICKS, TIMER_MAX_DELAY_TICKS)); });
+	});
+	result.Operations *= timerCount;
+	return result;
+}
+
+
+//  Moves the clock on a tick per operation, re-arming whatever fires so the count stays the same
+template <typename TimersType>
+Benchmark::Result MeasureTick(const Benchmark::Options& options, std::string name, uint64_t timerCount, TimersType& timers, uint64_t& firedCount)
+{
+	DelaySequence delays;
+	for (uint32_t timer = 0; timer < timerCount; ++timer) timers.Arm(timer, timers.GetCurrentTick() + delays.Next(TIMER_MIN_DELAY_TICKS, TIMER_MAX_DELAY_TICKS));
+
+	return Benchmark::Measure(options, "timers", name, 0, false, [&]()
+	{
+		timers.Advance(timers.GetCurrentTick() + 1, [&](uint32_t timer)
+		{
+			++firedCount;
+			timers.Arm(timer, timers.GetCurrentTick() + delays.Next(TIMER_MIN_DELAY_TICKS, TIMER_MAX_DELAY_TICKS));
+		});
+	});
+}
+
+
+//  Arms every timer across the next second, then moves the clock through it a tick at a time until they've all fired
+template <typename TimersType>
+Benchmark::Result MeasureExpire(const Benchmark::Options& options, std::string name, uint64_t timerCount, TimersType& timers, uint64_t& missedCount)
+{
+	DelaySequence delays;
+	auto result = Benchmark::Measure(options, "timers", name, 0, false, [&]()
+	{
+		auto startTick = timers.GetCurrentTick();
+		for (uint32_t timer = 0; timer < timerCount; ++timer) timers.Arm(timer, startTick + delays.Next(1, TIMER_EXPIRE_SPREAD_TICKS));
+
+		uint64_t fired = 0;
+		for (auto tick = startTick + 1; tick <= startTick + TIMER_EXPIRE_SPREAD_TICKS; ++tick) timers.Advance(tick, [&](uint32_t) { ++fired; });
+		missedCount += timerCount - fired;
+	});
+	result.Operations *= timerCount;
+	return result;
+}
+
+
+int main(int argc, char* argv[])
+{
+	Benchmark::Options options;
+	options.MinSize = 10000;
+	options.MaxSize = 10000;
+	if (!Benchmark::ParseOptions(argc, argv, options)) return 1;
+
+	Benchmark::PrintHeader(options);
+
+	uint64_t missedCount = 0;
+	for (auto timerCount : Benchmark::GetSizes(options))
+	{
+		if (Benchmark::MatchesFilter(options, "wheel_rearm")) { WheelTimers timers(timerCount); Benchmark::PrintResult(options, MeasureRearm(options, "wheel_rearm", timerCount, timers)); }
+		if (Benchmark::MatchesFilter(options, "set_rearm")) { SetTimers timers(timerCount); Benchmark::PrintResult(options, MeasureRearm(options, "set_rearm", timerCount, timers)); }
+
+		uint64_t firedCounts[3] = { 0, 0, 0 };
+		if (Benchmark::MatchesFilter(options, "wheel_tick")) { WheelTimers timers(timerCount); Benchmark::PrintResult(options, MeasureTick(options, "wheel_tick", timerCount, timers, firedCounts[0])); }
+		if (Benchmark::MatchesFilter(options, "set_tick")) { SetTimers timers(timerCount); Benchmark::PrintResult(options, MeasureTick(options, "set_tick", timerCount, timers, firedCounts[1])); }
+		if (Benchmark::MatchesFilter(options, "heap_tick")) { HeapTimers timers; Benchmark::PrintResult(options, MeasureTick(options, "heap_tick", timerCount, timers, firedCounts[2])); }
+
+		if (Benchmark::MatchesFilter(options, "wheel_expire")) { WheelTimers timers(timerCount); Benchmark::PrintResult(options, MeasureExpire(options, "wheel_expire", timerCount, timers, missedCount)); }
+		if (Benchmark::MatchesFilter(options, "set_expire")) { SetTimers timers(timerCount); Benchmark::PrintResult(options, MeasureExpire(options, "set_expire", timerCount, timers, missedCount)); }
+		if (Benchmark::MatchesFilter(options, "heap_expire")) { HeapTimers timers; Benchmark::PrintResult(options, MeasureExpire(options, "heap_expire", timerCount, timers, missedCount)); }
+
+		fprintf(stderr, "%llu timers: %llu, %llu and %llu fired while ticking (wheel, set, heap)\n", (unsigned long long)(timerCount),
+			(unsigned long long)(firedCounts[0]), (unsigned long long)(firedCounts[1]), (unsigned long long)(firedCounts[2]));
+	}
+
+	//  A non-zero exit means a timer didn't fire when it was due, so scripts can treat it as a regression
+	if (missedCount != 0) fprintf(stderr, "%llu timers failed to fire\n", (unsigned long long)(missedCount));
+	return (missedCount != 0) ? 2 : 0;
+}
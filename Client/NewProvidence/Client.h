@@ -3,64 +3,151 @@
 #include <filesystem>
 #include "Groundfish.h"
 #include "Engine/WinsockWrapper.h"
+#include "Engine/DatagramChannel.h"
+#include "Engine/MessageStream.h"
 #include "Engine/SimpleMD5.h"
 #include "Engine/SimpleSHA256.h"
 #include "Engine/StringTools.h"
 #include "FileSendAndReceive.h"
 #include "HostedFileData.h"
+#include "Engine/NetworkThread.h"
+#include "Engine/EventManager.h"
 
 constexpr auto VERSION_NUMBER			= "2019.03.02";
 constexpr auto NEW_PROVIDENCE_IP		= "98.181.188.165";
 constexpr auto NEW_PROVIDENCE_PORT		= 2347;
+constexpr auto RECEIVE_TIME_BUDGET		= 0.004;		//  Seconds per pass spent handling received messages, before the rest wait a pass
+constexpr auto UPLOAD_PACING_CAP		= 1.0;			//  Fraction of the path's estimated bandwidth uploads are paced at (0 to not pace)
+constexpr auto DATA_CHANNEL_ENABLED		= true;			//  Whether to take the server up on its offer of a datagram channel for transfers
+constexpr auto DATA_CHANNEL_HELLO_INTERVAL	= 0.25;		//  Seconds between hellos while waiting for the server to answer one
+constexpr auto DATA_CHANNEL_HELLO_ATTEMPTS	= 8;		//  Hellos sent before giving up, and leaving every transfer on TCP
+constexpr auto RECONNECT_INTERVAL		= 1.0;			//  Seconds before trying to reconnect once the connection is lost, doubling each try
+constexpr auto RECONNECT_INTERVAL_MAX	= 30.0;			//  Seconds between tries at most, while the server can't be reached
+
+static_assert((MESSAGE_CHANNEL_CONTROL == SEND_QUEUE_CONTROL_CHANNEL) && (MESSAGE_CHANNEL_COUNT <= SEND_QUEUE_CHANNEL_COUNT), "Every message channel needs a send queue channel, with control on the priority one");
+
+//  The connection to the server. Messages to and from it are read and built in its own buffers, never a shared one.
+//  Everything that has arrived is read into the frame decoder in one go, and then taken out a message at a time.
+struct ServerConnection
+{
+	int				SocketID = -1;
+	FrameDecoder	IncomingFrames;
+	SocketBuffer	ReceiveBuffer;
+	SocketBuffer	SendBuffer;
+
+	//  Shared with the transports of our transfers, which time their reminders by it. The framing offer is its first sample.
+	std::shared_ptr<RttEstimator>	Rtt = std::make_shared<RttEstimator>();
+	double			FramingOfferTime = 0.0;
+
+	//  Our session on the server's datagram channel, once it has offered one. Transfers only use it once it's established.
+	std::shared_ptr<DatagramSession>	DataSession;
+
+	inline int ReceiveIncomingData() { return winsockWrapper.ReceiveFrames(SocketID, &IncomingFrames); }
+	inline bool NextIncomingMessage() { return IncomingFrames.PopFrame(ReceiveBuffer); }
+	inline MessageWriter BeginMessage(unsigned char messageID) { return MessageWriter(SendBuffer, messageID); }
+	inline int SendOutgoingMessage() { return winsockWrapper.SendMessageBuffer(SocketID, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, &SendBuffer); }
+};
 
 //  Outgoing message send functions
-void SendMessage_PingResponse(int socket)
+void SendMessage_PingResponse(ServerConnection& connection)
+{
+	connection.BeginMessage(MESSAGE_ID_PING_RESPONSE);
+	connection.SendOutgoingMessage();
+}
+
+void SendMessage_FramingVersion(unsigned char framingVersion, ServerConnection& connection)
+{
+	auto message = connection.BeginMessage(MESSAGE_ID_FRAMING_VERSION);
+	message.WriteChar(framingVersion);
+	connection.SendOutgoingMessage();
+}
+
+void SendMessage_DataChannelConfirm(ServerConnection& connection)
 {
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_PING_RESPONSE, 0);
-	winsockWrapper.SendMessagePacket(socket, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, 0);
+	connection.BeginMessage(MESSAGE_ID_DATA_CHANNEL_CONFIRM);
+	connection.SendOutgoingMessage();
 }
 
-void SendMessage_UserLoginRequest(EncryptedData& encryptedUsername, EncryptedData& encryptedPassword, int socket)
+void SendMessage_UserLoginRequest(EncryptedData& encryptedUsername, EncryptedData& encryptedPassword, ServerConnection& connection)
 {
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_USER_LOGIN_REQUEST, 0);
-	winsockWrapper.WriteString(VERSION_NUMBER, 0);
-	winsockWrapper.WriteInt(int(encryptedUsername.size()), 0);
-	winsockWrapper.WriteChars(encryptedUsername.data(), int(encryptedUsername.size()), 0);
-	winsockWrapper.WriteInt(int(encryptedPassword.size()), 0);
-	winsockWrapper.WriteChars(encryptedPassword.data(), int(encryptedPassword.size()), 0);
-	winsockWrapper.SendMessagePacket(socket, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, 0);
+	auto message = connection.BeginMessage(MESSAGE_ID_USER_LOGIN_REQUEST);
+	message.WriteString(VERSION_NUMBER);
+	message.WriteInt(int(encryptedUsername.size()));
+	message.WriteBytes(encryptedUsername);
+	message.WriteInt(int(encryptedPassword.size()));
+	message.WriteBytes(encryptedPassword);
+	connection.SendOutgoingMessage();
 }
 
-void SendMessage_RequestHostedFileList(int startingIndex, int socket, EncryptedData username = EncryptedData(), HostedFileType type = FILE_TYPE_COUNT, HostedFileSubtype subtype = FILE_SUBTYPE_COUNT)
+void SendMessage_SessionResumeRequest(uint64_t ticketID, const EncryptedData& ticketSecret, uint64_t listSequence, ServerConnection& connection)
+{
+	EncryptedData encryptedSecret = Groundfish::Encrypt((const char*)(ticketSecret.data()), int(ticketSecret.size()), 0, rand() % 256);
+
+	auto message = connection.BeginMessage(MESSAGE_ID_SESSION_RESUME_REQUEST);
+	message.WriteString(VERSION_NUMBER);
+	message.WriteLongInt(ticketID);
+	message.WriteInt(int(encryptedSecret.size()));
+	message.WriteBytes(encryptedSecret);
+	message.WriteLongInt(listSequence);
+	connection.SendOutgoingMessage();
+}
+
+void SendMessage_RequestHostedFileList(int startingIndex, ServerConnection& connection, EncryptedData username = EncryptedData(), HostedFileType type = FILE_TYPE_COUNT, HostedFileSubtype subtype = FILE_SUBTYPE_COUNT)
 {
 	//  Send a "Hosted File List Request" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_REQUEST_HOSTED_FILE_LIST, 0);
+	auto message = connection.BeginMessage(MESSAGE_ID_REQUEST_HOSTED_FILE_LIST);
 
 	//  Define the user to request uploads from
-	winsockWrapper.WriteUnsignedShort((uint16_t)(username.size()), 0);
-	winsockWrapper.WriteChars(username.data(), username.size(), 0);
+	message.WriteUnsignedShort((uint16_t)(username.size()));
+	message.WriteBytes(username);
 
 	//  Define the type and sub-type to filter for
-	winsockWrapper.WriteChar(type, 0);
-	winsockWrapper.WriteChar(subtype, 0);
+	message.WriteChar(type);
+	message.WriteChar(subtype);
 
 	//  Define the starting index to begin the list at
-	winsockWrapper.WriteUnsignedShort(uint16_t(startingIndex), 0);
+	message.WriteUnsignedShort(uint16_t(startingIndex));
 
-	winsockWrapper.SendMessagePacket(socket, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, 0);
+	connection.SendOutgoingMessage();
 }
 
-void SendMessage_FileRequest(std::string fileID, int socket, const char* ip)
+void SendMessage_FileRequest(std::string fileID, ServerConnection& connection)
 {
-	//  Send a "File Request" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_REQUEST, 0);
-	winsockWrapper.WriteInt(fileID.length(), 0);
-	winsockWrapper.WriteChars((unsigned char*)fileID.c_str(), fileID.length(), 0);
-	winsockWrapper.SendMessagePacket(socket, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, 0);
+	//  Send a "File Request" message, with the largest file we'll take inline
+	auto message = connection.BeginMessage(MESSAGE_ID_FILE_REQUEST);
+	message.WriteInt(int(fileID.length()));
+	message.WriteBytes(fileID.c_str(), int(fileID.length()));
+	message.WriteInt(FILE_INLINE_MAX_SIZE);
+	connection.SendOutgoingMessage();
+}
+
+void SendMessage_FileBundleRequest(const std::vector<std::string>& fileIDs, ServerConnection& connection)
+{
+	//  Send a "File Bundle Request" message, for every file that's small enough to come back in the one message
+	auto message = connection.BeginMessage(MESSAGE_ID_FILE_BUNDLE_REQUEST);
+	message.WriteInt(FILE_INLINE_MAX_SIZE);
+	message.WriteUnsignedShort((uint16_t)(fileIDs.size()));
+	for (auto iter = fileIDs.begin(); iter != fileIDs.end(); ++iter)
+	{
+		message.WriteInt(int((*iter).length()));
+		message.WriteBytes((*iter).c_str(), int((*iter).length()));
+	}
+	connection.SendOutgoingMessage();
+}
+
+void SendMessage_CollectionRequest(uint64_t collectionID, const std::vector<std::string>& fileIDs, ServerConnection& connection)
+{
+	//  Send a "Collection Request" message, for files to be sent one after another in the order given
+	auto message = connection.BeginMessage(MESSAGE_ID_COLLECTION_REQUEST);
+	message.WriteLongInt(collectionID);
+	message.WriteInt(FILE_INLINE_MAX_SIZE);
+	message.WriteUnsignedShort((uint16_t)(fileIDs.size()));
+	for (auto iter = fileIDs.begin(); iter != fileIDs.end(); ++iter)
+	{
+		message.WriteInt(int((*iter).length()));
+		message.WriteBytes((*iter).c_str(), int((*iter).length()));
+	}
+	connection.SendOutgoingMessage();
 }
 
 struct HostedFileEntry
@@ -78,40 +165,116 @@ struct HostedFileEntry
 	{}
 };
 
-class Client
+
+//  Events the client sends to the UI from the network thread, in place of calling into the UI directly
+struct LoginResponseEventData : public EventData
+{
+	int Response;
+	int InboxCount;
+	int NotificationCount;
+
+	LoginResponseEventData(int response, int inboxCount, int notificationCount, std::string sender) : EventData::EventData("LoginResponse", sender), Response(response), InboxCount(inboxCount), NotificationCount(notificationCount) {}
+};
+
+//  We lost the connection, and are logged back in on a new one without the user having to do anything
+struct SessionResumedEventData : public EventData
+{
+	SessionResumedEventData(std::string sender) : EventData::EventData("SessionResumed", sender) {}
+};
+
+struct InboxAndNotificationCountEventData : public EventData
+{
+	int InboxCount;
+	int NotificationCount;
+
+	InboxAndNotificationCountEventData(int inboxCount, int notificationCount, std::string sender) : EventData::EventData("InboxAndNotificationCount", sender), InboxCount(inboxCount), NotificationCount(notificationCount) {}
+};
+
+struct LatestUploadsEventData : public EventData
+{
+	std::vector<HostedFileEntry> LatestUploads;
+
+	LatestUploadsEventData(const std::vector<HostedFileEntry>& latestUploads, std::string sender) : EventData::EventData("LatestUploads", sender), LatestUploads(latestUploads) {}
+};
+
+struct FileRequestResultEventData : public EventData
+{
+	bool Success;
+	std::string FileID;
+	std::string FailureReason;
+
+	FileRequestResultEventData(bool success, std::string fileID, std::string failureReason, std::string sender) : EventData::EventData("FileRequestResult", sender), Success(success), FileID(fileID), FailureReason(failureReason) {}
+};
+
+//  The files in a bundle that didn't come back inline: those too large to, which have to be asked for on their own, and those that
+//  didn't fit in the message this time, which can be asked for in the next bundle
+struct FileBundleResultEventData : public EventData
+{
+	std::vector<std::string> TooLargeFileIDs;
+	std::vector<std::string> DeferredFileIDs;
+
+	FileBundleResultEventData(std::string sender) : EventData::EventData("FileBundleResult", sender) {}
+};
+
+//  What's left of a collection, as the server starts on each of its files, counting the one it's starting on
+struct CollectionProgressEventData : public EventData
+{
+	uint64_t CollectionID;
+	int FilesRemaining;
+	uint64_t BytesRemaining;
+
+	CollectionProgressEventData(uint64_t collectionID, int filesRemaining, uint64_t bytesRemaining, std::string sender) : EventData::EventData("CollectionProgress", sender), CollectionID(collectionID), FilesRemaining(filesRemaining), BytesRemaining(bytesRemaining) {}
+};
+
+//  An upload has finished, failed or been cancelled, and the client is ready for the next one
+struct FileSendFinishedEventData : public EventData
+{
+	std::string FailureReason;
+
+	FileSendFinishedEventData(std::string failureReason, std::string sender) : EventData::EventData("FileSendFinished", sender), FailureReason(failureReason) {}
+};
+
+//  The client runs on the network thread once connected. The UI only calls the functions marked as main thread functions,
+//  and hears back through the events above.
+class Client : public EventListener
 {
 private:
-	int						ServerSocket = -1;
+	ServerConnection		Connection;
+	DatagramEndpoint		DataChannel{ winsockWrapper };
+	AsyncTask				DataChannelSetup;
 	FileEncryptTask*		FileEncrypt = nullptr;
 	std::vector<FileDecryptTask*> FileDecryptList;
 	FileReceiveTask*		FileReceive = nullptr;
 	FileSendTask*			FileSend = nullptr;
 	EncryptedData			EncryptedUsername;
+	double					ReceiveTimeBudget = RECEIVE_TIME_BUDGET;
 
-	std::function<void(int, int, int)> LoginResponseCallback = nullptr;
-	std::function<void(int, int)> InboxAndNotificationCountCallback = nullptr;
-	std::function<void(std::vector<HostedFileEntry>)> LatestUploadsCallback = nullptr;
-	std::function<void(std::string, std::string)> FileRequestFailureCallback = nullptr;
-	std::function<void(std::string)> FileSendFailureCallback = nullptr;
-	std::function<void(std::string)> FileRequestSuccessCallback = nullptr;
+	//  The ticket from our last login or resume, which gets us back in if we lose the connection, and the hosted file list
+	//  sequence we're up to, so only a list that's changed since is sent when we do
+	uint64_t				SessionTicketID = 0;
+	EncryptedData			SessionTicketSecret;
+	uint64_t				HostedFileListSequence = 0;
+	AsyncTask				Reconnection;
+	double					ReconnectInterval = RECONNECT_INTERVAL;
 
 	std::vector<HostedFileEntry> HostedFilesList;
 
+	//  Main thread only. Set as an upload is handed to the network thread, and cleared when it says it's finished.
+	bool					UploadInProgress = false;
+
+	virtual void ReceiveEvent(EventData* eventData) override;
+
 public:
 	static Client& GetInstance() { static Client INSTANCE; return INSTANCE; }
 
 	Client()	{}
 	~Client()	{ Shutdown(); }
 
-	inline int GetServerSocket(void) const { return ServerSocket; }
+	inline int GetServerSocket(void) const { return Connection.SocketID; }
+	inline ServerConnection& GetServerConnection(void) { return Connection; }
 	inline EncryptedData GetUsername(void) const { return EncryptedUsername; }
-	inline void SetLoginResponseCallback(const std::function<void(int, int, int)>& callback) { LoginResponseCallback = callback; }
-	inline void SetInboxAndNotificationCountCallback(const std::function<void(int, int)>& callback) { InboxAndNotificationCountCallback = callback; }
-	inline void SetLatestUploadsCallback(const std::function<void(std::vector<HostedFileEntry>)>& callback) { LatestUploadsCallback = callback; }
-	inline void SetFileRequestFailureCallback(const std::function<void(std::string, std::string)>& callback) { FileRequestFailureCallback = callback; }
-	inline void SetFileSendFailureCallback(const std::function<void(std::string)>& callback) { FileSendFailureCallback = callback; }
-	inline void SetFileRequestSuccessCallback(const std::function<void(std::string)>& callback) { FileRequestSuccessCallback = callback; }
 	inline void SetUsername(const EncryptedData& username) { EncryptedUsername = username; }
+	inline void SetReceiveTimeBudget(double seconds) { ReceiveTimeBudget = seconds; }
 
 	inline void AddFileEncryptTask(std::string taskName, std::string unencryptedFileName, std::string encryptedFileName)
 	{
@@ -128,19 +291,27 @@ public:
 	inline void AddFileSendTask(std::string fileName, std::string fileTitle, std::string filePath, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, int socketID, std::string ipAddress, const int port, bool deleteAfter = false)
 	{
 		assert(FileSend == nullptr);
-		FileSend = new FileSendTask(fileName, fileTitle, filePath, fileTypeID, fileSubTypeID, socketID, ipAddress, port, deleteAfter);
+		FileSend = new FileSendTask(fileName, fileTitle, filePath, fileTypeID, fileSubTypeID, std::make_shared<WinsockTransport>(socketID, ipAddress, port, winsockWrapper, MESSAGE_CHANNEL_UPLOAD, Connection.Rtt), deleteAfter);
+		FileSend->SetPacingCap(UPLOAD_PACING_CAP);
+		if ((Connection.DataSession != nullptr) && Connection.DataSession->Established && (Connection.Rtt->GetSmoothedRtt() >= FILE_DATAGRAM_MIN_RTT))
+			FileSend->SetDataTransport(std::make_shared<DatagramTransport>(DataChannel, Connection.DataSession, Connection.Rtt));
+		FileSend->SetPortionCompleteCallback([this]() { BroadcastFileSendProgress(); });
 	}
 
 	bool Connect(void);
 
-	inline bool IsFileBeingSent(void) const { return ((FileEncrypt != nullptr) || (FileSend != nullptr)); }
+	//  Main thread functions
+	inline bool IsFileBeingSent(void) const { return UploadInProgress; }
+	void SendFileToServer(std::string fileName, std::string filePath, std::string fileTitle, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID);
+
 	inline bool IsFileBeingReceived(void) const { return ((!FileDecryptList.empty()) || (FileReceive != nullptr)); }
 
 	void AddLatestUpload(int index, std::string upload, std::string uploader, HostedFileType type, HostedFileSubtype subtype);
 	void DetectFilesInUploadFolder(std::string folder, std::vector<std::wstring>& fileList);
-	void SendFileToServer(std::string fileName, std::string filePath, std::string fileTitle, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID);
+	void BeginFileSend(std::string fileName, std::string filePath, std::string fileTitle, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID);
 	void ContinueFileEncryptions(void);
-	void ContinueFileTransfers(void);
+	void StartFileSend(void);
+	void BroadcastFileSendProgress(void);
 	void CancelFileSend(void);
 
 	void Initialize(void);
@@ -148,14 +319,28 @@ public:
 	void Shutdown(void);
 
 	bool ReadMessages(void);
+	void LoseConnection(void);
+	AsyncTask Reconnect(void);
+	void ProcessMessage(void);
+	void ProcessDatagram(DatagramSession& session, std::unique_ptr<TransportMessage> message);
+	void SendDataChannelHello(void);
+	AsyncTask EstablishDataChannel(void);
 };
 
 
 bool Client::Connect(void)
 {
 	// Connect to the New Providence server
-	ServerSocket = winsockWrapper.TCPConnect(NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, 1);
-	return (ServerSocket >= 0);
+	Connection.IncomingFrames.Clear();
+	Connection.SocketID = winsockWrapper.TCPConnect(NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, 1);
+	if (Connection.SocketID < 0) return false;
+
+	//  Offer the newest framing we know. Until the server answers, both ends stay on the legacy framing.
+	Connection.Rtt = std::make_shared<RttEstimator>();
+	Connection.DataSession = nullptr;
+	SendMessage_FramingVersion((unsigned char)(FRAMING_VERSION_LATEST), Connection);
+	Connection.FramingOfferTime = AsyncScheduler::GetNow();
+	return true;
 }
 
 
@@ -188,7 +373,20 @@ void Client::DetectFilesInUploadFolder(std::string folder, std::vector<std::wstr
 
 void Client::SendFileToServer(std::string fileName, std::string filePath, std::string fileTitle, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID)
 {
-	if (IsFileBeingSent()) return;
+	if (UploadInProgress) return;
+	UploadInProgress = true;
+
+	networkThread.Post([=, this]() { BeginFileSend(fileName, filePath, fileTitle, fileTypeID, fileSubTypeID); });
+}
+
+
+void Client::BeginFileSend(std::string fileName, std::string filePath, std::string fileTitle, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID)
+{
+	if ((FileEncrypt != nullptr) || (FileSend != nullptr))
+	{
+		networkThread.PostEvent(std::make_unique<FileSendFinishedEventData>("", "Client"));
+		return;
+	}
 
 	auto titleMD5 = md5(fileTitle);
 	auto hostedFileName = titleMD5 + ".hostedfile";
@@ -207,8 +405,7 @@ void Client::ContinueFileEncryptions(void)
 	{
 		auto encryptComplete = FileEncrypt->Update();
 
-		auto cryptEvent = FileCryptProgressEventData(FileEncrypt->TaskName, FileEncrypt->EncryptionPercentage, "Encrypt", "Client");
-		eventManager.BroadcastEvent(&cryptEvent);
+		networkThread.PostEvent(std::make_unique<FileCryptProgressEventData>(FileEncrypt->TaskName, FileEncrypt->EncryptionPercentage, "Encrypt", "Client"));
 
 		if (encryptComplete)
 		{
@@ -218,6 +415,9 @@ void Client::ContinueFileEncryptions(void)
 #if FILE_TRANSFER_DEBUGGING
 			debugConsole->AddDebugConsoleLine("FileEncryptTask deleted...");
 #endif
+
+			//  The file send waits on the encryption, so it can start now
+			StartFileSend();
 		}
 	}
 
@@ -227,8 +427,7 @@ void Client::ContinueFileEncryptions(void)
 		{
 			auto decryptComplete = (*task)->Update();
 
-			auto cryptEvent = FileCryptProgressEventData((*task)->TaskName, (*task)->DecryptionPercentage, "Decrypt", "Client");
-			eventManager.BroadcastEvent(&cryptEvent);
+			networkThread.PostEvent(std::make_unique<FileCryptProgressEventData>((*task)->TaskName, (*task)->DecryptionPercentage, "Decrypt", "Client"));
 
 			if (decryptComplete)
 			{
@@ -247,45 +446,36 @@ void Client::ContinueFileEncryptions(void)
 }
 
 
-void Client::ContinueFileTransfers(void)
+void Client::StartFileSend(void)
 {
-	//  If we're currently encrypting a file, do not continue a file transfer
-	if (FileEncrypt != nullptr) return;
-
-	// If there is a file send task, send a file chunk for each one if the file transfer is ready
 	if (FileSend == nullptr) return;
 
-	//  If we haven't "started" the file send, do so now and return out
-	if (FileSend->FileSendStarted == false)
+	//  Once the file send is complete, report it and delete the file send task
+	FileSend->StartFileSend([this]()
 	{
-		FileSend->StartFileSend();
-		return;
-	}
+		BroadcastFileSendProgress();
 
-	//  If we aren't sending the file yet, continue out and wait for a ready signal
-	if (FileSend->GetFileTransferState() == FileSendTask::CHUNK_STATE_INITIALIZING) return;
+		//  If the datagrams stopped getting through, later uploads don't try them again
+		if (FileSend->GetDataTransportFailed() && (Connection.DataSession != nullptr)) Connection.DataSession->Established = false;
 
-	FileSend->SetFileTransferEndTime(gameSeconds);
-
-	//  Create the file progress event, but don't broadcast yet
-	auto fileProgressEvent = FileTransferProgressEventData(FileSend->GetFileTitle(), FileSend->GetPercentageComplete(), FileSend->GetTransferTime(), FileSend->GetFileSize(), FileSend->GetEstimatedSecondsRemaining(), "Upload", "Client");
-
-	if (FileSend->GetFileTransferComplete())
-	{
-		//  If the file send is complete, delete the file send task and move on
 		delete FileSend;
 		FileSend = nullptr;
 
 #if FILE_TRANSFER_DEBUGGING
 		debugConsole->AddDebugConsoleLine("FileSendTask deleted...");
 #endif
-	}
 
-	//  Broadcast the progress event after checking for a complete transfer, to avoid an overlap of FileSendTasks
-	eventManager.BroadcastEvent(&fileProgressEvent);
+		networkThread.PostEvent(std::make_unique<FileSendFinishedEventData>("", "Client"));
+	});
+}
+
+
+void Client::BroadcastFileSendProgress(void)
+{
+	if (FileSend == nullptr) return;
 
-	//  If we get this far, we have data to send. Send it and continue out
-	if (FileSend != nullptr) FileSend->SendFileChunk();
+	FileSend->SetFileTransferEndTime(AsyncScheduler::GetNow());
+	networkThread.PostEvent(std::make_unique<FileTransferProgressEventData>(FileSend->GetFileTitle(), FileSend->GetPercentageComplete(), FileSend->GetTransferTime(), FileSend->GetFileSize(), FileSend->GetEstimatedSecondsRemaining(), "Upload", "Client"));
 }
 
 
@@ -296,6 +486,12 @@ void Client::CancelFileSend(void)
 }
 
 
+void Client::ReceiveEvent(EventData* eventData)
+{
+	if (eventData->EventType == "FileSendFinished") UploadInProgress = false;
+}
+
+
 void Client::Initialize(void)
 {
 	//  Seed the random number generator
@@ -306,254 +502,470 @@ void Client::Initialize(void)
 
 	//  Initialize the Winsock wrapper
 	winsockWrapper.WinsockInitialize();
+
+	eventManager.AddEventListener("FileSendFinished", this);
 }
 
 bool Client::MainProcess(void)
 {
-	if (ServerSocket < 0) return false;
+	if (Connection.SocketID < 0) return false;
 
-	// Receive messages
-	ReadMessages();
+	// Receive messages, and if the connection has closed, start trying to get it back
+	if (!ReadMessages())
+	{
+		LoseConnection();
+		return false;
+	}
+	DataChannel.ReceiveAll([this](DatagramSession& session, std::unique_ptr<TransportMessage> message, const std::string&, int) { ProcessDatagram(session, std::move(message)); });
 
 	//  Encrypt files
 	ContinueFileEncryptions();
 
-	//  Send files
-	ContinueFileTransfers();
+	//  Everything this pass sent goes out together
+	winsockWrapper.FlushSendQueues();
 
 	return true;
 }
 
 void Client::Shutdown(void)
 {
-	if (ServerSocket == -1) return;
-	closesocket(ServerSocket);
-	ServerSocket = -1;
+	Reconnection.Reset();
+	if (Connection.SocketID == -1) return;
+	DataChannelSetup.Reset();
+	DataChannel.Close();
+	Connection.DataSession = nullptr;
+	closesocket(Connection.SocketID);
+	Connection.SocketID = -1;
 }
 
 bool Client::ReadMessages(void)
 {
-	auto messageBufferSize = winsockWrapper.ReceiveMessagePacket(ServerSocket, 0);
-	if (messageBufferSize == 0) return false;
-	if (messageBufferSize < 0) return true;
+	//  Read everything that's arrived, then handle every whole message in it until the time budget runs out. Whatever is
+	//  left over stays in the frame decoder for the next pass.
+	auto receivedSize = Connection.ReceiveIncomingData();
+	if (receivedSize == 0) return false;
+
+	auto deadline = AsyncScheduler::GetNow() + ReceiveTimeBudget;
+	while (Connection.NextIncomingMessage())
+	{
+		ProcessMessage();
+		if (AsyncScheduler::GetNow() >= deadline) break;
+	}
+
+	//  A close only counts once every message sent before it has been handled
+	return !(Connection.IncomingFrames.GetClosed() && !Connection.IncomingFrames.GetFrameReady());
+}
+
+void Client::LoseConnection(void)
+{
+	//  Whatever was in flight went with the connection. An upload has to be started again, and the download is asked for again
+	//  once we're back in.
+	if (FileSend != nullptr)
+	{
+		CancelFileSend();
+		networkThread.PostEvent(std::make_unique<FileSendFinishedEventData>("Lost the connection to the server", "Client"));
+	}
+	if (FileReceive != nullptr)
+	{
+		delete FileReceive;
+		FileReceive = nullptr;
+	}
+
+	DataChannelSetup.Reset();
+	DataChannel.Close();
+	Connection.DataSession = nullptr;
+	winsockWrapper.CloseSocket(Connection.SocketID);
+	Connection.SocketID = -1;
+
+	Reconnection = Reconnect();
+	Reconnection.Start();
+}
+
+AsyncTask Client::Reconnect(void)
+{
+	//  Try again every so often, backing off while the server can't be reached. With a ticket we pick up where we left off in
+	//  the one round trip, and without one (or once it's run out) the user logs in again as usual.
+	do
+	{
+		co_await SleepFor(ReconnectInterval);
+		ReconnectInterval = std::min<double>(ReconnectInterval * 2.0, RECONNECT_INTERVAL_MAX);
+	} while (!Connect());
+
+	if (SessionTicketID != 0) SendMessage_SessionResumeRequest(SessionTicketID, SessionTicketSecret, HostedFileListSequence, Connection);
+}
+
+void Client::SendDataChannelHello(void)
+{
+	//  Each hello is numbered, so the server can tell it from an old one sent again
+	DatagramTransport transport(DataChannel, Connection.DataSession);
+	auto& message = transport.BeginMessage(MESSAGE_ID_DATA_CHANNEL_HELLO);
+	message.writelint(++Connection.DataSession->HelloSequence);
+	transport.Send();
+}
+
+AsyncTask Client::EstablishDataChannel(void)
+{
+	//  Say hello until the server answers one. If it never does, UDP isn't getting through, and every transfer stays on TCP.
+	for (auto i = 0; (i < DATA_CHANNEL_HELLO_ATTEMPTS) && !Connection.DataSession->Established; ++i)
+	{
+		SendDataChannelHello();
+		co_await SleepFor(DATA_CHANNEL_HELLO_INTERVAL);
+	}
+}
+
+void Client::ProcessDatagram(DatagramSession& session, std::unique_ptr<TransportMessage> message)
+{
+	switch (message->MessageID)
+	{
+	case MESSAGE_ID_DATA_CHANNEL_HELLO:
+	{
+		//  The server's answer shows datagrams get through both ways. Telling it so (over TCP) lets its transfers use them too.
+		if (session.Established) break;
+		session.Established = true;
+		SendMessage_DataChannelConfirm(Connection);
+	}
+	break;
+
+	case MESSAGE_ID_FILE_PORTION:
+	case MESSAGE_ID_FILE_PARITY:
+	{
+		//  Pieces of a file we're receiving go to its receive coroutine, the same as those that come over the connection
+		if (FileReceive == nullptr) break;
+		FileReceive->Deliver(std::move(message));
+	}
+	break;
+	}
+}
 
-	auto messageID = winsockWrapper.ReadChar(0);
+void Client::ProcessMessage(void)
+{
+	//  A newer server may use channels we don't know about, and anything sent on them is ignored
+	if (Connection.IncomingFrames.GetFrameChannel() >= MESSAGE_CHANNEL_COUNT) return;
+
+	MessageReader message(Connection.ReceiveBuffer);
+	auto messageID = message.ReadChar();
 	switch (messageID)
 	{
 	case MESSAGE_ID_PING_REQUEST:
 	{
-		SendMessage_PingResponse(ServerSocket);
+		SendMessage_PingResponse(Connection);
+
+		//  A hello now and then keeps any NAT in the way holding the datagram channel open
+		if ((Connection.DataSession != nullptr) && Connection.DataSession->Established) SendDataChannelHello();
+	}
+	break;
+
+	case MESSAGE_ID_DATA_CHANNEL_OFFER:
+	{
+		//  (long) Session ID
+		//  (int) Length of encrypted key (n)
+		//  (n-size chars array) Encrypted key
+		//  (unsigned short) The server's UDP port
+		auto sessionID = message.ReadLongInt();
+		auto keySize = message.ReadInt();
+		auto encryptedKey = message.ReadBytes(keySize);
+		auto port = int(message.ReadUnsignedShort());
+		if (message.GetFailed() || !DATA_CHANNEL_ENABLED || (Connection.DataSession != nullptr)) break;
+
+		auto key = Groundfish::Decrypt(encryptedKey.data());
+		if ((key.size() != DATAGRAM_SESSION_KEY_SIZE) || !DataChannel.Open(0)) break;
+
+		auto session = std::make_shared<DatagramSession>();
+		session->SessionID = sessionID;
+		memcpy(session->Key, key.data(), DATAGRAM_SESSION_KEY_SIZE);
+		session->PeerIP = NEW_PROVIDENCE_IP;
+		session->PeerPort = port;
+		DataChannel.AddSession(session);
+		Connection.DataSession = session;
+
+		DataChannelSetup = EstablishDataChannel();
+		DataChannelSetup.Start();
+	}
+	break;
+
+	case MESSAGE_ID_FRAMING_VERSION:
+	{
+		//  The server's choice from our offer. Its messages after this one use it, and so do ours once we've confirmed it
+		//  (the confirmation still goes out in the legacy framing, as the server hasn't switched yet).
+		auto framingVersion = int(message.ReadChar());
+		if (message.GetFailed() || (framingVersion < FRAMING_VERSION_LEGACY) || (framingVersion > FRAMING_VERSION_LATEST)) break;
+
+		Connection.IncomingFrames.SetFramingVersion(framingVersion);
+		ReconnectInterval = RECONNECT_INTERVAL;
+		if (Connection.Rtt->GetSampleCount() == 0) Connection.Rtt->AddSample(AsyncScheduler::GetNow() - Connection.FramingOfferTime);
+		SendMessage_FramingVersion((unsigned char)(framingVersion), Connection);
+		winsockWrapper.SetFramingVersion(Connection.SocketID, framingVersion);
 	}
 	break;
 
 	case MESSAGE_ID_ENCRYPTED_CHAT_STRING:
 	{
-		int messageSize = winsockWrapper.ReadInt(0);
+		auto messageSize = message.ReadInt();
+		auto encryptedChatString = message.ReadBytes(messageSize);
+		if (message.GetFailed()) break;
 
 		//  Decrypt using Groundfish
-		unsigned char encryptedChatString[256];
-		memcpy(encryptedChatString, winsockWrapper.ReadChars(0, messageSize), messageSize);
-		auto chatString = Groundfish::DecryptToString(encryptedChatString);
+		auto chatString = Groundfish::DecryptToString(encryptedChatString.data());
 		//NewLine(chatString);
 	}
 	break;
 
 	case MESSAGE_ID_USER_LOGIN_RESPONSE:
 	{
-		auto response = winsockWrapper.ReadInt(0);
+		auto response = message.ReadInt();
 		bool success = (response == LOGIN_RESPONSE_SUCCESS);
-		auto inboxCount = success ? winsockWrapper.ReadInt(0) : 0;
-		auto notificationCount = success ? winsockWrapper.ReadInt(0) : 0;
-		if (LoginResponseCallback != nullptr) LoginResponseCallback(response, inboxCount, notificationCount);
+		auto inboxCount = success ? message.ReadInt() : 0;
+		auto notificationCount = success ? message.ReadInt() : 0;
+		if (message.GetFailed()) break;
+		networkThread.PostEvent(std::make_unique<LoginResponseEventData>(response, inboxCount, notificationCount, "Client"));
+	}
+	break;
+
+	case MESSAGE_ID_SESSION_TICKET:
+	{
+		//  (long) Ticket ID
+		//  (int) Length of encrypted ticket secret (n)
+		//  (n-size chars array) Encrypted ticket secret
+		//  (long) The hosted file list sequence everything sent along with the ticket is up to
+		auto ticketID = message.ReadLongInt();
+		auto secretSize = message.ReadInt();
+		auto encryptedSecret = message.ReadBytes(secretSize);
+		auto listSequence = message.ReadLongInt();
+		if (message.GetFailed()) break;
+
+		SessionTicketID = ticketID;
+		SessionTicketSecret = Groundfish::Decrypt(encryptedSecret.data());
+		HostedFileListSequence = listSequence;
+	}
+	break;
+
+	case MESSAGE_ID_SESSION_RESUME_RESPONSE:
+	{
+		auto response = message.ReadInt();
+		if (message.GetFailed()) break;
+
+		//  If the ticket is no good any more, it's back to the login screen
+		if (response == LOGIN_RESPONSE_SUCCESS) networkThread.PostEvent(std::make_unique<SessionResumedEventData>("Client"));
+		else
+		{
+			SessionTicketID = 0;
+			SessionTicketSecret.clear();
+			networkThread.PostEvent(std::make_unique<LoginResponseEventData>(response, 0, 0, "Client"));
+		}
 	}
 	break;
 
 	case MESSAGE_ID_USER_INBOX_AND_NOTIFICATIONS:
 	{
-		auto inboxCount = winsockWrapper.ReadInt(0);
+		auto inboxCount = message.ReadInt();
 		for (auto i = 0; i < inboxCount; ++i)
 		{
 			//  TODO: Read inbox item data
 		}
 
-		char* notification;
-		auto notificationsCount = winsockWrapper.ReadInt(0);
-		for (auto i = 0; i < notificationsCount; ++i)
+		std::string notification;
+		auto notificationsCount = message.ReadInt();
+		for (auto i = 0; (i < notificationsCount) && !message.GetFailed(); ++i)
 		{
-			auto notificationLength = winsockWrapper.ReadInt(0);
-			notification = (char*)winsockWrapper.ReadChars(0, notificationLength);
+			auto notificationLength = message.ReadInt();
+			notification = message.ReadChars(notificationLength);
 		}
+		if (message.GetFailed()) break;
 
-		if (InboxAndNotificationCountCallback != nullptr) InboxAndNotificationCountCallback(0, notificationsCount);
+		networkThread.PostEvent(std::make_unique<InboxAndNotificationCountEventData>(0, notificationsCount, "Client"));
 	}
 	break;
 
 	case MESSAGE_ID_HOSTED_FILE_LIST:
 	{
-		auto uploadsStartIndex = int(winsockWrapper.ReadUnsignedShort(0));
-		auto latestUploadCount = int(winsockWrapper.ReadUnsignedShort(0));
+		auto uploadsStartIndex = int(message.ReadUnsignedShort());
+		auto latestUploadCount = int(message.ReadUnsignedShort());
 		HostedFilesList.clear();
 		for (auto i = 0; i < latestUploadCount; ++i)
 		{
 			//  The file type and subtype
-			auto type = HostedFileType(winsockWrapper.ReadChar(0));
-			auto subtype = HostedFileSubtype(winsockWrapper.ReadChar(0));
+			auto type = HostedFileType(message.ReadChar());
+			auto subtype = HostedFileSubtype(message.ReadChar());
 
-			//  The encrypted file title
-			auto ftSize = int(winsockWrapper.ReadChar(0));
+			//  The encrypted file title and uploader
+			auto ftSize = int(message.ReadChar());
 			assert(ftSize != 0);
-			auto ftData = winsockWrapper.ReadChars(0, ftSize);
-			auto ftDataVector = EncryptedData(ftData, ftData + ftSize);
-			auto decryptedTitleString = Groundfish::DecryptToString(ftDataVector.data());
-
-			//  The encrypted file uploader
-			auto fuSize = int(winsockWrapper.ReadChar(0));
+			auto ftDataVector = message.ReadBytes(ftSize);
+			auto fuSize = int(message.ReadChar());
 			assert(fuSize != 0);
-			auto fuData = winsockWrapper.ReadChars(0, fuSize);
-			auto fuDataVector = EncryptedData(fuData, fuData + fuSize);
+			auto fuDataVector = message.ReadBytes(fuSize);
+			if (message.GetFailed()) break;
+
+			auto decryptedTitleString = Groundfish::DecryptToString(ftDataVector.data());
 			auto decryptedUploaderString = Groundfish::DecryptToString(fuDataVector.data());
 
 			AddLatestUpload(uploadsStartIndex++, decryptedTitleString, decryptedUploaderString, type, subtype);
 		}
 
-		if (LatestUploadsCallback != nullptr) LatestUploadsCallback(HostedFilesList);
+		//  A list can come from the cache, built before the ticket we were last handed, so it never takes the sequence back
+		auto listSequence = message.ReadLongInt();
+		if (!message.GetFailed()) HostedFileListSequence = std::max<uint64_t>(HostedFileListSequence, listSequence);
+
+		networkThread.PostEvent(std::make_unique<LatestUploadsEventData>(HostedFilesList, "Client"));
 	}
 	break;
 
 
 	case MESSAGE_ID_FILE_REQUEST_FAILED:
 	{
-		auto failedFileID = std::string(winsockWrapper.ReadString(0));
-		auto failureReason = std::string(winsockWrapper.ReadString(0));
-		if (FileRequestFailureCallback != nullptr) FileRequestFailureCallback(failedFileID, failureReason);
+		auto failedFileID = message.ReadString();
+		auto failureReason = message.ReadString();
+		networkThread.PostEvent(std::make_unique<FileRequestResultEventData>(false, failedFileID, failureReason, "Client"));
 	}
 	break;
 
 
 	case MESSAGE_ID_FILE_SEND_INIT:
 	{
-		int fileNameSize = winsockWrapper.ReadInt(0);
-		int fileTitleSize = winsockWrapper.ReadInt(0);
-		int fileDescriptionSize = winsockWrapper.ReadInt(0);
-
-		//  Decrypt the filename using Groundfish
-		auto decryptedFileNamePure = Groundfish::DecryptToString(winsockWrapper.ReadChars(0, fileNameSize));
-		auto decryptedFilename = "./_DownloadedFiles/" + decryptedFileNamePure;
-		auto tempFilename = std::string(decryptedFilename) + std::string(".tempfile");
+		int fileNameSize = message.ReadInt();
+		int fileTitleSize = message.ReadInt();
+		int fileDescriptionSize = message.ReadInt();
 
-		//  Decrypt the filename using Groundfish
-		auto decryptedFileTitle = Groundfish::DecryptToString(winsockWrapper.ReadChars(0, fileTitleSize));
-
-		//  Decrypt the filename using Groundfish
-		auto decryptedFileDescription = Groundfish::DecryptToString(winsockWrapper.ReadChars(0, fileDescriptionSize));
+		//  Read the encrypted file name, title, and description
+		auto encryptedFileName = message.ReadBytes(fileNameSize);
+		auto encryptedFileTitle = message.ReadBytes(fileTitleSize);
+		auto encryptedFileDescription = message.ReadBytes(fileDescriptionSize);
 
 		//  Grab the file type and sub-type
-		auto fileTypeID = HostedFileType(winsockWrapper.ReadUnsignedShort(0));
-		auto fileSubTypeID = HostedFileSubtype(winsockWrapper.ReadUnsignedShort(0));
+		auto fileTypeID = HostedFileType(message.ReadUnsignedShort());
+		auto fileSubTypeID = HostedFileSubtype(message.ReadUnsignedShort());
 
 		//  Grab the file size, file chunk size, and buffer count
-		auto fileSize = winsockWrapper.ReadLongInt(0);
-		auto fileChunkSize = winsockWrapper.ReadLongInt(0);
-		auto FileChunkBufferSize = winsockWrapper.ReadLongInt(0);
+		auto fileSize = message.ReadLongInt();
+		auto fileChunkSize = message.ReadLongInt();
+		auto FileChunkBufferSize = message.ReadLongInt();
+		if (message.GetFailed() || !FileReceiveTask::GetChunkLayoutValid(fileChunkSize, FileChunkBufferSize)) break;
+
+		//  Decrypt the filename using Groundfish
+		auto decryptedFileNamePure = Groundfish::DecryptToString(encryptedFileName.data());
+		auto decryptedFilename = "./_DownloadedFiles/" + decryptedFileNamePure;
+		auto tempFilename = std::string(decryptedFilename) + std::string(".tempfile");
+
+		//  Decrypt the file title and description using Groundfish
+		auto decryptedFileTitle = Groundfish::DecryptToString(encryptedFileTitle.data());
+		auto decryptedFileDescription = Groundfish::DecryptToString(encryptedFileDescription.data());
 
 		//  Create a new file receive task
 		(void)_wmkdir(L"_DownloadedFiles");
-		FileReceive = new FileReceiveTask(decryptedFilename, decryptedFileTitle, decryptedFileDescription, fileTypeID, fileSubTypeID, fileSize, fileChunkSize, FileChunkBufferSize, tempFilename, 0, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT);
+		FileReceive = new FileReceiveTask(decryptedFilename, decryptedFileTitle, decryptedFileDescription, fileTypeID, fileSubTypeID, fileSize, fileChunkSize, FileChunkBufferSize, tempFilename, std::make_shared<WinsockTransport>(Connection.SocketID, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, winsockWrapper, MESSAGE_CHANNEL_DOWNLOAD, Connection.Rtt));
 		FileReceive->SetDecryptWhenReceived(true);
 
-		//  Respond to the file request success
-		if (FileRequestSuccessCallback != nullptr) FileRequestSuccessCallback(decryptedFileNamePure);
-	}
-	break;
-
-	case MESSAGE_ID_FILE_SEND_FAILED:
-	{
-		auto failureReason = std::string(winsockWrapper.ReadString(0));
-		if (FileSendFailureCallback != nullptr) FileSendFailureCallback(failureReason);
-	}
-	break;
-
-	case MESSAGE_ID_FILE_RECEIVE_READY:
-	{
-		assert(FileSend != nullptr);
-
-		FileSend->SetFileTransferState(FileSendTask::CHUNK_STATE_SENDING);
-	}
-	break;
-
-	case MESSAGE_ID_FILE_PORTION:
-	{
-		if (FileReceive == nullptr) break;
-
-		if (FileReceive->ReceiveFileChunk())
+		//  Once the download is complete, hand it off to be decrypted and delete the file receive task. The files of a collection
+		//  follow one another without waiting, so the next one's task may already have taken this one's place.
+		auto receiveTask = FileReceive;
+		FileReceive->StartFileReceive([this, receiveTask]()
 		{
-			assert(false); // ALERT: We should never be receiving a chunk after the file transfer is complete
+			if (receiveTask->GetFileTransferComplete() && receiveTask->GetDecryptWhenRecieved())
+				AddFileDecryptTask(receiveTask->GetFileTitle(), receiveTask->GetTemporaryFileName(), receiveTask->GetFileName());
 
-			//  If ReceiveFile returns true, the transfer is complete
-			delete FileReceive;
-			FileReceive = nullptr;
+			if (FileReceive == receiveTask) FileReceive = nullptr;
+			delete receiveTask;
 
 #if FILE_TRANSFER_DEBUGGING
 			debugConsole->AddDebugConsoleLine("File Receive Task deleted...");
 #endif
-		}
+		});
+
+		//  Respond to the file request success
+		networkThread.PostEvent(std::make_unique<FileRequestResultEventData>(true, decryptedFileNamePure, "", "Client"));
 	}
 	break;
 
-	case MESSAGE_ID_FILE_PORTION_COMPLETE:
+	case MESSAGE_ID_FILE_INLINE:
 	{
-		auto portionIndex = winsockWrapper.ReadLongInt(0);
-
-		if (FileReceive == nullptr)
-		{
-			SendMessage_FilePortionCompleteConfirmation(portionIndex, ServerSocket, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT);
-			break;
-		}
-
-		(void) _wmkdir(L"_DownloadedFiles");
-		if (FileReceive->CheckFilePortionComplete(portionIndex))
+		//  (unsigned short) Number of files asked for, then for each:
+		//  (string) The file title it was asked for by
+		//  (char) Whether it was sent, or why not
+		//  If it was sent, the encrypted file name (int size, then bytes), and the hosted file (int size, then bytes)
+		auto fileCount = int(message.ReadUnsignedShort());
+		auto bundleResult = std::make_unique<FileBundleResultEventData>("Client");
+		(void)_wmkdir(L"_DownloadedFiles");
+		for (auto i = 0; (i < fileCount) && !message.GetFailed(); ++i)
 		{
-			FileReceive->SetFileTransferEndTime(gameSecondsF);
-
-			if (FileReceive->GetFileTransferComplete())
+			auto fileTitle = message.ReadString();
+			auto result = FileInlineResults(message.ReadChar());
+			if (message.GetFailed()) break;
+
+			if (result == FILE_INLINE_NOT_FOUND)
+				networkThread.PostEvent(std::make_unique<FileRequestResultEventData>(false, fileTitle, "The specified file was not found.", "Client"));
+			if (result == FILE_INLINE_TOO_LARGE) bundleResult->TooLargeFileIDs.push_back(fileTitle);
+			if (result == FILE_INLINE_DEFERRED) bundleResult->DeferredFileIDs.push_back(fileTitle);
+			if (result != FILE_INLINE_SENT) continue;
+
+			auto fileNameSize = message.ReadInt();
+			auto encryptedFileName = message.ReadBytes(fileNameSize);
+			auto fileContentsSize = message.ReadInt();
+			auto fileContents = message.ReadBytes(fileContentsSize);
+			if (message.GetFailed() || encryptedFileName.empty()) break;
+
+			//  The file is decrypted from the message straight into place, with no temporary file and no decryption task
+			auto decryptedFileNamePure = Groundfish::DecryptToString(encryptedFileName.data());
+			if (!Groundfish::DecryptToFile(fileContents, "./_DownloadedFiles/" + decryptedFileNamePure))
 			{
-				if (FileReceive->GetDecryptWhenRecieved())
-					AddFileDecryptTask(FileReceive->GetFileTitle(), FileReceive->GetTemporaryFileName(), FileReceive->GetFileName());
-
-				delete FileReceive;
-				FileReceive = nullptr;
-
-#if FILE_TRANSFER_DEBUGGING
-				debugConsole->AddDebugConsoleLine("File Receive Task deleted...");
-#endif
-				break;
+				networkThread.PostEvent(std::make_unique<FileRequestResultEventData>(false, fileTitle, "The file could not be written.", "Client"));
+				continue;
 			}
+
+			networkThread.PostEvent(std::make_unique<FileRequestResultEventData>(true, decryptedFileNamePure, "", "Client"));
+			networkThread.PostEvent(std::make_unique<FileCryptProgressEventData>(fileTitle, 1.0, "Decrypt", "Client"));
 		}
+
+		if (!bundleResult->TooLargeFileIDs.empty() || !bundleResult->DeferredFileIDs.empty()) networkThread.PostEvent(std::move(bundleResult));
 	}
 	break;
 
-	case MESSAGE_ID_FILE_CHUNKS_REMAINING:
+	case MESSAGE_ID_COLLECTION_PROGRESS:
 	{
-		assert(FileSend != nullptr);
+		auto collectionID = message.ReadLongInt();
+		auto filesRemaining = message.ReadInt();
+		auto bytesRemaining = message.ReadLongInt();
+		if (message.GetFailed()) break;
 
-		auto chunkCount = winsockWrapper.ReadInt(0);
-		std::unordered_map<int, bool> chunksRemaining;
-		for (auto i = 0; i < chunkCount; ++i) chunksRemaining[winsockWrapper.ReadShort(0)] = true;
-		FileSend->SetChunksRemaining(chunksRemaining);
+		networkThread.PostEvent(std::make_unique<CollectionProgressEventData>(collectionID, filesRemaining, bytesRemaining, "Client"));
 	}
 	break;
 
-	case MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM:
+	case MESSAGE_ID_FILE_SEND_FAILED:
 	{
-		auto portionIndex = winsockWrapper.ReadLongInt(0);
+		auto failureReason = message.ReadString();
+		CancelFileSend();
+		networkThread.PostEvent(std::make_unique<FileSendFinishedEventData>(failureReason, "Client"));
+	}
+	break;
 
+	case MESSAGE_ID_FILE_RECEIVE_READY:
+	case MESSAGE_ID_FILE_CHUNKS_REMAINING:
+	case MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM:
+	{
+		//  Replies about a file we're sending go to its send coroutine
 		if (FileSend == nullptr) break;
-		if (FileSend->GetFileTransferState() != FileSendTask::CHUNK_STATE_PENDING_COMPLETE) break;
+		FileSend->Deliver(TransportMessage::Create(messageID, message.GetBuffer()));
+	}
+	break;
+
+	case MESSAGE_ID_FILE_PORTION:
+	case MESSAGE_ID_FILE_PORTION_COMPLETE:
+	{
+		//  Pieces of a file we're receiving go to its receive coroutine
+		if (FileReceive != nullptr)
+		{
+			FileReceive->Deliver(TransportMessage::Take(messageID, message.GetBuffer()));
+			break;
+		}
 
-		FileSend->ConfirmFilePortionSendComplete(portionIndex);
+		//  A reminder for a download we've already finished means our last confirmation went missing, so send it again
+		if (messageID == MESSAGE_ID_FILE_PORTION_COMPLETE)
+		{
+			WinsockTransport transport(Connection.SocketID, NEW_PROVIDENCE_IP, NEW_PROVIDENCE_PORT, winsockWrapper, MESSAGE_CHANNEL_DOWNLOAD, Connection.Rtt);
+			WriteMessage_FilePortionCompleteConfirmation(transport, message.ReadLongInt());
+			transport.Send();
+		}
 	}
 	break;
 	}
-
-	return true;
 }
\ No newline at end of file
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "LockFreeQueue.h"
+#include "BufferPool.h"
+#include "MonotonicClock.h"
+#include "TimerWheel.h"
+
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+
+//  Async Runtime: C++20 coroutines for protocol code, so a transfer or session can be written as straight-line code.
+//  A coroutine suspends on an awaitable (a timer, an inbox message, a job, a blocked write, or the next frame) and is only
+//  resumed when that event happens, so idle coroutines cost nothing per frame. Everything resumes on the thread that runs
+//  Update() (the network thread once it's started, and PrimaryLoop otherwise): timers, yields and blocked writes from Update(),
+//  inbox messages from whoever delivers them, and jobs from that same thread's jobSystem.ProcessCompletedJobs().
+//  Other threads never touch a coroutine directly. They hand it work through PostFromAnyThread().
+//
+//  A thread that runs coroutines of its own (a server shard's event loop) gives itself its own scheduler with SetCurrent(),
+//  and awaiters register with whichever scheduler is current on the thread they suspend on. Everyone else shares the
+//  process-wide one, asyncScheduler.
+//
+//  Timers sit in a timer wheel ticking in MonotonicClock milliseconds, so arming one is O(1), and a wait that ends some other
+//  way (such as an inbox message arriving before its timeout) cancels its timer in O(1) rather than leaving it to expire.
+
+//  One suspension of one coroutine. Whichever event fires first resumes it, and every other registration is ignored.
+//  The awaiter marks the state as fired when it's destroyed, so a coroutine destroyed mid-wait is never resumed.
+struct AsyncWaitState
+{
+	std::coroutine_handle<> Handle;
+	bool Fired = false;
+	bool TimedOut = false;
+	TimerHandle Timer = INVALID_TIMER_HANDLE;
+
+	inline bool Resume(bool timedOut = false)
+	{
+		if (Fired) return false;
+		Fired = true;
+		TimedOut = timedOut;
+		Handle.resume();
+		return true;
+	}
+};
+
+
+class AsyncScheduler
+{
+private:
+	struct PollEntry
+	{
+		std::function<bool()> Poll;
+		std::shared_ptr<AsyncWaitState> WaitState;
+	};
+
+	TimerWheel<std::shared_ptr<AsyncWaitState>> Timers;
+	std::vector<std::shared_ptr<AsyncWaitState>> NextFrame;
+	std::vector<PollEntry> PollList;
+	std::vector<std::function<void()>> PostedCallbacks;
+	MPSCQueue<std::function<void()>> RemoteCallbacks;
+
+	//  What Update() walks while the lists above fill up again. Kept between updates, so their storage is reused.
+	std::vector<std::function<void()>> PostedScratch;
+	std::vector<std::shared_ptr<AsyncWaitState>> NextFrameScratch;
+	std::vector<PollEntry> PollScratch;
+
+	static thread_local AsyncScheduler* Current;
+
+public:
+	AsyncScheduler() : Timers(MonotonicClock::GetMilliseconds()) {}
+	~AsyncScheduler() {}
+
+	AsyncScheduler(const AsyncScheduler&) = delete;
+	AsyncScheduler& operator=(const AsyncScheduler&) = delete;
+
+	static AsyncScheduler& GetInstance() { static AsyncScheduler INSTANCE; return INSTANCE; }
+
+	//  The scheduler coroutines suspending on this thread register with: the thread's own, if it has set one, or the shared one
+	static inline AsyncScheduler& GetCurrent() { return (Current != nullptr) ? *Current : GetInstance(); }
+	static inline void SetCurrent(AsyncScheduler* scheduler) { Current = scheduler; }
+
+	static inline double GetNow() { return MonotonicClock::GetSeconds(); }
+
+	inline void AddTimer(double seconds, const std::shared_ptr<AsyncWaitState>& waitState) { waitState->Timer = Timers.Arm(MonotonicClock::GetDeadlineMilliseconds(seconds), waitState); }
+	inline void CancelTimer(AsyncWaitState& waitState) { Timers.Cancel(waitState.Timer); waitState.Timer = INVALID_TIMER_HANDLE; }
+	inline void AddNextFrame(const std::shared_ptr<AsyncWaitState>& waitState) { NextFrame.push_back(waitState); }
+	inline void AddPoll(const std::function<bool()>& poll, const std::shared_ptr<AsyncWaitState>& waitState) { PollList.push_back(PollEntry{ poll, waitState }); }
+	inline void Post(const std::function<void()>& callback) { PostedCallbacks.push_back(callback); }
+
+	//  Safe from any thread. The callback runs at the start of the next Update(), on the thread that owns the scheduler.
+	inline void PostFromAnyThread(const std::function<void()>& callback) { RemoteCallbacks.Push(callback); }
+
+	inline size_t GetTimerCount() const { return Timers.GetCount(); }
+	inline size_t GetPendingCount() const { return Timers.GetCount() + NextFrame.size() + PollList.size() + PostedCallbacks.size(); }
+
+	void Update();
+};
+
+
+inline void AsyncScheduler::Update()
+{
+	std::function<void()> remoteCallback;
+	while (RemoteCallbacks.TryPop(remoteCallback)) remoteCallback();
+
+	//  Swap each list out before walking it, as anything resumed here is free to register for the next frame
+	PostedScratch.swap(PostedCallbacks);
+	for (auto& callback : PostedScratch) callback();
+	PostedScratch.clear();
+
+	NextFrameScratch.swap(NextFrame);
+	for (auto& waitState : NextFrameScratch) waitState->Resume();
+	NextFrameScratch.clear();
+
+	//  Blocked writes and the like are retried once a frame. The poll is skipped if its coroutine has gone away.
+	PollScratch.swap(PollList);
+	for (auto& entry : PollScratch)
+	{
+		if (entry.WaitState->Fired) continue;
+		if (entry.Poll()) entry.WaitState->Resume();
+		else PollList.push_back(std::move(entry));
+	}
+	PollScratch.clear();
+
+	Timers.Advance(MonotonicClock::GetMilliseconds(), [](std::shared_ptr<AsyncWaitState>& waitState)
+	{
+		waitState->Timer = INVALID_TIMER_HANDLE;
+		waitState->Resume(true);
+	});
+}
+
+inline thread_local AsyncScheduler* AsyncScheduler::Current = nullptr;
+
+//  Instance to be utilized by anyone including this header
+AsyncScheduler& asyncScheduler = AsyncScheduler::GetInstance();
+
+
+//  The coroutine type. Tasks start suspended and run on Start() or when first awaited by another task.
+//  The owner holds the AsyncTask, and destroying it destroys the coroutine wherever it's suspended.
+class AsyncTask
+{
+public:
+	struct promise_type
+	{
+		bool Started = false;
+		bool Finished = false;
+		std::function<void()> OnComplete;
+		std::coroutine_handle<> Continuation;
+
+		struct FinalAwaiter
+		{
+			inline bool await_ready() noexcept { return false; }
+			inline std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				//  Copy everything out first, as the completion callback is allowed to destroy this task
+				auto& promise = handle.promise();
+				promise.Finished = true;
+				auto continuation = promise.Continuation;
+				auto onComplete = std::move(promise.OnComplete);
+				if (onComplete != nullptr) onComplete();
+				return (continuation ? continuation : std::noop_coroutine());
+			}
+			inline void await_resume() noexcept {}
+		};
+
+		inline AsyncTask get_return_object() { return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		inline std::suspend_always initial_suspend() noexcept { return {}; }
+		inline FinalAwaiter final_suspend() noexcept { return {}; }
+		inline void return_void() {}
+		inline void unhandled_exception() { std::terminate(); }
+	};
+
+private:
+	std::coroutine_handle<promise_type> Handle;
+
+public:
+	AsyncTask() : Handle(nullptr) {}
+	explicit AsyncTask(std::coroutine_handle<promise_type> handle) : Handle(handle) {}
+	AsyncTask(AsyncTask&& other) noexcept : Handle(other.Handle) { other.Handle = nullptr; }
+	AsyncTask& operator=(AsyncTask&& other) noexcept { if (this != &other) { Reset(); Handle = other.Handle; other.Handle = nullptr; } return *this; }
+	AsyncTask(const AsyncTask&) = delete;
+	AsyncTask& operator=(const AsyncTask&) = delete;
+	~AsyncTask() { Reset(); }
+
+	inline bool GetValid() const { return bool(Handle); }
+	inline bool GetStarted() const { return Handle && Handle.promise().Started; }
+	inline bool GetFinished() const { return Handle && Handle.promise().Finished; }
+
+	//  The callback runs on the scheduler's thread the moment the coroutine finishes, and may destroy the task (or its owner)
+	inline void SetOnComplete(const std::function<void()>& onComplete) { if (Handle) Handle.promise().OnComplete = onComplete; }
+
+	inline void Start() { if (!Handle || Handle.promise().Started) return; Handle.promise().Started = true; Handle.resume(); }
+	inline void Reset() { if (Handle) Handle.destroy(); Handle = nullptr; }
+
+	//  Awaiting a task runs it (if it hasn't started) and resumes the awaiting coroutine when it finishes
+	inline bool await_ready() const { return !Handle || Handle.promise().Finished; }
+	inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+	{
+		Handle.promise().Continuation = awaiting;
+		if (Handle.promise().Started) return std::noop_coroutine();
+		Handle.promise().Started = true;
+		return Handle;
+	}
+	inline void await_resume() const {}
+};
+
+
+//  Base for awaiters that register a wait state somewhere and get resumed through it
+struct AsyncWaitAwaiter
+{
+	std::shared_ptr<AsyncWaitState> WaitState;
+
+	AsyncWaitAwaiter() : WaitState(std::allocate_shared<AsyncWaitState>(PoolAllocator<AsyncWaitState>())) {}
+	AsyncWaitAwaiter(AsyncWaitAwaiter&& other) noexcept : WaitState(std::move(other.WaitState)) {}
+	~AsyncWaitAwaiter() { if (WaitState != nullptr) WaitState->Fired = true; }
+};
+
+
+//  co_await SleepFor(seconds): resumes once the time has passed
+struct SleepFor : public AsyncWaitAwaiter
+{
+	double Seconds;
+
+	explicit SleepFor(double seconds) : Seconds(seconds) {}
+	inline bool await_ready() const { return (Seconds <= 0.0); }
+	inline void await_suspend(std::coroutine_handle<> handle) { WaitState->Handle = handle; AsyncScheduler::GetCurrent().AddTimer(Seconds, WaitState); }
+	inline void await_resume() const {}
+};
+
+
+//  co_await YieldFrame(): resumes on the next frame, for coroutines spreading a burst of work out
+struct YieldFrame : public AsyncWaitAwaiter
+{
+	inline bool await_ready() const { return false; }
+	inline void await_suspend(std::coroutine_handle<> handle) { WaitState->Handle = handle; AsyncScheduler::GetCurrent().AddNextFrame(WaitState); }
+	inline void await_resume() const {}
+};
+
+
+//  co_await RunJob(work, priority): runs the work on the job system (disk reads and writes, hashing, encryption)
+//  and resumes on the submitting thread once it's done. If the coroutine is destroyed first, this waits for the work to finish,
+//  since the work is free to reference the coroutine's locals.
+struct RunJob : public AsyncWaitAwaiter
+{
+	std::function<void()> Work;
+	JobPriority Priority;
+	JobHandle Job;
+
+	explicit RunJob(const std::function<void()>& work, JobPriority priority = JOB_PRIORITY_NORMAL) : Work(work), Priority(priority), Job(INVALID_JOB_HANDLE) {}
+	RunJob(RunJob&& other) noexcept : AsyncWaitAwaiter(std::move(other)), Work(std::move(other.Work)), Priority(other.Priority), Job(other.Job) { other.Job = INVALID_JOB_HANDLE; }
+	~RunJob() { if (Job != INVALID_JOB_HANDLE) jobSystem.WaitForJob(Job); }
+
+	inline bool await_ready() const { return false; }
+	inline void await_suspend(std::coroutine_handle<> handle)
+	{
+		WaitState->Handle = handle;
+		auto waitState = WaitState;
+		Job = jobSystem.Submit(Work, [waitState]() { waitState->Resume(); }, Priority);
+	}
+	inline void await_resume() { Job = INVALID_JOB_HANDLE; }
+};
+
+
+//  A queue of messages for one coroutine. Whoever reads the socket delivers into it, and the coroutine awaits Receive().
+//  Receive() resumes immediately if a message is already waiting, and otherwise on the next delivery or the timeout.
+template <typename MessageType>
+class AsyncInbox
+{
+private:
+	std::deque<std::unique_ptr<MessageType>, PoolAllocator<std::unique_ptr<MessageType>>> Messages;
+	std::shared_ptr<AsyncWaitState> Waiter;
+
+public:
+	struct ReceiveAwaiter : public AsyncWaitAwaiter
+	{
+		AsyncInbox& Inbox;
+		double TimeoutSeconds;
+
+		ReceiveAwaiter(AsyncInbox& inbox, double timeoutSeconds) : Inbox(inbox), TimeoutSeconds(timeoutSeconds) {}
+
+		inline bool await_ready() const { return !Inbox.Messages.empty(); }
+		inline void await_suspend(std::coroutine_handle<> handle)
+		{
+			WaitState->Handle = handle;
+			Inbox.Waiter = WaitState;
+			if (TimeoutSeconds >= 0.0) AsyncScheduler::GetCurrent().AddTimer(TimeoutSeconds, WaitState);
+		}
+
+		//  Returns nullptr if the wait timed out
+		inline std::unique_ptr<MessageType> await_resume()
+		{
+			if (WaitState->Timer != INVALID_TIMER_HANDLE) AsyncScheduler::GetCurrent().CancelTimer(*WaitState);
+			if (Inbox.Waiter == WaitState) Inbox.Waiter = nullptr;
+			if (Inbox.Messages.empty()) return nullptr;
+			auto message = std::move(Inbox.Messages.front());
+			Inbox.Messages.pop_front();
+			return message;
+		}
+	};
+
+	~AsyncInbox() { if (Waiter != nullptr) Waiter->Fired = true; }
+
+	inline size_t GetCount() const { return Messages.size(); }
+	inline void Clear() { Messages.clear(); }
+
+	//  A negative timeout waits for as long as it takes
+	inline ReceiveAwaiter Receive(double timeoutSeconds = -1.0) { return ReceiveAwaiter(*this, timeoutSeconds); }
+
+	void Deliver(std::unique_ptr<MessageType> message)
+	{
+		Messages.push_back(std::move(message));
+		if (Waiter == nullptr) return;
+		auto waiter = Waiter;
+		Waiter = nullptr;
+		waiter->Resume();
+	}
+};
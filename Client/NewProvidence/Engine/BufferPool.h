@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <assert.h>
+
+//  Buffer Pool: size-classed memory for the things a connection makes and throws away with every message (message buffers,
+//  send queue blocks, transport messages, coroutine wait states). Sizes are rounded up to a power of two, and a freed block
+//  goes on its thread's free list for that size rather than back to the heap, so once a connection has seen its usual
+//  message sizes it stops allocating altogether.
+//  - Each thread keeps its own free lists, so there's no locking. A block freed on another thread joins that thread's lists.
+//  - Each size keeps at most BUFFER_POOL_RETAIN_BYTES (or BUFFER_POOL_RETAIN_MIN blocks) spare, and the rest go back to the heap
+//  - Sizes above BUFFER_POOL_MAX_SIZE aren't pooled at all
+//  - PoolAllocator<T> puts standard containers and allocate_shared on the pool
+
+constexpr int BUFFER_POOL_MIN_SHIFT			= 5;					//  32 bytes, enough to hold a free list link
+constexpr int BUFFER_POOL_MAX_SHIFT			= 24;					//  16 MB, the largest frame a connection can receive
+constexpr size_t BUFFER_POOL_MAX_SIZE		= size_t(1) << BUFFER_POOL_MAX_SHIFT;
+constexpr int BUFFER_POOL_CLASS_COUNT		= BUFFER_POOL_MAX_SHIFT - BUFFER_POOL_MIN_SHIFT + 1;
+constexpr size_t BUFFER_POOL_RETAIN_BYTES	= 1024 * 1024;
+constexpr int BUFFER_POOL_RETAIN_MIN		= 4;
+
+class BufferPool
+{
+private:
+	struct FreeBlock { FreeBlock* Next; };
+
+	struct ThreadCache
+	{
+		FreeBlock* FreeLists[BUFFER_POOL_CLASS_COUNT] = {};
+		int FreeCounts[BUFFER_POOL_CLASS_COUNT] = {};
+		~ThreadCache();
+	};
+
+	static thread_local ThreadCache Cache;
+
+	//  Trivially destructible, so it can still be read once the cache itself has been destroyed at thread exit
+	static thread_local bool CacheClosed;
+
+	static std::atomic<uint64_t> HeapAllocations;
+	static std::atomic<uint64_t> PoolAllocations;
+
+	static inline int GetSizeClass(size_t size)
+	{
+		auto sizeClass = 0;
+		while ((size_t(1) << (sizeClass + BUFFER_POOL_MIN_SHIFT)) < size) ++sizeClass;
+		return sizeClass;
+	}
+	static inline size_t GetClassSize(int sizeClass) { return size_t(1) << (sizeClass + BUFFER_POOL_MIN_SHIFT); }
+	static inline int GetRetainCount(int sizeClass) { return std::max<int>(BUFFER_POOL_RETAIN_MIN, int(BUFFER_POOL_RETAIN_BYTES / GetClassSize(sizeClass))); }
+
+	static char* AllocateFromHeap(size_t size);
+	static void ReleaseToHeap(void* data, size_t size);
+
+public:
+	//  The size a request will really be given, which callers can use in full
+	static inline size_t GetCapacity(size_t size) { return (size > BUFFER_POOL_MAX_SIZE) ? size : GetClassSize(GetSizeClass(size)); }
+
+	//  Hands back a block of at least the given size. Release it with the same size, or with the capacity it was given.
+	static void* Allocate(size_t size);
+	static void Release(void* data, size_t size);
+
+	//  How many requests reached the heap, and how many were met from a free list, across every thread
+	static inline uint64_t GetHeapAllocations() { return HeapAllocations.load(std::memory_order_relaxed); }
+	static inline uint64_t GetPoolAllocations() { return PoolAllocations.load(std::memory_order_relaxed); }
+};
+
+inline thread_local BufferPool::ThreadCache BufferPool::Cache;
+inline thread_local bool BufferPool::CacheClosed = false;
+inline std::atomic<uint64_t> BufferPool::HeapAllocations(0);
+inline std::atomic<uint64_t> BufferPool::PoolAllocations(0);
+
+
+inline BufferPool::ThreadCache::~ThreadCache()
+{
+	CacheClosed = true;
+	for (auto sizeClass = 0; sizeClass < BUFFER_POOL_CLASS_COUNT; ++sizeClass)
+	{
+		while (FreeLists[sizeClass] != nullptr)
+		{
+			auto block = FreeLists[sizeClass];
+			FreeLists[sizeClass] = block->Next;
+			ReleaseToHeap(block, GetClassSize(sizeClass));
+		}
+		FreeCounts[sizeClass] = 0;
+	}
+}
+
+
+inline void* BufferPool::Allocate(size_t size)
+{
+	if ((size > BUFFER_POOL_MAX_SIZE) || CacheClosed) return AllocateFromHeap(GetCapacity(size));
+
+	auto sizeClass = GetSizeClass(size);
+	auto block = Cache.FreeLists[sizeClass];
+	if (block == nullptr) return AllocateFromHeap(GetClassSize(sizeClass));
+
+	Cache.FreeLists[sizeClass] = block->Next;
+	--Cache.FreeCounts[sizeClass];
+	PoolAllocations.fetch_add(1, std::memory_order_relaxed);
+	return block;
+}
+
+
+inline void BufferPool::Release(void* data, size_t size)
+{
+	if (data == nullptr) return;
+	if ((size > BUFFER_POOL_MAX_SIZE) || CacheClosed) { ReleaseToHeap(data, GetCapacity(size)); return; }
+
+	auto sizeClass = GetSizeClass(size);
+	if (Cache.FreeCounts[sizeClass] >= GetRetainCount(sizeClass)) { ReleaseToHeap(data, GetClassSize(sizeClass)); return; }
+
+	auto block = static_cast<FreeBlock*>(data);
+	block->Next = Cache.FreeLists[sizeClass];
+	Cache.FreeLists[sizeClass] = block;
+	++Cache.FreeCounts[sizeClass];
+}
+
+
+inline char* BufferPool::AllocateFromHeap(size_t size)
+{
+	HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	MANAGE_MEMORY_NEW("BufferPool", size);
+	return static_cast<char*>(::operator new(size));
+}
+
+
+inline void BufferPool::ReleaseToHeap(void* data, size_t size)
+{
+	MANAGE_MEMORY_DELETE("BufferPool", size);
+	::operator delete(data);
+}
+
+
+//  A standard allocator over the buffer pool, for containers that come and go with every message
+template <typename ValueType>
+struct PoolAllocator
+{
+	typedef ValueType value_type;
+
+	PoolAllocator() noexcept {}
+	template <typename OtherType> PoolAllocator(const PoolAllocator<OtherType>&) noexcept {}
+
+	inline ValueType* allocate(size_t count) { return static_cast<ValueType*>(BufferPool::Allocate(count * sizeof(ValueType))); }
+	inline void deallocate(ValueType* data, size_t count) noexcept { BufferPool::Release(data, count * sizeof(ValueType)); }
+
+	template <typename OtherType> inline bool operator==(const PoolAllocator<OtherType>&) const noexcept { return true; }
+	template <typename OtherType> inline bool operator!=(const PoolAllocator<OtherType>&) const noexcept { return false; }
+};
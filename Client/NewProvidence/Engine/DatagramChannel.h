@@ -0,0 +1,207 @@
+#pragma once
+
+#include "WinsockWrapper.h"
+#include "MessageTransport.h"
+#include "SimpleSHA256.h"
+
+#include <random>
+#include <memory>
+#include <unordered_map>
+
+//  Datagram Channel: a UDP socket that carries messages for sessions set up over a TCP connection. The TCP side hands each
+//  session a random ID and key, and every datagram starts with its session's ID and a tag made from the key, so a datagram
+//  is only taken if it came from someone who was given the key. The message itself is sent as it is (anything private in it
+//  is already encrypted), and is never framed: one datagram is one message, and it either arrives whole or not at all.
+//
+//  Datagram layout:
+//    (8 bytes)   session ID
+//    (8 bytes)   tag: the start of SHA256(key, session ID, message, key)
+//    (the rest)  message, starting with its message ID
+
+constexpr auto DATAGRAM_SESSION_KEY_SIZE		= 32;
+constexpr auto DATAGRAM_TAG_SIZE				= 8;
+constexpr auto DATAGRAM_HEADER_SIZE				= (8 + DATAGRAM_TAG_SIZE);
+constexpr auto DATAGRAM_MAX_SIZE				= 1400;		//  Bytes, to stay under the MTU of any path with a tunnel or two on it
+constexpr auto DATAGRAMS_PER_RECEIVE			= 256;		//  Datagrams read in a pass, at most, before the rest wait for the next
+constexpr auto DATAGRAM_SOCKET_BUFFER_SIZE		= 4 * 1024 * 1024;	//  Bytes, so a burst isn't dropped while the loop is busy with something else
+
+
+//  One end's view of a session. The peer's address is known from the start on the client (it's the server's), and learned
+//  from the client's hellos on the server. Established is set once datagrams are known to get through in both directions.
+//  Each hello carries a sequence number under its tag, and the server only moves the peer to where a hello came from if its
+//  number is higher than any before it, so a hello copied off the wire and sent on from somewhere else is ignored.
+struct DatagramSession
+{
+	uint64_t		SessionID = 0;
+	unsigned char	Key[DATAGRAM_SESSION_KEY_SIZE] = {};
+	uint64_t		OwnerID = 0;
+	std::string		PeerIP;
+	int				PeerPort = 0;
+	bool			Established = false;
+	uint64_t		HelloSequence = 0;	//  The last hello sent, on the client, and the last taken, on the server
+
+	inline bool GetPeerKnown() const { return (PeerPort != 0); }
+
+	//  On the server, moves the peer to where a hello came from, if the hello is newer than any taken before. Returns whether it was.
+	inline bool TakeHello(uint64_t helloSequence, const std::string& senderIP, int senderPort)
+	{
+		if (helloSequence <= HelloSequence) return false;
+		HelloSequence = helloSequence;
+		PeerIP = senderIP;
+		PeerPort = senderPort;
+		return true;
+	}
+
+	//  A new session with a random ID and key, for the TCP side to hand to the other end
+	static std::shared_ptr<DatagramSession> Create(uint64_t ownerID)
+	{
+		std::random_device randomDevice;
+		std::mt19937_64 generator((uint64_t(randomDevice()) << 32) ^ uint64_t(randomDevice()));
+		auto session = std::make_shared<DatagramSession>();
+		session->SessionID = generator();
+		for (auto& keyByte : session->Key) keyByte = (unsigned char)(generator());
+		session->OwnerID = ownerID;
+		return session;
+	}
+};
+
+
+class DatagramEndpoint
+{
+private:
+	WinsockWrapper& Network;
+	int SocketID;
+	int Port;
+	std::unordered_map<uint64_t, std::shared_ptr<DatagramSession>> Sessions;
+	SocketBuffer SendBuffer;
+	SocketBuffer ReceiveBuffer;
+	uint64_t DatagramsRejected;
+
+	static void MakeTag(const DatagramSession& session, const char* message, int messageSize, unsigned char* tag)
+	{
+		unsigned char sessionBytes[8];
+		for (auto i = 0; i < 8; ++i) sessionBytes[i] = (unsigned char)(session.SessionID >> (8 * i));
+
+		SHA256 hasher;
+		hasher.update(session.Key, DATAGRAM_SESSION_KEY_SIZE);
+		hasher.update(sessionBytes, 8);
+		hasher.update((const unsigned char*)(message), size_t(messageSize));
+		hasher.update(session.Key, DATAGRAM_SESSION_KEY_SIZE);
+		unsigned char digest[SHA256::DIGEST_SIZE];
+		hasher.final(digest);
+		memcpy(tag, digest, DATAGRAM_TAG_SIZE);
+	}
+
+	//  Compares every byte, however early a mismatch is, so the time taken says nothing about the tag
+	static bool GetTagMatches(const unsigned char* expected, const unsigned char* received)
+	{
+		unsigned char difference = 0;
+		for (auto i = 0; i < DATAGRAM_TAG_SIZE; ++i) difference |= (unsigned char)(expected[i] ^ received[i]);
+		return (difference == 0);
+	}
+
+public:
+	explicit DatagramEndpoint(WinsockWrapper& network) : Network(network), SocketID(-1), Port(0), DatagramsRejected(0) {}
+	~DatagramEndpoint() { Close(); }
+
+	DatagramEndpoint(const DatagramEndpoint&) = delete;
+	DatagramEndpoint& operator=(const DatagramEndpoint&) = delete;
+
+	inline bool GetOpen() const { return (SocketID >= 0); }
+	inline int GetPort() const { return Port; }
+	inline uint64_t GetDatagramsRejected() const { return DatagramsRejected; }
+
+	//  Binds a non-blocking UDP socket to the port (0 for any free one). Returns false if the port can't be had.
+	bool Open(int port)
+	{
+		if (GetOpen()) return true;
+		SocketID = Network.UDPConnect(port, 1);
+		Port = port;
+		if (!GetOpen()) return false;
+
+		//  Nothing holds a datagram sender back when the receiver falls behind, so what arrives has to wait in the socket
+		Network.SetBufferSizes(SocketID, DATAGRAM_SOCKET_BUFFER_SIZE, DATAGRAM_SOCKET_BUFFER_SIZE);
+		return true;
+	}
+
+	void Close()
+	{
+		if (!GetOpen()) return;
+		Network.CloseSocket(SocketID);
+		SocketID = -1;
+		Sessions.clear();
+	}
+
+	inline void AddSession(const std::shared_ptr<DatagramSession>& session) { Sessions[session->SessionID] = session; }
+	inline void RemoveSession(uint64_t sessionID) { Sessions.erase(sessionID); }
+
+	//  Sends a message (starting with its message ID) to the session's peer. A datagram that can't be sent is as good as lost,
+	//  so only a full socket buffer is reported, for the sender to try again shortly.
+	TransportSendResult Send(const DatagramSession& session, const SocketBuffer& message)
+	{
+		if (!GetOpen() || !session.GetPeerKnown()) return TRANSPORT_SENT;
+		assert(message.m_BufferUtilizedCount + DATAGRAM_HEADER_SIZE <= DATAGRAM_MAX_SIZE);
+
+		unsigned char tag[DATAGRAM_TAG_SIZE];
+		MakeTag(session, message.m_BufferData, message.m_BufferUtilizedCount, tag);
+		SendBuffer.clear();
+		SendBuffer.writelint(session.SessionID);
+		SendBuffer.writechars((const char*)(tag), DATAGRAM_TAG_SIZE);
+		SendBuffer.writechars(message.m_BufferData, message.m_BufferUtilizedCount);
+
+		auto result = Network.SendMessageBuffer(SocketID, session.PeerIP.c_str(), session.PeerPort, &SendBuffer);
+		return (result == -WSAEWOULDBLOCK) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_SENT;
+	}
+
+	//  Reads what's arrived, and hands each good datagram's message to the callback along with its session and where it came
+	//  from: callback(DatagramSession&, std::unique_ptr<TransportMessage>, const std::string& senderIP, int senderPort).
+	//  Anything for a session we don't have, or with a tag that doesn't match, is dropped. Returns the messages handed over.
+	template <typename Callback>
+	int ReceiveAll(Callback&& callback)
+	{
+		if (!GetOpen()) return 0;
+
+		auto received = 0;
+		std::string senderIP;
+		auto senderPort = 0;
+		for (auto i = 0; i < DATAGRAMS_PER_RECEIVE; ++i)
+		{
+			if (Network.ReceiveDatagram(SocketID, &ReceiveBuffer, senderIP, senderPort) < 0) break;
+			if (ReceiveBuffer.m_BufferUtilizedCount <= DATAGRAM_HEADER_SIZE) { ++DatagramsRejected; continue; }
+
+			auto sessionID = ReceiveBuffer.readlint();
+			auto sessionIter = Sessions.find(sessionID);
+			if (sessionIter == Sessions.end()) { ++DatagramsRejected; continue; }
+			auto session = (*sessionIter).second;
+
+			unsigned char tag[DATAGRAM_TAG_SIZE];
+			MakeTag(*session, ReceiveBuffer.m_BufferData + DATAGRAM_HEADER_SIZE, ReceiveBuffer.m_BufferUtilizedCount - DATAGRAM_HEADER_SIZE, tag);
+			if (!GetTagMatches(tag, (const unsigned char*)(ReceiveBuffer.m_BufferData + 8))) { ++DatagramsRejected; continue; }
+
+			//  The message takes the receive buffer over, and reads on from just after its ID
+			ReceiveBuffer.m_ReadPosition = DATAGRAM_HEADER_SIZE;
+			auto messageID = (unsigned char)(ReceiveBuffer.readchar());
+			callback(*session, TransportMessage::Take(messageID, ReceiveBuffer), senderIP, senderPort);
+			++received;
+		}
+		return received;
+	}
+};
+
+
+//  Sends a transfer's messages to a session's peer over its endpoint. The endpoint must outlive the transport.
+class DatagramTransport : public MessageTransport
+{
+private:
+	DatagramEndpoint& Endpoint;
+	std::shared_ptr<DatagramSession> Session;
+
+public:
+	DatagramTransport(DatagramEndpoint& endpoint, std::shared_ptr<DatagramSession> session, std::shared_ptr<RttEstimator> rtt = nullptr) :
+		MessageTransport(rtt),
+		Endpoint(endpoint),
+		Session(session)
+	{}
+
+	TransportSendResult SendMessagePacket(SocketBuffer& message) override { return Endpoint.Send(*Session, message); }
+};
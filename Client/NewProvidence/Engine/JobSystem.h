@@ -0,0 +1,343 @@
+#pragma once
+
+#include "LockFreeQueue.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+//  Job System: runs work on a pool of worker threads (one per core, leaving one for the main thread).
+//  Each worker owns a deque per priority. Workers pop from the back of their own deques and steal from the front of
+//  other workers' deques when they run dry, so a burst of jobs spreads itself across the pool.
+//  Completion callbacks never run on a worker: they're queued back to the thread that submitted the job, and run inside that
+//  thread's ProcessCompletedJobs(). PrimaryLoop calls it once per frame for the main thread, and the network thread does the same.
+//  Jobs submitted by a worker while running a job complete on the thread that submitted the outer job.
+
+enum JobPriority
+{
+	JOB_PRIORITY_HIGH = 0,
+	JOB_PRIORITY_NORMAL,
+	JOB_PRIORITY_LOW,
+	JOB_PRIORITY_COUNT
+};
+
+typedef uint64_t JobHandle;
+constexpr JobHandle INVALID_JOB_HANDLE = 0;
+
+class JobSystem
+{
+private:
+	struct CompletionQueue;
+
+	struct Job
+	{
+		JobHandle Handle;
+		JobPriority Priority;
+		std::function<void()> Work;
+		std::function<void()> OnComplete;
+		CompletionQueue* Completions;
+
+		int PendingDependencies;				//  Guarded by JobListMutex
+		std::vector<Job*> Dependents;			//  Guarded by JobListMutex
+		bool Finished;							//  Guarded by JobListMutex
+	};
+
+	//  Finished jobs waiting for their submitting thread to run the completion callback
+	struct CompletionQueue
+	{
+		MPSCQueue<Job*> Jobs;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex QueueMutex;
+		std::deque<Job*> Jobs[JOB_PRIORITY_COUNT];
+	};
+
+	JobSystem();
+	~JobSystem();
+
+	std::vector<std::thread> Workers;
+	std::vector<WorkerQueue*> WorkerQueues;
+	std::atomic<bool> ShuttingDown;
+
+	std::mutex JobListMutex;
+	std::unordered_map<JobHandle, Job*> JobList;
+	JobHandle NextHandle;
+
+	std::mutex SleepMutex;
+	std::condition_variable SleepCondition;
+	std::atomic<int> QueuedJobCount;
+	std::atomic<unsigned int> NextQueueIndex;
+
+	std::mutex CompletionQueueMutex;
+	std::unordered_map<std::thread::id, CompletionQueue*> CompletionQueues;
+
+	static thread_local int CurrentWorkerIndex;
+	static thread_local CompletionQueue* CurrentCompletionQueue;
+
+	CompletionQueue* GetCompletionQueue();
+
+	void WorkerLoop(int workerIndex);
+	void Schedule(Job* job);
+	Job* FindJob(int workerIndex);
+	void RunJob(Job* job);
+
+public:
+	static JobSystem& GetInstance() { static JobSystem INSTANCE; return INSTANCE; }
+
+	JobHandle Submit(const std::function<void()>& work, const std::function<void()>& onComplete = nullptr, JobPriority priority = JOB_PRIORITY_NORMAL, const std::vector<JobHandle>& dependencies = {});
+	bool GetJobFinished(JobHandle handle);
+	void WaitForJob(JobHandle handle);
+	void ProcessCompletedJobs();
+	void Shutdown();
+
+	inline int GetWorkerCount() const { return int(Workers.size()); }
+	inline int GetQueuedJobCount() const { return QueuedJobCount; }
+};
+
+inline thread_local int JobSystem::CurrentWorkerIndex = -1;
+inline thread_local JobSystem::CompletionQueue* JobSystem::CurrentCompletionQueue = nullptr;
+
+
+inline JobSystem::JobSystem() :
+	ShuttingDown(false),
+	NextHandle(INVALID_JOB_HANDLE + 1),
+	QueuedJobCount(0),
+	NextQueueIndex(0)
+{
+	auto workerCount = std::max<int>(int(std::thread::hardware_concurrency()) - 1, 1);
+	for (auto i = 0; i < workerCount; ++i) WorkerQueues.push_back(new WorkerQueue);
+	for (auto i = 0; i < workerCount; ++i) Workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+}
+
+inline JobSystem::~JobSystem()
+{
+	Shutdown();
+
+	for (auto queue : CompletionQueues) delete queue.second;
+	CompletionQueues.clear();
+}
+
+
+inline JobSystem::CompletionQueue* JobSystem::GetCompletionQueue()
+{
+	//  A worker hands back to whoever submitted the job it's running. Anyone else gets a queue of their own the first time they ask.
+	if (CurrentCompletionQueue != nullptr) return CurrentCompletionQueue;
+
+	std::lock_guard<std::mutex> lock(CompletionQueueMutex);
+	auto& queue = CompletionQueues[std::this_thread::get_id()];
+	if (queue == nullptr) queue = new CompletionQueue;
+	CurrentCompletionQueue = queue;
+	return queue;
+}
+
+
+inline JobHandle JobSystem::Submit(const std::function<void()>& work, const std::function<void()>& onComplete, JobPriority priority, const std::vector<JobHandle>& dependencies)
+{
+	auto job = new Job;
+	job->Work = work;
+	job->OnComplete = onComplete;
+	job->Completions = GetCompletionQueue();
+	job->Priority = priority;
+	job->PendingDependencies = 0;
+	job->Finished = false;
+
+	{
+		std::lock_guard<std::mutex> lock(JobListMutex);
+		job->Handle = NextHandle++;
+		JobList[job->Handle] = job;
+
+		//  Hook the job onto any dependency that hasn't finished yet. Handles no longer in the list finished long ago.
+		for (auto dependency : dependencies)
+		{
+			auto dependencyIter = JobList.find(dependency);
+			if (dependencyIter == JobList.end() || (*dependencyIter).second->Finished) continue;
+			(*dependencyIter).second->Dependents.push_back(job);
+			++job->PendingDependencies;
+		}
+
+		if (job->PendingDependencies > 0) return job->Handle;
+	}
+
+	Schedule(job);
+	return job->Handle;
+}
+
+
+inline void JobSystem::Schedule(Job* job)
+{
+	//  After shutdown there's no one left to hand the job to, so it runs right here
+	if (WorkerQueues.empty()) { ++QueuedJobCount; RunJob(job); return; }
+
+	//  Workers keep jobs they spawn on their own deque, while jobs from other threads are dealt out round-robin
+	auto queueIndex = (CurrentWorkerIndex >= 0) ? CurrentWorkerIndex : int(NextQueueIndex++ % WorkerQueues.size());
+	{
+		std::lock_guard<std::mutex> lock(WorkerQueues[queueIndex]->QueueMutex);
+		WorkerQueues[queueIndex]->Jobs[job->Priority].push_back(job);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(SleepMutex);
+		++QueuedJobCount;
+	}
+	SleepCondition.notify_one();
+}
+
+
+inline JobSystem::Job* JobSystem::FindJob(int workerIndex)
+{
+	//  Highest priority first. Within a priority, our own newest job, then the oldest job of any other worker.
+	auto queueCount = int(WorkerQueues.size());
+	for (auto priority = 0; priority < JOB_PRIORITY_COUNT; ++priority)
+	{
+		if (workerIndex >= 0)
+		{
+			auto ownQueue = WorkerQueues[workerIndex];
+			std::lock_guard<std::mutex> lock(ownQueue->QueueMutex);
+			if (!ownQueue->Jobs[priority].empty())
+			{
+				auto job = ownQueue->Jobs[priority].back();
+				ownQueue->Jobs[priority].pop_back();
+				return job;
+			}
+		}
+
+		for (auto i = 1; i <= queueCount; ++i)
+		{
+			auto victimIndex = (std::max<int>(workerIndex, 0) + i) % queueCount;
+			if (victimIndex == workerIndex) continue;
+
+			auto victimQueue = WorkerQueues[victimIndex];
+			std::lock_guard<std::mutex> lock(victimQueue->QueueMutex);
+			if (victimQueue->Jobs[priority].empty()) continue;
+			auto job = victimQueue->Jobs[priority].front();
+			victimQueue->Jobs[priority].pop_front();
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+
+inline void JobSystem::RunJob(Job* job)
+{
+	--QueuedJobCount;
+
+	//  Anything the work submits completes on the same thread this job does. Saved and restored, as WaitForJob() can nest jobs.
+	auto outerCompletionQueue = CurrentCompletionQueue;
+	CurrentCompletionQueue = job->Completions;
+	if (job->Work != nullptr) job->Work();
+	CurrentCompletionQueue = outerCompletionQueue;
+
+	//  Release anything that was waiting on this job, keeping it on this worker's deque while the data is warm
+	std::vector<Job*> readyJobs;
+	{
+		std::lock_guard<std::mutex> lock(JobListMutex);
+		job->Finished = true;
+		for (auto dependent : job->Dependents)
+			if (--dependent->PendingDependencies == 0) readyJobs.push_back(dependent);
+		job->Dependents.clear();
+	}
+	for (auto readyJob : readyJobs) Schedule(readyJob);
+
+	job->Completions->Jobs.Push(job);
+}
+
+
+inline void JobSystem::WorkerLoop(int workerIndex)
+{
+	CurrentWorkerIndex = workerIndex;
+
+	while (true)
+	{
+		auto job = FindJob(workerIndex);
+		if (job != nullptr) { RunJob(job); continue; }
+
+		std::unique_lock<std::mutex> lock(SleepMutex);
+		SleepCondition.wait(lock, [this]() { return ShuttingDown || (QueuedJobCount > 0); });
+		if (ShuttingDown && (QueuedJobCount <= 0)) return;
+	}
+}
+
+
+inline bool JobSystem::GetJobFinished(JobHandle handle)
+{
+	std::lock_guard<std::mutex> lock(JobListMutex);
+	auto jobIter = JobList.find(handle);
+	return (jobIter == JobList.end()) || (*jobIter).second->Finished;
+}
+
+
+inline void JobSystem::WaitForJob(JobHandle handle)
+{
+	//  Rather than block, the waiting thread helps out by running queued jobs until the one it needs is done
+	while (!GetJobFinished(handle))
+	{
+		auto job = FindJob(CurrentWorkerIndex);
+		if (job != nullptr) RunJob(job);
+		else std::this_thread::yield();
+	}
+}
+
+
+inline void JobSystem::ProcessCompletedJobs()
+{
+	//  Only this thread's own completions. Jobs submitted from elsewhere are left for their own thread to pick up.
+	auto completionQueue = GetCompletionQueue();
+	std::vector<Job*> completedJobs;
+	Job* completedJob = nullptr;
+	while (completionQueue->Jobs.TryPop(completedJob)) completedJobs.push_back(completedJob);
+	if (completedJobs.empty()) return;
+
+	//  Drop the finished jobs from the handle list first, so callbacks are free to submit new work
+	{
+		std::lock_guard<std::mutex> lock(JobListMutex);
+		for (auto job : completedJobs) JobList.erase(job->Handle);
+	}
+
+	for (auto job : completedJobs)
+	{
+		if (job->OnComplete != nullptr) job->OnComplete();
+		delete job;
+	}
+}
+
+
+inline void JobSystem::Shutdown()
+{
+	if (Workers.empty()) return;
+
+	//  Workers drain whatever is still queued before they exit
+	{
+		std::lock_guard<std::mutex> lock(SleepMutex);
+		ShuttingDown = true;
+	}
+	SleepCondition.notify_all();
+	for (auto& worker : Workers) if (worker.joinable()) worker.join();
+	Workers.clear();
+
+	for (auto queue : WorkerQueues) delete queue;
+	WorkerQueues.clear();
+
+	//  Every job is still in the handle list until its completion has been processed, so the queues only need emptying
+	{
+		std::lock_guard<std::mutex> lock(CompletionQueueMutex);
+		Job* completedJob = nullptr;
+		for (auto queue : CompletionQueues) while (queue.second->Jobs.TryPop(completedJob)) {}
+	}
+
+	std::lock_guard<std::mutex> lock(JobListMutex);
+	for (auto job : JobList) delete job.second;
+	JobList.clear();
+}
+
+//  Instance to be utilized by anyone including this header
+JobSystem& jobSystem = JobSystem::GetInstance();
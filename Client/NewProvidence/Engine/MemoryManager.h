@@ -11,6 +11,7 @@
 
 #include <map>
 #include <fstream>
+#include <mutex>
 
 class MemoryManager
 {
@@ -33,10 +34,14 @@ private:
 
 	std::map<std::string, int> m_MemoryPoolList;
 	int m_TotalMemoryUsed;
+
+	//  Sockets and their buffers are created and destroyed on the network thread as well as the main thread
+	std::mutex m_MemoryPoolMutex;
 };
 
 inline void MemoryManager::ManageMemoryNew(std::string poolType, size_t amount)
 {
+	std::lock_guard<std::mutex> lock(m_MemoryPoolMutex);
 	if (m_MemoryPoolList.find(poolType) == m_MemoryPoolList.end()) m_MemoryPoolList[poolType] = 0;
 	m_MemoryPoolList[poolType] += int(amount);
 	m_TotalMemoryUsed += int(amount);
@@ -44,6 +49,7 @@ inline void MemoryManager::ManageMemoryNew(std::string poolType, size_t amount)
 
 inline void MemoryManager::ManageMemoryDelete(std::string poolType, size_t amount)
 {
+	std::lock_guard<std::mutex> lock(m_MemoryPoolMutex);
 	if (m_MemoryPoolList.find(poolType) == m_MemoryPoolList.end()) m_MemoryPoolList[poolType] = 0;
 	m_MemoryPoolList[poolType] -= int(amount);
 	if (m_MemoryPoolList[poolType] < 0 && m_MemoryPoolList[poolType] >= -int(amount)) printf("MemoryManager has gone negative on the %s pool.\n", poolType.c_str());
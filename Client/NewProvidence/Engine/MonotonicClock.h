@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+//  Monotonic Clock: the one time source for protocol timing (pings, idle disconnects, transfer reminders and the like).
+//  It counts up from the first time it's read, never goes backwards, and doesn't jump when the system clock is changed.
+//  Unlike clock() it measures real time rather than the process's CPU time, and unlike the frame-derived gameSeconds
+//  it's safe to read from any thread, and is just as accurate on a thread that has no frames.
+class MonotonicClock
+{
+private:
+	static inline std::chrono::steady_clock::time_point GetStartTime() { static const auto START_TIME = std::chrono::steady_clock::now(); return START_TIME; }
+
+public:
+	//  Seconds since the clock started, for measuring and comparing times
+	static inline double GetSeconds() { auto startTime = GetStartTime(); return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(); }
+
+	//  Whole milliseconds since the clock started, the tick the timer wheels run on
+	static inline uint64_t GetMilliseconds() { auto startTime = GetStartTime(); return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count()); }
+
+	//  The first millisecond tick at or after the given time from now, so a timer armed for it never fires early by GetSeconds()
+	static inline uint64_t GetDeadlineMilliseconds(double secondsFromNow) { return uint64_t(std::ceil((GetSeconds() + std::max<double>(secondsFromNow, 0.0)) * 1000.0)); }
+};
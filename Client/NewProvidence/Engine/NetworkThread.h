@@ -0,0 +1,153 @@
+#pragma once
+
+#include "AsyncRuntime.h"
+#include "JobSystem.h"
+#include "EventManager.h"
+#include "LockFreeQueue.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <deque>
+#include <functional>
+
+//  Network Thread: runs socket reads, protocol handling and the coroutines behind them on a thread of their own, so a slow frame
+//  never holds up the network and a burst of messages never holds up a frame. Once it's started it owns the async scheduler.
+//  The two sides only ever talk through lock-free queues:
+//  - Post() hands a command to the network thread (the UI asking for something to be sent), from any thread
+//  - PostEvent() hands a typed event back to the main thread (a list changed, a transfer moved on), from the network thread,
+//    and DispatchEvents(), which PrimaryLoop calls once per frame, broadcasts them through the event manager. Events from any
+//    other thread (a server shard) are passed to the network thread first, so the event queue only ever has the one producer.
+
+constexpr size_t NETWORK_EVENT_QUEUE_SIZE = 1024;
+constexpr int NETWORK_THREAD_SLEEP_MS = 1;
+
+class NetworkThread
+{
+private:
+	NetworkThread() : Running(false), Events(NETWORK_EVENT_QUEUE_SIZE), Process(nullptr) {}
+	~NetworkThread() { Stop(); }
+
+	std::thread Thread;
+	std::atomic<bool> Running;
+
+	//  Events go out through the ring, and only spill into the overflow (which the network thread alone touches) if the
+	//  main thread falls a long way behind. Once anything has spilled, everything after it does too, so order is kept.
+	SPSCQueue<EventData*> Events;
+	std::deque<EventData*> OverflowEvents;
+
+	std::function<void()> Process;
+
+	static thread_local bool OnNetworkThread;
+
+	void ThreadLoop();
+	void FlushOverflowEvents();
+
+public:
+	static NetworkThread& GetInstance() { static NetworkThread INSTANCE; return INSTANCE; }
+
+	inline bool GetRunning() const { return Running; }
+	inline bool GetOnNetworkThread() const { return OnNetworkThread; }
+
+	//  The process function is called once per loop, after due coroutines and job completions have been run
+	void Start(const std::function<void()>& process);
+	void Stop();
+
+	inline void Post(const std::function<void()>& command) { asyncScheduler.PostFromAnyThread(command); }
+	void PostEvent(std::unique_ptr<EventData> eventData);
+	void DispatchEvents();
+};
+
+inline thread_local bool NetworkThread::OnNetworkThread = false;
+
+
+inline void NetworkThread::Start(const std::function<void()>& process)
+{
+	if (Running) return;
+
+	Process = process;
+	Running = true;
+	Thread = std::thread(&NetworkThread::ThreadLoop, this);
+}
+
+
+inline void NetworkThread::Stop()
+{
+	if (!Running) return;
+
+	Running = false;
+	if (Thread.joinable()) Thread.join();
+
+	//  Anything still waiting was sent as we shut down, with no one left to show it to, so it's dropped
+	EventData* eventData = nullptr;
+	while (Events.TryPop(eventData)) delete eventData;
+	for (auto overflowEvent : OverflowEvents) delete overflowEvent;
+	OverflowEvents.clear();
+}
+
+
+inline void NetworkThread::ThreadLoop()
+{
+	OnNetworkThread = true;
+
+	while (Running)
+	{
+		jobSystem.ProcessCompletedJobs();
+		asyncScheduler.Update();
+		if (Process != nullptr) Process();
+		FlushOverflowEvents();
+
+		//  Sockets are polled rather than waited on, so give the core back between passes
+		std::this_thread::sleep_for(std::chrono::milliseconds(NETWORK_THREAD_SLEEP_MS));
+	}
+
+	OnNetworkThread = false;
+}
+
+
+inline void NetworkThread::FlushOverflowEvents()
+{
+	while (!OverflowEvents.empty())
+	{
+		auto eventData = OverflowEvents.front();
+		if (!Events.TryPush(std::move(eventData))) return;
+		OverflowEvents.pop_front();
+	}
+}
+
+
+inline void NetworkThread::PostEvent(std::unique_ptr<EventData> eventData)
+{
+	auto rawEvent = eventData.release();
+	if (!OnNetworkThread)
+	{
+		//  Without a network thread, whoever is running the network code is the main thread, so the event can go out right away
+		if (!Running)
+		{
+			eventManager.BroadcastEvent(rawEvent);
+			delete rawEvent;
+			return;
+		}
+
+		Post([this, rawEvent]() { PostEvent(std::unique_ptr<EventData>(rawEvent)); });
+		return;
+	}
+
+	if (OverflowEvents.empty() && Events.TryPush(std::move(rawEvent))) return;
+	OverflowEvents.push_back(rawEvent);
+}
+
+
+inline void NetworkThread::DispatchEvents()
+{
+	EventData* eventData = nullptr;
+	while (Events.TryPop(eventData))
+	{
+		eventManager.BroadcastEvent(eventData);
+		delete eventData;
+	}
+}
+
+//  Instance to be utilized by anyone including this header
+NetworkThread& networkThread = NetworkThread::GetInstance();
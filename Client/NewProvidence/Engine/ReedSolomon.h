@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <assert.h>
+
+//  Reed-Solomon: a systematic erasure code over GF(256). A block of K equal-sized data shards gets M parity shards, and any
+//  M of the K + M can go missing and still be rebuilt from the rest, as long as we know which ones are missing (an erasure,
+//  rather than an error, which is what a lost datagram is). The parity is built from a Cauchy matrix, as every square
+//  submatrix of one can be inverted, so any mix of data and parity shards that adds up to K is enough to rebuild the block.
+//
+//  Parity shard j is the sum over the data shards i of C(j, i) * data[i], where C(j, i) = 1 / (X(j) + Y(i)), with Y(i) = i
+//  and X(j) = K + j (addition in GF(256) being XOR), so K + M can be at most 256.
+
+constexpr auto REED_SOLOMON_MAX_SHARDS = 256;
+
+class ReedSolomon
+{
+private:
+	struct Field
+	{
+		uint8_t Exp[512];
+		uint8_t Log[256];
+		uint8_t Multiply[256][256];
+
+		Field()
+		{
+			//  The field is built on the primitive polynomial x^8 + x^4 + x^3 + x^2 + 1, so 2 generates every non-zero element
+			auto x = 1;
+			for (auto i = 0; i < 255; ++i)
+			{
+				Exp[i] = uint8_t(x);
+				Log[x] = uint8_t(i);
+				x <<= 1;
+				if (x & 0x100) x ^= 0x11D;
+			}
+			for (auto i = 255; i < 512; ++i) Exp[i] = Exp[i - 255];
+			Log[0] = 0;
+
+			for (auto a = 0; a < 256; ++a)
+				for (auto b = 0; b < 256; ++b)
+					Multiply[a][b] = ((a == 0) || (b == 0)) ? 0 : Exp[Log[a] + Log[b]];
+		}
+	};
+
+	static const Field& GetField() { static const Field FIELD; return FIELD; }
+
+	static inline uint8_t Inverse(uint8_t a) { assert(a != 0); auto& field = GetField(); return field.Exp[255 - field.Log[a]]; }
+	static inline uint8_t Coefficient(int dataCount, int parityIndex, int dataIndex) { return Inverse(uint8_t((dataCount + parityIndex) ^ dataIndex)); }
+
+	//  destination += coefficient * source, a byte at a time from the coefficient's row of the multiplication table
+	static inline void MultiplyAdd(uint8_t* destination, const uint8_t* source, uint8_t coefficient, size_t size)
+	{
+		if (coefficient == 0) return;
+		auto row = GetField().Multiply[coefficient];
+		for (size_t i = 0; i < size; ++i) destination[i] ^= row[source[i]];
+	}
+
+public:
+	//  Builds the parity shards for a block of data shards, each of them shardSize bytes
+	static void Encode(const uint8_t* const* data, int dataCount, uint8_t* const* parity, int parityCount, size_t shardSize)
+	{
+		assert(dataCount + parityCount <= REED_SOLOMON_MAX_SHARDS);
+		for (auto j = 0; j < parityCount; ++j)
+		{
+			memset(parity[j], 0, shardSize);
+			for (auto i = 0; i < dataCount; ++i) MultiplyAdd(parity[j], data[i], Coefficient(dataCount, j, i), shardSize);
+		}
+	}
+
+	//  Rebuilds the missing data shards of a block in place, from the data shards that arrived and enough of the parity shards.
+	//  Returns false (leaving the data as it was) if fewer parity shards arrived than there are data shards missing.
+	static bool Repair(uint8_t* const* data, const std::vector<bool>& dataPresent, int dataCount, const uint8_t* const* parity, const std::vector<bool>& parityPresent, int parityCount, size_t shardSize)
+	{
+		assert(dataCount + parityCount <= REED_SOLOMON_MAX_SHARDS);
+		std::vector<int> missing;
+		std::vector<int> available;
+		for (auto i = 0; i < dataCount; ++i) if (!dataPresent[i]) missing.push_back(i);
+		if (missing.empty()) return true;
+		for (auto j = 0; (j < parityCount) && (available.size() < missing.size()); ++j) if (parityPresent[j]) available.push_back(j);
+		if (available.size() < missing.size()) return false;
+		auto count = int(missing.size());
+
+		//  Take what the data we have contributed out of each parity shard we're using, leaving only what the missing shards did
+		std::vector<uint8_t> remainders(size_t(count) * shardSize);
+		for (auto r = 0; r < count; ++r)
+		{
+			auto remainder = remainders.data() + (size_t(r) * shardSize);
+			memcpy(remainder, parity[available[r]], shardSize);
+			for (auto i = 0; i < dataCount; ++i)
+				if (dataPresent[i]) MultiplyAdd(remainder, data[i], Coefficient(dataCount, available[r], i), shardSize);
+		}
+
+		//  Invert the square of the Cauchy matrix linking the parity shards we're using to the missing data shards (Gauss-Jordan)
+		std::vector<uint8_t> matrix(size_t(count) * count);
+		std::vector<uint8_t> inverse(size_t(count) * count, 0);
+		for (auto r = 0; r < count; ++r)
+		{
+			for (auto c = 0; c < count; ++c) matrix[(r * count) + c] = Coefficient(dataCount, available[r], missing[c]);
+			inverse[(r * count) + r] = 1;
+		}
+		auto& field = GetField();
+		for (auto c = 0; c < count; ++c)
+		{
+			auto pivot = c;
+			while (matrix[(pivot * count) + c] == 0) ++pivot;
+			assert(pivot < count);
+			if (pivot != c)
+			{
+				for (auto k = 0; k < count; ++k)
+				{
+					std::swap(matrix[(pivot * count) + k], matrix[(c * count) + k]);
+					std::swap(inverse[(pivot * count) + k], inverse[(c * count) + k]);
+				}
+			}
+
+			auto scale = Inverse(matrix[(c * count) + c]);
+			for (auto k = 0; k < count; ++k)
+			{
+				matrix[(c * count) + k] = field.Multiply[scale][matrix[(c * count) + k]];
+				inverse[(c * count) + k] = field.Multiply[scale][inverse[(c * count) + k]];
+			}
+
+			for (auto r = 0; r < count; ++r)
+			{
+				auto factor = matrix[(r * count) + c];
+				if ((r == c) || (factor == 0)) continue;
+				for (auto k = 0; k < count; ++k)
+				{
+					matrix[(r * count) + k] ^= field.Multiply[factor][matrix[(c * count) + k]];
+					inverse[(r * count) + k] ^= field.Multiply[factor][inverse[(c * count) + k]];
+				}
+			}
+		}
+
+		//  Each missing shard is then a sum of the remainders, weighted by its row of the inverse
+		for (auto c = 0; c < count; ++c)
+		{
+			auto shard = data[missing[c]];
+			memset(shard, 0, shardSize);
+			for (auto r = 0; r < count; ++r) MultiplyAdd(shard, remainders.data() + (size_t(r) * shardSize), inverse[(c * count) + r], shardSize);
+		}
+		return true;
+	}
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "BufferPool.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+#include <assert.h>
+
+//  Send Queue: a connection's outgoing bytes, waiting for the socket to take them. Sending a message only adds its frame to
+//  the queue, and the queue is flushed once a network pass, so everything a pass sends to a connection goes out together.
+//  - Small frames are packed one after another into blocks, and each flush hands up to SEND_QUEUE_MAX_SPANS blocks to a
+//    single gathered write (writev, or WSASend on Windows), however many frames they hold
+//  - A write the socket only takes part of is picked up where it stopped on the next flush, so a frame is never cut short
+//  - Past SEND_QUEUE_HIGH_WATER queued bytes the queue asks its producers to wait, until it has drained to SEND_QUEUE_LOW_WATER
+//  - Blocks come from the buffer pool and go back to it once sent, so a steady stream of messages doesn't allocate
+//
+//  Channels. Every frame is queued on a channel, and each channel keeps its own blocks, so frames only keep their order
+//  within a channel. Each flush decides which channel's blocks go next:
+//  - The control channel (0) has strict priority. Its blocks go ahead of everything else, so a ping or a list request never
+//    waits behind a file transfer's chunks.
+//  - The other channels share what's left by weight (start-time fair queueing). Each has a virtual time, which moves on by
+//    the bytes it sends divided by its weight, and the channel furthest behind goes next. A channel that has been idle
+//    starts level with the others, rather than with a burst of credit.
+//  - Backpressure is kept per channel, so a transfer that has filled its own channel doesn't hold back one on another
+//  - Only a block the socket stopped partway through has to go first, as blocks always end on a frame boundary
+//
+//  The queue never touches the socket itself. Socket::flushsend() gathers its spans, writes them, and reports back what went.
+
+constexpr int SEND_QUEUE_BLOCK_SIZE			= 16 * 1024;	//  Frames up to this size are packed together, larger ones get a block of their own
+constexpr int SEND_QUEUE_MAX_SPANS			= 64;
+constexpr int SEND_QUEUE_HIGH_WATER			= 256 * 1024;	//  Per channel
+constexpr int SEND_QUEUE_LOW_WATER			= 64 * 1024;
+constexpr int SEND_QUEUE_CHANNEL_COUNT		= 8;
+constexpr int SEND_QUEUE_CONTROL_CHANNEL	= 0;
+constexpr int SEND_QUEUE_MAX_WEIGHT			= 256;
+
+//  A run of queued bytes, ready to be copied into a platform's gathered write
+struct SendSpan
+{
+	const char*	Data;
+	size_t		Length;
+};
+
+
+class SendQueue
+{
+private:
+	struct Block
+	{
+		char*	Data;
+		size_t	Capacity;
+		size_t	Size;
+		size_t	Sent;
+	};
+
+	struct Channel
+	{
+		std::deque<Block, PoolAllocator<Block>> Blocks;
+		size_t		QueuedBytes = 0;
+		uint64_t	VirtualTime = 0;
+		int			Weight = 1;
+		bool		Backpressure = false;
+	};
+
+	Channel Channels[SEND_QUEUE_CHANNEL_COUNT];
+
+	//  The channel of each span handed out by the last GatherSpans(), in order, for Advance() to match the write against
+	int GatheredChannels[SEND_QUEUE_MAX_SPANS];
+	int GatheredCount;
+
+	//  The channel whose front block the socket stopped partway through, if any, which has to be finished before anything else
+	int PartialChannel;
+
+	size_t	QueuedBytes;
+
+	size_t		PeakQueuedBytes;
+	uint64_t	FramesQueued;
+	uint64_t	BytesSent;
+	uint64_t	WriteCalls;
+	uint64_t	PartialWrites;
+
+	Block& GetBlockFor(Channel& channel, size_t frameSize);
+	void UpdateBackpressure(Channel& channel);
+	uint64_t GetVirtualCost(int channelIndex, size_t bytes) const { return uint64_t(bytes) * uint64_t(SEND_QUEUE_MAX_WEIGHT / Channels[channelIndex].Weight); }
+
+public:
+	SendQueue();
+	~SendQueue() { Clear(); }
+
+	SendQueue(const SendQueue&) = delete;
+	SendQueue& operator=(const SendQueue&) = delete;
+
+	//  Queues one frame, made up of two pieces written back to back (a header and a message, or a message and a separator)
+	void Push(const char* first, int firstSize, const char* second, int secondSize, int channel = SEND_QUEUE_CONTROL_CHANNEL);
+
+	//  Fills spans with unsent bytes in the order they should go, returning how many were filled. Only valid until the next
+	//  Push() or Advance().
+	int GatherSpans(SendSpan* spans, int maxSpans);
+
+	//  Records the result of a write of bytesSent bytes, taken from the front of the spans that were last gathered
+	void Advance(size_t bytesSent);
+
+	//  Throws away everything still queued, once the connection it was for has failed
+	void Clear();
+
+	//  How a channel shares the connection with the other bulk channels, from 1 to SEND_QUEUE_MAX_WEIGHT. A channel with twice
+	//  the weight of another sends twice the bytes while both have something queued. The control channel has no weight.
+	void SetChannelWeight(int channel, int weight);
+
+	inline bool GetEmpty() const { return (QueuedBytes == 0); }
+	inline size_t GetQueuedBytes() const { return QueuedBytes; }
+	inline size_t GetQueuedBytes(int channel) const { return Channels[channel].QueuedBytes; }
+	inline int GetQueuedBlocks() const { auto count = 0; for (auto& channel : Channels) count += int(channel.Blocks.size()); return count; }
+
+	//  Whether producers on a channel that can wait (file transfers) should hold off until it drains. Messages are still taken.
+	inline bool GetBackpressure(int channel = SEND_QUEUE_CONTROL_CHANNEL) const { return Channels[channel].Backpressure; }
+
+	inline size_t GetPeakQueuedBytes() const { return PeakQueuedBytes; }
+	inline uint64_t GetFramesQueued() const { return FramesQueued; }
+	inline uint64_t GetBytesSent() const { return BytesSent; }
+	inline uint64_t GetWriteCalls() const { return WriteCalls; }
+	inline uint64_t GetPartialWrites() const { return PartialWrites; }
+};
+
+
+inline SendQueue::SendQueue() :
+	GatheredCount(0),
+	PartialChannel(-1),
+	QueuedBytes(0),
+	PeakQueuedBytes(0),
+	FramesQueued(0),
+	BytesSent(0),
+	WriteCalls(0),
+	PartialWrites(0)
+{}
+
+
+inline SendQueue::Block& SendQueue::GetBlockFor(Channel& channel, size_t frameSize)
+{
+	//  Pack onto the last block if there's room, whether or not some of it has gone out already
+	if (!channel.Blocks.empty())
+	{
+		auto& lastBlock = channel.Blocks.back();
+		if (lastBlock.Size + frameSize <= lastBlock.Capacity) return lastBlock;
+	}
+
+	auto capacity = BufferPool::GetCapacity(std::max<size_t>(frameSize, SEND_QUEUE_BLOCK_SIZE));
+	channel.Blocks.push_back(Block{ static_cast<char*>(BufferPool::Allocate(capacity)), capacity, 0, 0 });
+	return channel.Blocks.back();
+}
+
+
+inline void SendQueue::Push(const char* first, int firstSize, const char* second, int secondSize, int channelIndex)
+{
+	assert((firstSize >= 0) && (secondSize >= 0));
+	assert((channelIndex >= 0) && (channelIndex < SEND_QUEUE_CHANNEL_COUNT));
+	auto frameSize = size_t(firstSize) + size_t(secondSize);
+	if (frameSize == 0) return;
+
+	auto& channel = Channels[channelIndex];
+	if ((channelIndex != SEND_QUEUE_CONTROL_CHANNEL) && (channel.QueuedBytes == 0))
+	{
+		//  A channel coming back from idle starts level with the busiest of the others, so it can't make up for lost time
+		for (auto i = 1; i < SEND_QUEUE_CHANNEL_COUNT; ++i)
+			if ((i != channelIndex) && (Channels[i].QueuedBytes != 0)) channel.VirtualTime = std::max(channel.VirtualTime, Channels[i].VirtualTime);
+	}
+
+	auto& block = GetBlockFor(channel, frameSize);
+	if (firstSize > 0) memcpy(block.Data + block.Size, first, size_t(firstSize));
+	if (secondSize > 0) memcpy(block.Data + block.Size + firstSize, second, size_t(secondSize));
+	block.Size += frameSize;
+
+	channel.QueuedBytes += frameSize;
+	QueuedBytes += frameSize;
+	PeakQueuedBytes = std::max(PeakQueuedBytes, QueuedBytes);
+	++FramesQueued;
+	UpdateBackpressure(channel);
+}
+
+
+inline int SendQueue::GatherSpans(SendSpan* spans, int maxSpans)
+{
+	maxSpans = std::min<int>(maxSpans, SEND_QUEUE_MAX_SPANS);
+	GatheredCount = 0;
+
+	//  How far into each channel's blocks the gather has got, and where each bulk channel's virtual time would be by then
+	size_t nextBlock[SEND_QUEUE_CHANNEL_COUNT] = {};
+	uint64_t virtualTimes[SEND_QUEUE_CHANNEL_COUNT];
+	for (auto i = 0; i < SEND_QUEUE_CHANNEL_COUNT; ++i) virtualTimes[i] = Channels[i].VirtualTime;
+
+	auto addBlock = [&](int channelIndex)
+	{
+		auto& block = Channels[channelIndex].Blocks[nextBlock[channelIndex]++];
+		spans[GatheredCount].Data = block.Data + block.Sent;
+		spans[GatheredCount].Length = block.Size - block.Sent;
+		GatheredChannels[GatheredCount++] = channelIndex;
+		if (channelIndex != SEND_QUEUE_CONTROL_CHANNEL) virtualTimes[channelIndex] += GetVirtualCost(channelIndex, block.Size - block.Sent);
+	};
+
+	//  A block the socket stopped partway through has to be finished first, or its last frame would be cut in two
+	if (PartialChannel >= 0) addBlock(PartialChannel);
+
+	auto& control = Channels[SEND_QUEUE_CONTROL_CHANNEL];
+	while ((GatheredCount < maxSpans) && (nextBlock[SEND_QUEUE_CONTROL_CHANNEL] < control.Blocks.size())) addBlock(SEND_QUEUE_CONTROL_CHANNEL);
+
+	while (GatheredCount < maxSpans)
+	{
+		auto chosenChannel = -1;
+		for (auto i = 1; i < SEND_QUEUE_CHANNEL_COUNT; ++i)
+		{
+			if (nextBlock[i] >= Channels[i].Blocks.size()) continue;
+			if ((chosenChannel < 0) || (virtualTimes[i] < virtualTimes[chosenChannel])) chosenChannel = i;
+		}
+		if (chosenChannel < 0) break;
+		addBlock(chosenChannel);
+	}
+
+	return GatheredCount;
+}
+
+
+inline void SendQueue::Advance(size_t bytesSent)
+{
+	assert(bytesSent <= QueuedBytes);
+	++WriteCalls;
+	BytesSent += uint64_t(bytesSent);
+	QueuedBytes -= bytesSent;
+
+	//  The write took the gathered spans in order, and each was the front block of its channel by the time it was reached
+	for (auto i = 0; (i < GatheredCount) && (bytesSent > 0); ++i)
+	{
+		auto channelIndex = GatheredChannels[i];
+		auto& channel = Channels[channelIndex];
+		auto& frontBlock = channel.Blocks.front();
+		auto unsent = frontBlock.Size - frontBlock.Sent;
+		auto taken = std::min(bytesSent, unsent);
+
+		bytesSent -= taken;
+		channel.QueuedBytes -= taken;
+		if (channelIndex != SEND_QUEUE_CONTROL_CHANNEL) channel.VirtualTime += GetVirtualCost(channelIndex, taken);
+
+		if (taken < unsent)
+		{
+			//  The socket stopped partway through this block, so the next flush starts from here
+			frontBlock.Sent += taken;
+			PartialChannel = channelIndex;
+			++PartialWrites;
+			UpdateBackpressure(channel);
+			break;
+		}
+
+		PartialChannel = -1;
+		BufferPool::Release(frontBlock.Data, frontBlock.Capacity);
+		channel.Blocks.pop_front();
+		UpdateBackpressure(channel);
+	}
+
+	assert(bytesSent == 0);
+	GatheredCount = 0;
+}
+
+
+inline void SendQueue::Clear()
+{
+	for (auto& channel : Channels)
+	{
+		for (auto& block : channel.Blocks) BufferPool::Release(block.Data, block.Capacity);
+		channel.Blocks.clear();
+		channel.QueuedBytes = 0;
+		channel.Backpressure = false;
+	}
+	QueuedBytes = 0;
+	GatheredCount = 0;
+	PartialChannel = -1;
+}
+
+
+inline void SendQueue::SetChannelWeight(int channel, int weight)
+{
+	assert((channel > SEND_QUEUE_CONTROL_CHANNEL) && (channel < SEND_QUEUE_CHANNEL_COUNT));
+	Channels[channel].Weight = std::clamp(weight, 1, SEND_QUEUE_MAX_WEIGHT);
+}
+
+
+inline void SendQueue::UpdateBackpressure(Channel& channel)
+{
+	if (channel.QueuedBytes >= size_t(SEND_QUEUE_HIGH_WATER)) channel.Backpressure = true;
+	else if (channel.QueuedBytes <= size_t(SEND_QUEUE_LOW_WATER)) channel.Backpressure = false;
+}
@@ -36,6 +36,9 @@ documentation and/or software.
 #define BZF_MD5_H
 
 #include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
 
 // Constants for MD5Transform routine.
 #define S11 7
@@ -180,7 +183,7 @@ inline MD5::MD5(const std::vector<unsigned char>& data) :
 	memset(digest, 0, 16);
 
 	init();
-	update((const char*)(data.data()), UINT(data.size()));
+	update((const char*)(data.data()), size_type(data.size()));
 	finalize();
 }
 
@@ -196,7 +199,7 @@ inline MD5::MD5(const char* data, int dataCount, int dataLength) :
 
 	init();
 	for (int i = 0; i < dataCount; ++i)
-		update(pcuchar(&data[i * dataLength]), UINT(dataLength));
+		update(pcuchar(&data[i * dataLength]), size_type(dataLength));
 	finalize();
 }
 
@@ -211,7 +214,7 @@ inline MD5::MD5(const std::string &text) :
 	memset(digest, 0, 16);
 
 	init();
-	update(text.c_str(), UINT(text.length()));
+	update(text.c_str(), size_type(text.length()));
 	finalize();
 }
 
@@ -437,7 +440,7 @@ inline std::string MD5::hexdigest() const
 	if (!finalized) return "";
 
 	char buf[33];
-	for (auto i = 0; i < 16; i++) sprintf_s(buf + i * 2, 3, "%02x", digest[i]);
+	for (auto i = 0; i < 16; i++) snprintf(buf + i * 2, 3, "%02x", digest[i]);
 	buf[32] = 0;
 
 	return std::string(buf);
@@ -1,11 +1,49 @@
 #pragma once
 
 #include "SocketBuffer.h"
+#include "FrameDecoder.h"
+#include "SendQueue.h"
+#include "BroadcastFrame.h"
 
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <assert.h>
+
+#ifdef _WIN32
 #include <WS2tcpip.h>
 #pragma comment(lib, "Ws2_32.lib")
 
+constexpr int SOCKET_SEND_FLAGS = 0;
+#else
+//  POSIX sockets, behind the Winsock names the rest of the socket code is written against
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+typedef int SOCKET;
+typedef sockaddr_in SOCKADDR_IN;
+typedef sockaddr SOCKADDR;
+typedef sockaddr* LPSOCKADDR;
+constexpr int SOCKET_ERROR = -1;
+constexpr int INVALID_SOCKET = -1;
+constexpr int WSAEWOULDBLOCK = EWOULDBLOCK;
+constexpr int WSAECONNRESET = ECONNRESET;
+inline int closesocket(SOCKET socketID) { return close(socketID); }
+inline int WSAGetLastError() { return errno; }
+
+//  A send to a peer that's gone away should come back as an error, rather than raise SIGPIPE and end the process
+constexpr int SOCKET_SEND_FLAGS = MSG_NOSIGNAL;
+#endif
+
 static char ReceiveBuffer[8195];
 
 class Socket
@@ -13,7 +51,13 @@ class Socket
 private:
 	bool m_IsConnectionUDP;
 	int m_DataFormat;
+	int m_FramingVersion;
 	char m_FormatString[30];
+
+	//  TCP sends are queued, and written out by flushsend(). Blocked is set when the socket stops taking bytes.
+	SendQueue m_SendQueue;
+	bool m_SendBlocked;
+	int m_SendError;
 	static SOCKADDR_IN SenderAddr;
 
 public:
@@ -28,12 +72,22 @@ public:
 	Socket* tcpaccept(int mode) const;
 	std::string tcpip() const;
 	void setnagle(bool enabled) const;
+	void setbuffersizes(int receiveBytes, int sendBytes) const;
 	bool tcpconnected() const;
 	int setsync(int mode) const;
 	bool udpconnect(int port, int mode);
-	int sendmessage(const char* ip, int port, SocketBuffer* source);
+	int sendmessage(const char* ip, int port, SocketBuffer* source, int channel = SEND_QUEUE_CONTROL_CHANNEL);
+	int sendframe(const BroadcastFrame& frame);
+	int flushsend();
+	inline const SendQueue& getsendqueue() const { return m_SendQueue; }
+	inline bool getsendblocked() const { return m_SendBlocked; }
+	inline void setsendblocked(bool blocked) { m_SendBlocked = blocked; }
 	int receivemessage(SocketBuffer*destination);
+	int receiveframes(FrameDecoder* decoder);
+	inline void setframing(int version) { m_FramingVersion = version; }
+	inline int getframing() const { return m_FramingVersion; }
 	int peekmessage(int size, SocketBuffer*destination) const;
+	int receivedatagram(SocketBuffer* destination, std::string& senderIP, int& senderPort) const;
 	static int lasterror();
 	static std::string GetHostIP(const char* address);
 	static int SockExit(void);
@@ -44,13 +98,13 @@ public:
 	int SetFormat(int mode, char* sep);
 };
 
-int SenderAddrSize = sizeof(SOCKADDR_IN);
+socklen_t SenderAddrSize = sizeof(SOCKADDR_IN);
 SOCKADDR_IN Socket::SenderAddr;
 
 inline bool Socket::tcpconnect(const char *address, int port, int mode)
 {
 	char portString[16];
-	sprintf_s(portString, 16, "%d", port);
+	snprintf(portString, 16, "%d", port);
 
 	if ((m_SocketID = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == SOCKET_ERROR) return false;
 
@@ -66,19 +120,27 @@ inline bool Socket::tcpconnect(const char *address, int port, int mode)
 	{
 		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
 		closesocket(m_SocketID);
+		m_SocketID = INVALID_SOCKET;
 		return false;
 	}
 
 	if (mode == 2) setsync(1);
 	if (connect(m_SocketID, servinfo->ai_addr, (int)(servinfo->ai_addrlen)) == SOCKET_ERROR)
 	{
+		//  A non-blocking connect is still in progress, which POSIX reports as EINPROGRESS rather than would-block
 		int WSAerror = WSAGetLastError();
+#ifndef _WIN32
+		if (WSAerror == EINPROGRESS) WSAerror = WSAEWOULDBLOCK;
+#endif
 		if (WSAerror != WSAEWOULDBLOCK)
 		{
+			freeaddrinfo(servinfo);
 			closesocket(m_SocketID);
+			m_SocketID = INVALID_SOCKET;
 			return false;
 		}
 	}
+	freeaddrinfo(servinfo);
 
 	if (mode == 1) setsync(1);
 	return true;
@@ -92,16 +154,23 @@ inline bool Socket::tcplisten(int port, int max, int mode)
 	addr.sin_addr.s_addr = INADDR_ANY;
 	addr.sin_port = htons(port);
 	if (mode) setsync(1);
+#ifndef _WIN32
+	//  Let a restarted server take its port back straight away, instead of waiting out the old connections' TIME_WAIT
+	int reuseAddress = 1;
+	setsockopt(m_SocketID, SOL_SOCKET, SO_REUSEADDR, (char*)&reuseAddress, sizeof(reuseAddress));
+#endif
 	if (bind(m_SocketID, (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
 	{
 		int errorCode = WSAGetLastError();
 		closesocket(m_SocketID);
+		m_SocketID = INVALID_SOCKET;
 		return false;
 	}
 	if (listen(m_SocketID, max) == SOCKET_ERROR)
 	{
 		int errorCode = WSAGetLastError();
 		closesocket(m_SocketID);
+		m_SocketID = INVALID_SOCKET;
 		return false;
 	}
 	return true;
@@ -110,16 +179,22 @@ inline bool Socket::tcplisten(int port, int max, int mode)
 inline Socket::Socket(SOCKET sock) :
 	m_SocketID(sock),
 	m_IsConnectionUDP(false),
-	m_DataFormat(0)
+	m_DataFormat(0),
+	m_FramingVersion(FRAMING_VERSION_LEGACY),
+	m_SendBlocked(false),
+	m_SendError(0)
 {
 	//  Initialize member variable data arrays
 	memset(m_FormatString, 0, 30);
 }
 
 inline Socket::Socket() :
-	m_SocketID(0),
+	m_SocketID(INVALID_SOCKET),
 	m_IsConnectionUDP(false),
-	m_DataFormat(0)
+	m_DataFormat(0),
+	m_FramingVersion(FRAMING_VERSION_LEGACY),
+	m_SendBlocked(false),
+	m_SendError(0)
 {
 	//  Initialize member variable data arrays
 	memset(m_FormatString, 0, 30);
@@ -127,7 +202,7 @@ inline Socket::Socket() :
 
 inline Socket::~Socket()
 {
-	if (m_SocketID < 0) return;
+	if ((m_SocketID == INVALID_SOCKET) || (m_SocketID < 0)) return;
 	shutdown(m_SocketID, 1);
 	closesocket(m_SocketID);
 }
@@ -138,7 +213,7 @@ inline Socket* Socket::tcpaccept(int mode) const
 	SOCKET sock2;
 	if ((sock2 = accept(m_SocketID, (SOCKADDR *)&SenderAddr, &SenderAddrSize)) != INVALID_SOCKET)
 	{
-		MANAGE_MEMORY_NEW("Socket", sizeof(Socket));
+		MANAGE_MEMORY_NEW("WinsockWrapper", sizeof(Socket));
 		auto sockit = new Socket(sock2);
 		if (mode >= 1)sockit->setsync(1);
 		return sockit;
@@ -159,7 +234,16 @@ inline std::string Socket::tcpip() const
 inline void Socket::setnagle(bool enabled) const
 {
 	if (m_SocketID < 0) return;
-	setsockopt(m_SocketID, IPPROTO_TCP, TCP_NODELAY, (char*)&enabled, sizeof(bool));
+	int value = (enabled ? 1 : 0);
+	setsockopt(m_SocketID, IPPROTO_TCP, TCP_NODELAY, (char*)&value, sizeof(value));
+}
+
+//  The system may cap the sizes asked for (at net.core.rmem_max and wmem_max on Linux), which isn't treated as an error
+inline void Socket::setbuffersizes(int receiveBytes, int sendBytes) const
+{
+	if (m_SocketID < 0) return;
+	setsockopt(m_SocketID, SOL_SOCKET, SO_RCVBUF, (char*)&receiveBytes, sizeof(receiveBytes));
+	setsockopt(m_SocketID, SOL_SOCKET, SO_SNDBUF, (char*)&sendBytes, sizeof(sendBytes));
 }
 
 inline bool Socket::tcpconnected() const
@@ -174,8 +258,14 @@ inline bool Socket::tcpconnected() const
 inline int Socket::setsync(int mode) const
 {
 	if (m_SocketID < 0) return -1;
+#ifdef _WIN32
 	u_long i = mode;
 	return ioctlsocket(m_SocketID, FIONBIO, &i);
+#else
+	auto flags = fcntl(m_SocketID, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(m_SocketID, F_SETFL, (mode != 0) ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+#endif
 }
 
 inline bool Socket::udpconnect(int port, int mode)
@@ -190,13 +280,14 @@ inline bool Socket::udpconnect(int port, int mode)
 	if (bind(m_SocketID, (SOCKADDR*)&addr, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
 	{
 		closesocket(m_SocketID);
+		m_SocketID = INVALID_SOCKET;
 		return false;
 	}
 	m_IsConnectionUDP = true;
 	return true;
 }
 
-inline int Socket::sendmessage(const char *ip, int port, SocketBuffer *source)
+inline int Socket::sendmessage(const char *ip, int port, SocketBuffer *source, int channel)
 {
 	if (m_SocketID <= 0) return -1;
 	auto size = 0;
@@ -209,29 +300,115 @@ inline int Socket::sendmessage(const char *ip, int port, SocketBuffer *source)
 		size = std::min<int>(source->m_BufferUtilizedCount, 8195);
 		addr.sin_family = AF_INET;
 		addr.sin_port = htons(port);
-		addr.sin_addr.s_addr = sa.sin_addr.S_un.S_addr;
+		addr.sin_addr.s_addr = sa.sin_addr.s_addr;
 		size = sendto(m_SocketID, source->m_BufferData, size, 0, (SOCKADDR *)&addr, sizeof(SOCKADDR_IN));
+		return ((size == SOCKET_ERROR) ? -WSAGetLastError() : size);
 	}
-	else
+
+	//  A connection that has already failed to send takes nothing more, so the caller finds out it's gone
+	if (m_SendError != 0) return -m_SendError;
+
+	//  TCP messages are only queued here, and go out on the next flushsend(), in the order the send queue picks for their channel
+	if (m_DataFormat == 0)
 	{
-		SocketBuffer sendbuff;
-		sendbuff.clear();
-		if (m_DataFormat == 0)
-		{
-			sendbuff.writeushort(source->m_BufferUtilizedCount);
-			sendbuff.addBuffer(source);
-			size = send(m_SocketID, sendbuff.m_BufferData, sendbuff.m_BufferUtilizedCount, 0);
-		}
-		else if (m_DataFormat == 1)
+		//  A message too large for the connection's framing can't be sent at all
+		char header[FRAME_HEADER_MAX_SIZE];
+		auto headerSize = EncodeFrameHeader(m_FramingVersion, source->m_BufferUtilizedCount, header, channel);
+		assert(headerSize != 0);
+		if (headerSize == 0) return -1;
+
+		//  The header goes in the space the buffer keeps ahead of the message, so the frame is queued in a single copy
+		auto frame = source->getheaderspace(headerSize);
+		memcpy(frame, header, headerSize);
+		size = headerSize + source->m_BufferUtilizedCount;
+		m_SendQueue.Push(frame, size, nullptr, 0, channel);
+	}
+	else if (m_DataFormat == 1)
+	{
+		auto separatorSize = int(strlen(m_FormatString));
+		m_SendQueue.Push(source->m_BufferData, source->m_BufferUtilizedCount, m_FormatString, separatorSize, channel);
+		size = source->m_BufferUtilizedCount + separatorSize;
+	}
+	else if (m_DataFormat == 2)
+	{
+		m_SendQueue.Push(source->m_BufferData, source->m_BufferUtilizedCount, nullptr, 0, channel);
+		size = source->m_BufferUtilizedCount;
+	}
+	return size;
+}
+
+//  Queues a frame composed for many connections, with the header for this connection's framing, on the frame's own channel
+inline int Socket::sendframe(const BroadcastFrame& frame)
+{
+	if ((m_SocketID <= 0) || m_IsConnectionUDP) return -1;
+	if (m_SendError != 0) return -m_SendError;
+
+	auto channel = frame.GetChannel();
+	if (m_DataFormat == 0)
+	{
+		auto headerSize = frame.GetHeaderSize(m_FramingVersion);
+		assert(headerSize != 0);
+		if (headerSize == 0) return -1;
+		m_SendQueue.Push(frame.GetHeader(m_FramingVersion), headerSize, frame.GetMessage(), frame.GetMessageSize(), channel);
+		return headerSize + frame.GetMessageSize();
+	}
+	else if (m_DataFormat == 1)
+	{
+		auto separatorSize = int(strlen(m_FormatString));
+		m_SendQueue.Push(frame.GetMessage(), frame.GetMessageSize(), m_FormatString, separatorSize, channel);
+		return frame.GetMessageSize() + separatorSize;
+	}
+	m_SendQueue.Push(frame.GetMessage(), frame.GetMessageSize(), nullptr, 0, channel);
+	return frame.GetMessageSize();
+}
+
+inline int Socket::flushsend()
+{
+	if (m_SendError != 0) return -m_SendError;
+
+	auto totalSent = 0;
+	while (!m_SendQueue.GetEmpty())
+	{
+		SendSpan spans[SEND_QUEUE_MAX_SPANS];
+		auto spanCount = m_SendQueue.GatherSpans(spans, SEND_QUEUE_MAX_SPANS);
+		size_t gatheredBytes = 0;
+		for (auto i = 0; i < spanCount; ++i) gatheredBytes += spans[i].Length;
+
+		//  Every gathered block goes to the socket in one call
+		long long sent = 0;
+#ifdef _WIN32
+		WSABUF buffers[SEND_QUEUE_MAX_SPANS];
+		for (auto i = 0; i < spanCount; ++i) { buffers[i].buf = (CHAR*)spans[i].Data; buffers[i].len = ULONG(spans[i].Length); }
+		DWORD bytesSent = 0;
+		if (WSASend(m_SocketID, buffers, DWORD(spanCount), &bytesSent, 0, nullptr, nullptr) == SOCKET_ERROR) sent = SOCKET_ERROR;
+		else sent = (long long)(bytesSent);
+#else
+		iovec buffers[SEND_QUEUE_MAX_SPANS];
+		for (auto i = 0; i < spanCount; ++i) { buffers[i].iov_base = (void*)spans[i].Data; buffers[i].iov_len = spans[i].Length; }
+		msghdr header = {};
+		header.msg_iov = buffers;
+		header.msg_iovlen = spanCount;
+		sent = (long long)(sendmsg(m_SocketID, &header, SOCKET_SEND_FLAGS));
+#endif
+
+		if (sent == SOCKET_ERROR)
 		{
-			sendbuff.addBuffer(source);
-			sendbuff.writechars(m_FormatString);
-			size = send(m_SocketID, sendbuff.m_BufferData, sendbuff.m_BufferUtilizedCount, 0);
+			//  A full socket buffer just means waiting for the peer to catch up. Anything else and the connection is finished.
+			auto error = WSAGetLastError();
+			if (error == WSAEWOULDBLOCK) { m_SendBlocked = true; break; }
+
+			m_SendError = error;
+			m_SendQueue.Clear();
+			return -error;
 		}
-		else if (m_DataFormat == 2)
-			size = send(m_SocketID, source->m_BufferData, source->m_BufferUtilizedCount, 0);
+
+		m_SendQueue.Advance(size_t(sent));
+		totalSent += int(sent);
+
+		//  A short write means the socket buffer is full, so there's no point trying again until it has drained
+		if (size_t(sent) < gatheredBytes) { m_SendBlocked = true; break; }
 	}
-	return ((size == SOCKET_ERROR) ? -WSAGetLastError() : size);
+	return totalSent;
 }
 
 inline int Socket::receivemessage(SocketBuffer* destination)
@@ -240,7 +417,6 @@ inline int Socket::receivemessage(SocketBuffer* destination)
 
 	auto packetSize = -1;
 	uint16_t messageDataLength = 0;
-	char* messageBuffer = nullptr;
 
 	if (m_IsConnectionUDP)
 	{
@@ -264,7 +440,7 @@ inline int Socket::receivemessage(SocketBuffer* destination)
 			//  NOTE: Peek the data in case it hasn't fully arrived.
 			if ((packetSize = recv(m_SocketID, ReceiveBuffer, messageDataLength + 2, MSG_PEEK)) == SOCKET_ERROR) { return -4; }
 			if (packetSize != messageDataLength + 2) return -5;
-			memset(ReceiveBuffer, NULL, sizeof(ReceiveBuffer));
+			memset(ReceiveBuffer, 0, sizeof(ReceiveBuffer));
 
 			//  Remove the first two byte precursor now that we know the entire message has arrived and is accessible
 			if ((packetSize = recv(m_SocketID, ReceiveBuffer, 2, 0)) == SOCKET_ERROR) { assert(false); return -6; }
@@ -285,23 +461,73 @@ inline int Socket::receivemessage(SocketBuffer* destination)
 	return packetSize;
 }
 
-inline int Socket::peekmessage(int size, SocketBuffer* destination) const
+inline int Socket::receiveframes(FrameDecoder* decoder)
 {
 	if (m_SocketID < 0) return -1;
-	if (size == 0) size = 65536;
-	MANAGE_MEMORY_NEW("WinsockWrapper", size);
-	auto buff = new char[size];
-	size = recvfrom(m_SocketID, buff, size, MSG_PEEK, (SOCKADDR *)&SenderAddr, &SenderAddrSize);
-	if (size < 0)
+
+	//  Read until the socket is drained or the ring is full. A read that fills all the space it was given may have stopped at
+	//  the wrap, so go round again. One that comes back short has taken everything the socket had, so there's no need to wait
+	//  for a would-block to find that out.
+	auto receivedTotal = 0;
+	while (true)
 	{
-		MANAGE_MEMORY_DELETE("WinsockWrapper", sizeof(buff));
-		delete[] buff;
-		return -1;
+		int spaceLength = 0;
+		auto space = decoder->GetWriteSpace(spaceLength);
+		if (spaceLength == 0) return receivedTotal;
+
+		auto packetSize = recv(m_SocketID, space, spaceLength, 0);
+		if (packetSize == SOCKET_ERROR)
+		{
+			if (receivedTotal == 0) return -2;
+
+			//  The connection failed after handing over some data. Keep the data, and report the failure as a close.
+			if (WSAGetLastError() != WSAEWOULDBLOCK) decoder->SetClosed();
+			return receivedTotal;
+		}
+		if (packetSize == 0)
+		{
+			decoder->SetClosed();
+			return receivedTotal;
+		}
+
+		decoder->CommitWrite(int(packetSize));
+		receivedTotal += int(packetSize);
+		if (int(packetSize) < spaceLength) return receivedTotal;
 	}
+}
+
+inline int Socket::peekmessage(int size, SocketBuffer* destination) const
+{
+	if (m_SocketID < 0) return -1;
+	if (size == 0) size = 65536;
+
+	//  Peek straight into the destination, rather than into a buffer of our own and then copying
+	destination->clear();
+	destination->reserve(size);
+	size = recvfrom(m_SocketID, destination->m_BufferData, size, MSG_PEEK, (SOCKADDR *)&SenderAddr, &SenderAddrSize);
+	if (size < 0) return -1;
+	destination->m_BufferUtilizedCount = destination->m_WritePosition = size;
+	return size;
+}
+
+//  Reads one datagram straight into the destination, along with where it came from. Unlike receivemessage(), nothing static is
+//  touched, so sockets on different threads can each be read at once.
+inline int Socket::receivedatagram(SocketBuffer* destination, std::string& senderIP, int& senderPort) const
+{
+	if ((m_SocketID < 0) || !m_IsConnectionUDP) return -1;
+
+	SOCKADDR_IN senderAddress;
+	socklen_t senderAddressSize = sizeof(SOCKADDR_IN);
 	destination->clear();
-	destination->addBuffer(buff, size);
-	MANAGE_MEMORY_DELETE("WinsockWrapper", sizeof(buff));
-	delete[] buff;
+	destination->reserve(sizeof(ReceiveBuffer));
+	auto size = int(recvfrom(m_SocketID, destination->m_BufferData, int(sizeof(ReceiveBuffer)), 0, (SOCKADDR *)&senderAddress, &senderAddressSize));
+	if (size < 0) return -1;
+	destination->m_BufferUtilizedCount = destination->m_WritePosition = size;
+
+	char ipAddress[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &senderAddress.sin_addr, ipAddress, INET_ADDRSTRLEN);
+	senderIP = ipAddress;
+	senderPort = ntohs(senderAddress.sin_port);
 	return size;
 }
 
@@ -354,20 +580,24 @@ inline int Socket::SetFormat(int mode, char* sep)
 {
 	auto previous = m_DataFormat;
 	m_DataFormat = mode;
-	if (mode == 1 && strlen(sep) > 0) strcpy_s(m_FormatString, 30, sep);
+	if (mode == 1 && strlen(sep) > 0) snprintf(m_FormatString, 30, "%s", sep);
 	return previous;
 }
 
 inline int Socket::SockExit(void)
 {
+#ifdef _WIN32
 	WSACleanup();
+#endif
 	return 1;
 }
 
 inline int Socket::SockStart(void)
 {
+#ifdef _WIN32
 	WSADATA wsaData;
 	(void) WSAStartup(MAKEWORD(1, 1), &wsaData);
+#endif
 	return 1;
 }
 
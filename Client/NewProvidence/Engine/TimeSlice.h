@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <time.h>
 #include <SDL.h>
+#include "TimeString.h"
 
 static uint32_t gameTicksUint = 0;
 static uint32_t frameTicksUint = 0;
@@ -44,36 +45,3 @@ inline void DetermineTimeSlice()
 	frameSecondsF = float(frameSeconds);
 	gameSecondsF = float(gameSeconds);
 }
-
-inline std::string GetCurrentTimeString()
-{
-	auto currentTime = time(nullptr);
-
-	tm timeBuffer;
-	auto localTime = localtime_s(&timeBuffer, &currentTime);
-	timeBuffer.tm_year += 1900;
-	timeBuffer.tm_mon += 1;
-	if ((timeBuffer.tm_mon) > 12)
-	{
-		timeBuffer.tm_mon -= 12;
-		timeBuffer.tm_year += 1;
-	}
-
-	auto year = std::to_string(timeBuffer.tm_year);
-	auto month = std::to_string(timeBuffer.tm_mon);
-	if (month.length() == 1) month = "0" + month;
-	auto day = std::to_string(timeBuffer.tm_mday);
-	if (day.length() == 1) day = "0" + day;
-	auto date = year + "-" + month + "-" + day;
-
-	auto hour = std::to_string(timeBuffer.tm_hour);
-	if (hour.length() == 1) hour = "0" + hour;
-	auto minute = std::to_string(timeBuffer.tm_min);
-	if (minute.length() == 1) minute = "0" + minute;
-	auto second = std::to_string(timeBuffer.tm_sec);
-	if (second.length() == 1) second = "0" + second;
-	auto time = hour + ":" + minute + ":" + second;
-
-
-	return std::string(date + " | " + time);
-}
\ No newline at end of file
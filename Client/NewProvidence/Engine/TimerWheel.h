@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+//  Timer Wheel: a hierarchical timing wheel for large numbers of timers that are mostly cancelled or re-armed before they fire,
+//  such as one ping and one idle timer per connection, and a reminder or retransmit timer per transfer.
+//  Arming and cancelling are O(1), and timers that don't fire cost nothing per tick. Time is counted in whole ticks (the async
+//  scheduler uses MonotonicClock milliseconds), and the caller moves the wheel forward with Advance().
+//
+//  The wheel has four levels of 64 slots. Level 0 holds the timers due in the next 64 ticks, one slot per tick, and each level
+//  above covers 64 times the span of the one below. Whenever level 0 wraps around, the next slot of the level above is emptied
+//  down into the levels below it, so a timer is moved at most three times before it fires. With millisecond ticks the wheel
+//  reaches about four and a half hours ahead, and anything further out waits in the last level until it's within reach.
+//
+//  Timers live in one pool of nodes, linked into their slot by index, so the wheel stops allocating once the pool has grown
+//  to the most timers ever armed at once. A handle names a node and the generation it was armed in, so cancelling a timer that
+//  has already fired (and whose node has been reused) is safely ignored.
+
+typedef uint64_t TimerHandle;
+constexpr TimerHandle INVALID_TIMER_HANDLE = 0;
+
+template <typename PayloadType>
+class TimerWheel
+{
+private:
+	static constexpr int LEVEL_BITS = 6;
+	static constexpr int LEVEL_COUNT = 4;
+	static constexpr uint64_t SLOT_COUNT = (uint64_t(1) << LEVEL_BITS);
+	static constexpr uint64_t SLOT_MASK = (SLOT_COUNT - 1);
+	static constexpr uint64_t WHEEL_SPAN = (uint64_t(1) << (LEVEL_BITS * LEVEL_COUNT));
+	static constexpr uint32_t NO_NODE = 0xFFFFFFFF;
+
+	struct Node
+	{
+		uint64_t Deadline;
+		uint32_t Previous;
+		uint32_t Next;
+		uint32_t Generation;
+		uint32_t Slot;
+		bool Armed;
+		PayloadType Payload;
+	};
+
+	std::vector<Node> Nodes;
+	std::vector<uint32_t> FreeNodes;
+	uint32_t SlotHeads[LEVEL_COUNT * SLOT_COUNT];
+	uint64_t OccupiedSlots[LEVEL_COUNT];
+	uint64_t CurrentTick;
+	size_t TimerCount;
+
+	static inline TimerHandle MakeHandle(uint32_t nodeIndex, uint32_t generation) { return (uint64_t(generation) << 32) | uint64_t(nodeIndex + 1); }
+
+	void LinkNode(uint32_t nodeIndex);
+	void UnlinkNode(uint32_t nodeIndex);
+	void FreeNode(uint32_t nodeIndex);
+	void Cascade(void);
+
+public:
+	explicit TimerWheel(uint64_t startTick = 0) : CurrentTick(startTick), TimerCount(0)
+	{
+		for (auto& head : SlotHeads) head = NO_NODE;
+		for (auto& occupied : OccupiedSlots) occupied = 0;
+	}
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	inline uint64_t GetCurrentTick() const { return CurrentTick; }
+	inline size_t GetCount() const { return TimerCount; }
+
+	//  Arms a timer for the given tick. A tick that has already been reached fires on the next Advance().
+	TimerHandle Arm(uint64_t deadlineTick, PayloadType payload);
+
+	//  Returns false if the timer had already fired or been cancelled
+	bool Cancel(TimerHandle handle);
+
+	//  Fires every timer due up to and including the given tick, in tick order, handing each payload to the callback.
+	//  The callback is free to arm and cancel timers, and anything it arms fires no sooner than the next tick.
+	template <typename CallbackType>
+	void Advance(uint64_t tick, CallbackType&& callback);
+};
+
+
+template <typename PayloadType>
+inline TimerHandle TimerWheel<PayloadType>::Arm(uint64_t deadlineTick, PayloadType payload)
+{
+	uint32_t nodeIndex;
+	if (FreeNodes.empty())
+	{
+		nodeIndex = uint32_t(Nodes.size());
+		assert(nodeIndex != NO_NODE);
+		Nodes.push_back(Node{ 0, NO_NODE, NO_NODE, 1, 0, false, PayloadType() });
+	}
+	else
+	{
+		nodeIndex = FreeNodes.back();
+		FreeNodes.pop_back();
+	}
+
+	auto& node = Nodes[nodeIndex];
+	node.Deadline = std::max<uint64_t>(deadlineTick, CurrentTick + 1);
+	node.Armed = true;
+	node.Payload = std::move(payload);
+	LinkNode(nodeIndex);
+	++TimerCount;
+	return MakeHandle(nodeIndex, node.Generation);
+}
+
+
+template <typename PayloadType>
+inline bool TimerWheel<PayloadType>::Cancel(TimerHandle handle)
+{
+	if (handle == INVALID_TIMER_HANDLE) return false;
+	auto nodeIndex = uint32_t(handle & 0xFFFFFFFF) - 1;
+	if ((nodeIndex >= Nodes.size()) || (Nodes[nodeIndex].Generation != uint32_t(handle >> 32)) || !Nodes[nodeIndex].Armed) return false;
+
+	UnlinkNode(nodeIndex);
+	FreeNode(nodeIndex);
+	return true;
+}
+
+
+template <typename PayloadType>
+template <typename CallbackType>
+inline void TimerWheel<PayloadType>::Advance(uint64_t tick, CallbackType&& callback)
+{
+	while (CurrentTick < tick)
+	{
+		if (TimerCount == 0) { CurrentTick = tick; return; }
+
+		auto nextTick = CurrentTick + 1;
+		auto slotIndex = uint32_t(nextTick & SLOT_MASK);
+
+		//  Between cascades only level 0 can fire, so skip straight past any run of empty slots
+		if ((slotIndex != 0) && ((OccupiedSlots[0] >> slotIndex) == 0))
+		{
+			CurrentTick = std::min<uint64_t>(tick, nextTick | SLOT_MASK);
+			continue;
+		}
+
+		CurrentTick = nextTick;
+		if (slotIndex == 0) Cascade();
+
+		//  Take the timers off one at a time, as the callback may cancel the others
+		while (SlotHeads[slotIndex] != NO_NODE)
+		{
+			auto nodeIndex = SlotHeads[slotIndex];
+			UnlinkNode(nodeIndex);
+			auto payload = std::move(Nodes[nodeIndex].Payload);
+			FreeNode(nodeIndex);
+			callback(payload);
+		}
+	}
+}
+
+
+template <typename PayloadType>
+inline void TimerWheel<PayloadType>::LinkNode(uint32_t nodeIndex)
+{
+	auto& node = Nodes[nodeIndex];
+
+	//  The lowest level whose span reaches the deadline, and anything beyond the last level waits at its far end
+	auto delta = std::min<uint64_t>(node.Deadline - CurrentTick, WHEEL_SPAN - 1);
+	auto level = 0;
+	while ((level < LEVEL_COUNT - 1) && (delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1))))) ++level;
+	auto slot = uint32_t(level * SLOT_COUNT + (((CurrentTick + delta) >> (LEVEL_BITS * level)) & SLOT_MASK));
+
+	node.Slot = slot;
+	node.Previous = NO_NODE;
+	node.Next = SlotHeads[slot];
+	if (node.Next != NO_NODE) Nodes[node.Next].Previous = nodeIndex;
+	SlotHeads[slot] = nodeIndex;
+	OccupiedSlots[level] |= (uint64_t(1) << (slot & SLOT_MASK));
+}
+
+
+template <typename PayloadType>
+inline void TimerWheel<PayloadType>::UnlinkNode(uint32_t nodeIndex)
+{
+	auto& node = Nodes[nodeIndex];
+	if (node.Previous != NO_NODE) Nodes[node.Previous].Next = node.Next;
+	else SlotHeads[node.Slot] = node.Next;
+	if (node.Next != NO_NODE) Nodes[node.Next].Previous = node.Previous;
+	if (SlotHeads[node.Slot] == NO_NODE) OccupiedSlots[node.Slot / SLOT_COUNT] &= ~(uint64_t(1) << (node.Slot & SLOT_MASK));
+}
+
+
+template <typename PayloadType>
+inline void TimerWheel<PayloadType>::FreeNode(uint32_t nodeIndex)
+{
+	auto& node = Nodes[nodeIndex];
+	node.Armed = false;
+	node.Payload = PayloadType();
+	++node.Generation;
+	FreeNodes.push_back(nodeIndex);
+	--TimerCount;
+}
+
+
+//  Empties the current slot of each level above 0 back into the wheel as the level below it wraps around, so every timer
+//  in it lands where it's due relative to the tick now being processed. A level is only reached if the one below it wrapped.
+template <typename PayloadType>
+inline void TimerWheel<PayloadType>::Cascade()
+{
+	for (auto level = 1; level < LEVEL_COUNT; ++level)
+	{
+		auto slotIndex = uint32_t((CurrentTick >> (LEVEL_BITS * level)) & SLOT_MASK);
+		auto slot = uint32_t(level * SLOT_COUNT + slotIndex);
+
+		auto nodeIndex = SlotHeads[slot];
+		SlotHeads[slot] = NO_NODE;
+		OccupiedSlots[level] &= ~(uint64_t(1) << slotIndex);
+		while (nodeIndex != NO_NODE)
+		{
+			auto nextIndex = Nodes[nodeIndex].Next;
+			LinkNode(nodeIndex);
+			nodeIndex = nextIndex;
+		}
+
+		if (slotIndex != 0) break;
+	}
+}
@@ -2,14 +2,39 @@
 
 #include "Socket.h"
 #include "SocketBuffer.h"
+#include "MessageTransport.h"
 
+#ifdef _WIN32
 #include <windows.h>
 #include <Wininet.h>
 #include <Iphlpapi.h>
-#include <vector>
 #include <minwindef.h>
+#else
+#include <ifaddrs.h>
+#include <net/if.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <linux/if_packet.h>
+#endif
+#endif
+#include <vector>
 #include <assert.h>
 
+//  Readiness: rather than trying to receive on every connection every frame, watch the connections and ask which have
+//  something to read. On Linux that's epoll in edge-triggered mode: a notification marks a socket ready, and it stays ready
+//  until a receive (or accept) on it comes back empty, as an edge won't come again for data already waiting. A peer that
+//  hangs up straight after its last send raises one edge for both, so once a hangup is seen the socket stays ready until
+//  a receive has found the close, rather than until a read comes back short.
+//  Elsewhere every watched socket is treated as ready each update, which is the old behaviour.
+//
+//  Sending: messages sent on a TCP socket are queued on it (see SendQueue.h), and FlushSendQueues() writes out every queue
+//  with something in it, once a network pass. A socket that stops taking bytes isn't tried again until epoll says it has
+//  room (elsewhere, until the next flush). Each message goes on one of the queue's channels, control unless a channel is given.
+//
+//  A wrapper is only ever used from one thread. winsockWrapper is the one everything shares by default, and a server shard
+//  makes one of its own, so each shard watches and flushes its own connections. DetachSocket() lets a connection accepted on
+//  one wrapper be handed over to another.
+
 
 class WinsockWrapper
 {
@@ -18,10 +43,20 @@ public:
 
 	static WinsockWrapper& GetInstance() { static WinsockWrapper INSTANCE; return INSTANCE; }
 
+	WinsockWrapper();
+	~WinsockWrapper() {}
+
+	WinsockWrapper(const WinsockWrapper&) = delete;
+	WinsockWrapper& operator=(const WinsockWrapper&) = delete;
+
 	//  Utilities
-	static inline bool GetInternetConnected()						{ DWORD cstat; return (InternetGetConnectedState(&cstat, 0) != false); }
-	static unsigned int ConvertIPtoUINT(const char* ipAddress)		{ sockaddr_in sa; inet_pton(AF_INET, ipAddress, &(sa.sin_addr)); return sa.sin_addr.S_un.S_addr; }
-	static std::string ConvertUINTtoIP(unsigned int ipAddress)		{ char outputString[32]; inet_ntop(AF_INET, &ipAddress, outputString, INET_ADDRSTRLEN); return std::string(outputString); }
+#ifdef _WIN32
+	static inline bool GetInternetConnected() { DWORD cstat; return (InternetGetConnectedState(&cstat, 0) != false); }
+#else
+	static inline bool GetInternetConnected() { return true; }
+#endif
+	static unsigned int ConvertIPtoUINT(const char* ipAddress) { sockaddr_in sa; inet_pton(AF_INET, ipAddress, &(sa.sin_addr)); return sa.sin_addr.s_addr; }
+	static std::string ConvertUINTtoIP(unsigned int ipAddress) { char outputString[32]; inet_ntop(AF_INET, &ipAddress, outputString, INET_ADDRSTRLEN); return std::string(outputString); }
 
 	void WinsockInitialize(unsigned int bufferCount = 1);
 	void WinsockShutdown();
@@ -33,14 +68,33 @@ public:
 	bool TCPConnected(int socketID);
 	int UDPConnect(int port, int mode);
 	bool SetNagle(int socketID, bool value);
+	bool SetBufferSizes(int socketID, int receiveBytes, int sendBytes);
+
+	//  Readiness
+	bool WatchSocket(int socketID);
+	void UnwatchSocket(int socketID);
+	int UpdateReadySockets(std::vector<int>& readySockets);
+	inline bool GetSocketReady(int socketID) const { return ((socketID >= 0) && (socketID < int(m_SocketReady.size())) && m_SocketReady[socketID]); }
+
+	//  Send queues
+	int FlushSendQueues();
+	bool GetSendBackpressure(int socketID, int channel = SEND_QUEUE_CONTROL_CHANNEL) const;
+	const SendQueue* GetSendQueue(int socketID) const;
 
 	//  Miscelaneous
 	int SendMessagePacket(int socketID, const char* ipAddress, int port, int bufferID);
+	int SendMessageBuffer(int socketID, const char* ipAddress, int port, SocketBuffer* buffer, int channel = SEND_QUEUE_CONTROL_CHANNEL);
+	int SendBroadcastFrame(int socketID, const BroadcastFrame& frame);
 	int ReceiveMessagePacket(int socketID, int bufferID);
+	int ReceiveMessageBuffer(int socketID, SocketBuffer* buffer);
+	int ReceiveFrames(int socketID, FrameDecoder* decoder);
+	int ReceiveDatagram(int socketID, SocketBuffer* buffer, std::string& senderIP, int& senderPort);
+	bool SetFramingVersion(int socketID, int version);
 	int PeekMessagePacket(int socketID, int len, int bufferID);
 	int SetFormat(int socketID, int mode, char* separater);
 	int SetSync(int socketID, int mode);
 	bool CloseSocket(int socketID);
+	Socket* DetachSocket(int socketID);
 	int GetLastSocketError(int socketID);
 	static char* GetMyHostName();
 	static bool CompareIP(char* ipAddress, char* mask);
@@ -87,17 +141,30 @@ public:
 	int GetBytesLeft(int bufferID);
 	const char* GetMacAddress() const;
 	bool GetBufferExists(int bufferID);
+	inline SocketBuffer* GetBuffer(int bufferID) { return m_BufferList[bufferID]; }
 
 	int AddBuffer(SocketBuffer* b);
 	int AddSocket(Socket* b);
 
 private:
-	WinsockWrapper();
-	~WinsockWrapper() {}
+	void SetSocketReady(int socketID, bool ready);
+	inline bool GetSocketHungUp(int socketID) const { return ((socketID >= 0) && (socketID < int(m_SocketHungUp.size())) && m_SocketHungUp[socketID]); }
+	void SetSendPending(int socketID);
+	inline Socket* GetSocket(int socketID) const { return ((socketID >= 0) && (socketID < int(m_SocketList.size()))) ? m_SocketList[socketID] : nullptr; }
 
 	std::vector<SocketBuffer*> m_BufferList;
 	std::vector<Socket*> m_SocketList;
 	bool m_WinsockInitialized;
+
+	std::vector<bool> m_SocketWatched;
+	std::vector<bool> m_SocketReady;
+	std::vector<bool> m_SocketHungUp;
+	std::vector<int> m_ReadySockets;
+	std::vector<bool> m_SendPending;
+	std::vector<int> m_SendPendingSockets;
+#ifdef __linux__
+	int m_EpollHandle;
+#endif
 };
 
 inline void WinsockWrapper::WinsockInitialize(unsigned int bufferCount)
@@ -105,9 +172,16 @@ inline void WinsockWrapper::WinsockInitialize(unsigned int bufferCount)
 	//  If we're already initialized, exit gracefully
 	if (m_WinsockInitialized) return;
 
+#ifdef _WIN32
 	//  Start up the Winsock library, requesting version 2.2
 	WSADATA wsaData;
 	(void)WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+#ifdef __linux__
+	m_EpollHandle = epoll_create1(EPOLL_CLOEXEC);
+	assert(m_EpollHandle >= 0);
+#endif
 
 	for (unsigned int i = 0; i < bufferCount; ++i)
 	{
@@ -123,6 +197,11 @@ inline void WinsockWrapper::WinsockShutdown()
 {
 	Socket::SockExit();
 
+#ifdef __linux__
+	if (m_EpollHandle >= 0) close(m_EpollHandle);
+	m_EpollHandle = -1;
+#endif
+
 	while (!m_BufferList.empty())
 	{
 		MANAGE_MEMORY_DELETE("WinsockWrapper", sizeof(SocketBuffer));
@@ -168,7 +247,13 @@ inline int WinsockWrapper::TCPAccept(int socketID, int mode)
 	if (socket1 == nullptr)	return -1;
 
 	auto socket2 = socket1->tcpaccept(mode);
-	return ((socket2 != nullptr) ? AddSocket(socket2) : -1);
+	if (socket2 == nullptr)
+	{
+		//  Nothing left to accept until the listening socket is notified again
+		SetSocketReady(socketID, false);
+		return -1;
+	}
+	return AddSocket(socket2);
 }
 
 inline bool WinsockWrapper::TCPConnected(int socketID)
@@ -196,6 +281,14 @@ inline bool WinsockWrapper::SetNagle(int socketID, bool value)
 	return true;
 }
 
+inline bool WinsockWrapper::SetBufferSizes(int socketID, int receiveBytes, int sendBytes)
+{
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return false;
+	socket->setbuffersizes(receiveBytes, sendBytes);
+	return true;
+}
+
 inline int WinsockWrapper::SendMessagePacket(int socketID, const char* ipAddress, int port, int bufferID)
 {
 	auto socket = m_SocketList[socketID];
@@ -203,28 +296,100 @@ inline int WinsockWrapper::SendMessagePacket(int socketID, const char* ipAddress
 	if (socket == nullptr) return -1;
 	if (buffer == nullptr) return -2;
 	auto size = socket->sendmessage(ipAddress, port, buffer);
-	if (size < 0) return -socket->lasterror();
+	if (size > 0) SetSendPending(socketID);
+	return size;
+}
+
+inline int WinsockWrapper::SendMessageBuffer(int socketID, const char* ipAddress, int port, SocketBuffer* buffer, int channel)
+{
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return -1;
+	if (buffer == nullptr) return -2;
+	auto size = socket->sendmessage(ipAddress, port, buffer, channel);
+	if (size > 0) SetSendPending(socketID);
+	return size;
+}
+
+inline int WinsockWrapper::SendBroadcastFrame(int socketID, const BroadcastFrame& frame)
+{
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return -1;
+	auto size = socket->sendframe(frame);
+	if (size > 0) SetSendPending(socketID);
 	return size;
 }
 
 inline int WinsockWrapper::ReceiveMessagePacket(int socketID, int bufferID)
+{
+	return ReceiveMessageBuffer(socketID, m_BufferList[bufferID]);
+}
+
+inline int WinsockWrapper::ReceiveMessageBuffer(int socketID, SocketBuffer* buffer)
 {
 	auto socket = m_SocketList[socketID];
-	auto buffer = m_BufferList[bufferID];
 	if (socket == nullptr) return -1;
 	if (buffer == nullptr) return -2;
 	auto size = socket->receivemessage(buffer);
 
+	//  Without a whole message waiting, the socket isn't ready again until more data arrives
+	if (size <= 0) SetSocketReady(socketID, false);
+
+	if (size < 0)
+	{
+		auto error = socket->lasterror();
+		if (error == 0)				return -1;
+		if (error == WSAECONNRESET)	return 0;
+		return -error;
+	}
+	return size;
+}
+
+inline int WinsockWrapper::ReceiveFrames(int socketID, FrameDecoder* decoder)
+{
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return -1;
+	if (decoder == nullptr) return -2;
+	auto size = socket->receiveframes(decoder);
+
+	//  Once the socket is drained it isn't ready again until more data arrives. If the decoder filled up first, the socket
+	//  stays ready, so the rest is read once some frames have been taken out. A short read doesn't find a close waiting
+	//  behind the data, so a socket that has hung up stays ready until the decoder has seen it.
+	if ((decoder->GetFreeSpace() > 0) && (!GetSocketHungUp(socketID) || decoder->GetClosed())) SetSocketReady(socketID, false);
+
 	if (size < 0)
 	{
 		auto error = socket->lasterror();
-		if (error == 0)		return -1;
-		if (error == 10054)	return 0;
+		if ((error == 0) || (error == WSAEWOULDBLOCK))	return -1;
+		if (error == WSAECONNRESET)						return 0;
 		return -error;
 	}
+	if (size == 0) return (decoder->GetClosed() ? 0 : -1);
+	return size;
+}
+
+inline int WinsockWrapper::ReceiveDatagram(int socketID, SocketBuffer* buffer, std::string& senderIP, int& senderPort)
+{
+	if ((socketID < 0) || (socketID >= int(m_SocketList.size()))) return -1;
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return -1;
+	if (buffer == nullptr) return -2;
+
+	//  A UDP socket has no connection to lose, so every error (including a port unreachable from an earlier send) is just nothing to read
+	auto size = socket->receivedatagram(buffer, senderIP, senderPort);
+	if (size < 0) SetSocketReady(socketID, false);
 	return size;
 }
 
+inline bool WinsockWrapper::SetFramingVersion(int socketID, int version)
+{
+	//  Only affects what's sent from here on. What's received is read by the connection's own frame decoder.
+	if ((socketID < 0) || (socketID >= int(m_SocketList.size()))) return false;
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return false;
+	socket->setframing(version);
+	return true;
+}
+
 inline int WinsockWrapper::PeekMessagePacket(int socketID, int len, int bufferID)
 {
 	auto socket = m_SocketList[socketID];
@@ -235,7 +400,7 @@ inline int WinsockWrapper::PeekMessagePacket(int socketID, int len, int bufferID
 	if (size < 0)
 	{
 		auto error = socket->lasterror();
-		return ((error == 10054) ? 0 : -error);
+		return ((error == WSAECONNRESET) ? 0 : -error);
 	}
 	return size;
 }
@@ -260,12 +425,40 @@ inline bool WinsockWrapper::CloseSocket(int socketID)
 	if (socketID < 0) return false;
 	auto socket = m_SocketList[socketID];
 	if (socket == nullptr) return false;
+
+	//  Give whatever is still queued (often a last message before a disconnect) one chance to go out
+	socket->flushsend();
+	if ((socketID < int(m_SendPending.size())) && m_SendPending[socketID])
+	{
+		m_SendPending[socketID] = false;
+		m_SendPendingSockets.erase(std::find(m_SendPendingSockets.begin(), m_SendPendingSockets.end(), socketID));
+	}
+
+	UnwatchSocket(socketID);
 	MANAGE_MEMORY_DELETE("WinsockWrapper", sizeof(Socket));
 	delete socket;
 	m_SocketList[socketID] = nullptr;
 	return true;
 }
 
+//  Takes a socket out of the wrapper without closing it, for another wrapper to AddSocket(). Anything still queued goes with it.
+inline Socket* WinsockWrapper::DetachSocket(int socketID)
+{
+	if ((socketID < 0) || (socketID >= int(m_SocketList.size()))) return nullptr;
+	auto socket = m_SocketList[socketID];
+	if (socket == nullptr) return nullptr;
+
+	if ((socketID < int(m_SendPending.size())) && m_SendPending[socketID])
+	{
+		m_SendPending[socketID] = false;
+		m_SendPendingSockets.erase(std::find(m_SendPendingSockets.begin(), m_SendPendingSockets.end(), socketID));
+	}
+
+	UnwatchSocket(socketID);
+	m_SocketList[socketID] = nullptr;
+	return socket;
+}
+
 inline int WinsockWrapper::GetLastSocketError(int socketID)
 {
 	auto socket = m_SocketList[socketID];
@@ -515,6 +708,23 @@ inline int WinsockWrapper::GetBytesLeft(int bufferID)
 inline const char* WinsockWrapper::GetMacAddress() const
 {
 	static char mac_address[32];
+#ifndef _WIN32
+	//  The hardware address of the first interface that isn't loopback
+	mac_address[0] = 0;
+#ifdef __linux__
+	struct ifaddrs* interfaceList = nullptr;
+	if (getifaddrs(&interfaceList) != 0) return mac_address;
+	for (auto entry = interfaceList; entry != nullptr; entry = entry->ifa_next)
+	{
+		if ((entry->ifa_addr == nullptr) || (entry->ifa_addr->sa_family != AF_PACKET) || ((entry->ifa_flags & IFF_LOOPBACK) != 0)) continue;
+		auto address = ((struct sockaddr_ll*)entry->ifa_addr)->sll_addr;
+		snprintf(mac_address, 31, "%02X-%02X-%02X-%02X-%02X-%02X", address[0], address[1], address[2], address[3], address[4], address[5]);
+		break;
+	}
+	freeifaddrs(interfaceList);
+#endif
+	return mac_address;
+#else
 	IP_ADAPTER_INFO AdapterInfo[16];
 	DWORD dwBufLen = sizeof(AdapterInfo);
 	auto dwStatus = GetAdaptersInfo(AdapterInfo, &dwBufLen);
@@ -524,6 +734,7 @@ inline const char* WinsockWrapper::GetMacAddress() const
 
 	sprintf_s(mac_address, 31, "%02X-%02X-%02X-%02X-%02X-%02X", AdapterInfo->Address[0], AdapterInfo->Address[1], AdapterInfo->Address[2], AdapterInfo->Address[3], AdapterInfo->Address[4], AdapterInfo->Address[5]);
 	return mac_address;
+#endif
 }
 
 inline bool WinsockWrapper::GetBufferExists(int bufferID)
@@ -559,11 +770,183 @@ inline int WinsockWrapper::AddSocket(Socket* b)
 }
 
 
+inline bool WinsockWrapper::WatchSocket(int socketID)
+{
+	if ((socketID < 0) || (socketID >= int(m_SocketList.size())) || (m_SocketList[socketID] == nullptr)) return false;
+	if (int(m_SocketWatched.size()) <= socketID) m_SocketWatched.resize(socketID + 1, false);
+	if (m_SocketWatched[socketID]) return true;
+
+#ifdef __linux__
+	epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.u64 = 0;
+	event.data.u32 = uint32_t(socketID);
+	if (epoll_ctl(m_EpollHandle, EPOLL_CTL_ADD, m_SocketList[socketID]->m_SocketID, &event) != 0) return false;
+#endif
+
+	//  Anything that arrived before we started watching won't raise an edge, so start out ready
+	m_SocketWatched[socketID] = true;
+	SetSocketReady(socketID, true);
+	return true;
+}
+
+inline void WinsockWrapper::UnwatchSocket(int socketID)
+{
+	if ((socketID < 0) || (socketID >= int(m_SocketWatched.size())) || !m_SocketWatched[socketID]) return;
+
+#ifdef __linux__
+	if (m_SocketList[socketID] != nullptr) epoll_ctl(m_EpollHandle, EPOLL_CTL_DEL, m_SocketList[socketID]->m_SocketID, nullptr);
+#endif
+
+	m_SocketWatched[socketID] = false;
+	if (socketID < int(m_SocketHungUp.size())) m_SocketHungUp[socketID] = false;
+	SetSocketReady(socketID, false);
+}
+
+inline int WinsockWrapper::UpdateReadySockets(std::vector<int>& readySockets)
+{
+#ifdef __linux__
+	//  Collect every notification since the last update without waiting. Each one marks its socket ready until drained.
+	epoll_event events[256];
+	int eventCount;
+	do
+	{
+		eventCount = epoll_wait(m_EpollHandle, events, 256, 0);
+		for (auto i = 0; i < eventCount; ++i)
+		{
+			auto socketID = int(events[i].data.u32);
+			if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) SetSocketReady(socketID, true);
+			if ((events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0)
+			{
+				if (int(m_SocketHungUp.size()) <= socketID) m_SocketHungUp.resize(socketID + 1, false);
+				m_SocketHungUp[socketID] = true;
+			}
+			if (((events[i].events & EPOLLOUT) != 0) && (m_SocketList[socketID] != nullptr)) m_SocketList[socketID]->setsendblocked(false);
+		}
+	} while (eventCount == 256);
+#else
+	for (auto i = 0; i < int(m_SocketWatched.size()); ++i)
+		if (m_SocketWatched[i]) SetSocketReady(i, true);
+#endif
+
+	//  Hand back a copy, as receiving on a socket while walking the list takes it out of the ready list
+	readySockets = m_ReadySockets;
+	return int(readySockets.size());
+}
+
+inline void WinsockWrapper::SetSocketReady(int socketID, bool ready)
+{
+	if (socketID < 0) return;
+	if (int(m_SocketReady.size()) <= socketID) m_SocketReady.resize(socketID + 1, false);
+	if (m_SocketReady[socketID] == ready) return;
+
+	m_SocketReady[socketID] = ready;
+	if (ready) { m_ReadySockets.push_back(socketID); return; }
+
+	auto iter = std::find(m_ReadySockets.begin(), m_ReadySockets.end(), socketID);
+	if (iter == m_ReadySockets.end()) return;
+	*iter = m_ReadySockets.back();
+	m_ReadySockets.pop_back();
+}
+
+
+inline int WinsockWrapper::FlushSendQueues()
+{
+	auto totalSent = 0;
+	for (auto i = 0; i < int(m_SendPendingSockets.size());)
+	{
+		auto socketID = m_SendPendingSockets[i];
+		auto socket = m_SocketList[socketID];
+
+#ifdef __linux__
+		//  A socket that filled up is left alone until epoll says it has room again
+		auto watched = ((socketID < int(m_SocketWatched.size())) && m_SocketWatched[socketID]);
+		if (watched && socket->getsendblocked()) { ++i; continue; }
+#endif
+
+		auto sent = socket->flushsend();
+		if (sent > 0) totalSent += sent;
+
+		//  Done with once it's empty, or once it has failed (which the connection's next receive will find out about)
+		if ((sent < 0) || socket->getsendqueue().GetEmpty())
+		{
+			m_SendPending[socketID] = false;
+			m_SendPendingSockets[i] = m_SendPendingSockets.back();
+			m_SendPendingSockets.pop_back();
+			continue;
+		}
+		++i;
+	}
+	return totalSent;
+}
+
+inline bool WinsockWrapper::GetSendBackpressure(int socketID, int channel) const
+{
+	auto socket = GetSocket(socketID);
+	return ((socket != nullptr) && socket->getsendqueue().GetBackpressure(channel));
+}
+
+inline const SendQueue* WinsockWrapper::GetSendQueue(int socketID) const
+{
+	auto socket = GetSocket(socketID);
+	return ((socket == nullptr) ? nullptr : &socket->getsendqueue());
+}
+
+inline void WinsockWrapper::SetSendPending(int socketID)
+{
+	if (int(m_SendPending.size()) <= socketID) m_SendPending.resize(socketID + 1, false);
+	if (m_SendPending[socketID]) return;
+
+	m_SendPending[socketID] = true;
+	m_SendPendingSockets.push_back(socketID);
+}
+
+
 inline WinsockWrapper::WinsockWrapper() :
 	m_WinsockInitialized(false)
+#ifdef __linux__
+	, m_EpollHandle(-1)
+#endif
 {
 
 }
 
 //  Instance to be utilized by anyone including this header
-WinsockWrapper& winsockWrapper = WinsockWrapper::GetInstance();
\ No newline at end of file
+WinsockWrapper& winsockWrapper = WinsockWrapper::GetInstance();
+
+
+//  A MessageTransport over one of a wrapper's sockets, for protocol coroutines talking to a real connection. Everything it
+//  sends goes on the one send queue channel, so a transfer given a channel of its own shares the connection fairly.
+class WinsockTransport : public MessageTransport
+{
+private:
+	const int SocketID;
+	const std::string IPAddress;
+	const int ConnectionPort;
+	WinsockWrapper& Network;
+	const int Channel;
+
+public:
+	WinsockTransport(int socketID, std::string ipAddress, int port, WinsockWrapper& network = winsockWrapper, int channel = SEND_QUEUE_CONTROL_CHANNEL, std::shared_ptr<RttEstimator> rtt = nullptr) :
+		MessageTransport(rtt),
+		SocketID(socketID),
+		IPAddress(ipAddress),
+		ConnectionPort(port),
+		Network(network),
+		Channel(channel)
+	{}
+
+	inline int GetSocketID() const { return SocketID; }
+	inline int GetChannel() const { return Channel; }
+
+	TransportSendResult SendMessagePacket(SocketBuffer& message) override
+	{
+		//  A channel with a long send queue takes nothing more from the transport until it has drained, which holds file
+		//  transfers back rather than letting them queue up a whole file's chunks
+		if (Network.GetSendBackpressure(SocketID, Channel)) return TRANSPORT_WOULD_BLOCK;
+
+		auto result = Network.SendMessageBuffer(SocketID, IPAddress.c_str(), ConnectionPort, &message, Channel);
+		if (result >= 0) return TRANSPORT_SENT;
+		return ((result == -WSAEWOULDBLOCK) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_CLOSED);
+	}
+};
\ No newline at end of file
@@ -2,19 +2,43 @@
 
 #include <thread>
 #include <filesystem>
-#include "Engine/WinsockWrapper.h"
+#include "Engine/MessageTransport.h"
+#include "Engine/AsyncRuntime.h"
+#include "Engine/NetworkThread.h"
+#include "Engine/SimpleSHA256.h"
+#include "Engine/TransferPacer.h"
+#include "Engine/ReedSolomon.h"
 #include "MessageIdentifiers.h"
 #include "Groundfish.h"
 #include "HostedFileData.h"
 
 
-constexpr auto FILE_CHUNK_SIZE				= 1024;
-constexpr auto FILE_CHUNK_BUFFER_COUNT		= 500;
-constexpr auto FILE_SEND_BUFFER_SIZE		= (FILE_CHUNK_SIZE * FILE_CHUNK_BUFFER_COUNT);
-constexpr auto PORTION_COMPLETE_REMIND_TIME	= 0.1;
+constexpr auto FILE_CHUNK_SIZE = 1024;
+constexpr auto FILE_CHUNK_BUFFER_COUNT = 500;
+constexpr auto FILE_SEND_BUFFER_SIZE = (FILE_CHUNK_SIZE * FILE_CHUNK_BUFFER_COUNT);
+constexpr auto FILE_CHUNKS_PER_FRAME = 64;
+constexpr auto FILE_PROGRESS_EVENT_INTERVAL = 0.1;
 
-constexpr auto UPLOAD_TITLE_MAX_LENGTH		= 40;
-constexpr auto ENCRYPTED_TITLE_MAX_SIZE		= (UPLOAD_TITLE_MAX_LENGTH + 9);
+//  Chunks sent by datagram go in blocks, each followed by parity that can rebuild up to FILE_FEC_PARITY_CHUNKS of its lost chunks
+constexpr auto FILE_FEC_BLOCK_CHUNKS = 50;
+constexpr auto FILE_FEC_PARITY_CHUNKS = 4;
+constexpr auto FILE_FEC_BLOCK_COUNT = ((FILE_CHUNK_BUFFER_COUNT + FILE_FEC_BLOCK_CHUNKS - 1) / FILE_FEC_BLOCK_CHUNKS);
+constexpr auto FILE_REORDER_GRACE_TIME = 0.005;		//  Seconds a receiver waits on chunks still arriving by datagram before asking for them
+constexpr auto FILE_DATAGRAM_STALLED_PASSES = 2;		//  Replies in a row that show no progress before a sender gives up on datagrams
+constexpr auto FILE_DATAGRAM_MIN_RTT = 0.01;			//  Seconds of round trip under which transfers stay on TCP, as a loss costs it little to repair
+
+//  A file whose hosted copy is no larger than the inline limit is sent whole in a FILE_INLINE, in place of a FILE_SEND_INIT, and is
+//  written out as soon as it arrives. The client names its limit in each request, and the smaller of that and the server's is used.
+//  Several can go in one message, up to FILE_INLINE_BUNDLE_MAX_SIZE, or what the user's framing can carry if that's less.
+constexpr auto FILE_INLINE_MAX_SIZE = (64 * 1024);
+constexpr auto FILE_INLINE_BUNDLE_MAX_SIZE = (1024 * 1024);
+constexpr auto FILE_INLINE_BUNDLE_MAX_FILES = 64;
+
+//  A collection (an album, a season) is asked for in one request, and the server sends its files one straight after the other
+constexpr auto FILE_COLLECTION_MAX_FILES = 1024;
+
+constexpr auto UPLOAD_TITLE_MAX_LENGTH = 40;
+constexpr auto ENCRYPTED_TITLE_MAX_SIZE = (UPLOAD_TITLE_MAX_LENGTH + 9);
 
 #define FILE_TRANSFER_DEBUGGING				0
 #if FILE_TRANSFER_DEBUGGING
@@ -22,183 +46,224 @@ constexpr auto ENCRYPTED_TITLE_MAX_SIZE		= (UPLOAD_TITLE_MAX_LENGTH + 9);
 #endif
 
 
-void SendMessage_FileSendInitializer(std::string fileName, std::string fileTitle, std::string fileDescription, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, uint64_t fileSize, int socket, const char* ip, const int port)
+//  Message writers. Each one composes a message as the transport's outgoing message, which the caller then sends
+//  with co_await transport.Write() from a coroutine, or transport.Send() from anywhere else.
+void WriteMessage_FileSendInitializer(MessageTransport& transport, std::string fileName, std::string fileTitle, std::string fileDescription, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, uint64_t fileSize)
 {
 	//  Encrypt the file name, title, and description string using Groundfish
 	EncryptedData encryptedFilename = Groundfish::Encrypt(fileName.c_str(), int(fileName.length()), 0, rand() % 256);
 	EncryptedData encryptedTitle = Groundfish::Encrypt(fileTitle.c_str(), int(fileTitle.length()), 0, rand() % 256);
 	EncryptedData encryptedDescription = Groundfish::Encrypt(fileDescription.c_str(), int(fileDescription.length()), 0, rand() % 256);
 
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_SEND_INIT, 0);
-	winsockWrapper.WriteInt(int(encryptedFilename.size()), 0);
-	winsockWrapper.WriteInt(int(encryptedTitle.size()), 0);
-	winsockWrapper.WriteInt(int(encryptedDescription.size()), 0);
-	winsockWrapper.WriteChars(encryptedFilename.data(), int(encryptedFilename.size()), 0);
-	winsockWrapper.WriteChars(encryptedTitle.data(), int(encryptedTitle.size()), 0);
-	winsockWrapper.WriteChars(encryptedDescription.data(), int(encryptedDescription.size()), 0);
-	winsockWrapper.WriteUnsignedShort((short)(fileTypeID), 0);
-	winsockWrapper.WriteUnsignedShort((short)(fileSubTypeID), 0);
-	winsockWrapper.WriteLongInt(fileSize, 0);
-	winsockWrapper.WriteLongInt(FILE_CHUNK_SIZE, 0);
-	winsockWrapper.WriteLongInt(FILE_CHUNK_BUFFER_COUNT, 0);
-	winsockWrapper.SendMessagePacket(socket, ip, port, 0);
+	auto& message = transport.BeginMessage(MESSAGE_ID_FILE_SEND_INIT);
+	message.writeint(int(encryptedFilename.size()));
+	message.writeint(int(encryptedTitle.size()));
+	message.writeint(int(encryptedDescription.size()));
+	message.writechars((char*)encryptedFilename.data(), int(encryptedFilename.size()));
+	message.writechars((char*)encryptedTitle.data(), int(encryptedTitle.size()));
+	message.writechars((char*)encryptedDescription.data(), int(encryptedDescription.size()));
+	message.writeushort((unsigned short)(fileTypeID));
+	message.writeushort((unsigned short)(fileSubTypeID));
+	message.writelint(fileSize);
+	message.writelint(FILE_CHUNK_SIZE);
+	message.writelint(FILE_CHUNK_BUFFER_COUNT);
 
 #if FILE_TRANSFER_DEBUGGING
-	debugConsole->AddDebugConsoleLine("Message Sent: MESSAGE_ID_FILE_SEND_INIT");
+	debugConsole->AddDebugConsoleLine("Message Written: MESSAGE_ID_FILE_SEND_INIT");
 #endif
 }
 
 
-void SendMessage_FileSendChunk(uint64_t chunkBufferIndex, uint64_t chunkIndex, uint64_t chunkSize, unsigned char* buffer, int socket, const char* ip, const int port)
+void WriteMessage_FileSendChunk(MessageTransport& transport, uint64_t chunkBufferIndex, uint64_t chunkIndex, uint64_t chunkSize, unsigned char* buffer, const unsigned char* chunkDigest)
 {
-	//  Generate the checksum of the buffer to send before it, so the client can confirm the full, unaltered message arrived
-	auto checksum4 = sha256((char*)buffer, 1, int(chunkSize)).substr(0, 4);
-
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_PORTION, 0);
-	winsockWrapper.WriteLongInt(chunkBufferIndex, 0);
-	winsockWrapper.WriteLongInt(chunkIndex, 0);
-	winsockWrapper.WriteLongInt(chunkSize, 0);
-	winsockWrapper.WriteInt(4, 0);
-	winsockWrapper.WriteChars((unsigned char*)checksum4.c_str(), 4, 0);
-	winsockWrapper.WriteChars(buffer, int(chunkSize), 0);
-	winsockWrapper.SendMessagePacket(socket, ip, port, 0);
+	//  Send the checksum of the buffer before it, so the client can confirm the full, unaltered message arrived
+	char checksum4[4];
+	SHA256::DigestToHex(chunkDigest, checksum4, 2);
+
+	auto& message = transport.BeginMessage(MESSAGE_ID_FILE_PORTION);
+	message.writelint(chunkBufferIndex);
+	message.writelint(chunkIndex);
+	message.writelint(chunkSize);
+	message.writeint(4);
+	message.writechars(checksum4, 4);
+	message.writechars((char*)buffer, int(chunkSize));
 }
 
 
-void SendMessage_FileTransferPortionComplete(uint64_t portionIndex, int socket, const char* ip, const int port)
+//  Parity for one block of a portion's chunks (see ReedSolomon). Always a full chunk in size, as the block's short chunk is zero-padded.
+void WriteMessage_FileParityChunk(MessageTransport& transport, uint64_t portionIndex, uint64_t blockIndex, uint64_t parityIndex, const unsigned char* buffer)
 {
-	//  Send a "File Transfer Portion Complete" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_PORTION_COMPLETE, 0);
-	winsockWrapper.WriteLongInt(portionIndex, 0);
-	winsockWrapper.SendMessagePacket(socket, ip, port, 0);
+	auto& message = transport.BeginMessage(MESSAGE_ID_FILE_PARITY);
+	message.writelint(portionIndex);
+	message.writeushort((unsigned short)(blockIndex));
+	message.writeushort((unsigned short)(parityIndex));
+	message.writechars((const char*)(buffer), FILE_CHUNK_SIZE);
+}
+
+
+void WriteMessage_FileTransferPortionComplete(MessageTransport& transport, uint64_t portionIndex)
+{
+	auto& message = transport.BeginMessage(MESSAGE_ID_FILE_PORTION_COMPLETE);
+	message.writelint(portionIndex);
 
 #if FILE_TRANSFER_DEBUGGING
-	debugConsole->AddDebugConsoleLine("Message Sent: MESSAGE_ID_FILE_PORTION_COMPLETE");
+	debugConsole->AddDebugConsoleLine("Message Written: MESSAGE_ID_FILE_PORTION_COMPLETE");
 #endif
 }
 
 
-void SendMessage_FileReceiveReady(int socket, const char* ip, const int port)
+void WriteMessage_FileReceiveReady(MessageTransport& transport)
 {
-	//  Send a "File Receive Ready" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_RECEIVE_READY, 0);
-	winsockWrapper.SendMessagePacket(socket, ip, port, 0);
+	transport.BeginMessage(MESSAGE_ID_FILE_RECEIVE_READY);
 
 #if FILE_TRANSFER_DEBUGGING
-	debugConsole->AddDebugConsoleLine("Message Sent: MESSAGE_ID_FILE_RECEIVE_READY");
+	debugConsole->AddDebugConsoleLine("Message Written: MESSAGE_ID_FILE_RECEIVE_READY");
 #endif
 }
 
 
-void SendMessage_FilePortionCompleteConfirmation(uint64_t portionIndex, int socket, const char* ip, const int port)
+//  A confirmation can carry how long the portion's chunks took to arrive (the bytes after the first, and the microseconds
+//  from the first to the last) for the sender's pacer. A sender that doesn't pace never reads past the portion index.
+void WriteMessage_FilePortionCompleteConfirmation(MessageTransport& transport, uint64_t portionIndex, uint64_t arrivalByteCount = 0, uint64_t arrivalMicroseconds = 0)
 {
-	//  Send a "File Portion Complete Confirmation" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM, 0);
-	winsockWrapper.WriteLongInt(portionIndex, 0);
-	winsockWrapper.SendMessagePacket(socket, ip, port, 0);
+	auto& message = transport.BeginMessage(MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM);
+	message.writelint(portionIndex);
+	if (arrivalByteCount != 0)
+	{
+		message.writelint(arrivalByteCount);
+		message.writelint(arrivalMicroseconds);
+	}
 
 #if FILE_TRANSFER_DEBUGGING
-	debugConsole->AddDebugConsoleLine("Message Sent: MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM");
+	debugConsole->AddDebugConsoleLine("Message Written: MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM");
 #endif
 }
 
 
-void SendMessage_FileChunksRemaining(std::unordered_map<uint64_t, bool>& chunksRemaining, int socket, const char* ip, const int port)
+void WriteMessage_FileChunksRemaining(MessageTransport& transport, const std::vector<bool>& chunksReceived, uint64_t chunksRemaining)
 {
-	//  Send a "File Chunks Remaining" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_CHUNKS_REMAINING, 0);
-	winsockWrapper.WriteInt(chunksRemaining.size(), 0);
-	for (auto i = chunksRemaining.begin(); i != chunksRemaining.end(); ++i) winsockWrapper.WriteShort((short)((*i).first), 0);
-	winsockWrapper.SendMessagePacket(socket, ip, port, 0);
+	auto& message = transport.BeginMessage(MESSAGE_ID_FILE_CHUNKS_REMAINING);
+	message.writeint(int(chunksRemaining));
+	for (size_t i = 0; i < chunksReceived.size(); ++i) if (!chunksReceived[i]) message.writeshort((short)(i));
 
 #if FILE_TRANSFER_DEBUGGING
-	debugConsole->AddDebugConsoleLine("Message Sent: MESSAGE_ID_FILE_CHUNKS_REMAINING");
+	debugConsole->AddDebugConsoleLine("Message Written: MESSAGE_ID_FILE_CHUNKS_REMAINING");
 #endif
 }
 
+
 //  FileSendTask class
+//  Sends a file as a coroutine: buffer a portion, send its chunks, then remind the receiver the portion is done until it
+//  confirms it, re-sending whatever chunks it says are missing. The owner delivers the receiver's replies with Deliver().
+//  A reminder goes unanswered for the connection's retransmit timeout before it's repeated, and each repeat backs the timeout off.
+//  Chunks are paced to the path's estimated bandwidth (see TransferPacer), from what the receiver reports of each portion.
+//  Given a data transport (a datagram channel), the chunks go over it with parity for each block, while everything else stays on
+//  the main transport. If none of a portion gets through, or passes stop getting anything through, the datagrams aren't arriving,
+//  and the rest of the file goes on the main transport.
 class FileSendTask
 {
-public:
-	enum FileChunkSendState
-	{
-		CHUNK_STATE_INITIALIZING = 0,
-		CHUNK_STATE_READY_TO_SEND = 1,
-		CHUNK_STATE_SENDING = 2,
-		CHUNK_STATE_PENDING_COMPLETE = 3,
-		CHUNK_STATE_COMPLETE = 4,
-	};
-
-	bool FileSendStarted;
-
 private:
 	const std::string FileName;
 	const std::string FileTitle;
 	const std::string FilePath;
 	const HostedFileType FileTypeID;
 	const HostedFileSubtype FileSubTypeID;
-	const int SocketID;
-	const std::string IPAddress;
-	const int ConnectionPort;
+	std::shared_ptr<MessageTransport> Transport;
+	std::shared_ptr<MessageTransport> DataTransport;
+	TransportInbox Inbox;
 
-	FileChunkSendState FileChunkTransferState;
 	uint64_t FilePortionIndex;
-	clock_t LastMessageTime;
+	bool TransportClosed;
+	bool DataTransportFailed;
 
 	uint64_t FileSize;
 	std::ifstream FileStream;
 
 	uint64_t FilePortionCount;
 	uint64_t FileChunkCount;
-	std::unordered_map<uint64_t, bool> FileChunksToSend;
+	std::vector<uint64_t> FileChunksToSend;
+	uint64_t FilePortionChunkCount;
 	char FilePortionBuffer[FILE_CHUNK_BUFFER_COUNT][FILE_CHUNK_SIZE];
+	unsigned char FileChunkDigests[FILE_CHUNK_BUFFER_COUNT][SHA256::DIGEST_SIZE];
+	unsigned char FileParityBuffer[FILE_FEC_BLOCK_COUNT][FILE_FEC_PARITY_CHUNKS][FILE_CHUNK_SIZE];
+
+	//  Every chunk and reminder sent is numbered in order, so a chunk sent after the last reminder is known to be still on its way
+	//  when a reply lists it as missing. On one channel, anything sent before a reminder arrives first. Chunks sent by datagram
+	//  can be overtaken by the reminder, but the receiver waits a moment for any still arriving before it replies.
+	uint64_t SendSequence;
+	uint64_t ReminderSendSequence;
+	uint64_t FileChunkSendSequences[FILE_CHUNK_BUFFER_COUNT];
+
+	TransferPacer Pacer;
 
 	double TransferStartTime;
 	double TransferEndTime;
 
 	bool DeleteAfter;
+	bool AwaitReceiveReady;
+	std::function<void()> PortionCompleteCallback;
+
+	//  Declared last, so the coroutine is destroyed before anything it might be using
+	AsyncTask Session;
 
 public:
 	//  Accessors & Modifiers
 	inline std::string GetFileName() const { return FileName; }
 	inline std::string GetFileTitle() const { return FileTitle; }
+	inline std::string GetFilePath() const { return FilePath; }
 	inline uint64_t GetFileSize() const { return FileSize; }
-	inline bool GetFileTransferComplete(void) const { return (FilePortionIndex >= FilePortionCount); }
-	inline int GetFileTransferState() const { return FileChunkTransferState; }
-	inline void SetFileTransferState(int state) { FileChunkTransferState = (FileChunkSendState)state; }
-	inline uint64_t GetFileTransferBytesCompleted() const { return (FilePortionIndex * FILE_SEND_BUFFER_SIZE); }
-	inline double GetPercentageComplete() const { return (double)(GetFileTransferBytesCompleted()) / (double)(FileSize); }
-	inline double GetEstimatedTransferSpeed() const { return (float(GetFileTransferBytesCompleted()) / (std::max<float>(float(gameSeconds - TransferStartTime), 0.01f))); }
+	inline bool GetFileSendStarted() const { return Session.GetStarted(); }
+	inline bool GetFileTransferComplete(void) const { return (FilePortionCount != 0) && (FilePortionIndex >= FilePortionCount); }
+	inline bool GetTransportClosed() const { return TransportClosed; }
+	inline bool GetUsingDataTransport() const { return (DataTransport != nullptr); }
+	inline bool GetDataTransportFailed() const { return DataTransportFailed; }
+	inline uint64_t GetFileTransferBytesCompleted() const { return std::min<uint64_t>(FilePortionIndex * FILE_SEND_BUFFER_SIZE, FileSize); }
+	inline double GetPercentageComplete() const { return (FileSize == 0) ? 0.0 : (double)(GetFileTransferBytesCompleted()) / (double)(FileSize); }
+	inline double GetEstimatedTransferSpeed() const { return (float(GetFileTransferBytesCompleted()) / (std::max<float>(float(AsyncScheduler::GetNow() - TransferStartTime), 0.01f))); }
 	inline void SetFileTransferEndTime(double endTime) { TransferEndTime = endTime; }
 	inline double GetTransferTime() { return TransferEndTime - TransferStartTime; }
 	inline uint64_t GetFilePortionsRemaining() const { return (FilePortionCount - FilePortionIndex); }
 	inline uint64_t GetEstimatedSecondsRemaining() const { auto estimate = GetEstimatedTransferSpeed(); return ((estimate == 0) ? 100 : uint64_t(double(GetFilePortionsRemaining() * FILE_SEND_BUFFER_SIZE) / GetEstimatedTransferSpeed())); }
+	inline void SetPortionCompleteCallback(const std::function<void()>& callback) { PortionCompleteCallback = callback; }
+	inline const TransferPacer& GetPacer() const { return Pacer; }
+	inline void SetPacingCap(double capFraction) { Pacer.SetCapFraction(capFraction); }
+
+	//  A file that follows straight on from another needn't wait to hear the receiver is ready: the receiver's task is made as it
+	//  reads the initializer, and holds on to whatever arrives over the connection after it before it's ready for it
+	inline void SetAwaitReceiveReady(bool awaitReady) { AwaitReceiveReady = awaitReady; }
 
-	FileSendTask(std::string fileName, std::string fileTitle, std::string filePath, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, int socketID, std::string ipAddress, const int port, bool deleteAfter = false) :
-		FileSendStarted(false),
+	//  Only before the send starts. The data transport shares the main transport's RTT estimator.
+	inline void SetDataTransport(std::shared_ptr<MessageTransport> dataTransport) { assert(!Session.GetValid()); DataTransport = dataTransport; }
+
+	//  Hands the send coroutine a message from the receiver (ready, chunks remaining, or portion confirmation)
+	inline void Deliver(std::unique_ptr<TransportMessage> message) { Inbox.Deliver(std::move(message)); }
+
+	FileSendTask(std::string fileName, std::string fileTitle, std::string filePath, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, std::shared_ptr<MessageTransport> transport, bool deleteAfter = false) :
 		FileName(fileName),
 		FileTitle(fileTitle),
 		FilePath(filePath),
 		FileTypeID(fileTypeID),
 		FileSubTypeID(fileSubTypeID),
-		SocketID(socketID),
-		IPAddress(ipAddress),
-		ConnectionPort(port),
-		FileChunkTransferState(CHUNK_STATE_INITIALIZING),
+		Transport(transport),
+		DataTransport(nullptr),
 		FilePortionIndex(0),
-		LastMessageTime(clock()),
-		TransferStartTime(gameSeconds),
-		TransferEndTime(gameSeconds + 0.1),
-		DeleteAfter(deleteAfter)
+		TransportClosed(false),
+		DataTransportFailed(false),
+		FileSize(0),
+		FilePortionCount(0),
+		FileChunkCount(0),
+		FilePortionChunkCount(0),
+		SendSequence(0),
+		ReminderSendSequence(0),
+		TransferStartTime(AsyncScheduler::GetNow()),
+		TransferEndTime(AsyncScheduler::GetNow() + 0.1),
+		DeleteAfter(deleteAfter),
+		AwaitReceiveReady(true),
+		PortionCompleteCallback(nullptr)
 	{
 		//  Initialize the file portion buffer
 		memset(FilePortionBuffer, 0, FILE_SEND_BUFFER_SIZE);
+		memset(FileChunkSendSequences, 0, sizeof(FileChunkSendSequences));
 
 #if FILE_TRANSFER_DEBUGGING
 		debugConsole->AddDebugConsoleLine("FileSendTask created!");
@@ -207,37 +272,29 @@ public:
 
 	~FileSendTask()
 	{
+		Session.Reset();
 		FileStream.close();
 
 		if (DeleteAfter) std::remove(FilePath.c_str());
 	}
 
-	void StartFileSend()
+	//  Starts the send coroutine. The completion callback runs once it finishes (or the transport closes), and may delete this task.
+	void StartFileSend(const std::function<void()>& onComplete = nullptr)
 	{
-		FileSendStarted = true;
-
-		//  Open the file we're sending and ensure the file handler is valid
-		FileStream.open(FilePath, std::ios_base::binary);
-		assert(FileStream.good() && !FileStream.bad());
-
-		//  Get the file size in bytes for the file
-		FileSize = std::filesystem::file_size(FilePath);
-
-		//  Determine the file chunk count and file portion count
-		FileChunkCount = FileSize / FILE_CHUNK_SIZE;
-		if ((FileSize % FILE_CHUNK_SIZE) != 0) FileChunkCount += 1;
-
-		FilePortionCount = FileChunkCount / FILE_CHUNK_BUFFER_COUNT;
-		if ((FileChunkCount % FILE_CHUNK_BUFFER_COUNT) != 0) FilePortionCount += 1;
+		if (Session.GetValid()) return;
+		Session = SendFile();
+		Session.SetOnComplete(onComplete);
+		Session.Start();
+	}
 
-		//  Buffer a portion of the file in preparation of sending it
-		BufferFilePortion(FilePortionIndex);
+private:
+	AsyncTask SendFile();
+	AsyncTask SendPortionChunks(bool withParity = false);
 
-		//  Send a "File Send Initializer" message
-		SendMessage_FileSendInitializer(FileName, FileTitle, "FILE DESCRIPTION", FileTypeID, FileSubTypeID, FileSize, SocketID, IPAddress.c_str(), ConnectionPort);
-	}
+	//  Chunks (and parity) go by datagram while there's a data transport, and on the main transport otherwise
+	inline MessageTransport& GetChunkTransport() { return (DataTransport != nullptr) ? *DataTransport : *Transport; }
 
-	void BufferFilePortion(uint64_t filePortionIndex)
+	void BufferFilePortion(uint64_t filePortionIndex, bool buildParity)
 	{
 #if FILE_TRANSFER_DEBUGGING
 		debugConsole->AddDebugConsoleLine("FileSendTask: Buffering file portion...");
@@ -249,11 +306,13 @@ public:
 		auto portionbufferCount = (((portionByteCount % FILE_CHUNK_SIZE) == 0) ? (portionByteCount / FILE_CHUNK_SIZE) : ((portionByteCount / FILE_CHUNK_SIZE) + 1));
 
 		//  Empty the entire FilePortionBuffer
-		memset(FilePortionBuffer, NULL, FILE_SEND_BUFFER_SIZE);
+		memset(FilePortionBuffer, 0, FILE_SEND_BUFFER_SIZE);
 
 		//  Go through each chunk of the file and place it in the file buffer until we either fill the buffer or run out of file
 		FileChunksToSend.clear();
-		for (auto i = 0; i < portionbufferCount; ++i)
+		const unsigned char* chunkPointers[FILE_CHUNK_BUFFER_COUNT] = {};
+		uint64_t chunkLengths[FILE_CHUNK_BUFFER_COUNT] = {};
+		for (uint64_t i = 0; i < portionbufferCount; ++i)
 		{
 			//  Seek to the beginning of the chunk we're loading
 			auto chunkPosition = portionPosition + (i * FILE_CHUNK_SIZE);
@@ -264,78 +323,221 @@ public:
 			FileStream.read(FilePortionBuffer[i], chunkFill);
 
 			//  Set an indicator that this chunk must be sent into a list
-			FileChunksToSend[i] = true;
+			FileChunksToSend.push_back(i);
+			chunkPointers[i] = (const unsigned char*)FilePortionBuffer[i];
+			chunkLengths[i] = chunkFill;
+		}
+
+		//  Hash every chunk of the portion in one pass, rather than one at a time as each is sent (or re-sent)
+		FilePortionChunkCount = portionbufferCount;
+		sha256MultiBuffer(chunkPointers, chunkLengths, size_t(portionbufferCount), FileChunkDigests);
+		if (!buildParity) return;
+
+		//  Build each block's parity from its chunks. The buffer was emptied first, so a short last chunk is zero-padded.
+		for (uint64_t block = 0; block * FILE_FEC_BLOCK_CHUNKS < portionbufferCount; ++block)
+		{
+			auto firstChunk = block * FILE_FEC_BLOCK_CHUNKS;
+			auto blockChunkCount = std::min<uint64_t>(FILE_FEC_BLOCK_CHUNKS, portionbufferCount - firstChunk);
+			unsigned char* parityPointers[FILE_FEC_PARITY_CHUNKS];
+			for (auto j = 0; j < FILE_FEC_PARITY_CHUNKS; ++j) parityPointers[j] = FileParityBuffer[block][j];
+			ReedSolomon::Encode((const uint8_t* const*)(chunkPointers + firstChunk), int(blockChunkCount), parityPointers, FILE_FEC_PARITY_CHUNKS, FILE_CHUNK_SIZE);
 		}
 	}
 
-	void SendFileChunk()
+	//  Returns how many chunks the receiver says it's missing, before any still on their way are taken off the list
+	int ReadChunksRemaining(TransportMessage& message)
 	{
-		//  Double-check we're not calling this even though our file send is complete
-		if (GetFileTransferComplete()) return;
+		//  Given a list from the file receiver, reset the FileChunksToSend list so we can re-send the necessary file chunks.
+		//  A chunk already re-sent since the last reminder is still on its way, so a reply to an earlier reminder doesn't repeat it.
+		FileChunksToSend.clear();
+		auto chunkCount = message.Buffer.readint();
+		for (auto i = 0; i < chunkCount; ++i)
+		{
+			auto chunkIndex = uint64_t((unsigned short)(message.Buffer.readshort()));
+			if (chunkIndex >= FILE_CHUNK_BUFFER_COUNT) continue;
+			if (FileChunkSendSequences[chunkIndex] > ReminderSendSequence) continue;
+			FileChunksToSend.push_back(chunkIndex);
+		}
+		return chunkCount;
+	}
+};
+
 
-		//  If we're pending completion, wait and send completion confirmation only if we've reached the end
-		if (GetFileTransferState() == CHUNK_STATE_PENDING_COMPLETE)
+inline AsyncTask FileSendTask::SendFile()
+{
+	//  Open the file we're sending and ensure the file handler is valid
+	FileStream.open(FilePath, std::ios_base::binary);
+	assert(FileStream.good() && !FileStream.bad());
+	if (!FileStream.good()) co_return;
+
+	//  Get the file size in bytes for the file, and determine the file chunk count and file portion count
+	FileSize = std::filesystem::file_size(FilePath);
+	FileChunkCount = FileSize / FILE_CHUNK_SIZE;
+	if ((FileSize % FILE_CHUNK_SIZE) != 0) FileChunkCount += 1;
+	FilePortionCount = FileChunkCount / FILE_CHUNK_BUFFER_COUNT;
+	if ((FileChunkCount % FILE_CHUNK_BUFFER_COUNT) != 0) FilePortionCount += 1;
+	TransferStartTime = AsyncScheduler::GetNow();
+
+	//  Buffer the first portion on a worker, then tell the receiver what's coming
+	auto buildParity = (DataTransport != nullptr);
+	co_await RunJob([this, buildParity]() { BufferFilePortion(0, buildParity); });
+	WriteMessage_FileSendInitializer(*Transport, FileName, FileTitle, "FILE DESCRIPTION", FileTypeID, FileSubTypeID, FileSize);
+	if (co_await Transport->Write() == TRANSPORT_CLOSED) { TransportClosed = true; co_return; }
+
+	//  Wait for the receiver to create its file and tell us it's ready
+	while (AwaitReceiveReady)
+	{
+		auto message = co_await Inbox.Receive();
+		if (message->MessageID == MESSAGE_ID_FILE_RECEIVE_READY) break;
+	}
+
+	while (FilePortionIndex < FilePortionCount)
+	{
+		//  The portion's first pass is the pacer's round, and how long it took to go out is half of its delivery sample
+		Pacer.StartRound();
+		auto sendStartTime = AsyncScheduler::GetNow();
+		co_await SendPortionChunks(DataTransport != nullptr);
+		if (TransportClosed) co_return;
+		auto sendSeconds = AsyncScheduler::GetNow() - sendStartTime;
+
+		//  Remind the receiver the portion is complete until it confirms it. A reply listing missing chunks gets those re-sent,
+		//  and then a fresh reminder. The time from a reminder to its reply is a sample of the connection's round trip, unless
+		//  a reminder this portion has been repeated, in which case there's no telling which reminder a reply is answering.
+		auto& rtt = Transport->GetRtt();
+		auto portionConfirmed = false;
+		auto sendReminder = true;
+		auto awaitingReply = false;
+		auto reminderRepeated = false;
+		auto reminderTime = 0.0;
+		auto lastChunksMissing = int(FilePortionChunkCount);
+		auto stalledPasses = 0;
+		while (!portionConfirmed)
 		{
-			//  If enough time has gone by without response from the last one, send the FileTransferPortionComplete message again
-			auto secondsSinceLastMessage = double(clock() - LastMessageTime) / CLOCKS_PER_SEC;
-			if (secondsSinceLastMessage > PORTION_COMPLETE_REMIND_TIME)
+			if (sendReminder)
+			{
+				WriteMessage_FileTransferPortionComplete(*Transport, FilePortionIndex);
+				if (co_await Transport->Write() == TRANSPORT_CLOSED) { TransportClosed = true; co_return; }
+				ReminderSendSequence = ++SendSequence;
+				reminderTime = AsyncScheduler::GetNow();
+				reminderRepeated = reminderRepeated || awaitingReply;
+				awaitingReply = true;
+			}
+
+			auto message = co_await Inbox.Receive(rtt.GetTimeout());
+			if (message == nullptr)
+			{
+				rtt.Backoff();
+				sendReminder = true;
+				continue;
+			}
+
+			//  A confirmation of an earlier portion is a late duplicate, and not a reply to anything sent this portion
+			portionConfirmed = (message->MessageID == MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM) && (message->Buffer.readlint() == FilePortionIndex);
+			auto isReply = portionConfirmed || (message->MessageID == MESSAGE_ID_FILE_CHUNKS_REMAINING);
+			if (!isReply) { sendReminder = false; continue; }
+			if (awaitingReply && !reminderRepeated)
+			{
+				auto now = AsyncScheduler::GetNow();
+				rtt.AddSample(now - reminderTime);
+				Pacer.AddRttSample(now - reminderTime, now);
+			}
+			awaitingReply = false;
+			sendReminder = false;
+
+			//  The confirmation says how long the portion's first pass took to arrive (up to when the receiver first asked for more)
+			if (portionConfirmed)
 			{
-				SendMessage_FileTransferPortionComplete(FilePortionIndex, SocketID, IPAddress.c_str(), ConnectionPort);
-				LastMessageTime = clock();
+				if (message->Buffer.bytesleft() >= 16)
+				{
+					auto arrivalByteCount = message->Buffer.readlint();
+					auto arrivalMicroseconds = message->Buffer.readlint();
+					Pacer.AddDeliverySample(arrivalByteCount, sendSeconds, double(arrivalMicroseconds) / 1000000.0);
+				}
+				break;
 			}
-			return;
+
+			//  If every chunk listed is already on its way again, this answered an earlier reminder, and the latest one's reply is still to come
+			auto chunksMissing = ReadChunksRemaining(*message);
+			if (FileChunksToSend.empty()) continue;
+
+			//  Datagrams that aren't arriving show up as none of the portion arriving, or as replies that stop going down. One reply
+			//  that doesn't go down can be an answer to an earlier reminder, so it takes a few in a row.
+			stalledPasses = (chunksMissing >= lastChunksMissing) ? (stalledPasses + 1) : 0;
+			lastChunksMissing = chunksMissing;
+			if ((DataTransport != nullptr) && ((chunksMissing >= int(FilePortionChunkCount)) || (stalledPasses >= FILE_DATAGRAM_STALLED_PASSES)))
+			{
+				DataTransport = nullptr;
+				DataTransportFailed = true;
+			}
+			co_await SendPortionChunks();
+			if (TransportClosed) co_return;
+			sendReminder = true;
 		}
 
-		//  First, check that we have data left unsent in the current chunk buffer. If not, set us to "Pending Complete" on the current chunk buffer
-		if (FileChunksToSend.begin() == FileChunksToSend.end())
-		{
 #if FILE_TRANSFER_DEBUGGING
-			debugConsole->AddDebugConsoleLine("CHUNK_STATE_PENDING_COMPLETE");
+		debugConsole->AddDebugConsoleLine("FileSendTask portion confirmed");
 #endif
-			SetFileTransferState(CHUNK_STATE_PENDING_COMPLETE);
-			SendMessage_FileTransferPortionComplete(FilePortionIndex, SocketID, IPAddress.c_str(), ConnectionPort);
-			LastMessageTime = clock();
-			return;
-		}
+
+		//  Buffer the next portion for sending, unless we've reached the end of the file
+		TransferEndTime = AsyncScheduler::GetNow();
+		buildParity = (DataTransport != nullptr);
+		if (++FilePortionIndex < FilePortionCount) co_await RunJob([this, buildParity]() { BufferFilePortion(FilePortionIndex, buildParity); });
+		if (PortionCompleteCallback != nullptr) PortionCompleteCallback();
+	}
+}
+
+
+inline AsyncTask FileSendTask::SendPortionChunks(bool withParity)
+{
+	std::vector<uint64_t> chunkList;
+	chunkList.swap(FileChunksToSend);
+
+	Pacer.StartSending(AsyncScheduler::GetNow());
+	for (size_t i = 0; i < chunkList.size(); ++i)
+	{
+		//  Wait for the chunk's turn at the pacing rate, if it isn't due yet
+		auto pacingDelay = Pacer.GetSendDelay(AsyncScheduler::GetNow());
+		if (pacingDelay > 0.0) co_await SleepFor(pacingDelay);
 
 		//  Determine the values needed to access the data (we might need less than the full buffer)
-		auto chunkIndex = uint64_t((*FileChunksToSend.begin()).first);
+		auto chunkIndex = chunkList[i];
 		auto chunkPosition = uint64_t((FilePortionIndex * FILE_SEND_BUFFER_SIZE) + (FILE_CHUNK_SIZE * chunkIndex));
 		auto chunkByteCount = uint64_t(((chunkPosition + FILE_CHUNK_SIZE) > FileSize) ? (FileSize - chunkPosition) : FILE_CHUNK_SIZE);
 
 		//  Write the chunk buffer index, the index of the chunk, the size of the chunk, and then the chunk data
-		SendMessage_FileSendChunk(FilePortionIndex, chunkIndex, chunkByteCount, (unsigned char*)FilePortionBuffer[chunkIndex], SocketID, IPAddress.c_str(), ConnectionPort);
-
-		//  Delete the portionIter to signal we've completed sending it
-		FileChunksToSend.erase(chunkIndex);
-	}
-
-	void SetChunksRemaining(std::unordered_map<int, bool>& chunksRemaining)
-	{
-		//  Given a list from the file receiver, reset the FileChunksToSend list so we can re-send the necessary file chunks
-		FileChunksToSend.clear();
-		for (auto i = chunksRemaining.begin(); i != chunksRemaining.end(); ++i) FileChunksToSend[(*i).first] = true;
-		SetFileTransferState(CHUNK_STATE_SENDING);
+		auto& transport = GetChunkTransport();
+		WriteMessage_FileSendChunk(transport, FilePortionIndex, chunkIndex, chunkByteCount, (unsigned char*)FilePortionBuffer[chunkIndex], FileChunkDigests[chunkIndex]);
+		if (co_await transport.Write() == TRANSPORT_CLOSED) { TransportClosed = true; co_return; }
+		FileChunkSendSequences[chunkIndex] = ++SendSequence;
+		Pacer.OnSend(chunkByteCount, AsyncScheduler::GetNow());
+
+		//  Spread a portion over a few frames, rather than holding up everything else while it goes out
+		if (((i + 1) % FILE_CHUNKS_PER_FRAME) == 0) co_await YieldFrame();
 	}
+	if (!withParity) co_return;
 
-	void ConfirmFilePortionSendComplete(uint64_t portionIndex)
+	//  The parity follows the portion's chunks, so a block that lost a few of them can be rebuilt without asking for them again
+	for (uint64_t block = 0; block * FILE_FEC_BLOCK_CHUNKS < FilePortionChunkCount; ++block)
 	{
-#if FILE_TRANSFER_DEBUGGING
-		debugConsole->AddDebugConsoleLine("FileSendTask ConfirmFilePortionSendComplete");
-#endif
-
-		//  If this message is not regarding the current file portion index, ignore it
-		if (FilePortionIndex != portionIndex) return;
-
-		//  If we've reached the end of the file, don't attempt to buffer anything, and leave the state PENDING COMPLETE
-		if (++FilePortionIndex >= FilePortionCount)  return;
+		for (auto j = 0; j < FILE_FEC_PARITY_CHUNKS; ++j)
+		{
+			auto pacingDelay = Pacer.GetSendDelay(AsyncScheduler::GetNow());
+			if (pacingDelay > 0.0) co_await SleepFor(pacingDelay);
 
-		//  Buffer the next file portion for sending
-		BufferFilePortion(FilePortionIndex);
+			auto& transport = GetChunkTransport();
+			WriteMessage_FileParityChunk(transport, FilePortionIndex, block, j, FileParityBuffer[block][j]);
+			if (co_await transport.Write() == TRANSPORT_CLOSED) { TransportClosed = true; co_return; }
+			Pacer.OnSend(FILE_CHUNK_SIZE, AsyncScheduler::GetNow());
+		}
 	}
-};
+}
 
 
+//  FileReceiveTask class
+//  Receives a file as a coroutine: collect a portion's chunks, and when the sender says the portion is done either ask for
+//  the missing chunks or write the portion out in one go and confirm it. The owner delivers the sender's messages with Deliver().
+//  Chunks that came by datagram may come with parity, and any block missing no more chunks than it has parity is rebuilt
+//  before we ask, so only the losses the parity couldn't cover cost a round trip.
 class FileReceiveTask
 {
 private:
@@ -349,9 +551,8 @@ private:
 	const uint64_t FileChunkSize;
 	const uint64_t FileChunkBufferCount;
 	const std::string TempFileName;
-	const int SocketID;
-	const std::string IPAddress;
-	const int ConnectionPort;
+	std::shared_ptr<MessageTransport> Transport;
+	TransportInbox Inbox;
 
 	uint64_t FilePortionIndex;
 	bool FileTransferComplete;
@@ -359,15 +560,37 @@ private:
 	bool DecryptWhenReceived;
 	uint64_t FileChunkCount;
 	uint64_t FilePortionCount;
-	std::unordered_map<uint64_t, bool> FileChunksToReceive;
 	std::ofstream FileStream;
 	uint64_t CurrentPortionChunkCount;
 
+	//  Which of the current portion's chunks have arrived. Sized once, so receiving a chunk never allocates.
+	std::vector<bool> FileChunksReceived;
+	uint64_t FileChunksRemaining;
+
+	//  The current portion's parity, a block at a time, and which of it has arrived
+	std::vector<unsigned char> FileParityBuffer;
+	std::vector<bool> FileParityReceived;
+	uint64_t FileChunksRepaired;
+
+	//  How long the current portion's chunks took to arrive, reported to the sender's pacer. Only what arrived before we first
+	//  asked for any again counts, as anything after that was sent again, later.
+	double PortionFirstArrivalTime;
+	double PortionLastArrivalTime;
+	uint64_t PortionArrivalCount;
+	uint64_t PortionArrivalByteCount;
+	bool PortionChunksRequested;
+	double LastArrivalTime;
+
 	double TransferStartTime;
 	double TransferEndTime;
+	double LastProgressEventTime;
+	std::function<void()> PortionCompleteCallback;
+
+	//  The portion currently being received. It's written to the temporary file in one go once every chunk has arrived.
+	std::vector<unsigned char> FilePortionBuffer;
 
-	//  NOTE: The file chunk data buffer is set to a size of FILE_CHUNK_SIZE, which assumes this header is the same on sender and receiver.
-	unsigned char FileChunkDataBuffer[FILE_CHUNK_SIZE];
+	//  Declared last, so the coroutine is destroyed before anything it might be using
+	AsyncTask Session;
 
 public:
 	//  Accessors & Modifiers
@@ -381,28 +604,39 @@ public:
 	inline bool GetDecryptWhenRecieved() const { return DecryptWhenReceived; }
 	inline uint64_t GetFileSendBufferSize() const { return FileChunkSize * FileChunkBufferCount; }
 	inline std::string GetTemporaryFileName() const { return TempFileName; }
-	inline double GetPortionPartComplete() const { return double(CurrentPortionChunkCount - FileChunksToReceive.size()) / double(CurrentPortionChunkCount); }
+	inline double GetPortionPartComplete() const { return double(CurrentPortionChunkCount - FileChunksRemaining) / double(CurrentPortionChunkCount); }
 	inline double GetPercentageComplete() const { return (double(FilePortionIndex) + GetPortionPartComplete()) * double(GetFileSendBufferSize()) / double(FileSize); }
 	inline void SetFileTransferEndTime(double endTime) { TransferEndTime = endTime; }
 	inline double GetTransferTime() { return TransferEndTime - TransferStartTime; }
 	inline uint64_t GetFileTransferBytesCompleted() const { return (FilePortionIndex * GetFileSendBufferSize()); }
-	inline double GetEstimatedTransferSpeed() const { return (float(GetFileTransferBytesCompleted()) / (std::max<float>(float(gameSeconds - TransferStartTime), 0.01f))); }
+	inline double GetEstimatedTransferSpeed() const { return (float(GetFileTransferBytesCompleted()) / (std::max<float>(float(AsyncScheduler::GetNow() - TransferStartTime), 0.01f))); }
 	inline uint64_t GetFilePortionsRemaining() const { return (FilePortionCount - FilePortionIndex); }
 	inline uint64_t GetEstimatedSecondsRemaining() const { return uint64_t(double(GetFilePortionsRemaining() * GetFileSendBufferSize()) / GetEstimatedTransferSpeed()); }
+	inline void SetPortionCompleteCallback(const std::function<void()>& callback) { PortionCompleteCallback = callback; }
+	inline uint64_t GetFileChunksRepaired() const { return FileChunksRepaired; }
 
 	inline void SetDecryptWhenReceived(bool decrypt) { DecryptWhenReceived = decrypt; }
 	inline void ResetChunksToReceiveMap(uint64_t chunkCount) {
-		FileChunksToReceive.clear(); for (auto i = 0; i < int(chunkCount); ++i)  FileChunksToReceive[i] = true; CurrentPortionChunkCount = chunkCount; }
+		FileChunksReceived.assign(size_t(chunkCount), false); FileChunksRemaining = chunkCount; CurrentPortionChunkCount = chunkCount;
+		FileParityReceived.assign(FileParityReceived.size(), false);
+		PortionArrivalCount = 0; PortionArrivalByteCount = 0; PortionChunksRequested = false;
+	}
 
 	inline void CreateTemporaryFile(const std::string tempFileName, const uint64_t tempFileSize) const {
-		std::ofstream outputFile(tempFileName, std::ios::binary | std::ios::trunc | std::ios_base::beg);
+		std::ofstream outputFile(tempFileName, std::ios::binary | std::ios::trunc);
 		assert(outputFile.good() && !outputFile.bad());
-		outputFile.seekp(tempFileSize - 1);
-		outputFile.write("", 1);
+		if (tempFileSize > 0)
+		{
+			outputFile.seekp(tempFileSize - 1);
+			outputFile.write("", 1);
+		}
 		outputFile.close();
 	}
 
-	FileReceiveTask(std::string fileName, std::string fileTitle, std::string fileDescription, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, uint64_t fileSize, uint64_t fileChunkSize, uint64_t fileChunkBufferCount, std::string tempFilePath, int socketID, std::string ipAddress, const int port) :
+	//  Hands the receive coroutine a message from the sender (a chunk, or a portion complete reminder)
+	inline void Deliver(std::unique_ptr<TransportMessage> message) { Inbox.Deliver(std::move(message)); }
+
+	FileReceiveTask(std::string fileName, std::string fileTitle, std::string fileDescription, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID, uint64_t fileSize, uint64_t fileChunkSize, uint64_t fileChunkBufferCount, std::string tempFilePath, std::shared_ptr<MessageTransport> transport) :
 		FileName(fileName),
 		FileTitle(fileTitle),
 		FileDescription(fileDescription),
@@ -411,139 +645,262 @@ public:
 		FileSize(fileSize),
 		FileChunkSize(fileChunkSize),
 		FileChunkBufferCount(fileChunkBufferCount),
-		CurrentPortionChunkCount(fileChunkBufferCount),
 		TempFileName(tempFilePath),
-		SocketID(socketID),
-		IPAddress(ipAddress),
-		ConnectionPort(port),
+		Transport(transport),
 		FilePortionIndex(0),
 		FileTransferComplete(false),
-		TransferStartTime(gameSeconds),
-		TransferEndTime(gameSeconds + 0.1)
+		DecryptWhenReceived(false),
+		CurrentPortionChunkCount(fileChunkBufferCount),
+		FileChunksRemaining(0),
+		FileChunksRepaired(0),
+		PortionFirstArrivalTime(0.0),
+		PortionLastArrivalTime(0.0),
+		PortionArrivalCount(0),
+		PortionArrivalByteCount(0),
+		PortionChunksRequested(false),
+		LastArrivalTime(0.0),
+		TransferStartTime(AsyncScheduler::GetNow()),
+		TransferEndTime(AsyncScheduler::GetNow() + 0.1),
+		LastProgressEventTime(0.0),
+		PortionCompleteCallback(nullptr)
 	{
-		//  Initialize member variable data arrays
-		memset(FileChunkDataBuffer, 0, FILE_CHUNK_SIZE);
+		//  The chunk size and count come from the sender, and whoever read them from it has checked them with GetChunkLayoutValid()
+		assert(GetChunkLayoutValid(FileChunkSize, FileChunkBufferCount));
+		FilePortionBuffer.resize(size_t(FileChunkSize * FileChunkBufferCount));
+		auto parityCount = ((FileChunkBufferCount + FILE_FEC_BLOCK_CHUNKS - 1) / FILE_FEC_BLOCK_CHUNKS) * FILE_FEC_PARITY_CHUNKS;
+		FileParityBuffer.resize(size_t(parityCount * FileChunkSize));
+		FileParityReceived.assign(size_t(parityCount), false);
 
 		//  Determine the count of file chunks and file portions we'll be receiving
 		FileChunkCount = ((FileSize % FileChunkSize) == 0) ? (FileSize / FileChunkSize) : ((FileSize / FileChunkSize) + 1);
 		FilePortionCount = ((FileChunkCount % FileChunkBufferCount) == 0) ? (FileChunkCount / FileChunkBufferCount) : ((FileChunkCount / FileChunkBufferCount) + 1);
 
-		//  Reset the FileChunksToReceive list, which we use to confirm we've successfully received all chunks in a file portion
+		//  Reset the FileChunksReceived list, which we use to confirm we've successfully received all chunks in a file portion
 		ResetChunksToReceiveMap((FileChunkCount > FileChunkBufferCount) ? fileChunkBufferCount : FileChunkCount);
 
-		//  Create a temporary file of the proper size based on the sender's file description
-		CreateTemporaryFile(TempFileName, FileSize);
-
-		//  Open the temporary file, this time keeping the file handle open for later writing
-		FileStream.open(TempFileName, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
-		assert(FileStream.good() && !FileStream.bad());
-
 #if FILE_TRANSFER_DEBUGGING
 		debugConsole->AddDebugConsoleLine("File Receive Task created!");
 #endif
+	}
 
-		//  Send a signal to the file sender that we're ready to receive the file
-		SendMessage_FileReceiveReady(SocketID, IPAddress.c_str(), ConnectionPort);
+	//  The chunk size and count a sender gives in its initializer can't be larger than our own sends use
+	static inline bool GetChunkLayoutValid(uint64_t fileChunkSize, uint64_t fileChunkBufferCount)
+	{
+		return (fileChunkSize > 0) && (fileChunkSize <= FILE_CHUNK_SIZE) && (fileChunkBufferCount > 0) && (fileChunkBufferCount <= FILE_CHUNK_BUFFER_COUNT);
 	}
 
 	~FileReceiveTask()
 	{
+		Session.Reset();
 		if (FileStream.is_open()) FileStream.close();
 	}
 
+	//  Starts the receive coroutine. The completion callback runs once the file is complete (or the transport closes), and may delete this task.
+	void StartFileReceive(const std::function<void()>& onComplete = nullptr)
+	{
+		if (Session.GetValid()) return;
+		Session = ReceiveFile();
+		Session.SetOnComplete(onComplete);
+		Session.Start();
+	}
+
+private:
+	AsyncTask ReceiveFile();
+
+	//  The pacer's sample is timed from the portion's first arrival, so the first one's bytes don't count
+	inline void RecordArrival(uint64_t byteCount)
+	{
+		LastArrivalTime = AsyncScheduler::GetNow();
+		if (PortionChunksRequested) return;
+		if (PortionArrivalCount++ == 0) PortionFirstArrivalTime = LastArrivalTime;
+		else PortionArrivalByteCount += byteCount;
+		PortionLastArrivalTime = LastArrivalTime;
+	}
 
-	bool ReceiveFileChunk()
+	void ReceiveFileParity(SocketBuffer& message)
 	{
-		//  Clear out the File Chunk Data Buffer
-		memset(FileChunkDataBuffer, 0, FILE_CHUNK_SIZE);
-		std::string chunkChecksum;
-
-		//  Get the file chunk data from the message, as well as a checksum to check it against
-		auto filePortionIndex = winsockWrapper.ReadLongInt(0);
-		assert(filePortionIndex >= 0);
-		assert(filePortionIndex <= FilePortionCount);
-		auto chunkIndex = winsockWrapper.ReadLongInt(0);
-		assert(chunkIndex >= 0);
-		assert(chunkIndex < FILE_CHUNK_BUFFER_COUNT);
-		auto chunkSize = winsockWrapper.ReadLongInt(0);
-		assert(chunkSize >= 0);
-		assert(chunkSize <= FILE_CHUNK_SIZE);
-		auto checksumSize = winsockWrapper.ReadInt(0);
-		assert(checksumSize >= 0);
-		assert(checksumSize == 4);
-		chunkChecksum = std::string((char*)winsockWrapper.ReadChars(0, checksumSize), checksumSize);
-		memcpy(FileChunkDataBuffer, winsockWrapper.ReadChars(0, int(chunkSize)), int(chunkSize));
-
-		//  If the file transfer is already complete, return out
-		if (FileTransferComplete) return true;
-
-		//  If we're receiving a chunk from a portion other than what we're currently on, return out
-		if (filePortionIndex != FilePortionIndex) return false;
-
-		//  Ensure we haven't already received this chunk. If we have, return out
-		auto iter = FileChunksToReceive.find(chunkIndex);
-		if (iter == FileChunksToReceive.end()) return false;
-
-		//  Check the checksum against the data. If they differ, return out
-		if (sha256((char*)FileChunkDataBuffer, 1, int(chunkSize)).substr(0, 4) != chunkChecksum) return false;
-
-		//  If the data is new and valid, seek to the appropriate position and write it to the temporary file
-		FileStream.seekp((filePortionIndex * FileChunkSize * FileChunkBufferCount) + (chunkIndex * FileChunkSize));
-		FileStream.write((char*)FileChunkDataBuffer, chunkSize);
-
-		//  Remove the chunk index from the list of chunks to receive, and return out
-		FileChunksToReceive.erase(iter);
-
-		auto fileProgressEvent = FileTransferProgressEventData(GetFileTitle(), GetPercentageComplete(), GetTransferTime(), GetFileSize(), GetEstimatedSecondsRemaining(), "Download", "FileSendAndReceive");
-		eventManager.BroadcastEvent(&fileProgressEvent);
-
-		return false;
+		auto filePortionIndex = message.readlint();
+		auto blockIndex = uint64_t(message.readushort());
+		auto parityIndex = uint64_t(message.readushort());
+		if (FileTransferComplete || (filePortionIndex != FilePortionIndex)) return;
+		if ((parityIndex >= FILE_FEC_PARITY_CHUNKS) || (message.bytesleft() != int(FileChunkSize))) return;
+
+		auto paritySlot = size_t((blockIndex * FILE_FEC_PARITY_CHUNKS) + parityIndex);
+		if ((paritySlot >= FileParityReceived.size()) || FileParityReceived[paritySlot]) return;
+		memcpy(FileParityBuffer.data() + (paritySlot * FileChunkSize), message.m_BufferData + message.m_ReadPosition, size_t(FileChunkSize));
+		FileParityReceived[paritySlot] = true;
+		RecordArrival(FileChunkSize);
 	}
 
-	bool CheckFilePortionComplete(uint64_t portionIndex)
+	//  Rebuilds whatever chunks the parity that's arrived can cover, a block at a time
+	void RepairPortion()
 	{
-		//  If we are being requested to check a portion we're not on right now, ignore it and return out
-		if (portionIndex != FilePortionIndex)
+		std::vector<bool> chunksPresent;
+		std::vector<bool> parityPresent(FILE_FEC_PARITY_CHUNKS);
+		for (uint64_t firstChunk = 0; (firstChunk < CurrentPortionChunkCount) && (FileChunksRemaining != 0); firstChunk += FILE_FEC_BLOCK_CHUNKS)
 		{
-			if (portionIndex < FilePortionIndex)
-				SendMessage_FilePortionCompleteConfirmation(portionIndex, SocketID, IPAddress.c_str(), ConnectionPort);
-			return false;
+			auto blockChunkCount = std::min<uint64_t>(FILE_FEC_BLOCK_CHUNKS, CurrentPortionChunkCount - firstChunk);
+			auto firstParity = size_t((firstChunk / FILE_FEC_BLOCK_CHUNKS) * FILE_FEC_PARITY_CHUNKS);
+			chunksPresent.assign(FileChunksReceived.begin() + firstChunk, FileChunksReceived.begin() + firstChunk + blockChunkCount);
+			if (std::find(chunksPresent.begin(), chunksPresent.end(), false) == chunksPresent.end()) continue;
+
+			uint8_t* chunkPointers[FILE_FEC_BLOCK_CHUNKS];
+			const uint8_t* parityPointers[FILE_FEC_PARITY_CHUNKS];
+			for (uint64_t i = 0; i < blockChunkCount; ++i) chunkPointers[i] = FilePortionBuffer.data() + ((firstChunk + i) * FileChunkSize);
+			for (auto j = 0; j < FILE_FEC_PARITY_CHUNKS; ++j)
+			{
+				parityPointers[j] = FileParityBuffer.data() + ((firstParity + j) * FileChunkSize);
+				parityPresent[j] = FileParityReceived[firstParity + j];
+			}
+			if (!ReedSolomon::Repair(chunkPointers, chunksPresent, int(blockChunkCount), parityPointers, parityPresent, FILE_FEC_PARITY_CHUNKS, size_t(FileChunkSize))) continue;
+
+			for (uint64_t i = 0; i < blockChunkCount; ++i)
+			{
+				if (chunksPresent[i]) continue;
+				FileChunksReceived[size_t(firstChunk + i)] = true;
+				--FileChunksRemaining;
+				++FileChunksRepaired;
+			}
+		}
+	}
+
+	void ReceiveFileChunk(SocketBuffer& message)
+	{
+		//  Get the file chunk data from the message, as well as a checksum to check it against. It all comes from the sender, so
+		//  anything out of range has the chunk ignored.
+		auto filePortionIndex = message.readlint();
+		auto chunkIndex = message.readlint();
+		auto chunkSize = message.readlint();
+		auto checksumSize = message.readint();
+		if ((chunkIndex >= FileChunkBufferCount) || (chunkSize > FileChunkSize)) return;
+		if ((checksumSize != 4) || (message.bytesleft() < checksumSize)) return;
+		auto chunkChecksum = message.m_BufferData + message.m_ReadPosition;
+		message.m_ReadPosition += checksumSize;
+
+		//  The chunk is read where it sits in the message, so it's only copied once, into the portion buffer
+		if (message.bytesleft() < int(chunkSize)) return;
+		auto chunkData = (unsigned char*)(message.m_BufferData + message.m_ReadPosition);
+		message.m_ReadPosition += int(chunkSize);
+
+		//  If the file transfer is already complete, or the chunk is from a portion other than what we're currently on, ignore it
+		if (FileTransferComplete) return;
+		if (filePortionIndex != FilePortionIndex) return;
+
+		//  Ensure we haven't already received this chunk. If we have, ignore it
+		if ((chunkIndex >= FileChunksReceived.size()) || FileChunksReceived[size_t(chunkIndex)]) return;
+
+		//  Check the checksum against the data. If they differ, ignore it and let the sender re-send it
+		SHA256 chunkHasher;
+		chunkHasher.update(chunkData, size_t(chunkSize));
+		unsigned char chunkDigest[SHA256::DIGEST_SIZE];
+		char chunkHex[4];
+		chunkHasher.final(chunkDigest);
+		SHA256::DigestToHex(chunkDigest, chunkHex, 2);
+		if (memcmp(chunkHex, chunkChecksum, 4) != 0) return;
+
+		//  If the data is new and valid, place it in the portion buffer and mark the chunk as received
+		//  A short chunk is zero-padded in the buffer, as it was when the sender built the parity from it
+		memcpy(FilePortionBuffer.data() + (chunkIndex * FileChunkSize), chunkData, size_t(chunkSize));
+		if (chunkSize < FileChunkSize) memset(FilePortionBuffer.data() + (chunkIndex * FileChunkSize) + chunkSize, 0, size_t(FileChunkSize - chunkSize));
+		FileChunksReceived[size_t(chunkIndex)] = true;
+		--FileChunksRemaining;
+		RecordArrival(chunkSize);
+		auto now = LastArrivalTime;
+
+		//  The UI only needs a handful of progress updates a second, not one for every chunk
+		if ((FileChunksRemaining != 0) && (now - LastProgressEventTime < FILE_PROGRESS_EVENT_INTERVAL)) return;
+		LastProgressEventTime = now;
+		networkThread.PostEvent(std::make_unique<FileTransferProgressEventData>(GetFileTitle(), GetPercentageComplete(), GetTransferTime(), GetFileSize(), GetEstimatedSecondsRemaining(), "Download", "FileSendAndReceive"));
+	}
+};
+
+
+inline AsyncTask FileReceiveTask::ReceiveFile()
+{
+	//  Create a temporary file of the proper size and open it on a worker, as allocating a large file can take a moment
+	co_await RunJob([this]()
+	{
+		CreateTemporaryFile(TempFileName, FileSize);
+		FileStream.open(TempFileName, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
+	});
+	assert(FileStream.good() && !FileStream.bad());
+
+	//  Send a signal to the file sender that we're ready to receive the file
+	WriteMessage_FileReceiveReady(*Transport);
+	if (co_await Transport->Write() == TRANSPORT_CLOSED) co_return;
+
+	while (FilePortionIndex < FilePortionCount)
+	{
+		auto message = co_await Inbox.Receive();
+		if (message->MessageID == MESSAGE_ID_FILE_PORTION) { ReceiveFileChunk(message->Buffer); continue; }
+		if (message->MessageID == MESSAGE_ID_FILE_PARITY) { ReceiveFileParity(message->Buffer); continue; }
+		if (message->MessageID != MESSAGE_ID_FILE_PORTION_COMPLETE) continue;
+
+		auto portionIndex = message->Buffer.readlint();
+
+		//  A reminder for a portion we've already finished means our confirmation went missing, so send it again
+		if (portionIndex < FilePortionIndex)
+		{
+			WriteMessage_FilePortionCompleteConfirmation(*Transport, portionIndex);
+			if (co_await Transport->Write() == TRANSPORT_CLOSED) co_return;
+			continue;
 		}
+		if (portionIndex != FilePortionIndex) continue;
 
-		//  If there are still chunks we haven't received in this portion, send a list to the server and return out
-		if (FileChunksToReceive.size() != 0)
+		//  Chunks sent by datagram can be overtaken by the reminder sent after them, so take in any still arriving before deciding
+		//  what's missing. Then rebuild what we can from the parity.
+		while ((FileChunksRemaining != 0) && (AsyncScheduler::GetNow() - LastArrivalTime < FILE_REORDER_GRACE_TIME))
 		{
-			SendMessage_FileChunksRemaining(FileChunksToReceive, SocketID, IPAddress.c_str(), ConnectionPort);
-			return false;
+			auto lateMessage = co_await Inbox.Receive(FILE_REORDER_GRACE_TIME);
+			if (lateMessage == nullptr) break;
+			if (lateMessage->MessageID == MESSAGE_ID_FILE_PORTION) ReceiveFileChunk(lateMessage->Buffer);
+			else if (lateMessage->MessageID == MESSAGE_ID_FILE_PARITY) ReceiveFileParity(lateMessage->Buffer);
 		}
+		if (FileChunksRemaining != 0) RepairPortion();
 
-		//  If there are no chunks to receive, send a confirmation that this file portion is complete
-		SendMessage_FilePortionCompleteConfirmation(FilePortionIndex, SocketID, IPAddress.c_str(), ConnectionPort);
+		//  If there are still chunks we haven't received in this portion, send the sender a list of them (which serves as
+		//  a selective acknowledgement of everything else)
+		if (FileChunksRemaining != 0)
+		{
+			WriteMessage_FileChunksRemaining(*Transport, FileChunksReceived, FileChunksRemaining);
+			if (co_await Transport->Write() == TRANSPORT_CLOSED) co_return;
+			PortionChunksRequested = true;
+			continue;
+		}
 
-		//  Iterate to the next file portion, and if we've completed all portions in the file, complete the transfer and decrypt the file
-		if (++FilePortionIndex == FilePortionCount)
+		//  The portion is complete, so write it out in one go on a worker, then confirm it
+		auto portionPosition = FilePortionIndex * GetFileSendBufferSize();
+		auto portionByteCount = std::min<uint64_t>(FileSize - portionPosition, GetFileSendBufferSize());
+		co_await RunJob([this, portionPosition, portionByteCount]()
 		{
-			FileTransferComplete = true;
-			FileStream.close();
-			std::remove(FileName.c_str());
-#if FILE_TRANSFER_DEBUGGING
-			debugConsole->AddDebugConsoleLine("File Receive Task complete!");
-#endif
+			FileStream.seekp(portionPosition);
+			FileStream.write((char*)FilePortionBuffer.data(), portionByteCount);
+		});
 
-			if (DecryptWhenReceived)
-			{
-				return true;
-			}
-			else std::rename(TempFileName.c_str(), FileName.c_str());
-		}
-		else
+		auto arrivalMicroseconds = uint64_t((PortionLastArrivalTime - PortionFirstArrivalTime) * 1000000.0);
+		WriteMessage_FilePortionCompleteConfirmation(*Transport, FilePortionIndex, PortionArrivalByteCount, arrivalMicroseconds);
+		if (co_await Transport->Write() == TRANSPORT_CLOSED) co_return;
+		TransferEndTime = AsyncScheduler::GetNow();
+
+		//  Iterate to the next file portion, and reset the chunk list to ensure we're waiting on the right number of chunks for it
+		if (++FilePortionIndex < FilePortionCount)
 		{
-			//  Reset the chunk list to ensure we're waiting on the right number of chunks for the next portion
 			auto chunksProcessed = FilePortionIndex * FileChunkBufferCount;
 			auto nextChunkCount = (FileChunkCount > (chunksProcessed + FileChunkBufferCount)) ? FileChunkBufferCount : (FileChunkCount - chunksProcessed);
 			ResetChunksToReceiveMap(nextChunkCount);
 		}
 
-		return true;
+		if (PortionCompleteCallback != nullptr) PortionCompleteCallback();
 	}
-};
\ No newline at end of file
+
+	//  We've completed all portions in the file, so complete the transfer
+	FileTransferComplete = true;
+	FileStream.close();
+	std::remove(FileName.c_str());
+#if FILE_TRANSFER_DEBUGGING
+	debugConsole->AddDebugConsoleLine("File Receive Task complete!");
+#endif
+
+	//  A file to be decrypted stays in the temporary file, for the owner to decrypt into place
+	if (!DecryptWhenReceived) std::rename(TempFileName.c_str(), FileName.c_str());
+}
@@ -6,6 +6,8 @@
 #include "Client.h"
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 #include <string>
 
 
@@ -41,6 +43,21 @@ struct FileUploadData
 };
 
 
+//  A collection (an album, a season) downloaded as one, and shown as one entry in the download queue. The server sends its files
+//  one after another, and says how much is left as it starts on each, which with the progress of the file arriving gives the
+//  progress of the whole. Whatever's still to come is asked for again if the connection is lost and the session resumed.
+struct DownloadCollection
+{
+	uint64_t CollectionID = 0;
+	std::string CollectionName = "";
+	std::vector<std::string> FilesRemaining;	//  In the order asked for
+	uint64_t BytesTotal = 0;
+	uint64_t BytesRemaining = 0;				//  As the server last said, counting the file it was starting on
+	uint64_t FileBytesReceived = 0;				//  Of the file arriving since then
+	bool Requested = false;
+};
+
+
 class FileTransfersDialogue : public GUIObjectNode, EventListener
 {
 public:
@@ -59,6 +76,7 @@ public:
 	inline void SetUIHidden() { MenuUINode->SetVisible(false); }
 
 	void AddDownloadToQueue(std::string fileTitle, HostedFileType fileTypeIndex, HostedFileSubtype fileSubTypeIndex);
+	void AddCollectionToQueue(std::string collectionName, const std::vector<std::string>& fileTitles, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID);
 	void AddUploadToQueue(FileUploadData& fileUploadData);
 	void RemoveDownloadFromQueue(std::string fileTitle);
 	void RemoveUploadFromQueue(std::string fileTitle);
@@ -69,6 +87,10 @@ public:
 private:
 	virtual void ReceiveEvent(EventData* eventData) override;
 
+	void RequestQueuedDownloads();
+	DownloadCollection* GetCollectionWithFile(const std::string& fileTitle);
+	void RemoveCollectionFile(DownloadCollection& collection, const std::string& fileTitle);
+	void UpdateCollection(DownloadCollection& collection);
 	void AddTransferEntryToList(GUIListBox* listbox, std::string entryTitle, HostedFileType fileTypeID, HostedFileSubtype fileSubtypeID);
 	void RemoveDownloadFromQueueUI(std::string fileTitle);
 	void RemoveUploadFromQueueUI(std::string fileTitle);
@@ -80,6 +102,17 @@ private:
 	std::unordered_map<std::string, FileUploadData> QueuedUploadsMap;
 	std::vector<std::string> QueuedUploadsList;
 
+	//  What's been asked for from the download queue: the one download asked for on its own, which is streamed if it isn't small,
+	//  the downloads asked for in bundles, which only ever come back inline, and those we've been told are too large to
+	std::string StreamedDownload;
+	std::unordered_set<std::string> BundledDownloads;
+	std::unordered_set<std::string> TooLargeDownloads;
+	bool DownloadRequestsDue = false;
+
+	//  Only the first collection is asked for at a time, as the server sends it through the user's one stream
+	std::vector<DownloadCollection> QueuedCollections;
+	uint64_t NextCollectionID = 1;
+
 	GUIListBox* DownloadQueueListBox;
 	GUIListBox* UploadQueueListBox;
 };
@@ -126,6 +159,10 @@ FileTransfersDialogue::FileTransfersDialogue() :
 
 	eventManager.AddEventListener("FileTransferProgress", this);
 	eventManager.AddEventListener("FileCryptProgress", this);
+	eventManager.AddEventListener("SessionResumed", this);
+	eventManager.AddEventListener("FileRequestResult", this);
+	eventManager.AddEventListener("FileBundleResult", this);
+	eventManager.AddEventListener("CollectionProgress", this);
 }
 
 
@@ -144,6 +181,9 @@ inline void FileTransfersDialogue::Update()
 		Client::GetInstance().SendFileToServer(uploadData.FileName, uploadData.FilePath, uploadData.FileTitle, uploadData.FileTypeID, uploadData.FileSubTypeID);
 	}
 
+	//  Requests are made once a frame, so everything queued in the same frame goes in the same bundle
+	if (DownloadRequestsDue) RequestQueuedDownloads();
+
 	GUIObjectNode::Update();
 }
 
@@ -164,16 +204,30 @@ void FileTransfersDialogue::AddDownloadToQueue(std::string fileTitle, HostedFile
 	auto queuedDownload = QueuedDownloadsMap.find(fileTitle);
 	if (queuedDownload != QueuedDownloadsMap.end()) return;
 
-	if (QueuedDownloadsList.empty())
-		SendMessage_FileRequest(fileTitle, Client::GetInstance().GetServerSocket(), NEW_PROVIDENCE_IP);
-
 	//  Add an entry in the QueuedDownloads map and list
 	QueuedDownloadsMap[fileTitle] = true;
 	QueuedDownloadsList.push_back(fileTitle);
+	DownloadRequestsDue = true;
 
 	AddTransferEntryToList(DownloadQueueListBox, fileTitle, fileTypeID, fileSubTypeID);
 }
 
+void FileTransfersDialogue::AddCollectionToQueue(std::string collectionName, const std::vector<std::string>& fileTitles, HostedFileType fileTypeID, HostedFileSubtype fileSubTypeID)
+{
+	if (fileTitles.empty() || (int(fileTitles.size()) > FILE_COLLECTION_MAX_FILES)) return;
+	for (auto iter = QueuedCollections.begin(); iter != QueuedCollections.end(); ++iter)
+		if ((*iter).CollectionName == collectionName) return;
+
+	DownloadCollection collection;
+	collection.CollectionID = NextCollectionID++;
+	collection.CollectionName = collectionName;
+	collection.FilesRemaining = fileTitles;
+	QueuedCollections.push_back(collection);
+	DownloadRequestsDue = true;
+
+	AddTransferEntryToList(DownloadQueueListBox, collectionName, fileTypeID, fileSubTypeID);
+}
+
 void FileTransfersDialogue::AddUploadToQueue(FileUploadData& uploadData)
 {
 	auto queuedDownload = QueuedUploadsMap.find(uploadData.FileTitle);
@@ -202,6 +256,11 @@ void FileTransfersDialogue::RemoveDownloadFromQueue(std::string fileTitle)
 		}
 	}
 
+	if (StreamedDownload == fileTitle) StreamedDownload.clear();
+	BundledDownloads.erase(fileTitle);
+	TooLargeDownloads.erase(fileTitle);
+	DownloadRequestsDue = true;
+
 	RemoveDownloadFromQueueUI(fileTitle);
 }
 
@@ -247,15 +306,7 @@ bool FileTransfersDialogue::UpdateDownload(std::string entryName, double progres
 		progressBar->SetVisible(true);
 		progressBar->SetProgress(float(progress));
 
-		if (progress >= 1.0 && barColor == COLOR_LIGHTGREEN)
-		{
-			this->RemoveDownloadFromQueue(entryName);
-			if (!QueuedDownloadsList.empty())
-			{
-				SendMessage_FileRequest(QueuedDownloadsList[0], Client::GetInstance().GetServerSocket(), NEW_PROVIDENCE_IP);
-				debugConsole->AddDebugConsoleLine("Attempting to begin the next queued download");
-			}
-		}
+		if (progress >= 1.0 && barColor == COLOR_LIGHTGREEN) this->RemoveDownloadFromQueue(entryName);
 	}
 
 	return true;
@@ -306,13 +357,178 @@ void FileTransfersDialogue::ReceiveEvent(EventData* eventData)
 	if (eventData->EventType.compare("FileTransferProgress") == 0)
 	{
 		auto fpEvent = dynamic_cast<FileTransferProgressEventData*>(eventData);
+		auto collection = (fpEvent->TransferType.compare("Download") == 0) ? GetCollectionWithFile(fpEvent->FileTitle) : nullptr;
+		if (collection != nullptr)
+		{
+			collection->FileBytesReceived = uint64_t(std::min<double>(1.0, fpEvent->Progress) * double(fpEvent->FileSize));
+			UpdateCollection(*collection);
+			return;
+		}
 		SetTransferPercentage(fpEvent->FileTitle, fpEvent->Progress, fpEvent->TotalTime, fpEvent->FileSize, fpEvent->TimeRemaining, fpEvent->TransferType);
 	}
 	else if (eventData->EventType.compare("FileCryptProgress") == 0)
 	{
 		auto cpEvent = dynamic_cast<FileCryptProgressEventData*>(eventData);
+		auto collection = ((cpEvent != nullptr) && (cpEvent->CryptType.compare("Decrypt") == 0)) ? GetCollectionWithFile(cpEvent->FileTitle) : nullptr;
+		if (collection != nullptr)
+		{
+			//  A collection's file is done once it's been decrypted into place
+			if (cpEvent->Progress >= 1.0) RemoveCollectionFile(*collection, cpEvent->FileTitle);
+			return;
+		}
 		if (cpEvent != nullptr) SetCryptPercentage(cpEvent->FileTitle, cpEvent->Progress, cpEvent->CryptType);
 	}
+	else if (eventData->EventType.compare("SessionResumed") == 0)
+	{
+		//  Anything asked for and not yet here went with the old connection, so ask for it again on the new one. A collection
+		//  carries on from the file it was part way through.
+		StreamedDownload.clear();
+		BundledDownloads.clear();
+		if (!QueuedCollections.empty())
+		{
+			QueuedCollections[0].Requested = false;
+			QueuedCollections[0].FileBytesReceived = 0;
+		}
+		DownloadRequestsDue = true;
+	}
+	else if (eventData->EventType.compare("FileRequestResult") == 0)
+	{
+		//  A download that couldn't be had comes out of the queue, so the rest aren't held up behind it
+		auto resultEvent = dynamic_cast<FileRequestResultEventData*>(eventData);
+		if ((resultEvent == nullptr) || resultEvent->Success) return;
+		if ((resultEvent->FileID == StreamedDownload) || (BundledDownloads.find(resultEvent->FileID) != BundledDownloads.end()))
+			RemoveDownloadFromQueue(resultEvent->FileID);
+
+		auto collection = GetCollectionWithFile(resultEvent->FileID);
+		if (collection != nullptr) RemoveCollectionFile(*collection, resultEvent->FileID);
+	}
+	else if (eventData->EventType.compare("FileBundleResult") == 0)
+	{
+		auto bundleEvent = dynamic_cast<FileBundleResultEventData*>(eventData);
+		if (bundleEvent == nullptr) return;
+		for (auto iter = bundleEvent->TooLargeFileIDs.begin(); iter != bundleEvent->TooLargeFileIDs.end(); ++iter)
+		{
+			BundledDownloads.erase(*iter);
+			TooLargeDownloads.insert(*iter);
+		}
+		for (auto iter = bundleEvent->DeferredFileIDs.begin(); iter != bundleEvent->DeferredFileIDs.end(); ++iter)
+			BundledDownloads.erase(*iter);
+		DownloadRequestsDue = true;
+	}
+	else if (eventData->EventType.compare("CollectionProgress") == 0)
+	{
+		auto progressEvent = dynamic_cast<CollectionProgressEventData*>(eventData);
+		if ((progressEvent == nullptr) || QueuedCollections.empty() || (QueuedCollections[0].CollectionID != progressEvent->CollectionID)) return;
+
+		//  The first word from the server is how large the collection is. After a resume it's only what's left, so the total stays.
+		auto& collection = QueuedCollections[0];
+		if (collection.BytesTotal == 0) collection.BytesTotal = progressEvent->BytesRemaining;
+		collection.BytesRemaining = progressEvent->BytesRemaining;
+		collection.FileBytesReceived = 0;
+		UpdateCollection(collection);
+	}
+}
+
+
+void FileTransfersDialogue::RequestQueuedDownloads()
+{
+	DownloadRequestsDue = false;
+
+	//  The first collection is asked for with whatever of it is still to come. It has the user's stream to itself until it's done.
+	auto collectionStreaming = !QueuedCollections.empty();
+	if (collectionStreaming && !QueuedCollections[0].Requested)
+	{
+		auto& collection = QueuedCollections[0];
+		collection.Requested = true;
+		auto collectionID = collection.CollectionID;
+		auto collectionFiles = collection.FilesRemaining;
+		networkThread.Post([collectionID, collectionFiles]() { SendMessage_CollectionRequest(collectionID, collectionFiles, Client::GetInstance().GetServerConnection()); });
+	}
+
+	//  The first download not yet asked for is asked for on its own, unless another is being, and is sent inline if it's small
+	//  or streamed if it isn't. The rest are asked for in one bundle, apart from those we know are too large to come inline,
+	//  which wait their turn to be streamed. A bundle is only ever answered inline, so it's asked for even while a download is
+	//  still streaming, and a queue of small files arrives in a single round trip.
+	std::vector<std::string> bundleRequest;
+	for (auto iter = QueuedDownloadsList.begin(); iter != QueuedDownloadsList.end(); ++iter)
+	{
+		if (((*iter) == StreamedDownload) || (BundledDownloads.find(*iter) != BundledDownloads.end())) continue;
+
+		if (StreamedDownload.empty() && !collectionStreaming)
+		{
+			StreamedDownload = (*iter);
+			auto streamRequest = StreamedDownload;
+			networkThread.Post([streamRequest]() { SendMessage_FileRequest(streamRequest, Client::GetInstance().GetServerConnection()); });
+			continue;
+		}
+
+		if (TooLargeDownloads.find(*iter) != TooLargeDownloads.end()) continue;
+		if (int(bundleRequest.size()) == FILE_INLINE_BUNDLE_MAX_FILES) break;
+		bundleRequest.push_back(*iter);
+	}
+
+	if (bundleRequest.empty()) return;
+	for (auto iter = bundleRequest.begin(); iter != bundleRequest.end(); ++iter) BundledDownloads.insert(*iter);
+	networkThread.Post([bundleRequest]() { SendMessage_FileBundleRequest(bundleRequest, Client::GetInstance().GetServerConnection()); });
+}
+
+
+DownloadCollection* FileTransfersDialogue::GetCollectionWithFile(const std::string& fileTitle)
+{
+	if (QueuedCollections.empty() || !QueuedCollections[0].Requested) return nullptr;
+	auto& filesRemaining = QueuedCollections[0].FilesRemaining;
+	return (std::find(filesRemaining.begin(), filesRemaining.end(), fileTitle) != filesRemaining.end()) ? &QueuedCollections[0] : nullptr;
+}
+
+
+void FileTransfersDialogue::RemoveCollectionFile(DownloadCollection& collection, const std::string& fileTitle)
+{
+	auto fileIter = std::find(collection.FilesRemaining.begin(), collection.FilesRemaining.end(), fileTitle);
+	if (fileIter != collection.FilesRemaining.end()) collection.FilesRemaining.erase(fileIter);
+	UpdateCollection(collection);
+}
+
+
+void FileTransfersDialogue::UpdateCollection(DownloadCollection& collection)
+{
+	auto entry = DownloadQueueListBox->GetItemByName(collection.CollectionName);
+	auto progressBar = (entry == nullptr) ? nullptr : static_cast<GUIProgressBar*>(entry->GetChildByName("ProgressBar"));
+	auto statusLabel = (entry == nullptr) ? nullptr : static_cast<GUILabel*>(entry->GetChildByName("FileStatus"));
+
+	//  Once every file is in, the collection comes out of the queue, and the next download can be asked for
+	if (collection.FilesRemaining.empty())
+	{
+		if (progressBar != nullptr)
+		{
+			progressBar->SetBarColor(COLOR_LIGHTGREEN);
+			progressBar->SetVisible(true);
+			progressBar->SetProgress(1.0f);
+		}
+		if (statusLabel != nullptr) statusLabel->SetText("");
+		RemoveDownloadFromQueueUI(collection.CollectionName);
+
+		auto collectionID = collection.CollectionID;
+		for (auto iter = QueuedCollections.begin(); iter != QueuedCollections.end(); ++iter)
+		{
+			if ((*iter).CollectionID != collectionID) continue;
+			QueuedCollections.erase(iter);
+			break;
+		}
+		DownloadRequestsDue = true;
+		return;
+	}
+
+	auto bytesRemaining = (collection.BytesRemaining > collection.FileBytesReceived) ? (collection.BytesRemaining - collection.FileBytesReceived) : 0;
+	auto progress = (collection.BytesTotal == 0) ? 0.0 : (double(collection.BytesTotal - std::min<uint64_t>(collection.BytesTotal, bytesRemaining)) / double(collection.BytesTotal));
+	if (progressBar != nullptr)
+	{
+		progressBar->SetBarColor(COLOR_LIGHTRED);
+		progressBar->SetVisible(true);
+		progressBar->SetProgress(float(progress));
+	}
+
+	auto filesString = std::to_string(collection.FilesRemaining.size()) + ((collection.FilesRemaining.size() == 1) ? " file, " : " files, ");
+	if (statusLabel != nullptr) statusLabel->SetText(filesString + getDoubleStringRounded(double(bytesRemaining) / (1024.0 * 1024.0), 1) + " MB left");
 }
 
 
@@ -1,15 +1,20 @@
 #pragma once
 
 #include <stdio.h>			/* printf, scanf, puts, NULL */
+#include <stdint.h>			/* uint32_t, uint64_t */
+#include <string.h>			/* memcpy */
 #include <stdlib.h>			/* srand, rand */
 #include <time.h>			/* time */
 #include <assert.h>			/* assert */
 #include <fstream>			/* ifstream, ofstream */
 #include <string>			/* string */
+#include <vector>			/* vector */
 #include <unordered_map>	/* unordered_map */
 #include <filesystem>		/* file_size */
+#include <mutex>			/* mutex */
 
 #define FILE_ENCRYPTION_BYTES_PER_STEP		1024
+#define UNSTAMPED_VERSION_FILE				"WordLists/Unstamped.version"
 
 typedef std::vector<unsigned char> EncryptedData;
 
@@ -17,7 +22,7 @@ namespace Groundfish
 {
 	struct GroundfishWordlist
 	{
-		unsigned long int ListVersion;
+		uint32_t ListVersion;	//  NOTE: Fixed at 4 bytes to match the word list file format on every platform
 		unsigned char WordList[256][256];
 		unsigned char ReverseWordList[256][256];
 	};
@@ -25,18 +30,81 @@ namespace Groundfish
 	GroundfishWordlist CurrentWordList;
 	unsigned int CurrentVersion = 0;
 
+	//  The version of the list that data from before version stamping was encrypted with, which it carries as a 0. Until the first
+	//  rotation, that's the current list. The first rotation records it next to the archives, as from then on it's one of them.
+	int UnstampedVersion = 0;
+
+	//  Word lists retired by a rotation, loaded from "WordLists/N.words" the first time data stamped with that version is seen.
+	//  Any thread may be the first to need one, so the cache is locked. The current list is only changed by UpdateWordList(),
+	//  which the server runs with every other thread that encrypts held off.
+	std::unordered_map<int, GroundfishWordlist*> ArchivedWordLists;
+	std::mutex ArchivedWordListsMutex;
+
+	void LoadWordList(GroundfishWordlist& wordList, int index = -1);
+
+	//  NOTE: Version 0 is what data encrypted before version stamping carries, so that's the list it resolves to when decrypting
+	inline int ResolveVersion(const int wordListVersion)
+	{
+		if (wordListVersion != 0) return wordListVersion;
+		return (UnstampedVersion != 0) ? UnstampedVersion : int(CurrentVersion);
+	}
+
+	//  NOTE: Asking to encrypt with version 0 means the current list, which is what the data is then stamped with
+	inline int GetStampVersion(const int wordListVersion) { return (wordListVersion == 0) ? int(CurrentVersion) : wordListVersion; }
+
+	inline bool GetWordListExists(const int wordListVersion)
+	{
+		auto version = ResolveVersion(wordListVersion);
+		if (version == int(CurrentVersion)) return true;
+		{
+			std::lock_guard<std::mutex> lock(ArchivedWordListsMutex);
+			if (ArchivedWordLists.find(version) != ArchivedWordLists.end()) return true;
+		}
+		return std::filesystem::exists("WordLists/" + std::to_string(version) + ".words");
+	}
+
+	GroundfishWordlist& GetWordList(const int wordListVersion)
+	{
+		auto version = ResolveVersion(wordListVersion);
+		if (version == int(CurrentVersion)) return CurrentWordList;
+
+		std::lock_guard<std::mutex> lock(ArchivedWordListsMutex);
+		auto archivedIter = ArchivedWordLists.find(version);
+		if (archivedIter != ArchivedWordLists.end()) return *(*archivedIter).second;
+
+		//  If the archive for this version is missing, there's nothing we can decrypt with, so fall back to the current list
+		if (!std::filesystem::exists("WordLists/" + std::to_string(version) + ".words")) { assert(false); return CurrentWordList; }
+
+		auto archivedList = new GroundfishWordlist;
+		LoadWordList(*archivedList, version);
+		ArchivedWordLists[version] = archivedList;
+		return *archivedList;
+	}
+
+	inline int GetEncryptedVersion(const unsigned char* encrypted) { int wordListVersion = 0; memcpy((void*)&wordListVersion, (const void*)encrypted, 4); return wordListVersion; }
+
+	//  Whether data from elsewhere is whole: a header, and exactly as many bytes as the header says
+	inline bool GetEncryptedValid(const EncryptedData& encrypted)
+	{
+		if (encrypted.size() < 9) return false;
+		unsigned int messageLength = 0;
+		memcpy((void*)&messageLength, (const void*)&encrypted[4], 4);
+		return (uint64_t(messageLength) == uint64_t(encrypted.size() - 9)) && GetWordListExists(GetEncryptedVersion(encrypted.data()));
+	}
+
 	EncryptedData Encrypt(const char* data, const int dataLength, const int wordListVersion = 0, unsigned char wordIndex = 0)
 	{
 		EncryptedData encryptedData;
 
-		GroundfishWordlist& wordList = (wordListVersion == 0) ? CurrentWordList : CurrentWordList; // TODO: Update this to grab old versions
+		auto stampedVersion = GetStampVersion(wordListVersion);
+		GroundfishWordlist& wordList = GetWordList(stampedVersion);
 		unsigned int encryptionIndex = 0;
 
 		//  Input the word list version number
-		encryptedData.push_back(((unsigned char*)&wordListVersion)[0]);
-		encryptedData.push_back(((unsigned char*)&wordListVersion)[1]);
-		encryptedData.push_back(((unsigned char*)&wordListVersion)[2]);
-		encryptedData.push_back(((unsigned char*)&wordListVersion)[3]);
+		encryptedData.push_back(((unsigned char*)&stampedVersion)[0]);
+		encryptedData.push_back(((unsigned char*)&stampedVersion)[1]);
+		encryptedData.push_back(((unsigned char*)&stampedVersion)[2]);
+		encryptedData.push_back(((unsigned char*)&stampedVersion)[3]);
 		encryptionIndex += 4;
 
 		encryptedData.push_back(((unsigned char*)&dataLength)[0]);
@@ -57,7 +125,8 @@ namespace Groundfish
 
 	bool EncryptAndMoveFile(std::string targetFileName, std::string newFileName, const int wordListVersion = 0, unsigned char wordIndex = 0)
 	{
-		GroundfishWordlist& wordList = (wordListVersion == 0) ? CurrentWordList : CurrentWordList; // TODO: Update this to grab old versions
+		auto stampedVersion = GetStampVersion(wordListVersion);
+		GroundfishWordlist& wordList = GetWordList(stampedVersion);
 
 		std::ifstream targetFile(targetFileName, std::ios_base::binary);
 		assert(targetFile.good() && !targetFile.bad());
@@ -68,7 +137,7 @@ namespace Groundfish
 		//  Get the file size in bytes for the unencrypted file
 		uint64_t fileSize = std::filesystem::file_size(targetFileName);
 
-		newFile.write((char*)&wordListVersion, sizeof(wordListVersion));
+		newFile.write((char*)&stampedVersion, sizeof(stampedVersion));
 		newFile.write((char*)&fileSize, sizeof(fileSize));
 		newFile.write((char*)&wordIndex, sizeof(wordIndex));
 
@@ -93,6 +162,49 @@ namespace Groundfish
 		return true;
 	}
 
+	//  Decrypts a whole file held in memory, as written by EncryptAndMoveFile or a FileEncryptTask, straight into the new file
+	bool DecryptToFile(const EncryptedData& encryptedFile, std::string newFileName)
+	{
+		int wordListVersion = 0;
+		uint64_t fileSize = 0;
+		unsigned char wordIndex = 0;
+		auto headerSize = sizeof(wordListVersion) + sizeof(fileSize) + sizeof(wordIndex);
+		if (encryptedFile.size() < headerSize) return false;
+
+		memcpy((void*)&wordListVersion, (const void*)&encryptedFile[0], sizeof(wordListVersion));
+		memcpy((void*)&fileSize, (const void*)&encryptedFile[sizeof(wordListVersion)], sizeof(fileSize));
+		memcpy((void*)&wordIndex, (const void*)&encryptedFile[sizeof(wordListVersion) + sizeof(fileSize)], sizeof(wordIndex));
+		if ((fileSize != (encryptedFile.size() - headerSize)) || !GetWordListExists(wordListVersion)) return false;
+
+		std::ofstream newFile(newFileName, std::ios_base::binary);
+		if (!newFile.good() || newFile.bad()) return false;
+
+		GroundfishWordlist& wordList = GetWordList(wordListVersion);
+		std::vector<unsigned char> decryptedData(encryptedFile.begin() + headerSize, encryptedFile.end());
+		for (auto& byte : decryptedData) byte = wordList.ReverseWordList[wordIndex++][byte];
+
+		newFile.write((char*)decryptedData.data(), decryptedData.size());
+		newFile.close();
+		return !newFile.fail();
+	}
+
+	EncryptedData Decrypt(const unsigned char* encrypted, const GroundfishWordlist& wordList)
+	{
+		EncryptedData decryptedData;
+
+		unsigned int encryptionIndex = 8;
+		unsigned int messageLength = 0;
+		memcpy((void*)&messageLength, (const void*)&encrypted[4], 4);
+
+		unsigned char wordIndex = wordList.ReverseWordList[0][encrypted[encryptionIndex]];
+		encryptionIndex += 1;
+
+		for (unsigned int i = 0; i < messageLength; ++i)
+			decryptedData.push_back((char)wordList.ReverseWordList[wordIndex++][(unsigned char)encrypted[encryptionIndex + i]]);
+
+		return decryptedData;
+	}
+
 	EncryptedData Decrypt(const unsigned char* encrypted)
 	{
 		EncryptedData decryptedData;
@@ -107,7 +219,7 @@ namespace Groundfish
 		memcpy((void*)&messageLength, (const void*)&encrypted[encryptionIndex], 4);
 		encryptionIndex += 4;
 
-		GroundfishWordlist& wordList = (wordListVersion == 0) ? CurrentWordList : CurrentWordList; // TODO: Update this to grab old versions
+		GroundfishWordlist& wordList = GetWordList(int(wordListVersion));
 
 		std::unordered_map<unsigned char, unsigned char> characterMap;
 		for (int i = 0; i < 256; ++i) characterMap[wordList.WordList[0][i]] = i;
@@ -127,6 +239,14 @@ namespace Groundfish
 		return std::string((char*)decryptedVector.data(), decryptedVector.size());
 	}
 
+	//  Re-encrypts data under the current word list, decrypting with the given list and keeping the original word index
+	EncryptedData ReEncrypt(const EncryptedData& encrypted, const GroundfishWordlist& oldList)
+	{
+		auto decryptedData = Decrypt(encrypted.data(), oldList);
+		unsigned char wordIndex = oldList.ReverseWordList[0][encrypted[8]];
+		return Encrypt((char*)decryptedData.data(), int(decryptedData.size()), 0, wordIndex);
+	}
+
 	void SaveWordList(GroundfishWordlist& savedList, std::string filename)
 	{
 		std::ofstream wordlistOutput(filename.c_str(), std::ofstream::out | std::ifstream::binary);
@@ -137,7 +257,7 @@ namespace Groundfish
 		wordlistOutput.close();
 	}
 
-	void LoadWordList(GroundfishWordlist& wordList, int index = -1)
+	void LoadWordList(GroundfishWordlist& wordList, int index)
 	{
 		std::string filename;
 		if (index == -1) filename += "Groundfish.words";
@@ -159,6 +279,10 @@ namespace Groundfish
 	{
 		LoadWordList(CurrentWordList);
 		CurrentVersion = CurrentWordList.ListVersion;
+
+		std::ifstream unstampedInput(UNSTAMPED_VERSION_FILE);
+		if (unstampedInput.good()) unstampedInput >> UnstampedVersion;
+		unstampedInput.close();
 	}
 
 	void CreateWordList(GroundfishWordlist& newList)
@@ -220,7 +344,23 @@ namespace Groundfish
 	void UpdateWordList()
 	{
 		ArchiveWordList(CurrentWordList);
+
+		//  The first list to be archived is the one anything unstamped was encrypted with
+		if (UnstampedVersion == 0)
+		{
+			UnstampedVersion = int(CurrentWordList.ListVersion);
+			std::ofstream unstampedOutput(UNSTAMPED_VERSION_FILE, std::ofstream::out | std::ofstream::trunc);
+			assert(!unstampedOutput.bad() && unstampedOutput.good());
+			unstampedOutput << UnstampedVersion << "\n";
+			unstampedOutput.close();
+		}
+
 		CreateWordList(CurrentWordList);
+
+		//  Any cached copy of the new version is stale now that it's the current list
+		std::lock_guard<std::mutex> lock(ArchivedWordListsMutex);
+		auto staleIter = ArchivedWordLists.find(int(CurrentVersion));
+		if (staleIter != ArchivedWordLists.end()) { delete (*staleIter).second; ArchivedWordLists.erase(staleIter); }
 	}
 }
 
@@ -247,9 +387,9 @@ struct FileEncryptTask
 		TaskName(taskName),
 		TargetFileName(targetFileName),
 		NewFileName(newFileName),
-		WordListVersion(wordListVersion),
+		WordListVersion(Groundfish::GetStampVersion(wordListVersion)),
 		WordIndex(wordStartingIndex),
-		WordList(Groundfish::CurrentWordList),
+		WordList(Groundfish::GetWordList(WordListVersion)),
 		BytesRead(0),
 		EncryptionComplete(false),
 		EncryptionPercentage(0.0)
@@ -311,7 +451,7 @@ struct FileDecryptTask
 	int WordListVersion;
 	unsigned char WordIndex;
 
-	Groundfish::GroundfishWordlist& WordList;
+	Groundfish::GroundfishWordlist* WordList;
 
 	std::ifstream FileStreamIn;
 	std::ofstream FileStreamOut;
@@ -327,7 +467,7 @@ struct FileDecryptTask
 		TargetFileName(targetFileName),
 		NewFileName(newFileName),
 		DeleteOldFile(deleteOldFile),
-		WordList(Groundfish::CurrentWordList),
+		WordList(&Groundfish::CurrentWordList),
 		BytesRead(0),
 		DecryptionComplete(false),
 		DecryptionPercentage(0.0)
@@ -347,6 +487,9 @@ struct FileDecryptTask
 		FileStreamIn.read((char*)&WordListVersion, sizeof(WordListVersion));
 		FileStreamIn.read((char*)&FileInSize, sizeof(FileInSize));
 		FileStreamIn.read((char*)&WordIndex, sizeof(WordIndex));
+
+		//  Decrypt with the word list the file was stamped with, which may have since been rotated out
+		WordList = &Groundfish::GetWordList(WordListVersion);
 	}
 
 	bool Update()
@@ -363,7 +506,7 @@ struct FileDecryptTask
 		//  If we've gotten this far, we should grab the specified amount of data, decrypt it, and write it to the new file
 		FileStreamIn.read((char*)readArray, bytesToRead);
 		BytesRead += bytesToRead;
-		for (int i = 0; i < bytesToRead; ++i) readArray[i] = (char)WordList.ReverseWordList[WordIndex++][(unsigned char)readArray[i]];
+		for (uint64_t i = 0; i < bytesToRead; ++i) readArray[i] = (char)WordList->ReverseWordList[WordIndex++][(unsigned char)readArray[i]];
 		FileStreamOut.write((char*)readArray, bytesToRead);
 
 		DecryptionPercentage = double(BytesRead) / double(FileInSize);
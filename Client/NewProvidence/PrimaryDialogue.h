@@ -76,6 +76,22 @@ void RequestLatestUploadFile(GUIObjectNode* node)
 	FileTransfersDialogue::GetInstance()->AddDownloadToQueue(entry->GetObjectName(), fileTypeIndex, fileSubTypeIndex);
 }
 
+//  Everything on the page of latest uploads being shown, downloaded as one collection
+void RequestLatestUploadsCollection(GUIObjectNode* node)
+{
+	if (LatestUploadsListBox == nullptr) return;
+	auto entryList = LatestUploadsListBox->GetItemList();
+	if (entryList.empty()) return;
+
+	std::vector<std::string> fileTitles;
+	for (auto iter = entryList.begin(); iter != entryList.end(); ++iter) fileTitles.push_back((*iter)->GetObjectName());
+	auto fileTypeIndex = HostedFileType(entryList[0]->GetChildByName("FileTypeImage")->GetZOrder());
+	auto fileSubTypeIndex = HostedFileSubtype(entryList[0]->GetChildByName("FileSubTypeImage")->GetZOrder());
+
+	auto rangeString = std::to_string(CurrentLatestUploadsStartingIndex) + " to " + std::to_string(CurrentLatestUploadsStartingIndex + int(entryList.size()));
+	FileTransfersDialogue::GetInstance()->AddCollectionToQueue("Latest Uploads (" + rangeString + ")", fileTitles, fileTypeIndex, fileSubTypeIndex);
+}
+
 
 void UpdateLatestUploadsListBoxDownloadButtons(GUIObjectNode* object)
 {
@@ -157,7 +173,8 @@ void RequestHostedFileList(int searchIndex = 0)
 	auto filterType = HostedFileType(GetFileTypeIDFromName(FilterByTypeDropDown->GetSelectedItem()->GetObjectName()));
 	auto filterSubtype = HostedFileSubtype(GetFileSubTypeIDFromName(FilterBySubtypeDropDown->GetSelectedItem()->GetObjectName()));
 
-	SendMessage_RequestHostedFileList(CurrentLatestUploadsStartingIndex, ClientControl.GetServerSocket(), encryptedUser, filterType, filterSubtype);
+	auto startingIndex = CurrentLatestUploadsStartingIndex;
+	networkThread.Post([=]() { SendMessage_RequestHostedFileList(startingIndex, ClientControl.GetServerConnection(), encryptedUser, filterType, filterSubtype); });
 }
 
 
@@ -384,11 +401,9 @@ void FileRequestFailureCallback(std::string fileID, std::string failureReason)
 
 void FileSendFailureCallback(std::string failureReason)
 {
-	//  Generate the full string and set the status bar message
+	//  Generate the full string and set the status bar message (the client has already cancelled the send)
 	auto fullString = "File upload initialization failed: " + failureReason;
 	SetStatusBarMessage(fullString, true);
-
-	ClientControl.CancelFileSend();
 }
 
 void InboxAndNotificationsCountCallback(int inboxCount, int notificationCount)
@@ -405,7 +420,7 @@ void LoginButtonLeftClickCallback(GUIObjectNode* button)
 
 	ClientControl.SetUsername(encryptedUsernameVector);
 
-	SendMessage_UserLoginRequest(encryptedUsernameVector, encryptedPasswordVector, ClientControl.GetServerSocket());
+	networkThread.Post([=]() mutable { SendMessage_UserLoginRequest(encryptedUsernameVector, encryptedPasswordVector, ClientControl.GetServerConnection()); });
 }
 
 void TabFromUsernameBoxCallback(GUIObjectNode* node)
@@ -431,7 +446,7 @@ void EnterFromUsernameOrPasswordBoxCallback(GUIObjectNode* node)
 }
 
 
-class PrimaryDialogue : public GUIObjectNode
+class PrimaryDialogue : public GUIObjectNode, EventListener
 {
 public:
 	PrimaryDialogue();
@@ -451,6 +466,8 @@ private:
 
 	void UpdateUI();
 
+	virtual void ReceiveEvent(EventData* eventData) override;
+
 	//  Status Bar objects
 	GUIObjectNode* StatusBarNode	= nullptr;
 
@@ -482,14 +499,15 @@ inline void PrimaryDialogue::Update()
 {
 	GUIObjectNode::Update();
 
-	if (ClientConnected == CONNECTION_STATUS_CONNECTED) ClientControl.MainProcess();
-
 	UpdateUI();
 }
 
 
 inline void PrimaryDialogue::Shutdown()
 {
+	//  Stop the network thread before the client it's running goes away
+	networkThread.Stop();
+
 	//  Shut down the client
 	ClientControl.Shutdown();
 
@@ -504,6 +522,9 @@ void PrimaryDialogue::InitializeClient()
 	ClientControl.Initialize();
 	ClientConnected = (ClientControl.Connect() ? CONNECTION_STATUS_CONNECTED : CONNECTION_STATUS_CANNOT_CONNECT);
 
+	//  Once connected, the client runs on the network thread, and reports back through events
+	if (ClientConnected == CONNECTION_STATUS_CONNECTED) networkThread.Start([]() { ClientControl.MainProcess(); });
+
 	//  Show a status bar message to tell the user of their connection status
 	auto connectionError = (ClientConnected != CONNECTION_STATUS_CONNECTED);
 	SetStatusBarMessage(connectionError ? "Failed to connect to server. Contact administrator." : "Successfully connected to server!", connectionError);
@@ -649,13 +670,47 @@ void PrimaryDialogue::LoadMainMenuBarUI()
 	LoadSearchFilterUI();
 	LoadSideBarUI();
 
-	//  Set the Client control callbacks
-	ClientControl.SetLoginResponseCallback(LoginRequestResponseCallback);
-	ClientControl.SetInboxAndNotificationCountCallback(InboxAndNotificationsCountCallback);
-	ClientControl.SetLatestUploadsCallback(SetLatestUploads);
-	ClientControl.SetFileRequestFailureCallback(FileRequestFailureCallback);
-	ClientControl.SetFileSendFailureCallback(FileSendFailureCallback);
-	ClientControl.SetFileRequestSuccessCallback(FileRequestSucceeded);
+	//  Listen for the events the Client control sends over from the network thread
+	eventManager.AddEventListener("LoginResponse", this);
+	eventManager.AddEventListener("SessionResumed", this);
+	eventManager.AddEventListener("InboxAndNotificationCount", this);
+	eventManager.AddEventListener("LatestUploads", this);
+	eventManager.AddEventListener("FileRequestResult", this);
+	eventManager.AddEventListener("FileSendFinished", this);
+}
+
+
+void PrimaryDialogue::ReceiveEvent(EventData* eventData)
+{
+	if (eventData->EventType == "LoginResponse")
+	{
+		auto loginEvent = static_cast<LoginResponseEventData*>(eventData);
+		LoginRequestResponseCallback(loginEvent->Response, loginEvent->InboxCount, loginEvent->NotificationCount);
+	}
+	else if (eventData->EventType == "SessionResumed")
+	{
+		SetStatusBarMessage("Lost the connection to the server, and reconnected.", false);
+	}
+	else if (eventData->EventType == "InboxAndNotificationCount")
+	{
+		auto countEvent = static_cast<InboxAndNotificationCountEventData*>(eventData);
+		InboxAndNotificationsCountCallback(countEvent->InboxCount, countEvent->NotificationCount);
+	}
+	else if (eventData->EventType == "LatestUploads")
+	{
+		SetLatestUploads(static_cast<LatestUploadsEventData*>(eventData)->LatestUploads);
+	}
+	else if (eventData->EventType == "FileRequestResult")
+	{
+		auto resultEvent = static_cast<FileRequestResultEventData*>(eventData);
+		if (resultEvent->Success) FileRequestSucceeded(resultEvent->FileID);
+		else FileRequestFailureCallback(resultEvent->FileID, resultEvent->FailureReason);
+	}
+	else if (eventData->EventType == "FileSendFinished")
+	{
+		auto finishedEvent = static_cast<FileSendFinishedEventData*>(eventData);
+		if (!finishedEvent->FailureReason.empty()) FileSendFailureCallback(finishedEvent->FailureReason);
+	}
 }
 
 void PrimaryDialogue::LoadSideBarUI()
@@ -856,6 +911,12 @@ void PrimaryDialogue::LoadSearchFilterUI()
 	applySearchFilterButton->SetText("Apply Search Filter");
 	applySearchFilterButton->SetLeftClickCallback(ApplySearchFilter);
 	searchFilterContainer->AddChild(applySearchFilterButton);
+
+	auto downloadAllButton = GUIButton::CreateTemplatedButton("Standard", 220, 170, 200, 26);
+	downloadAllButton->SetFont("Arial");
+	downloadAllButton->SetText("Download All Listed");
+	downloadAllButton->SetLeftClickCallback(RequestLatestUploadsCollection);
+	searchFilterContainer->AddChild(downloadAllButton);
 }
 
 
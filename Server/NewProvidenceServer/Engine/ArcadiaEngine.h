@@ -60,6 +60,9 @@
 #include "DebugConsole.h"
 #include "AutoPlayManager.h"
 #include "EventManager.h"
+#include "JobSystem.h"
+#include "AsyncRuntime.h"
+#include "NetworkThread.h"
 
 #if AUDIO_ENABLED
 #include "SoundWrapper.h"
@@ -346,6 +349,10 @@ inline bool InitializeEngine(const char* programTitle, float screenWidth, float
 
 inline void ShutdownEngine()
 {
+	//  Stop the network thread first, as it submits jobs, then let the job system finish any outstanding work before the systems it may touch go away
+	networkThread.Stop();
+	jobSystem.Shutdown();
+
 	//  Shut down the manager classes that need it
 	windowManager.Shutdown();
 	guiManager.Shutdown();
@@ -442,6 +449,15 @@ inline void PrimaryLoop()
 			}
 		}
 
+		//  Run the completion callbacks of any jobs that finished since last frame
+		jobSystem.ProcessCompletedJobs();
+
+		//  Broadcast anything the network thread has sent over since last frame
+		networkThread.DispatchEvents();
+
+		//  Resume any coroutines whose timers, frame yields or blocked writes are due, unless the network thread is doing so
+		if (!networkThread.GetRunning()) asyncScheduler.Update();
+
 		//  Pre-Update
 		autoplayManager.Update();
 
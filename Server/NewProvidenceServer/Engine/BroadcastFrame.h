@@ -0,0 +1,50 @@
+#pragma once
+
+#include "SocketBuffer.h"
+#include "FrameDecoder.h"
+#include "SendQueue.h"
+
+#include <vector>
+#include <memory>
+#include <assert.h>
+
+//  Broadcast Frame: a message composed once for many connections (a chat line, the latest uploads list), along with the frame
+//  header every framing version would put ahead of it. It's immutable once made and passed around by shared pointer, so it can
+//  be handed to every shard and queued on every connection as it is: queueing it is a copy of its bytes into the connection's
+//  send queue, with nothing composed, encrypted or framed again per connection.
+
+class BroadcastFrame
+{
+private:
+	std::vector<char>	Message;
+	int					Channel;
+	char				Headers[FRAMING_VERSION_LATEST + 1][FRAME_HEADER_MAX_SIZE];
+	int					HeaderSizes[FRAMING_VERSION_LATEST + 1];
+
+public:
+	BroadcastFrame(const char* message, int messageSize, int channel = SEND_QUEUE_CONTROL_CHANNEL) :
+		Message(message, message + messageSize),
+		Channel(channel)
+	{
+		//  A message too large for a framing gets a header size of 0 there, and can't be sent to connections still using it
+		HeaderSizes[0] = 0;
+		for (auto version = FRAMING_VERSION_LEGACY; version <= FRAMING_VERSION_LATEST; ++version)
+			HeaderSizes[version] = EncodeFrameHeader(version, messageSize, Headers[version], channel);
+	}
+
+	BroadcastFrame(const BroadcastFrame&) = delete;
+	BroadcastFrame& operator=(const BroadcastFrame&) = delete;
+
+	//  Takes the message composed in a buffer (from its message ID on)
+	static inline std::shared_ptr<const BroadcastFrame> Create(const SocketBuffer& message, int channel = SEND_QUEUE_CONTROL_CHANNEL)
+	{
+		return std::make_shared<const BroadcastFrame>(message.m_BufferData, message.m_BufferUtilizedCount, channel);
+	}
+
+	inline const char* GetMessage() const { return Message.data(); }
+	inline int GetMessageSize() const { return int(Message.size()); }
+	inline int GetChannel() const { return Channel; }
+
+	inline const char* GetHeader(int framingVersion) const { assert((framingVersion >= FRAMING_VERSION_LEGACY) && (framingVersion <= FRAMING_VERSION_LATEST)); return Headers[framingVersion]; }
+	inline int GetHeaderSize(int framingVersion) const { assert((framingVersion >= FRAMING_VERSION_LEGACY) && (framingVersion <= FRAMING_VERSION_LATEST)); return HeaderSizes[framingVersion]; }
+};
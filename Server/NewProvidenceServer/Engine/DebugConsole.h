@@ -5,9 +5,11 @@
 #include "FontManager.h"
 #include "GUIListBox.h"
 #include "GUILabel.h"
+#include "LockFreeQueue.h"
 
 #include <unordered_map>
 #include <functional>
+#include <thread>
 
 class DebugConsole : public GUIObjectNode
 {
@@ -24,9 +26,12 @@ public:
 	void AddDebugCommand(std::string command, DebugConsoleCallback callback) { m_DebugConsoleCommands[command] = callback; }
 
 	void EnterCommand(std::string& commandString);
+
+	//  Safe from any thread. Lines from anywhere but the main thread are queued and added on the next Update().
 	void AddDebugConsoleLine(std::string newLine) const;
 
 	virtual void Input(int xOffset = 0, int yOffset = 0) override;
+	virtual void Update() override;
 	virtual void TrueRender(int x = 0, int y = 0) override;
 
 	inline GUIListBox* GetListbox() { return m_DebugConsoleListBox; }
@@ -38,6 +43,8 @@ private:
 	std::string m_Text;
 	float m_LastBackspaceTime;
 	GUIListBox* m_DebugConsoleListBox;
+	std::thread::id m_MainThreadID;
+	mutable MPSCQueue<std::string> m_QueuedLines;
 
 	const float TIME_BETWEEN_BACKSPACES = 0.1f;
 	std::unordered_map<std::string, DebugConsoleCallback> m_DebugConsoleCommands;
@@ -49,7 +56,8 @@ DebugConsole::DebugConsole() :
 	m_Font(nullptr),
 	m_Text(""),
 	m_LastBackspaceTime(0),
-	m_DebugConsoleListBox(nullptr)
+	m_DebugConsoleListBox(nullptr),
+	m_MainThreadID(std::this_thread::get_id())
 {
 	SetZOrder(-9999);
 	SetVisible(false);
@@ -95,11 +103,25 @@ inline void DebugConsole::EnterCommand(std::string& commandString)
 
 inline void DebugConsole::AddDebugConsoleLine(std::string newLine) const
 {
+	if (std::this_thread::get_id() != m_MainThreadID)
+	{
+		m_QueuedLines.Push(newLine);
+		return;
+	}
+
 	auto newLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial-12-White"), newLine.c_str(), 6, 0, m_WindowWidth - 16, 22);
 	m_DebugConsoleListBox->AddItem(newLabel);
 }
 
 
+inline void DebugConsole::Update()
+{
+	std::string queuedLine;
+	while (m_QueuedLines.TryPop(queuedLine)) AddDebugConsoleLine(queuedLine);
+
+	GUIObjectNode::Update();
+}
+
 
 inline void DebugConsole::Input(int xOffset, int yOffset)
 {
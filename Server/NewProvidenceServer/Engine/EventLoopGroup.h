@@ -0,0 +1,170 @@
+#pragma once
+
+#include "AsyncRuntime.h"
+#include "JobSystem.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <assert.h>
+
+//  Event Loop Group: a fixed set of event loop threads (shards), for spreading connections across cores. Each shard has its
+//  own async scheduler, so a coroutine started on a shard is only ever resumed there, and whatever a shard owns is only ever
+//  touched from its own thread. Other threads reach a shard by posting to it.
+//  - Post() runs a callback on one shard, and PostToAll() on every shard, from any thread
+//  - Each pass a shard runs its job completions, its coroutines, then the process function the group was started with. A
+//    shard whose process function had nothing to do sleeps for a moment before the next pass.
+//  - RunExclusive() holds every shard between passes while a callback runs, for the rare change to something every shard
+//    reads without a lock (rotating the word list)
+
+constexpr int EVENT_LOOP_IDLE_SLEEP_MS = 1;
+
+class EventLoopGroup
+{
+public:
+	//  Called every pass on the shard's own thread. Returns whether it found anything to do.
+	typedef std::function<bool(int shardIndex)> ProcessFunction;
+
+	//  Called once on the shard's own thread, after its last pass
+	typedef std::function<void(int shardIndex)> ShutdownFunction;
+
+private:
+	struct Shard
+	{
+		int						Index;
+		std::thread				Thread;
+		AsyncScheduler			Scheduler;
+		std::atomic<uint64_t>	PassCount;
+
+		explicit Shard(int index) : Index(index), PassCount(0) {}
+	};
+
+	std::vector<std::unique_ptr<Shard>> Shards;
+	std::atomic<bool> Running;
+	ProcessFunction Process;
+	ShutdownFunction OnShutdown;
+
+	//  RunExclusive() raises the flag, and every shard parks on the condition at the top of its next pass until it's lowered
+	std::mutex ExclusiveMutex;
+	std::condition_variable ExclusiveCondition;
+	std::atomic<bool> ExclusiveRequested;
+	int ParkedCount;
+
+	static thread_local int CurrentShardIndex;
+
+	void ThreadLoop(Shard* shard);
+	void Park();
+
+public:
+	EventLoopGroup() : Running(false), Process(nullptr), OnShutdown(nullptr), ExclusiveRequested(false), ParkedCount(0) {}
+	~EventLoopGroup() { Stop(); }
+
+	EventLoopGroup(const EventLoopGroup&) = delete;
+	EventLoopGroup& operator=(const EventLoopGroup&) = delete;
+
+	//  One shard per core, leaving one for the network thread
+	static inline int GetDefaultShardCount() { return std::max<int>(1, int(std::thread::hardware_concurrency()) - 1); }
+
+	//  The shard the calling thread is running, or -1 if it isn't one of them
+	static inline int GetCurrentShardIndex() { return CurrentShardIndex; }
+
+	void Start(int shardCount, const ProcessFunction& process, const ShutdownFunction& onShutdown = nullptr);
+	void Stop();
+
+	inline bool GetRunning() const { return Running; }
+	inline int GetShardCount() const { return int(Shards.size()); }
+	inline uint64_t GetPassCount(int shardIndex) const { return Shards[shardIndex]->PassCount.load(std::memory_order_relaxed); }
+
+	inline void Post(int shardIndex, const std::function<void()>& callback) { assert((shardIndex >= 0) && (shardIndex < GetShardCount())); Shards[shardIndex]->Scheduler.PostFromAnyThread(callback); }
+	inline void PostToAll(const std::function<void()>& callback) { for (auto& shard : Shards) shard->Scheduler.PostFromAnyThread(callback); }
+
+	//  Runs the callback on the calling thread while every shard waits between passes. Not for use from a shard itself.
+	void RunExclusive(const std::function<void()>& callback);
+};
+
+inline thread_local int EventLoopGroup::CurrentShardIndex = -1;
+
+
+inline void EventLoopGroup::Start(int shardCount, const ProcessFunction& process, const ShutdownFunction& onShutdown)
+{
+	if (Running) return;
+	assert(shardCount > 0);
+
+	Process = process;
+	OnShutdown = onShutdown;
+	Running = true;
+
+	//  Every shard exists before any thread starts, so a shard can be posted to the moment Start() returns
+	for (auto i = 0; i < shardCount; ++i) Shards.push_back(std::make_unique<Shard>(i));
+	for (auto& shard : Shards) shard->Thread = std::thread(&EventLoopGroup::ThreadLoop, this, shard.get());
+}
+
+
+inline void EventLoopGroup::Stop()
+{
+	if (!Running) return;
+
+	Running = false;
+	for (auto& shard : Shards) if (shard->Thread.joinable()) shard->Thread.join();
+
+	//  Anything still posted to a shard was sent as it shut down, so it's dropped along with the shard
+	Shards.clear();
+}
+
+
+inline void EventLoopGroup::ThreadLoop(Shard* shard)
+{
+	CurrentShardIndex = shard->Index;
+	AsyncScheduler::SetCurrent(&shard->Scheduler);
+
+	while (Running)
+	{
+		if (ExclusiveRequested.load(std::memory_order_acquire)) Park();
+
+		jobSystem.ProcessCompletedJobs();
+		shard->Scheduler.Update();
+		auto busy = (Process != nullptr) && Process(shard->Index);
+		shard->PassCount.fetch_add(1, std::memory_order_relaxed);
+
+		//  Sockets are polled rather than waited on, so only a shard with nothing to do gives the core back
+		if (!busy) std::this_thread::sleep_for(std::chrono::milliseconds(EVENT_LOOP_IDLE_SLEEP_MS));
+	}
+
+	if (OnShutdown != nullptr) OnShutdown(shard->Index);
+
+	AsyncScheduler::SetCurrent(nullptr);
+	CurrentShardIndex = -1;
+}
+
+
+inline void EventLoopGroup::Park()
+{
+	std::unique_lock<std::mutex> lock(ExclusiveMutex);
+	++ParkedCount;
+	ExclusiveCondition.notify_all();
+	ExclusiveCondition.wait(lock, [this]() { return !ExclusiveRequested.load(std::memory_order_acquire); });
+	--ParkedCount;
+}
+
+
+inline void EventLoopGroup::RunExclusive(const std::function<void()>& callback)
+{
+	assert(CurrentShardIndex < 0);
+	if (!Running) { callback(); return; }
+
+	//  The lock is only let go while waiting for the shards, each of which has to take it to park
+	std::unique_lock<std::mutex> lock(ExclusiveMutex);
+	ExclusiveRequested.store(true, std::memory_order_release);
+	ExclusiveCondition.wait(lock, [this]() { return (ParkedCount == GetShardCount()); });
+
+	callback();
+
+	ExclusiveRequested.store(false, std::memory_order_release);
+	ExclusiveCondition.notify_all();
+}
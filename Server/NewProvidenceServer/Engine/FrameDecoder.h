@@ -0,0 +1,321 @@
+#pragma once
+
+#include "SocketBuffer.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <assert.h>
+
+//  Frame Decoder: the receiving end of a TCP connection's framing. Rather than peeking and reading each message on its own,
+//  the socket reads whatever has arrived, in blocks as large as the ring has room for, and complete frames are then taken out
+//  one at a time. A frame is a length header the sender writes ahead of each message, then that many bytes of message.
+//  - GetWriteSpace() and CommitWrite() are for whoever fills the decoder (Socket::receiveframes), without a copy in between
+//  - PopFrame() hands the next whole frame's message over in a buffer, ready to be read, and leaves partial frames where they are
+//
+//  Framing versions. Every connection starts on the legacy framing, and the two ends agree on a newer one once connected:
+//  - FRAMING_VERSION_LEGACY: a 2 byte length, so no message can be larger than 64 KB
+//  - FRAMING_VERSION_LARGE: a varint length (7 bits a byte, low bits first), for messages up to FRAME_MAX_MESSAGE_SIZE
+//  - FRAMING_VERSION_CHANNELS: the varint length, then a byte naming the channel the frame was sent on (see SendQueue.h).
+//    Frames from the older framings all count as being on channel 0.
+//
+//  Large frames skip the ring. Once a frame bigger than FRAME_DIRECT_THRESHOLD reaches the front without having fully arrived,
+//  the rest of its body is read from the socket straight into a buffer of its own, which PopFrame() then swaps into the destination.
+
+constexpr int FRAMING_VERSION_LEGACY		= 1;
+constexpr int FRAMING_VERSION_LARGE			= 2;
+constexpr int FRAMING_VERSION_CHANNELS		= 3;
+constexpr int FRAMING_VERSION_LATEST		= FRAMING_VERSION_CHANNELS;
+
+constexpr int FRAME_LENGTH_MAX_SIZE			= 5;
+constexpr int FRAME_HEADER_MAX_SIZE			= FRAME_LENGTH_MAX_SIZE + 1;
+constexpr int FRAME_LEGACY_MAX_MESSAGE_SIZE	= 0xFFFF;
+constexpr int FRAME_MAX_MESSAGE_SIZE		= 16 * 1024 * 1024;
+constexpr int FRAME_DIRECT_THRESHOLD		= 32 * 1024;
+constexpr int FRAME_DECODER_CAPACITY		= 128 * 1024;		//  Must be a power of two, and hold the largest legacy frame
+
+static_assert(FRAME_HEADER_MAX_SIZE <= SOCKET_BUFFER_HEADER_SPACE, "A frame header must fit in the space a SocketBuffer keeps ahead of its message");
+
+//  Writes the length header for a message of the given size, returning how many bytes it took, or 0 if the framing can't describe it
+inline int EncodeFrameHeader(int framingVersion, int messageLength, char* header, int channel = 0)
+{
+	if (messageLength < 0) return 0;
+
+	if (framingVersion == FRAMING_VERSION_LEGACY)
+	{
+		if (messageLength > FRAME_LEGACY_MAX_MESSAGE_SIZE) return 0;
+		auto length = uint16_t(messageLength);
+		memcpy(header, &length, 2);
+		return 2;
+	}
+
+	if (messageLength > FRAME_MAX_MESSAGE_SIZE) return 0;
+	auto length = uint32_t(messageLength);
+	auto headerSize = 0;
+	do
+	{
+		header[headerSize++] = char((length & 0x7F) | ((length > 0x7F) ? 0x80 : 0x00));
+		length >>= 7;
+	} while (length != 0);
+
+	if (framingVersion >= FRAMING_VERSION_CHANNELS) header[headerSize++] = char(channel);
+	return headerSize;
+}
+
+
+class FrameDecoder
+{
+private:
+	char*		RingData;
+	uint32_t	Capacity;
+	uint32_t	ReadCount;
+	uint32_t	WriteCount;
+	int			FramingVersion;
+	bool		Closed;
+	bool		Corrupt;
+
+	//  The large frame being read straight into its own buffer, if there is one
+	SocketBuffer	DirectFrame;
+	int				DirectFrameSize;
+	int				DirectFrameFilled;
+	int				DirectFrameChannel;
+
+	//  The channel of the frame PopFrame() last took out
+	int				FrameChannel;
+
+	uint64_t	BytesReceived;
+	uint64_t	FramesDecoded;
+	uint64_t	ReceiveCalls;
+
+	inline uint32_t GetMask() const { return Capacity - 1; }
+	inline bool GetDirectFrameActive() const { return (DirectFrameSize >= 0); }
+	inline bool GetDirectFrameFilling() const { return (DirectFrameSize >= 0) && (DirectFrameFilled < DirectFrameSize); }
+
+	//  Copies out of the ring starting at the given count, across the wrap if needed
+	inline void CopyOut(uint32_t fromCount, char* destination, uint32_t length) const
+	{
+		auto start = fromCount & GetMask();
+		auto firstLength = std::min<uint32_t>(length, Capacity - start);
+		memcpy(destination, RingData + start, firstLength);
+		if (firstLength < length) memcpy(destination + firstLength, RingData, length - firstLength);
+	}
+
+	//  Reads the header at the front of the ring. Returns false if it hasn't all arrived, or marks the decoder corrupt if it's invalid.
+	bool ReadFrameHeader(int& headerSize, int& messageLength, int& channel);
+	void BeginDirectFrame(int headerSize, int messageLength, int channel);
+
+public:
+	explicit FrameDecoder(int capacity = FRAME_DECODER_CAPACITY);
+	~FrameDecoder();
+
+	FrameDecoder(const FrameDecoder&) = delete;
+	FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+	inline int GetCapacity() const { return int(Capacity); }
+	inline int GetBufferedBytes() const { return int(WriteCount - ReadCount); }
+	inline int GetFreeSpace() const { return GetDirectFrameFilling() ? (DirectFrameSize - DirectFrameFilled) : int(Capacity - (WriteCount - ReadCount)); }
+
+	//  Frames after the current one are read with the given framing. Takes effect from the next frame taken out.
+	inline void SetFramingVersion(int framingVersion) { FramingVersion = framingVersion; }
+	inline int GetFramingVersion() const { return FramingVersion; }
+
+	//  The contiguous free space to read into next: the rest of a large frame's body, or the ring at its write position
+	char* GetWriteSpace(int& length);
+	void CommitWrite(int length);
+
+	//  The peer closed its end. Anything buffered before then is still there to be taken out.
+	inline void SetClosed() { Closed = true; }
+	inline bool GetClosed() const { return Closed; }
+
+	//  The peer sent a header that can't be read, or a frame larger than allowed, so nothing from there on can be trusted
+	inline bool GetCorrupt() const { return Corrupt; }
+
+	bool GetFrameReady();
+	bool PopFrame(SocketBuffer& destination);
+	void Clear();
+
+	//  The channel the last frame taken out was sent on
+	inline int GetFrameChannel() const { return FrameChannel; }
+
+	inline uint64_t GetBytesReceived() const { return BytesReceived; }
+	inline uint64_t GetFramesDecoded() const { return FramesDecoded; }
+	inline uint64_t GetReceiveCalls() const { return ReceiveCalls; }
+};
+
+
+inline FrameDecoder::FrameDecoder(int capacity) :
+	Capacity(uint32_t(capacity)),
+	ReadCount(0),
+	WriteCount(0),
+	FramingVersion(FRAMING_VERSION_LEGACY),
+	Closed(false),
+	Corrupt(false),
+	DirectFrameSize(-1),
+	DirectFrameFilled(0),
+	DirectFrameChannel(0),
+	FrameChannel(0),
+	BytesReceived(0),
+	FramesDecoded(0),
+	ReceiveCalls(0)
+{
+	assert((capacity > 0) && ((capacity & (capacity - 1)) == 0));
+	assert(capacity >= (2 + FRAME_LEGACY_MAX_MESSAGE_SIZE));
+
+	MANAGE_MEMORY_NEW("WinsockWrapper", Capacity);
+	RingData = new char[Capacity];
+}
+
+
+inline FrameDecoder::~FrameDecoder()
+{
+	MANAGE_MEMORY_DELETE("WinsockWrapper", Capacity);
+	delete[] RingData;
+}
+
+
+inline char* FrameDecoder::GetWriteSpace(int& length)
+{
+	//  A large frame at the front that hasn't all arrived is read straight into its own buffer from here on
+	int headerSize, messageLength, channel;
+	if (!GetDirectFrameActive() && ReadFrameHeader(headerSize, messageLength, channel))
+	{
+		if ((messageLength > FRAME_DIRECT_THRESHOLD) && (GetBufferedBytes() < headerSize + messageLength)) BeginDirectFrame(headerSize, messageLength, channel);
+	}
+
+	if (GetDirectFrameFilling())
+	{
+		length = DirectFrameSize - DirectFrameFilled;
+		return DirectFrame.m_BufferData + DirectFrameFilled;
+	}
+
+	//  Nothing more is read once the stream is corrupt, so the connection is closed rather than reading on regardless
+	auto start = WriteCount & GetMask();
+	length = Corrupt ? 0 : std::min<int>(int(Capacity - (WriteCount - ReadCount)), int(Capacity - start));
+	return RingData + start;
+}
+
+
+inline void FrameDecoder::CommitWrite(int length)
+{
+	assert(length <= GetFreeSpace());
+	if (GetDirectFrameFilling()) DirectFrameFilled += length;
+	else WriteCount += uint32_t(length);
+
+	BytesReceived += uint64_t(length);
+	++ReceiveCalls;
+}
+
+
+inline bool FrameDecoder::ReadFrameHeader(int& headerSize, int& messageLength, int& channel)
+{
+	if (Corrupt) return false;
+	auto buffered = WriteCount - ReadCount;
+	channel = 0;
+
+	if (FramingVersion == FRAMING_VERSION_LEGACY)
+	{
+		if (buffered < 2) return false;
+		uint16_t length = 0;
+		CopyOut(ReadCount, (char*)&length, 2);
+		headerSize = 2;
+		messageLength = int(length);
+		return true;
+	}
+
+	uint32_t length = 0;
+	for (uint32_t i = 0; i < uint32_t(FRAME_LENGTH_MAX_SIZE); ++i)
+	{
+		if (i >= buffered) return false;
+
+		auto headerByte = (unsigned char)(RingData[(ReadCount + i) & GetMask()]);
+		length |= uint32_t(headerByte & 0x7F) << (7 * i);
+		if ((headerByte & 0x80) != 0) continue;
+
+		if (length > uint32_t(FRAME_MAX_MESSAGE_SIZE)) break;
+		headerSize = int(i + 1);
+		messageLength = int(length);
+
+		//  The channel byte follows the length
+		if (FramingVersion >= FRAMING_VERSION_CHANNELS)
+		{
+			if (uint32_t(headerSize) >= buffered) return false;
+			channel = int((unsigned char)(RingData[(ReadCount + uint32_t(headerSize)) & GetMask()]));
+			++headerSize;
+		}
+		return true;
+	}
+
+	Corrupt = true;
+	Closed = true;
+	return false;
+}
+
+
+inline void FrameDecoder::BeginDirectFrame(int headerSize, int messageLength, int channel)
+{
+	//  Whatever of the body is already in the ring moves across, which empties the ring, as nothing after the frame has arrived yet
+	DirectFrame.reserve(messageLength);
+	auto bufferedBody = GetBufferedBytes() - headerSize;
+	CopyOut(ReadCount + uint32_t(headerSize), DirectFrame.m_BufferData, uint32_t(bufferedBody));
+	ReadCount = WriteCount;
+
+	DirectFrameSize = messageLength;
+	DirectFrameFilled = bufferedBody;
+	DirectFrameChannel = channel;
+}
+
+
+inline bool FrameDecoder::GetFrameReady()
+{
+	if (GetDirectFrameActive()) return (DirectFrameFilled == DirectFrameSize);
+
+	int headerSize, messageLength, channel;
+	if (!ReadFrameHeader(headerSize, messageLength, channel)) return false;
+	return ((WriteCount - ReadCount) >= uint32_t(headerSize + messageLength));
+}
+
+
+inline bool FrameDecoder::PopFrame(SocketBuffer& destination)
+{
+	if (!GetFrameReady()) return false;
+	++FramesDecoded;
+
+	if (GetDirectFrameActive())
+	{
+		//  The body is already in a buffer of its own, so hand that over rather than copying it. The destination's old
+		//  storage is kept for the next large frame.
+		destination.swap(DirectFrame);
+		destination.m_BufferUtilizedCount = destination.m_WritePosition = DirectFrameSize;
+		destination.m_ReadPosition = 0;
+		FrameChannel = DirectFrameChannel;
+		DirectFrameSize = -1;
+		DirectFrameFilled = 0;
+		return true;
+	}
+
+	int headerSize = 0, messageLength = 0;
+	ReadFrameHeader(headerSize, messageLength, FrameChannel);
+
+	//  The destination keeps its size from frame to frame, so a connection's receive buffer stops allocating once it has
+	//  seen its largest message
+	destination.reserve(messageLength);
+	CopyOut(ReadCount + uint32_t(headerSize), destination.m_BufferData, uint32_t(messageLength));
+	destination.m_BufferUtilizedCount = destination.m_WritePosition = messageLength;
+	destination.m_ReadPosition = 0;
+
+	ReadCount += uint32_t(headerSize + messageLength);
+	return true;
+}
+
+
+inline void FrameDecoder::Clear()
+{
+	ReadCount = WriteCount = 0;
+	FramingVersion = FRAMING_VERSION_LEGACY;
+	Closed = false;
+	Corrupt = false;
+	DirectFrameSize = -1;
+	DirectFrameFilled = 0;
+	FrameChannel = 0;
+}
+
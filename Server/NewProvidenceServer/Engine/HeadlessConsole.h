@@ -0,0 +1,132 @@
+#pragma once
+
+#include "LockFreeQueue.h"
+
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+//  Headless Console: the debug console for a program with no window. Lines are written to stdout and to a log file, and
+//  commands are typed (or piped) into stdin a line at a time. Commands are added and entered the same way as on the
+//  DebugConsole, so code written against debugConsole runs unchanged in either kind of program.
+
+class HeadlessConsole
+{
+private:
+	HeadlessConsole();
+
+public:
+	typedef std::function<bool(std::string)> DebugConsoleCallback;
+
+	static HeadlessConsole* GetInstance() { static HeadlessConsole* INSTANCE = new HeadlessConsole; return INSTANCE; }
+
+	//  Opens (appending to) the log file every line is copied into. Returns false if it can't be opened.
+	bool SetLogFile(std::string fileName);
+
+	void AddDebugCommand(std::string command, DebugConsoleCallback callback) { m_DebugConsoleCommands[command] = callback; }
+	void EnterCommand(std::string& commandString);
+
+	//  Safe from any thread. Each line goes out whole, so lines from different threads never interleave.
+	void AddDebugConsoleLine(std::string newLine) const;
+
+	//  Starts reading stdin on a thread of its own. Update() enters whatever commands have been read since the last call.
+	void StartReadingInput();
+	void Update();
+
+	//  True once stdin has been closed (or was never open), after which the program can only be stopped by a signal
+	inline bool GetInputClosed() const { return m_InputClosed; }
+
+private:
+	void ReadInput();
+
+	mutable std::mutex m_OutputMutex;
+	mutable std::ofstream m_LogFile;
+	MPSCQueue<std::string> m_EnteredCommands;
+	std::atomic<bool> m_InputClosed;
+
+	std::unordered_map<std::string, DebugConsoleCallback> m_DebugConsoleCommands;
+};
+
+HeadlessConsole::HeadlessConsole() :
+	m_InputClosed(false)
+{
+	//  Help: ["Help"] lists every command that has been added
+	AddDebugCommand("Help", [this](std::string) -> bool
+	{
+		std::vector<std::string> commandList;
+		for (auto& command : m_DebugConsoleCommands) commandList.push_back(command.first);
+		std::sort(commandList.begin(), commandList.end());
+
+		AddDebugConsoleLine("Commands:");
+		for (auto& command : commandList) AddDebugConsoleLine("  " + command);
+		return true;
+	});
+}
+
+inline bool HeadlessConsole::SetLogFile(std::string fileName)
+{
+	std::lock_guard<std::mutex> lock(m_OutputMutex);
+	if (m_LogFile.is_open()) m_LogFile.close();
+	m_LogFile.open(fileName, std::ios_base::out | std::ios_base::app);
+	return m_LogFile.good();
+}
+
+inline void HeadlessConsole::EnterCommand(std::string& commandString)
+{
+	auto soleCommand = false;
+	auto firstSpace = commandString.find_first_of(' ');
+	if (firstSpace == std::string::npos) { soleCommand = true; firstSpace = commandString.length(); }
+	auto command = commandString.substr(0, firstSpace);
+
+	auto debugCommand = m_DebugConsoleCommands.find(command);
+	if (debugCommand == m_DebugConsoleCommands.end())
+	{
+		AddDebugConsoleLine("\"" + commandString + "\" is not a known command. Try \"Help\".");
+		return;
+	}
+
+	commandString = soleCommand ? "" : commandString.substr(firstSpace + 1, commandString.length());
+	debugCommand->second(commandString);
+}
+
+inline void HeadlessConsole::AddDebugConsoleLine(std::string newLine) const
+{
+	std::lock_guard<std::mutex> lock(m_OutputMutex);
+	std::cout << newLine << std::endl;
+	if (m_LogFile.is_open()) m_LogFile << newLine << std::endl;
+}
+
+inline void HeadlessConsole::StartReadingInput()
+{
+	//  A blocking read can't be woken up, so the reader is left to end with the program rather than being joined
+	std::thread(&HeadlessConsole::ReadInput, this).detach();
+}
+
+inline void HeadlessConsole::ReadInput()
+{
+	std::string inputLine;
+	while (std::getline(std::cin, inputLine))
+	{
+		//  Lines piped in from Windows tools end in a carriage return
+		if (!inputLine.empty() && (inputLine.back() == '\r')) inputLine.pop_back();
+		if (!inputLine.empty()) m_EnteredCommands.Push(inputLine);
+	}
+
+	m_InputClosed = true;
+}
+
+inline void HeadlessConsole::Update()
+{
+	std::string commandString;
+	while (m_EnteredCommands.TryPop(commandString)) EnterCommand(commandString);
+}
+
+//  Instance to be utilized by anyone including this header
+auto debugConsole = HeadlessConsole::GetInstance();
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+//  Lock-Free Queues: how threads hand work and events to each other without taking a lock.
+//  SPSCQueue is a fixed size ring for exactly one producer thread and one consumer thread, and never allocates after it's built.
+//  MPSCQueue is an unbounded linked queue any number of threads can push onto, drained by one consumer thread.
+
+template <typename ValueType>
+class SPSCQueue
+{
+private:
+	std::vector<ValueType> Slots;
+	size_t Mask;
+
+	//  Each index is only written by one side, so keep them on separate cache lines to stop the two threads fighting over one
+	alignas(64) std::atomic<size_t> WriteIndex;
+	alignas(64) std::atomic<size_t> ReadIndex;
+
+public:
+	//  The capacity is rounded up to a power of two, so an index becomes a slot with a mask
+	explicit SPSCQueue(size_t capacity) : Mask(0), WriteIndex(0), ReadIndex(0)
+	{
+		size_t slotCount = 1;
+		while (slotCount < capacity) slotCount <<= 1;
+		Slots.resize(slotCount);
+		Mask = slotCount - 1;
+	}
+
+	SPSCQueue(const SPSCQueue&) = delete;
+	SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+	inline size_t GetCapacity() const { return Slots.size(); }
+	inline size_t GetCount() const { return WriteIndex.load(std::memory_order_acquire) - ReadIndex.load(std::memory_order_acquire); }
+
+	//  Producer only. Returns false (leaving the value untouched) if the ring is full.
+	inline bool TryPush(ValueType&& value)
+	{
+		auto writeIndex = WriteIndex.load(std::memory_order_relaxed);
+		if ((writeIndex - ReadIndex.load(std::memory_order_acquire)) == Slots.size()) return false;
+		Slots[writeIndex & Mask] = std::move(value);
+		WriteIndex.store(writeIndex + 1, std::memory_order_release);
+		return true;
+	}
+
+	//  Consumer only. Returns false if there's nothing waiting.
+	inline bool TryPop(ValueType& value)
+	{
+		auto readIndex = ReadIndex.load(std::memory_order_relaxed);
+		if (readIndex == WriteIndex.load(std::memory_order_acquire)) return false;
+		value = std::move(Slots[readIndex & Mask]);
+		ReadIndex.store(readIndex + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+
+template <typename ValueType>
+class MPSCQueue
+{
+private:
+	struct Node
+	{
+		std::atomic<Node*> Next;
+		ValueType Value;
+
+		Node() : Next(nullptr), Value() {}
+		explicit Node(ValueType&& value) : Next(nullptr), Value(std::move(value)) {}
+	};
+
+	//  Producers swap themselves in at the head, and the consumer walks from the tail, which always sits on an already-read node
+	alignas(64) std::atomic<Node*> Head;
+	alignas(64) Node* Tail;
+
+public:
+	MPSCQueue()
+	{
+		auto stub = new Node;
+		Head.store(stub, std::memory_order_relaxed);
+		Tail = stub;
+	}
+
+	~MPSCQueue()
+	{
+		ValueType value;
+		while (TryPop(value)) {}
+		delete Tail;
+	}
+
+	MPSCQueue(const MPSCQueue&) = delete;
+	MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+	//  Any thread
+	inline void Push(ValueType value)
+	{
+		auto node = new Node(std::move(value));
+		auto previous = Head.exchange(node, std::memory_order_acq_rel);
+		previous->Next.store(node, std::memory_order_release);
+	}
+
+	//  Consumer only. A push that's halfway through linking itself in shows up on the next call.
+	inline bool TryPop(ValueType& value)
+	{
+		auto tail = Tail;
+		auto next = tail->Next.load(std::memory_order_acquire);
+		if (next == nullptr) return false;
+
+		value = std::move(next->Value);
+		Tail = next;
+		delete tail;
+		return true;
+	}
+
+	inline bool GetEmpty() const { return (Tail->Next.load(std::memory_order_acquire) == nullptr); }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "SocketBuffer.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <cstring>
+
+//  Message Streams: typed reading and writing over a buffer someone else owns, most often one of a connection's own
+//  receive or send buffers. Nothing is shared between streams, so messages on different connections can be read and
+//  built at the same time, and building one message can never clobber another that's halfway done.
+//  - MessageWriter clears the buffer and writes the message ID when it's made, then appends each value after it
+//  - MessageReader reads from wherever the buffer's read position is. Reading past the end of the message gives zeroes
+//    (or empty strings) and marks the reader failed, so a handler can read every field and then check GetFailed() once.
+
+class MessageWriter
+{
+private:
+	SocketBuffer& Buffer;
+
+public:
+	MessageWriter(SocketBuffer& buffer, unsigned char messageID) : Buffer(buffer)
+	{
+		Buffer.clear();
+		Buffer.writechar(messageID);
+	}
+
+	inline void WriteChar(unsigned char value)			{ Buffer.writechar(value); }
+	inline void WriteShort(short value)					{ Buffer.writeshort(value); }
+	inline void WriteUnsignedShort(unsigned short value)	{ Buffer.writeushort(value); }
+	inline void WriteInt(int value)						{ Buffer.writeint(value); }
+	inline void WriteUnsignedInt(unsigned int value)	{ Buffer.writeuint(value); }
+	inline void WriteLongInt(uint64_t value)			{ Buffer.writelint(value); }
+	inline void WriteFloat(float value)					{ Buffer.writefloat(value); }
+	inline void WriteDouble(double value)				{ Buffer.writedouble(value); }
+
+	//  Raw bytes, with no length written. Write the length first if the reader can't know it.
+	inline void WriteBytes(const void* data, int length)	{ Buffer.writechars((const char*)data, length); }
+	inline void WriteBytes(const std::vector<unsigned char>& data) { Buffer.writechars((const char*)data.data(), int(data.size())); }
+
+	//  A null terminated string, read back with MessageReader::ReadString()
+	inline void WriteString(const std::string& value)	{ Buffer.writechars(value.c_str(), int(value.length()) + 1); }
+
+	inline SocketBuffer& GetBuffer() { return Buffer; }
+	inline int GetSize() const { return Buffer.m_BufferUtilizedCount; }
+};
+
+
+class MessageReader
+{
+private:
+	SocketBuffer& Buffer;
+	bool Failed;
+
+	//  Copies the next sizeof(ValueType) bytes out, or fails and skips to the end if there aren't that many left
+	template <typename ValueType>
+	inline ValueType ReadValue()
+	{
+		ValueType value = ValueType();
+		if (Buffer.bytesleft() < int(sizeof(ValueType))) { SkipToEnd(); return value; }
+		memcpy(&value, Buffer.m_BufferData + Buffer.m_ReadPosition, sizeof(ValueType));
+		Buffer.m_ReadPosition += int(sizeof(ValueType));
+		return value;
+	}
+
+	inline void SkipToEnd() { Failed = true; Buffer.m_ReadPosition = Buffer.m_BufferUtilizedCount; }
+
+public:
+	explicit MessageReader(SocketBuffer& buffer) : Buffer(buffer), Failed(false) {}
+
+	inline unsigned char ReadChar()				{ return ReadValue<unsigned char>(); }
+	inline short ReadShort()					{ return ReadValue<short>(); }
+	inline unsigned short ReadUnsignedShort()	{ return ReadValue<unsigned short>(); }
+	inline int ReadInt()						{ return ReadValue<int>(); }
+	inline unsigned int ReadUnsignedInt()		{ return ReadValue<unsigned int>(); }
+	inline uint64_t ReadLongInt()				{ return ReadValue<uint64_t>(); }
+	inline float ReadFloat()					{ return ReadValue<float>(); }
+	inline double ReadDouble()					{ return ReadValue<double>(); }
+
+	//  The next length bytes, or an empty vector if the message doesn't hold that many
+	inline std::vector<unsigned char> ReadBytes(int length)
+	{
+		if ((length < 0) || (Buffer.bytesleft() < length)) { SkipToEnd(); return std::vector<unsigned char>(); }
+		auto start = (const unsigned char*)(Buffer.m_BufferData + Buffer.m_ReadPosition);
+		Buffer.m_ReadPosition += length;
+		return std::vector<unsigned char>(start, start + length);
+	}
+
+	//  The next length bytes as a string, or an empty string if the message doesn't hold that many
+	inline std::string ReadChars(int length)
+	{
+		if ((length < 0) || (Buffer.bytesleft() < length)) { SkipToEnd(); return std::string(); }
+		auto start = Buffer.m_BufferData + Buffer.m_ReadPosition;
+		Buffer.m_ReadPosition += length;
+		return std::string(start, length);
+	}
+
+	//  Everything up to the next null terminator, which is skipped over. Fails if the message ends first.
+	inline std::string ReadString()
+	{
+		auto start = Buffer.m_BufferData + Buffer.m_ReadPosition;
+		auto terminator = (const char*)memchr(start, '\0', Buffer.bytesleft());
+		if (terminator == nullptr) { SkipToEnd(); return std::string(); }
+		Buffer.m_ReadPosition += int(terminator - start) + 1;
+		return std::string(start, terminator - start);
+	}
+
+	inline int GetBytesLeft() const { return Buffer.bytesleft(); }
+	inline bool GetFailed() const { return Failed; }
+	inline SocketBuffer& GetBuffer() { return Buffer; }
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "SocketBuffer.h"
+#include "AsyncRuntime.h"
+#include "BufferPool.h"
+#include "RttEstimator.h"
+
+#include <stdlib.h>
+#include <memory>
+#include <functional>
+
+//  Message Transport: where protocol code sends its messages, so the same coroutine can run over a real socket
+//  or over an in-memory pair in a test. Messages are composed with BeginMessage() and sent with Write().
+//  Each transport times its waits by its connection's RTT estimator, which every transport over the same connection shares.
+
+enum TransportSendResult
+{
+	TRANSPORT_SENT = 0,
+	TRANSPORT_WOULD_BLOCK,
+	TRANSPORT_CLOSED
+};
+
+
+//  A message taken off a transport, with the message ID already read off the front
+struct TransportMessage
+{
+	unsigned char MessageID;
+	SocketBuffer Buffer;
+
+	//  One is made for every message a coroutine receives, so they come from the buffer pool
+	static void* operator new(size_t size) { return BufferPool::Allocate(size); }
+	static void operator delete(void* data, size_t size) { BufferPool::Release(data, size); }
+
+	//  Copies whatever is left unread in the source, so the shared receive buffer can be reused straight away
+	static std::unique_ptr<TransportMessage> Create(unsigned char messageID, SocketBuffer& source)
+	{
+		auto message = std::make_unique<TransportMessage>();
+		message->MessageID = messageID;
+		if (source.bytesleft() > 0) message->Buffer.addBuffer(source.m_BufferData + source.m_ReadPosition, source.bytesleft());
+		return message;
+	}
+
+	//  Takes the source's storage over rather than copying it, leaving the source with the message's old (empty) buffer. The
+	//  read position is kept, so the message reads on from just after its ID. Used for large messages off a connection.
+	static std::unique_ptr<TransportMessage> Take(unsigned char messageID, SocketBuffer& source)
+	{
+		auto message = std::make_unique<TransportMessage>();
+		message->MessageID = messageID;
+		message->Buffer.swap(source);
+		return message;
+	}
+};
+
+typedef AsyncInbox<TransportMessage> TransportInbox;
+
+
+class MessageTransport
+{
+protected:
+	SocketBuffer OutgoingMessage;
+	std::shared_ptr<RttEstimator> Rtt;
+
+public:
+	struct WriteAwaiter : public AsyncWaitAwaiter
+	{
+		MessageTransport& Transport;
+		TransportSendResult Result;
+
+		WriteAwaiter(MessageTransport& transport) : Transport(transport), Result(TRANSPORT_SENT) {}
+
+		//  A message that goes straight out never suspends. One that would block is retried once a frame until it goes.
+		inline bool await_ready() { Result = Transport.SendMessagePacket(Transport.OutgoingMessage); return (Result != TRANSPORT_WOULD_BLOCK); }
+		inline void await_suspend(std::coroutine_handle<> handle)
+		{
+			WaitState->Handle = handle;
+			AsyncScheduler::GetCurrent().AddPoll([this]() { Result = Transport.SendMessagePacket(Transport.OutgoingMessage); return (Result != TRANSPORT_WOULD_BLOCK); }, WaitState);
+		}
+		inline TransportSendResult await_resume() const { return Result; }
+	};
+
+	//  A transport given no estimator keeps one of its own
+	explicit MessageTransport(std::shared_ptr<RttEstimator> rtt = nullptr) : Rtt((rtt != nullptr) ? rtt : std::make_shared<RttEstimator>()) {}
+	virtual ~MessageTransport() {}
+
+	inline RttEstimator& GetRtt() { return *Rtt; }
+
+	//  Clears the outgoing message and writes the message ID, ready for the rest of the message to be written
+	inline SocketBuffer& BeginMessage(unsigned char messageID) { OutgoingMessage.clear(); OutgoingMessage.writechar(messageID); return OutgoingMessage; }
+	inline SocketBuffer& GetOutgoingMessage() { return OutgoingMessage; }
+
+	//  Sends the outgoing message right away, whatever the result
+	inline TransportSendResult Send() { return SendMessagePacket(OutgoingMessage); }
+
+	//  co_await Write(): sends the outgoing message, suspending the coroutine while the transport would block
+	inline WriteAwaiter Write() { return WriteAwaiter(*this); }
+
+	virtual TransportSendResult SendMessagePacket(SocketBuffer& message) = 0;
+};
+
+
+//  One end of an in-memory connection. Messages sent on one end are handed to the other end's receive callback
+//  on the next scheduler update, as if they'd arrived over a socket. Used to run protocol coroutines without a network.
+class InMemoryTransport : public MessageTransport
+{
+private:
+	std::weak_ptr<InMemoryTransport> Peer;
+	std::function<void(std::unique_ptr<TransportMessage>)> ReceiveCallback;
+	int LossPercentage;
+	uint64_t MessagesSent;
+	uint64_t MessagesDropped;
+
+public:
+	InMemoryTransport() : ReceiveCallback(nullptr), LossPercentage(0), MessagesSent(0), MessagesDropped(0) {}
+
+	static void CreatePair(std::shared_ptr<InMemoryTransport>& first, std::shared_ptr<InMemoryTransport>& second)
+	{
+		first = std::make_shared<InMemoryTransport>();
+		second = std::make_shared<InMemoryTransport>();
+		first->Peer = second;
+		second->Peer = first;
+	}
+
+	inline void SetReceiveCallback(const std::function<void(std::unique_ptr<TransportMessage>)>& callback) { ReceiveCallback = callback; }
+	inline void SetLossPercentage(int percentage) { LossPercentage = percentage; }
+	inline uint64_t GetMessagesSent() const { return MessagesSent; }
+	inline uint64_t GetMessagesDropped() const { return MessagesDropped; }
+
+	TransportSendResult SendMessagePacket(SocketBuffer& message) override
+	{
+		auto peer = Peer.lock();
+		if (peer == nullptr) return TRANSPORT_CLOSED;
+
+		++MessagesSent;
+		if ((LossPercentage > 0) && ((rand() % 100) < LossPercentage)) { ++MessagesDropped; return TRANSPORT_SENT; }
+
+		message.m_ReadPosition = 0;
+		auto messageID = message.readchar();
+		auto delivery = std::make_shared<std::unique_ptr<TransportMessage>>(TransportMessage::Create(messageID, message));
+		std::weak_ptr<InMemoryTransport> receiver = peer;
+		AsyncScheduler::GetCurrent().Post([receiver, delivery]()
+		{
+			auto peer = receiver.lock();
+			if ((peer != nullptr) && (peer->ReceiveCallback != nullptr)) peer->ReceiveCallback(std::move(*delivery));
+		});
+		return TRANSPORT_SENT;
+	}
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+//  RTT Estimator: a connection's smoothed round trip time and its variance, estimated the Jacobson/Karels way (RFC 6298),
+//  and the retransmit timeout that follows from them. Every protocol timer waiting on the other end (a reminder, a retransmit,
+//  a request) waits GetTimeout() rather than a fixed time, so it's quick on a LAN and patient on a long or busy path.
+//
+//  Samples are only taken from exchanges that weren't repeated (Karn's algorithm), as an answer to a repeated message can't be
+//  matched to the one it answers. A wait that times out calls Backoff(), which doubles the timeout until the next good sample.
+
+constexpr auto RTT_INITIAL_TIMEOUT		= 1.0;		//  Seconds waited before there's a sample to go on
+constexpr auto RTT_MIN_TIMEOUT			= 0.02;
+constexpr auto RTT_MAX_TIMEOUT			= 30.0;
+constexpr auto RTT_CLOCK_GRANULARITY	= 0.001;	//  The timer wheel's tick
+constexpr auto RTT_MAX_BACKOFF			= 6;		//  Doublings of the timeout, at most
+
+class RttEstimator
+{
+private:
+	double SmoothedRtt;
+	double RttVariance;
+	double BaseTimeout;
+	int SampleCount;
+	int BackoffCount;
+
+public:
+	RttEstimator() : SmoothedRtt(0.0), RttVariance(0.0), BaseTimeout(RTT_INITIAL_TIMEOUT), SampleCount(0), BackoffCount(0) {}
+
+	inline bool GetHasSample() const { return (SampleCount != 0); }
+	inline int GetSampleCount() const { return SampleCount; }
+	inline double GetSmoothedRtt() const { return SmoothedRtt; }
+	inline double GetRttVariance() const { return RttVariance; }
+	inline int GetBackoffCount() const { return BackoffCount; }
+
+	//  How long to wait for an answer before asking again
+	inline double GetTimeout() const { return std::min<double>(BaseTimeout * double(1 << BackoffCount), RTT_MAX_TIMEOUT); }
+
+	inline void Backoff() { BackoffCount = std::min<int>(BackoffCount + 1, RTT_MAX_BACKOFF); }
+
+	void AddSample(double rtt)
+	{
+		rtt = std::max<double>(rtt, 0.0);
+		if (SampleCount++ == 0)
+		{
+			SmoothedRtt = rtt;
+			RttVariance = rtt / 2.0;
+		}
+		else
+		{
+			//  The variance is updated from the old average, before the average moves towards the sample
+			RttVariance = (0.75 * RttVariance) + (0.25 * std::abs(SmoothedRtt - rtt));
+			SmoothedRtt = (0.875 * SmoothedRtt) + (0.125 * rtt);
+		}
+
+		BaseTimeout = std::clamp<double>(SmoothedRtt + std::max<double>(RTT_CLOCK_GRANULARITY, 4.0 * RttVariance), RTT_MIN_TIMEOUT, RTT_MAX_TIMEOUT);
+		BackoffCount = 0;
+	}
+};
@@ -5,7 +5,36 @@
 
 #include <string>
 #include <cstring>
+#include <cstdio>
+#include <cstdint>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+//  Hardware acceleration: SHA-NI on x86 (checked at runtime) and the ARMv8 crypto extensions (checked at compile time)
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA256_X86_SHANI 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA256_SHANI_TARGET
+#else
+#include <cpuid.h>
+#define SHA256_SHANI_TARGET __attribute__((target("sha,sse4.1")))
+#endif
+#elif (defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))) || defined(_M_ARM64)
+#define SHA256_ARMV8_CRYPTO 1
+#include <arm_neon.h>
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+constexpr auto SHA256_FILE_READ_SIZE		= (4 * 1024 * 1024);	//  Bytes per positional read when hashing a file
+constexpr auto SHA256_MULTI_BUFFER_LANES	= 8;					//  Messages hashed side by side by the portable multi-buffer path
 
 class SHA256
 {
@@ -16,22 +45,46 @@ protected:
 
 	const static uint32 sha256_k[];
 	static const unsigned int SHA224_256_BLOCK_SIZE = (512 / 8);
+
 public:
+	typedef void (*TransformFunction)(uint32 state[8], const unsigned char* message, size_t block_nb);
+
+	SHA256() { init(); }
+
 	void init();
-	void update(const unsigned char *message, unsigned int len);
+	void update(const unsigned char *message, size_t len);
 	void final(unsigned char *digest);
+	std::string hexdigest();
 	static const unsigned int DIGEST_SIZE = (256 / 8);
 
+	static std::string DigestToHex(const unsigned char* digest);
+	static void DigestToHex(const unsigned char* digest, char* hex, unsigned int digestBytes);
+	static TransformFunction GetTransform();
+	static const char* GetTransformName();
+
+	static void TransformPortable(uint32 state[8], const unsigned char* message, size_t block_nb);
+#if SHA256_X86_SHANI
+	static bool GetSHANISupported();
+	static void TransformSHANI(uint32 state[8], const unsigned char* message, size_t block_nb);
+#endif
+#if SHA256_ARMV8_CRYPTO
+	static void TransformARMv8(uint32 state[8], const unsigned char* message, size_t block_nb);
+#endif
+	static void TransformLanes(uint32 state[8][SHA256_MULTI_BUFFER_LANES], const unsigned char* blocks[SHA256_MULTI_BUFFER_LANES]);
+
 protected:
-	void transform(const unsigned char *message, unsigned int block_nb);
-	unsigned int m_tot_len;
+	void transform(const unsigned char *message, size_t block_nb) { m_transform(m_h, message, block_nb); }
+	uint64 m_tot_len;
 	unsigned int m_len;
 	unsigned char m_block[2 * SHA224_256_BLOCK_SIZE];
 	uint32 m_h[8];
+	TransformFunction m_transform;
 };
 
 std::string sha256(std::string input);
-std::string sha256(char* data, int dataLength);
+std::string sha256(char* data, int dataCount, int dataLength);
+std::string sha256File(std::string fileName);
+void sha256MultiBuffer(const unsigned char* const* buffers, const uint64_t* lengths, size_t count, unsigned char (*digests)[SHA256::DIGEST_SIZE]);
 
 #define SHA2_SHFR(x, n)    (x >> n)
 #define SHA2_ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
@@ -49,6 +102,11 @@ std::string sha256(char* data, int dataLength);
     *((str) + 1) = (uint8) ((x) >> 16);       \
     *((str) + 0) = (uint8) ((x) >> 24);       \
 }
+#define SHA2_UNPACK64(x, str)                 \
+{                                             \
+    SHA2_UNPACK32((uint32) ((x) >> 32), str); \
+    SHA2_UNPACK32((uint32) ((x)      ), (str) + 4); \
+}
 #define SHA2_PACK32(str, x)                   \
 {                                             \
     *(x) =   ((uint32) *((str) + 3)      )    \
@@ -57,7 +115,7 @@ std::string sha256(char* data, int dataLength);
            | ((uint32) *((str) + 0) << 24);   \
 }
 
-const unsigned int SHA256::sha256_k[64] = //UL = uint32
+inline const unsigned int SHA256::sha256_k[64] = //UL = uint32
 { 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -75,15 +133,15 @@ const unsigned int SHA256::sha256_k[64] = //UL = uint32
  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
-void SHA256::transform(const unsigned char *message, unsigned int block_nb)
+inline void SHA256::TransformPortable(uint32 state[8], const unsigned char *message, size_t block_nb)
 {
 	uint32 w[64];
 	uint32 wv[8];
 	uint32 t1, t2;
 	const unsigned char *sub_block;
-	int i;
+	size_t i;
 	int j;
-	for (i = 0; i < (int)block_nb; i++) {
+	for (i = 0; i < block_nb; i++) {
 		sub_block = message + (i << 6);
 		for (j = 0; j < 16; j++) {
 			SHA2_PACK32(&sub_block[j << 2], &w[j]);
@@ -92,7 +150,7 @@ void SHA256::transform(const unsigned char *message, unsigned int block_nb)
 			w[j] = SHA256_F4(w[j - 2]) + w[j - 7] + SHA256_F3(w[j - 15]) + w[j - 16];
 		}
 		for (j = 0; j < 8; j++) {
-			wv[j] = m_h[j];
+			wv[j] = state[j];
 		}
 		for (j = 0; j < 64; j++) {
 			t1 = wv[7] + SHA256_F2(wv[4]) + SHA2_CH(wv[4], wv[5], wv[6])
@@ -108,12 +166,200 @@ void SHA256::transform(const unsigned char *message, unsigned int block_nb)
 			wv[0] = t1 + t2;
 		}
 		for (j = 0; j < 8; j++) {
-			m_h[j] += wv[j];
+			state[j] += wv[j];
 		}
 	}
 }
 
-void SHA256::init()
+#if SHA256_X86_SHANI
+inline bool SHA256::GetSHANISupported()
+{
+	//  SHA-NI is leaf 7 EBX bit 29. The shuffles used alongside it need SSSE3 and SSE4.1 (leaf 1 ECX bits 9 and 19).
+#if defined(_MSC_VER)
+	int leaf1[4], leaf7[4];
+	__cpuid(leaf1, 0);
+	if (leaf1[0] < 7) return false;
+	__cpuid(leaf1, 1);
+	__cpuidex(leaf7, 7, 0);
+	unsigned int ecx1 = leaf1[2], ebx7 = leaf7[1];
+#else
+	unsigned int eax, ebx, ecx1, edx, ebx7, ecx7;
+	if (__get_cpuid_max(0, nullptr) < 7) return false;
+	__cpuid(1, eax, ebx, ecx1, edx);
+	__cpuid_count(7, 0, eax, ebx7, ecx7, edx);
+#endif
+	return ((ebx7 >> 29) & 1) && ((ecx1 >> 19) & 1) && ((ecx1 >> 9) & 1);
+}
+
+//  Four rounds of the SHA-NI compression, with the message schedule for a later group interleaved by the caller
+#define SHA256_SHANI_ROUNDS(msg, k)																	\
+{																									\
+	__m128i roundInput = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&sha256_k[k]));		\
+	state1 = _mm_sha256rnds2_epu32(state1, state0, roundInput);									\
+	roundInput = _mm_shuffle_epi32(roundInput, 0x0E);												\
+	state0 = _mm_sha256rnds2_epu32(state0, state1, roundInput);									\
+}
+#define SHA256_SHANI_SCHEDULE(next, current, previous)											\
+{																									\
+	next = _mm_add_epi32(next, _mm_alignr_epi8(current, previous, 4));								\
+	next = _mm_sha256msg2_epu32(next, current);														\
+}
+
+SHA256_SHANI_TARGET inline void SHA256::TransformSHANI(uint32 state[8], const unsigned char *message, size_t block_nb)
+{
+	const __m128i byteSwapMask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	//  The instructions work on the state as ABEF and CDGH, rather than ABCD and EFGH
+	__m128i abcd = _mm_loadu_si128((const __m128i*)&state[0]);
+	__m128i efgh = _mm_loadu_si128((const __m128i*)&state[4]);
+	abcd = _mm_shuffle_epi32(abcd, 0xB1);
+	efgh = _mm_shuffle_epi32(efgh, 0x1B);
+	__m128i state0 = _mm_alignr_epi8(abcd, efgh, 8);
+	__m128i state1 = _mm_blend_epi16(efgh, abcd, 0xF0);
+
+	for (size_t i = 0; i < block_nb; ++i, message += 64)
+	{
+		__m128i savedState0 = state0;
+		__m128i savedState1 = state1;
+
+		__m128i msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 0)), byteSwapMask);
+		__m128i msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 16)), byteSwapMask);
+		__m128i msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 32)), byteSwapMask);
+		__m128i msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 48)), byteSwapMask);
+
+		SHA256_SHANI_ROUNDS(msg0, 0);
+		SHA256_SHANI_ROUNDS(msg1, 4);	msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+		SHA256_SHANI_ROUNDS(msg2, 8);	msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+		SHA256_SHANI_ROUNDS(msg3, 12);	SHA256_SHANI_SCHEDULE(msg0, msg3, msg2);	msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+		SHA256_SHANI_ROUNDS(msg0, 16);	SHA256_SHANI_SCHEDULE(msg1, msg0, msg3);	msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+		SHA256_SHANI_ROUNDS(msg1, 20);	SHA256_SHANI_SCHEDULE(msg2, msg1, msg0);	msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+		SHA256_SHANI_ROUNDS(msg2, 24);	SHA256_SHANI_SCHEDULE(msg3, msg2, msg1);	msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+		SHA256_SHANI_ROUNDS(msg3, 28);	SHA256_SHANI_SCHEDULE(msg0, msg3, msg2);	msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+		SHA256_SHANI_ROUNDS(msg0, 32);	SHA256_SHANI_SCHEDULE(msg1, msg0, msg3);	msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+		SHA256_SHANI_ROUNDS(msg1, 36);	SHA256_SHANI_SCHEDULE(msg2, msg1, msg0);	msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+		SHA256_SHANI_ROUNDS(msg2, 40);	SHA256_SHANI_SCHEDULE(msg3, msg2, msg1);	msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+		SHA256_SHANI_ROUNDS(msg3, 44);	SHA256_SHANI_SCHEDULE(msg0, msg3, msg2);	msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+		SHA256_SHANI_ROUNDS(msg0, 48);	SHA256_SHANI_SCHEDULE(msg1, msg0, msg3);	msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+		SHA256_SHANI_ROUNDS(msg1, 52);	SHA256_SHANI_SCHEDULE(msg2, msg1, msg0);
+		SHA256_SHANI_ROUNDS(msg2, 56);	SHA256_SHANI_SCHEDULE(msg3, msg2, msg1);
+		SHA256_SHANI_ROUNDS(msg3, 60);
+
+		state0 = _mm_add_epi32(state0, savedState0);
+		state1 = _mm_add_epi32(state1, savedState1);
+	}
+
+	//  Put the state back into ABCD and EFGH order
+	abcd = _mm_shuffle_epi32(state0, 0x1B);
+	efgh = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(abcd, efgh, 0xF0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(efgh, abcd, 8));
+}
+
+#undef SHA256_SHANI_ROUNDS
+#undef SHA256_SHANI_SCHEDULE
+#endif
+
+#if SHA256_ARMV8_CRYPTO
+inline void SHA256::TransformARMv8(uint32 state[8], const unsigned char *message, size_t block_nb)
+{
+	uint32x4_t abcd = vld1q_u32(&state[0]);
+	uint32x4_t efgh = vld1q_u32(&state[4]);
+
+	for (size_t i = 0; i < block_nb; ++i, message += 64)
+	{
+		uint32x4_t savedAbcd = abcd;
+		uint32x4_t savedEfgh = efgh;
+
+		uint32x4_t msg[4];
+		for (int j = 0; j < 4; ++j) msg[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + (j * 16))));
+
+		//  Each group of four rounds consumes one message vector, then extends the schedule into it for a later group
+		for (int j = 0; j < 16; ++j)
+		{
+			uint32x4_t roundInput = vaddq_u32(msg[j % 4], vld1q_u32(&sha256_k[j * 4]));
+			if (j < 12) msg[j % 4] = vsha256su1q_u32(vsha256su0q_u32(msg[j % 4], msg[(j + 1) % 4]), msg[(j + 2) % 4], msg[(j + 3) % 4]);
+
+			uint32x4_t previousAbcd = abcd;
+			abcd = vsha256hq_u32(abcd, efgh, roundInput);
+			efgh = vsha256h2q_u32(efgh, previousAbcd, roundInput);
+		}
+
+		abcd = vaddq_u32(abcd, savedAbcd);
+		efgh = vaddq_u32(efgh, savedEfgh);
+	}
+
+	vst1q_u32(&state[0], abcd);
+	vst1q_u32(&state[4], efgh);
+}
+#endif
+
+//  One block from each of several independent messages, in structure-of-arrays form so every step is a lane-wide loop
+//  the compiler can vectorize. Used by the multi-buffer path when no hardware SHA instructions are available.
+inline void SHA256::TransformLanes(uint32 state[8][SHA256_MULTI_BUFFER_LANES], const unsigned char* blocks[SHA256_MULTI_BUFFER_LANES])
+{
+	constexpr auto L = SHA256_MULTI_BUFFER_LANES;
+	uint32 w[64][L];
+	uint32 a[L], b[L], c[L], d[L], e[L], f[L], g[L], h[L];
+
+	for (int j = 0; j < 16; ++j)
+		for (int l = 0; l < L; ++l)
+			SHA2_PACK32(&blocks[l][j << 2], &w[j][l]);
+	for (int j = 16; j < 64; ++j)
+		for (int l = 0; l < L; ++l)
+			w[j][l] = SHA256_F4(w[j - 2][l]) + w[j - 7][l] + SHA256_F3(w[j - 15][l]) + w[j - 16][l];
+
+	for (int l = 0; l < L; ++l)
+	{
+		a[l] = state[0][l]; b[l] = state[1][l]; c[l] = state[2][l]; d[l] = state[3][l];
+		e[l] = state[4][l]; f[l] = state[5][l]; g[l] = state[6][l]; h[l] = state[7][l];
+	}
+
+	for (int j = 0; j < 64; ++j)
+	{
+		for (int l = 0; l < L; ++l)
+		{
+			uint32 t1 = h[l] + SHA256_F2(e[l]) + SHA2_CH(e[l], f[l], g[l]) + sha256_k[j] + w[j][l];
+			uint32 t2 = SHA256_F1(a[l]) + SHA2_MAJ(a[l], b[l], c[l]);
+			h[l] = g[l]; g[l] = f[l]; f[l] = e[l]; e[l] = d[l] + t1;
+			d[l] = c[l]; c[l] = b[l]; b[l] = a[l]; a[l] = t1 + t2;
+		}
+	}
+
+	for (int l = 0; l < L; ++l)
+	{
+		state[0][l] += a[l]; state[1][l] += b[l]; state[2][l] += c[l]; state[3][l] += d[l];
+		state[4][l] += e[l]; state[5][l] += f[l]; state[6][l] += g[l]; state[7][l] += h[l];
+	}
+}
+
+inline SHA256::TransformFunction SHA256::GetTransform()
+{
+	//  Chosen once per process, based on what the CPU supports
+	static const TransformFunction transformFunction = []() -> TransformFunction
+	{
+#if SHA256_X86_SHANI
+		if (GetSHANISupported()) return TransformSHANI;
+#endif
+#if SHA256_ARMV8_CRYPTO
+		return TransformARMv8;
+#endif
+		return TransformPortable;
+	}();
+	return transformFunction;
+}
+
+inline const char* SHA256::GetTransformName()
+{
+#if SHA256_X86_SHANI
+	if (GetTransform() == TransformSHANI) return "SHA-NI";
+#endif
+#if SHA256_ARMV8_CRYPTO
+	if (GetTransform() == TransformARMv8) return "ARMv8";
+#endif
+	return "Portable";
+}
+
+inline void SHA256::init()
 {
 	m_h[0] = 0x6a09e667;
 	m_h[1] = 0xbb67ae85;
@@ -125,18 +371,19 @@ void SHA256::init()
 	m_h[7] = 0x5be0cd19;
 	m_len = 0;
 	m_tot_len = 0;
+	m_transform = GetTransform();
 }
 
-void SHA256::update(const unsigned char *message, unsigned int len)
+inline void SHA256::update(const unsigned char *message, size_t len)
 {
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
+	size_t block_nb;
+	size_t new_len, rem_len, tmp_len;
 	const unsigned char *shifted_message;
 	tmp_len = SHA224_256_BLOCK_SIZE - m_len;
 	rem_len = len < tmp_len ? len : tmp_len;
 	memcpy(&m_block[m_len], message, rem_len);
 	if (m_len + len < SHA224_256_BLOCK_SIZE) {
-		m_len += len;
+		m_len += (unsigned int)len;
 		return;
 	}
 	new_len = len - rem_len;
@@ -146,15 +393,15 @@ void SHA256::update(const unsigned char *message, unsigned int len)
 	transform(shifted_message, block_nb);
 	rem_len = new_len % SHA224_256_BLOCK_SIZE;
 	memcpy(m_block, &shifted_message[block_nb << 6], rem_len);
-	m_len = rem_len;
-	m_tot_len += (block_nb + 1) << 6;
+	m_len = (unsigned int)rem_len;
+	m_tot_len += uint64(block_nb + 1) << 6;
 }
 
-void SHA256::final(unsigned char *digest)
+inline void SHA256::final(unsigned char *digest)
 {
 	unsigned int block_nb;
 	unsigned int pm_len;
-	unsigned int len_b;
+	uint64 len_b;
 	int i;
 	block_nb = (1 + ((SHA224_256_BLOCK_SIZE - 9)
 		< (m_len % SHA224_256_BLOCK_SIZE)));
@@ -162,46 +409,169 @@ void SHA256::final(unsigned char *digest)
 	pm_len = block_nb << 6;
 	memset(m_block + m_len, 0, pm_len - m_len);
 	m_block[m_len] = 0x80;
-	SHA2_UNPACK32(len_b, m_block + pm_len - 4);
+	SHA2_UNPACK64(len_b, m_block + pm_len - 8);
 	transform(m_block, block_nb);
 	for (i = 0; i < 8; i++) {
 		SHA2_UNPACK32(m_h[i], &digest[i << 2]);
 	}
 }
 
-std::string sha256(std::string input)
+inline std::string SHA256::hexdigest()
+{
+	unsigned char digest[DIGEST_SIZE];
+	final(digest);
+	return DigestToHex(digest);
+}
+
+inline std::string SHA256::DigestToHex(const unsigned char* digest)
+{
+	char buf[2 * SHA256::DIGEST_SIZE];
+	DigestToHex(digest, buf, SHA256::DIGEST_SIZE);
+	return std::string(buf, 2 * SHA256::DIGEST_SIZE);
+}
+
+//  Writes the first digestBytes of a digest as 2 * digestBytes lowercase hex characters, with no terminator
+inline void SHA256::DigestToHex(const unsigned char* digest, char* hex, unsigned int digestBytes)
 {
-	unsigned char digest[SHA256::DIGEST_SIZE];
-	memset(digest, 0, SHA256::DIGEST_SIZE);
+	static const char hexDigits[] = "0123456789abcdef";
+	for (unsigned int i = 0; i < digestBytes; i++)
+	{
+		hex[i * 2] = hexDigits[digest[i] >> 4];
+		hex[i * 2 + 1] = hexDigits[digest[i] & 0x0F];
+	}
+}
 
+inline std::string sha256(std::string input)
+{
 	SHA256 ctx = SHA256();
-	ctx.init();
 	ctx.update((unsigned char*)input.c_str(), input.length());
-	ctx.final(digest);
-
-	char buf[2 * SHA256::DIGEST_SIZE + 1];
-	buf[2 * SHA256::DIGEST_SIZE] = 0;
-	for (int i = 0; i < SHA256::DIGEST_SIZE; i++)
-		sprintf_s(buf + i * 2, 3, "%02x", digest[i]);
-	return std::string(buf);
+	return ctx.hexdigest();
 }
 
 
-std::string sha256(char* data, int dataCount, int dataLength)
+inline std::string sha256(char* data, int dataCount, int dataLength)
 {
-	unsigned char digest[SHA256::DIGEST_SIZE];
-	memset(digest, 0, SHA256::DIGEST_SIZE);
+	SHA256 ctx = SHA256();
+	for (int i = 0; i < dataCount; ++i) ctx.update((unsigned char*)&data[size_t(i) * dataLength], dataLength);
+	return ctx.hexdigest();
+}
+
 
+//  Hashes a file of any size with large positional reads, returning an empty string if the file can't be read
+inline std::string sha256File(std::string fileName)
+{
 	SHA256 ctx = SHA256();
-	ctx.init();
-	for (int i = 0; i < dataCount; ++i) ctx.update((unsigned char*)&data[i * dataLength], dataLength);
-	ctx.final(digest);
 
-	char buf[2 * SHA256::DIGEST_SIZE + 1];
-	buf[2 * SHA256::DIGEST_SIZE] = 0;
-	for (int i = 0; i < SHA256::DIGEST_SIZE; i++)
-		sprintf_s(buf + i * 2, 3, "%02x", digest[i]);
-	return std::string(buf);
+	//  Small files only need a buffer as large as themselves
+	std::error_code sizeError;
+	auto fileSize = std::filesystem::file_size(fileName, sizeError);
+	if (sizeError) return "";
+	std::vector<unsigned char> readBuffer(size_t(std::max<uintmax_t>(std::min<uintmax_t>(fileSize, SHA256_FILE_READ_SIZE), 1)));
+
+#if defined(_WIN32)
+	//  NOTE: Windows has no pread, so an unbuffered stream with reads of the same size stands in for it
+	FILE* file = nullptr;
+	if (fopen_s(&file, fileName.c_str(), "rb") != 0 || file == nullptr) return "";
+	setvbuf(file, nullptr, _IONBF, 0);
+	size_t bytesRead = 0;
+	while ((bytesRead = fread(readBuffer.data(), 1, readBuffer.size(), file)) > 0) ctx.update(readBuffer.data(), bytesRead);
+	auto readFailed = (ferror(file) != 0);
+	fclose(file);
+	if (readFailed) return "";
+#else
+	int file = open(fileName.c_str(), O_RDONLY);
+	if (file < 0) return "";
+	off_t offset = 0;
+	while (true)
+	{
+		auto bytesRead = pread(file, readBuffer.data(), readBuffer.size(), offset);
+		if (bytesRead < 0) { close(file); return ""; }
+		if (bytesRead == 0) break;
+		ctx.update(readBuffer.data(), size_t(bytesRead));
+		offset += bytesRead;
+	}
+	close(file);
+#endif
+
+	return ctx.hexdigest();
+}
+
+
+//  Hashes many independent messages at once, such as the chunks of a file portion. With hardware SHA instructions each
+//  message runs through those back to back; otherwise messages are grouped into lanes and hashed side by side.
+inline void sha256MultiBuffer(const unsigned char* const* buffers, const uint64_t* lengths, size_t count, unsigned char (*digests)[SHA256::DIGEST_SIZE])
+{
+	typedef unsigned char uint8;
+	typedef unsigned int uint32;
+	constexpr auto L = SHA256_MULTI_BUFFER_LANES;
+
+	if (SHA256::GetTransform() != SHA256::TransformPortable)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			SHA256 ctx;
+			ctx.update(buffers[i], size_t(lengths[i]));
+			ctx.final(digests[i]);
+		}
+		return;
+	}
+
+	static const unsigned char emptyBlock[64] = { 0 };
+	for (size_t group = 0; group < count; group += L)
+	{
+		uint32 state[8][L];
+		unsigned char tails[L][128];
+		uint64_t fullBlocks[L];
+		uint64_t totalBlocks[L];
+		uint64_t maxBlocks = 0;
+
+		for (int l = 0; l < L; ++l)
+		{
+			const uint32 initialState[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+			for (int j = 0; j < 8; ++j) state[j][l] = initialState[j];
+
+			fullBlocks[l] = totalBlocks[l] = 0;
+			if (group + l >= count) continue;
+
+			//  Build the padded tail of each message up front, so every lane just walks a list of 64 byte blocks
+			auto length = lengths[group + l];
+			auto tailLength = size_t(length % 64);
+			fullBlocks[l] = length / 64;
+			totalBlocks[l] = fullBlocks[l] + ((tailLength < 56) ? 1 : 2);
+			memset(tails[l], 0, sizeof(tails[l]));
+			memcpy(tails[l], buffers[group + l] + (fullBlocks[l] * 64), tailLength);
+			tails[l][tailLength] = 0x80;
+			auto tailEnd = tails[l] + ((totalBlocks[l] - fullBlocks[l]) * 64);
+			SHA2_UNPACK64(length << 3, tailEnd - 8);
+
+			if (totalBlocks[l] > maxBlocks) maxBlocks = totalBlocks[l];
+		}
+
+		for (uint64_t block = 0; block < maxBlocks; ++block)
+		{
+			uint32 savedState[8][L];
+			memcpy(savedState, state, sizeof(state));
+
+			const unsigned char* blocks[L];
+			for (int l = 0; l < L; ++l)
+			{
+				if (block < fullBlocks[l]) blocks[l] = buffers[group + l] + (block * 64);
+				else if (block < totalBlocks[l]) blocks[l] = tails[l] + ((block - fullBlocks[l]) * 64);
+				else blocks[l] = emptyBlock;
+			}
+
+			SHA256::TransformLanes(state, blocks);
+
+			//  Lanes whose message already finished keep their final state
+			for (int l = 0; l < L; ++l)
+				if (block >= totalBlocks[l])
+					for (int j = 0; j < 8; ++j) state[j][l] = savedState[j][l];
+		}
+
+		for (int l = 0; (l < L) && (group + l < count); ++l)
+			for (int j = 0; j < 8; ++j)
+				SHA2_UNPACK32(state[j][l], &digests[group + l][j << 2]);
+	}
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,21 @@
 #pragma once
 
+#include "BufferPool.h"
+
 #include <algorithm>
+#include <cstring>
+#include <utility>
 
 #define RETURNVAL_BUFFER_SIZE 1024 * 128 // 128KB
 
+//  Buffers come from the buffer pool and are never shrunk by clear() unless they've grown past SOCKET_BUFFER_KEEP_SIZE, so a
+//  buffer that's reused message after message stops allocating once it has seen its largest message. Every buffer also keeps
+//  SOCKET_BUFFER_HEADER_SPACE bytes free just ahead of m_BufferData, so a frame header can be written in front of the message
+//  where it sits, rather than the message being copied somewhere with room for one.
+constexpr int SOCKET_BUFFER_HEADER_SPACE	= 8;
+constexpr int SOCKET_BUFFER_INITIAL_SIZE	= 64;				//  Including the header space
+constexpr int SOCKET_BUFFER_KEEP_SIZE		= 256 * 1024;
+
 class SocketBuffer
 {
 	static char m_ReturnValueBuffer[RETURNVAL_BUFFER_SIZE + 1];
@@ -17,6 +29,8 @@ public:
 	void StreamRead(void* out, int size, bool peek);
 	SocketBuffer();
 	~SocketBuffer();
+	SocketBuffer(const SocketBuffer&) = delete;
+	SocketBuffer& operator=(const SocketBuffer&) = delete;
 	int 				writechar(unsigned char a);
 	int 				writeshort(short a);
 	int 				writeushort(unsigned short a);
@@ -46,8 +60,11 @@ public:
 	int bytesleft() const { return m_BufferUtilizedCount - m_ReadPosition; }
 	void StreamSet(int pos);
 	void clear();
+	void reserve(int size, bool keepContents = false);
+	inline char* getheaderspace(int headerSize) { return m_BufferData - headerSize; }
 	int addBuffer(char*, int);
 	int addBuffer(SocketBuffer*);
+	void swap(SocketBuffer& other);
 	char operator[](int index) const;
 };
 
@@ -64,9 +81,8 @@ char SocketBuffer::m_ReturnValueBuffer[RETURNVAL_BUFFER_SIZE + 1];
 
 inline SocketBuffer::SocketBuffer()
 {
-	m_BufferSize = 30;
-	MANAGE_MEMORY_NEW("WinsockWrapper", m_BufferSize);
-	m_BufferData = new char[m_BufferSize];
+	m_BufferData = static_cast<char*>(BufferPool::Allocate(SOCKET_BUFFER_INITIAL_SIZE)) + SOCKET_BUFFER_HEADER_SPACE;
+	m_BufferSize = SOCKET_BUFFER_INITIAL_SIZE - SOCKET_BUFFER_HEADER_SPACE;
 	m_BufferUtilizedCount = 0;
 	m_ReadPosition = 0;
 	m_WritePosition = 0;
@@ -74,20 +90,13 @@ inline SocketBuffer::SocketBuffer()
 
 inline SocketBuffer::~SocketBuffer()
 {
-	if (m_BufferData != nullptr)
-	{
-		MANAGE_MEMORY_DELETE("WinsockWrapper", m_BufferSize);
-		delete[] m_BufferData;
-	}
+	if (m_BufferData != nullptr) BufferPool::Release(m_BufferData - SOCKET_BUFFER_HEADER_SPACE, size_t(m_BufferSize + SOCKET_BUFFER_HEADER_SPACE));
 }
 
 inline void SocketBuffer::StreamWrite(void *in, int size)
 {
-	if (m_WritePosition + size >= m_BufferSize)
-	{
-		m_BufferSize = m_WritePosition + size + 30;
-		if ((m_BufferData = static_cast<char*>(realloc(m_BufferData, m_BufferSize))) == nullptr) return;
-	}
+	//  Grow to at least double, so a message built a value at a time only grows a handful of times
+	if (m_WritePosition + size > m_BufferSize) reserve(std::max(m_WritePosition + size, m_BufferSize * 2), true);
 	memcpy(m_BufferData + m_WritePosition, in, size);
 	m_WritePosition += size;
 	if (m_WritePosition > m_BufferUtilizedCount) m_BufferUtilizedCount = m_WritePosition;
@@ -190,7 +199,7 @@ inline int SocketBuffer::writestring(const char *str)
 
 inline unsigned char SocketBuffer::readchar(bool peek)
 {
-	unsigned char b;
+	unsigned char b = 0;
 	StreamRead(&b, 1, peek);
 	return b;
 }
@@ -204,48 +213,48 @@ inline char* SocketBuffer::readchars(int len, bool peek)
 
 inline short SocketBuffer::readshort(bool peek)
 {
-	short b;
+	short b = 0;
 	StreamRead(&b, 2, peek);
 	return b;
 }
 
 inline unsigned short SocketBuffer::readushort(bool peek)
 {
-	unsigned short b;
+	unsigned short b = 0;
 	StreamRead(&b, 2, peek);
 	return b;
 }
 
 inline int SocketBuffer::readint(bool peek)
 {
-	int b;
+	int b = 0;
 	StreamRead(&b, 4, peek);
 	return b;
 }
 
 inline unsigned int SocketBuffer::readuint(bool peek)
 {
-	unsigned int b;
+	unsigned int b = 0;
 	StreamRead(&b, 4, peek);
 	return b;
 }
 
 inline uint64_t SocketBuffer::readlint(bool peek)
 {
-	uint64_t b;
+	uint64_t b = 0;
 	StreamRead(&b, 8, peek);
 	return b;
 }
 
 inline float SocketBuffer::readfloat(bool peek)
 {
-	float b;
+	float b = 0;
 	StreamRead(&b, 4, peek);
 	return b;
 }
 inline double SocketBuffer::readdouble(bool peek)
 {
-	double b;
+	double b = 0;
 	StreamRead(&b, 8, peek);
 	return b;
 }
@@ -277,19 +286,41 @@ inline int SocketBuffer::addBuffer(char *m_BufferData, int len)
 
 inline void SocketBuffer::clear()
 {
-	if (m_BufferSize > 30)
+	//  Only a buffer that grew for an unusually large message gives its memory back
+	if (m_BufferSize > SOCKET_BUFFER_KEEP_SIZE)
 	{
-		MANAGE_MEMORY_DELETE("WinsockWrapper", sizeof(m_BufferData));
-		delete[] m_BufferData;
-		m_BufferSize = 30;
-		MANAGE_MEMORY_NEW("WinsockWrapper", m_BufferSize);
-		m_BufferData = new char[m_BufferSize];
+		BufferPool::Release(m_BufferData - SOCKET_BUFFER_HEADER_SPACE, size_t(m_BufferSize + SOCKET_BUFFER_HEADER_SPACE));
+		m_BufferData = static_cast<char*>(BufferPool::Allocate(SOCKET_BUFFER_INITIAL_SIZE)) + SOCKET_BUFFER_HEADER_SPACE;
+		m_BufferSize = SOCKET_BUFFER_INITIAL_SIZE - SOCKET_BUFFER_HEADER_SPACE;
 	}
 	m_BufferUtilizedCount = 0;
 	m_ReadPosition = 0;
 	m_WritePosition = 0;
 }
 
+inline void SocketBuffer::reserve(int size, bool keepContents)
+{
+	if (m_BufferSize >= size) return;
+
+	//  Take the whole of the pool block, as the rest of it would go unused anyway
+	auto capacity = BufferPool::GetCapacity(size_t(size + SOCKET_BUFFER_HEADER_SPACE));
+	auto bufferData = static_cast<char*>(BufferPool::Allocate(capacity)) + SOCKET_BUFFER_HEADER_SPACE;
+	if (keepContents && (m_BufferUtilizedCount > 0)) memcpy(bufferData, m_BufferData, m_BufferUtilizedCount);
+	BufferPool::Release(m_BufferData - SOCKET_BUFFER_HEADER_SPACE, size_t(m_BufferSize + SOCKET_BUFFER_HEADER_SPACE));
+
+	m_BufferData = bufferData;
+	m_BufferSize = int(capacity) - SOCKET_BUFFER_HEADER_SPACE;
+}
+
+inline void SocketBuffer::swap(SocketBuffer& other)
+{
+	std::swap(m_BufferData, other.m_BufferData);
+	std::swap(m_BufferSize, other.m_BufferSize);
+	std::swap(m_ReadPosition, other.m_ReadPosition);
+	std::swap(m_WritePosition, other.m_WritePosition);
+	std::swap(m_BufferUtilizedCount, other.m_BufferUtilizedCount);
+}
+
 inline void SocketBuffer::StreamSet(int pos)
 {
 	m_ReadPosition = 0;
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+
+//  Transfer Pacer: spaces a transfer's sends out at the rate the path can carry them, rather than handing the socket a whole
+//  portion at once and leaving it to queue up in front of the slowest link (where it holds up everything else going that way,
+//  including our own control messages). It works the way BBR does, from two estimates of the path:
+//    bottleneck bandwidth   the most any recent round delivered, as measured by the receiver (a windowed max)
+//    min RTT                the least any recent round trip took, so anything above it was spent waiting in a queue (a windowed min)
+//  A round is one portion: its chunks go out, and the receiver's confirmation reports how long they took to arrive.
+//
+//  Rounds go out unpaced to begin with, and each burst measures the bottleneck, until the estimate stops growing (a new
+//  connection's first rounds are held back by TCP's slow start, so the first one alone would underestimate). From then on
+//  each round is paced at the estimate times a gain that cycles through a probing round (a little over the estimate, to find bandwidth that has freed up), a
+//  draining round (a little under, to clear whatever the probe queued), and six rounds at the estimate. A round that arrives as
+//  quickly as it was sent says more about our sending than about the path, so it only lowers the estimate if the path stretched it.
+//
+//  The cap is the fraction of the estimate to pace at, so a transfer can be kept to a share of the path. A cap of 0 turns
+//  pacing off, and every round goes out as fast as the socket takes it.
+
+constexpr auto PACING_BANDWIDTH_WINDOW_ROUNDS	= 10;		//  Rounds a bandwidth sample counts towards the estimate
+constexpr auto PACING_MIN_RTT_WINDOW			= 10.0;		//  Seconds a min RTT sample counts towards the estimate
+constexpr auto PACING_MAX_CREDIT_TIME			= 0.02;		//  Seconds of sending that can be caught up after waking late
+constexpr auto PACING_MIN_SLEEP_TIME			= 0.001;	//  The timer wheel's tick. Anything due sooner is sent right away.
+constexpr auto PACING_MIN_SAMPLE_TIME			= 0.001;	//  Rounds that arrived quicker than this are too short to measure
+constexpr auto PACING_MIN_RATE					= 16384.0;	//  Bytes per second, however low the estimate falls
+constexpr auto PACING_STRETCH_FACTOR			= 1.1;		//  How much slower than sent a round must arrive to show the path was the limit
+constexpr auto PACING_STARTUP_GROWTH			= 1.25;		//  How much the estimate must grow in a round to still be starting up
+constexpr auto PACING_STARTUP_FLAT_ROUNDS		= 3;		//  Rounds without that growth before pacing begins
+constexpr auto PACING_GAIN_CYCLE_LENGTH			= 8;
+constexpr double PACING_GAIN_CYCLE[PACING_GAIN_CYCLE_LENGTH] = { 1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+
+class TransferPacer
+{
+private:
+	struct BandwidthSample
+	{
+		uint64_t Round;
+		double Rate;
+	};
+
+	BandwidthSample BandwidthSamples[PACING_BANDWIDTH_WINDOW_ROUNDS];
+	double BottleneckBandwidth;
+	double MinRtt;
+	double MinRttTime;
+	double LatestRtt;
+
+	bool StartupComplete;
+	double StartupBandwidth;
+	int StartupFlatRounds;
+
+	double CapFraction;
+	uint64_t RoundCount;
+	int GainIndex;
+	double RoundPacingRate;
+	double NextSendTime;
+
+public:
+	explicit TransferPacer(double capFraction = 1.0) :
+		BottleneckBandwidth(0.0),
+		MinRtt(0.0),
+		MinRttTime(0.0),
+		LatestRtt(0.0),
+		StartupComplete(false),
+		StartupBandwidth(0.0),
+		StartupFlatRounds(0),
+		CapFraction(std::clamp<double>(capFraction, 0.0, 1.0)),
+		RoundCount(0),
+		GainIndex(0),
+		RoundPacingRate(0.0),
+		NextSendTime(0.0)
+	{
+		for (auto& sample : BandwidthSamples) sample = BandwidthSample{ 0, 0.0 };
+	}
+
+	inline double GetBottleneckBandwidth() const { return BottleneckBandwidth; }
+	inline double GetMinRtt() const { return MinRtt; }
+	inline double GetBandwidthDelayProduct() const { return BottleneckBandwidth * MinRtt; }
+	inline double GetPacingRate() const { return RoundPacingRate; }
+	inline bool GetStartupComplete() const { return StartupComplete; }
+	inline uint64_t GetRoundCount() const { return RoundCount; }
+	inline double GetCapFraction() const { return CapFraction; }
+	inline void SetCapFraction(double capFraction) { CapFraction = std::clamp<double>(capFraction, 0.0, 1.0); }
+
+	//  Begins a round (a portion's first pass of chunks), choosing the rate it's paced at
+	void StartRound(void);
+
+	//  Begins a pass of sends after a wait (a round's first pass, or re-sending missing chunks), so the wait isn't caught up on
+	inline void StartSending(double now) { NextSendTime = now; }
+
+	//  How long to wait before the next send. Anything under a timer tick is sent right away, and caught up on by the next wait.
+	inline double GetSendDelay(double now) const { auto delay = NextSendTime - now; return ((RoundPacingRate == 0.0) || (delay < PACING_MIN_SLEEP_TIME)) ? 0.0 : delay; }
+
+	//  Moves the next send back by the time the bytes take at the pacing rate. If the send came late, only a little is caught up.
+	inline void OnSend(uint64_t byteCount, double now)
+	{
+		if (RoundPacingRate == 0.0) return;
+		NextSendTime = std::max<double>(NextSendTime, now - PACING_MAX_CREDIT_TIME) + (double(byteCount) / RoundPacingRate);
+	}
+
+	//  A round trip, timed from a message to its answer
+	void AddRttSample(double rtt, double now);
+
+	//  What a round delivered: the bytes that arrived after its first, and the time they took to send and to arrive
+	void AddDeliverySample(uint64_t byteCount, double sendSeconds, double arrivalSeconds);
+};
+
+
+inline void TransferPacer::StartRound()
+{
+	//  The bandwidth estimate is the best of the recent rounds. Once they've all aged out, the last estimate stands.
+	auto best = 0.0;
+	for (auto& sample : BandwidthSamples)
+		if ((sample.Rate > 0.0) && (sample.Round + PACING_BANDWIDTH_WINDOW_ROUNDS > RoundCount)) best = std::max<double>(best, sample.Rate);
+	if (best > 0.0) BottleneckBandwidth = best;
+
+	++RoundCount;
+	if (!StartupComplete && (BottleneckBandwidth != 0.0))
+	{
+		if (BottleneckBandwidth >= StartupBandwidth * PACING_STARTUP_GROWTH) { StartupBandwidth = BottleneckBandwidth; StartupFlatRounds = 0; }
+		else StartupComplete = (++StartupFlatRounds >= PACING_STARTUP_FLAT_ROUNDS);
+	}
+	if ((CapFraction == 0.0) || !StartupComplete) { RoundPacingRate = 0.0; return; }
+
+	//  Probing adds to the queue, so it's skipped while someone else's queue is already holding our round trips up
+	auto gain = PACING_GAIN_CYCLE[GainIndex];
+	GainIndex = (GainIndex + 1) % PACING_GAIN_CYCLE_LENGTH;
+	if ((gain > 1.0) && (MinRtt > 0.0) && (LatestRtt > (2.0 * MinRtt) + PACING_MIN_SLEEP_TIME)) gain = 1.0;
+	RoundPacingRate = std::max<double>(BottleneckBandwidth * gain * CapFraction, PACING_MIN_RATE);
+}
+
+
+inline void TransferPacer::AddRttSample(double rtt, double now)
+{
+	LatestRtt = rtt;
+	if ((MinRttTime == 0.0) || (rtt <= MinRtt) || (now - MinRttTime > PACING_MIN_RTT_WINDOW))
+	{
+		MinRtt = rtt;
+		MinRttTime = now;
+	}
+}
+
+
+inline void TransferPacer::AddDeliverySample(uint64_t byteCount, double sendSeconds, double arrivalSeconds)
+{
+	//  The round went no faster than the slower of its sending and its arrival
+	auto seconds = std::max<double>(sendSeconds, arrivalSeconds);
+	if ((byteCount == 0) || (seconds < PACING_MIN_SAMPLE_TIME)) return;
+	auto rate = double(byteCount) / seconds;
+
+	//  A round that arrived as fast as it was sent only shows the path kept up with us (we may have paced it under the estimate,
+	//  or woken late to send it), so it can raise the estimate but not lower it. Only a path that stretched the round out can.
+	if ((rate < BottleneckBandwidth) && (arrivalSeconds < sendSeconds * PACING_STRETCH_FACTOR)) return;
+
+	auto& sample = BandwidthSamples[RoundCount % PACING_BANDWIDTH_WINDOW_ROUNDS];
+	sample.Round = RoundCount;
+	sample.Rate = rate;
+	if (BottleneckBandwidth == 0.0) BottleneckBandwidth = rate;
+}
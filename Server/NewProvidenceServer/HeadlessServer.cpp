@@ -0,0 +1,192 @@
+//  New Providence Server (headless)
+//  Runs the server with no window, no SDL and no OpenGL, so it can be hosted on a Linux box or benchmarked without a display.
+//  Log lines go to stdout and a log file, and the same commands the windowed server's debug console takes are read from stdin.
+//
+//  Like the windowed server it works out of the current folder, which needs the same Groundfish.words the clients have.
+//
+//  Example: NewProvidenceServerHeadless --log server.log --shards 4 --command "AddUserData alice hunter2"
+
+#include "Engine/MemoryManager.h"
+#include "Engine/HeadlessConsole.h"
+#include "ServerCommands.h"
+
+#include <csignal>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <map>
+#include <string>
+#include <filesystem>
+
+constexpr auto DEFAULT_LOG_FILE = "NewProvidenceServer.log";
+constexpr int HEADLESS_UPDATE_SLEEP_MS = 10;
+
+std::atomic<bool> ServerRunning(true);
+
+void StopServerFromSignal(int) { ServerRunning = false; }
+
+
+//  Stands in for the windowed server's lists. Keeps the latest copy of what the network thread reports, so the list
+//  commands can print it, and writes re-key progress to the log rather than to a label.
+class HeadlessServerStatus : public EventListener
+{
+public:
+	HeadlessServerStatus();
+
+	void AddStatusCommands(void);
+
+private:
+	std::map<uint64_t, UserListEntry> UserList;		//  By connection ID, so they list in the order they connected
+	std::vector<HostedFileListEntry> FileList;
+	std::string LastReKeyProgress;
+
+	virtual void ReceiveEvent(EventData* eventData) override;
+};
+
+HeadlessServerStatus::HeadlessServerStatus()
+{
+	eventManager.AddEventListener("UserListChanged", this);
+	eventManager.AddEventListener("UserConnected", this);
+	eventManager.AddEventListener("UserDisconnected", this);
+	eventManager.AddEventListener("UserStatusChanged", this);
+	eventManager.AddEventListener("HostedFileListChanged", this);
+	eventManager.AddEventListener("ReKeyProgress", this);
+}
+
+void HeadlessServerStatus::AddStatusCommands(void)
+{
+	//  ListUsers: ["ListUsers"] prints every connected user, their round trip time and their current status
+	debugConsole->AddDebugCommand("ListUsers", [this](std::string) -> bool
+	{
+		debugConsole->AddDebugConsoleLine(std::to_string(UserList.size()) + " connected users");
+		for (auto& userEntry : UserList)
+		{
+			auto& user = userEntry.second;
+			debugConsole->AddDebugConsoleLine("  [" + user.IPAddress + "] " + user.UserIdentifier + " (" + user.GetRoundTripTimeString() + ") - " + user.StatusString);
+		}
+		return true;
+	});
+
+	//  ListHostedFiles: ["ListHostedFiles"] prints the checksum, size and title of every hosted file, newest first
+	debugConsole->AddDebugCommand("ListHostedFiles", [this](std::string) -> bool
+	{
+		debugConsole->AddDebugConsoleLine(std::to_string(FileList.size()) + " hosted files");
+		for (auto& file : FileList) debugConsole->AddDebugConsoleLine("  " + file.FileTitleChecksum + " " + std::to_string(file.FileSize) + " \"" + file.FileTitle + "\"");
+		return true;
+	});
+}
+
+void HeadlessServerStatus::ReceiveEvent(EventData* eventData)
+{
+	if (eventData->EventType == "UserListChanged")
+	{
+		UserList.clear();
+		for (auto& user : static_cast<UserListChangedEventData*>(eventData)->UserList) UserList[user.ConnectionID] = user;
+	}
+	else if (eventData->EventType == "UserConnected") { auto& user = static_cast<UserConnectedEventData*>(eventData)->User; UserList[user.ConnectionID] = user; }
+	else if (eventData->EventType == "UserDisconnected") UserList.erase(static_cast<UserDisconnectedEventData*>(eventData)->ConnectionID);
+	else if (eventData->EventType == "HostedFileListChanged") FileList = static_cast<HostedFileListChangedEventData*>(eventData)->FileList;
+	else if (eventData->EventType == "UserStatusChanged")
+	{
+		//  A status can trail in after the user has gone, and is dropped rather than bringing them back
+		auto& changedUser = static_cast<UserStatusChangedEventData*>(eventData)->User;
+		auto userIter = UserList.find(changedUser.ConnectionID);
+		if (userIter != UserList.end()) (*userIter).second = changedUser;
+	}
+	else if (eventData->EventType == "ReKeyProgress")
+	{
+		//  Progress arrives a few times a second while a re-key runs, so only changes in the text are worth a line
+		auto& progressString = static_cast<ReKeyProgressEventData*>(eventData)->ProgressString;
+		if (progressString == LastReKeyProgress) return;
+		LastReKeyProgress = progressString;
+		debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - " + progressString);
+	}
+}
+
+
+void PrintUsage(const char* programName)
+{
+	printf("Usage: %s [--log FILE] [--no-log] [--shards N] [--command \"COMMAND ARGS\"]...\n", programName);
+	printf("  --log FILE        append log lines to FILE (default %s)\n", DEFAULT_LOG_FILE);
+	printf("  --no-log          only log to stdout\n");
+	printf("  --shards N        handle connections on N threads (default %d, one per core less the network thread)\n", EventLoopGroup::GetDefaultShardCount());
+	printf("  --command CMD     enter a console command once the server is up (can be repeated)\n");
+	printf("Once running, type \"Help\" for the list of console commands, and \"Quit\" (or Ctrl+C) to shut down.\n");
+}
+
+int main(int argc, char* argv[])
+{
+	std::string logFile = DEFAULT_LOG_FILE;
+	std::vector<std::string> startupCommands;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if ((strcmp(argv[i], "--log") == 0) && (i + 1 < argc)) logFile = argv[++i];
+		else if (strcmp(argv[i], "--no-log") == 0) logFile.clear();
+		else if ((strcmp(argv[i], "--shards") == 0) && (i + 1 < argc) && (atoi(argv[i + 1]) > 0)) ServerControl.SetShardCount(atoi(argv[++i]));
+		else if ((strcmp(argv[i], "--command") == 0) && (i + 1 < argc)) startupCommands.push_back(argv[++i]);
+		else
+		{
+			PrintUsage(argv[0]);
+			return (strcmp(argv[i], "--help") == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!logFile.empty() && !debugConsole->SetLogFile(logFile))
+	{
+		fprintf(stderr, "Failed to open log file \"%s\"\n", logFile.c_str());
+		return EXIT_FAILURE;
+	}
+
+	HeadlessServerStatus serverStatus;
+	AddServerCommands();
+	serverStatus.AddStatusCommands();
+
+	//  Quit: ["Quit"] shuts the server down cleanly
+	debugConsole->AddDebugCommand("Quit", [](std::string) -> bool { ServerRunning = false; return true; });
+
+	std::signal(SIGINT, StopServerFromSignal);
+	std::signal(SIGTERM, StopServerFromSignal);
+#ifndef _WIN32
+	//  A client dropping mid-send shouldn't take the whole server down with it
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+	if (!std::filesystem::exists("Groundfish.words"))
+	{
+		debugConsole->AddDebugConsoleLine("No Groundfish.words in " + std::filesystem::current_path().string() + ". Run the server from the folder that holds its word list.");
+		return EXIT_FAILURE;
+	}
+
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - New Providence Server " + VERSION_NUMBER + " starting on port " + std::to_string(NEW_PROVIDENCE_PORT));
+	if (!ServerControl.Initialize())
+	{
+		debugConsole->AddDebugConsoleLine("Failed to listen on port " + std::to_string(NEW_PROVIDENCE_PORT) + ". Is another server already running?");
+		jobSystem.Shutdown();
+		return EXIT_FAILURE;
+	}
+
+	//  From here on the server runs on the network thread, exactly as it does behind the windowed server
+	networkThread.Start([]() { ServerControl.MainProcess(); });
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - Server is running. Type \"Help\" for commands.");
+
+	for (auto& command : startupCommands) debugConsole->EnterCommand(command);
+	debugConsole->StartReadingInput();
+
+	//  The main thread only enters commands and receives events, so it can afford to sleep far longer than the network thread
+	while (ServerRunning)
+	{
+		debugConsole->Update();
+		networkThread.DispatchEvents();
+		jobSystem.ProcessCompletedJobs();
+		std::this_thread::sleep_for(std::chrono::milliseconds(HEADLESS_UPDATE_SLEEP_MS));
+	}
+
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - Server shutting down");
+	networkThread.Stop();
+	ServerControl.Shutdown();
+	jobSystem.Shutdown();
+	return EXIT_SUCCESS;
+}
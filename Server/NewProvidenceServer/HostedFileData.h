@@ -1,6 +1,12 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <assert.h>
 
 enum HostedFileType { FILETYPE_MUSIC, FILETYPE_VIDEO, FILETYPE_GAMES, FILETYPE_OTHER, FILE_TYPE_COUNT };
 enum HostedFileSubtype
@@ -75,35 +81,6 @@ inline HostedFileSubtype GetFileSubTypeIDFromName(std::string name)
 	return (dataMap.find(name) == dataMap.end() ? HostedFileSubtype(-1) : dataMap[name]);
 }
 
-inline GUIObjectNode* GetFileTypeIconFromID(HostedFileType id)
-{
-	switch (id)
-	{
-	case FILETYPE_MUSIC:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/MusicIcon.png");
-	case FILETYPE_VIDEO:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/VideoIcon.png");
-	case FILETYPE_GAMES:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/GamesIcon.png");
-	case FILETYPE_OTHER:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
-	default:					assert(false); return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");;
-	}
-}
-
-inline GUIObjectNode* GetFileSubTypeIconFromID(HostedFileSubtype id)
-{
-	switch (id)
-	{
-	case FILETYPE_MUSIC_LFHHRBTRST:			return GUIObjectNode::CreateObjectNode("./Assets/Textures/LHHRBTRSTIcon.png");
-	case FILETYPE_MUSIC_EDM_DANCE:			return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
-	case FILETYPE_MUSIC_OTHER:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
-	case FILETYPE_VIDEO_TV:					return GUIObjectNode::CreateObjectNode("./Assets/Textures/TelevisionIcon.png");
-	case FILETYPE_VIDEO_MOVIE:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/MovieIcon.png");
-	case FILETYPE_VIDEO_PORN:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/PornIcon.png");
-	case FILETYPE_VIDEO_OTHER:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
-	case FILETYPE_GAMES_MISCELLANEOUS:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
-	case FILETYPE_OTHER_MISCELLANEOUS:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
-	default:								return nullptr;
-	}
-}
-
 std::vector<std::string> GetListOfFileTypes(void)
 {
 	std::vector<std::string> typeList;
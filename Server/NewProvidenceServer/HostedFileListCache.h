@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Groundfish.h"
+#include "HostedFileData.h"
+#include "Engine/BroadcastFrame.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+
+constexpr auto HOSTED_FILE_LIST_CACHE_SIZE	= 64;		//  Entries kept, after which the least recently used one makes way
+
+//  Hosted File List Cache: the hosted file list messages the server has built, encoded and ready to send, keyed by the request
+//  that asked for them (the page's starting index and the filters). Most requests are for the first page with no filters, so
+//  once it has been built, a login or a list request is answered without touching the database or decrypting anything.
+//  The cache lives on the network thread along with the database, so requests are answered one at a time, and a crowd of the
+//  same request (everyone logging back in after a restart) is one query followed by cache hits.
+//
+//  A list is built from a window of the FILES table: up to LATEST_UPLOADS_SENT_COUNT rows by upload time, from the page's
+//  starting index, which are then filtered. Each entry keeps what it needs to tell whether a change to the catalog reached
+//  its window, and only those entries are dropped:
+//  - A row added or removed shifts every window at or after it by upload time, and fills or empties the last, short window
+//  - A row changed in place (its columns re-keyed onto a new word list) only matters to the windows it's in
+//  Every change also moves the list sequence on, which each list is sent with, so a user coming back on a new connection can
+//  say which lists they've seen, and is only sent another if something has changed since.
+
+struct HostedFileListKey
+{
+	int					StartIndex;
+	std::string			Uploader;	//  Decrypted and lowercased, as the filter is, so it doesn't matter how the client encrypted it
+	HostedFileType		Type;
+	HostedFileSubtype	Subtype;
+
+	inline bool operator==(const HostedFileListKey& other) const { return (StartIndex == other.StartIndex) && (Type == other.Type) && (Subtype == other.Subtype) && (Uploader == other.Uploader); }
+};
+
+struct HostedFileListKeyHash
+{
+	inline size_t operator()(const HostedFileListKey& key) const
+	{
+		return std::hash<std::string>()(key.Uploader) ^ (size_t(key.StartIndex) * 31) ^ (size_t(key.Type) << 20) ^ (size_t(key.Subtype) << 26);
+	}
+};
+
+//  The rows a list was built from, as read from the database before filtering
+struct HostedFileListWindow
+{
+	std::vector<std::string>	Checksums;
+	std::string					LastUploadTime;
+	bool						Full = false;		//  Whether the window had every row it asked for, so rows added later land outside it
+};
+
+
+class HostedFileListCache
+{
+private:
+	struct CacheEntry
+	{
+		std::shared_ptr<const BroadcastFrame>	Frame;
+		HostedFileListWindow					Window;
+		uint64_t								LastUsed;
+	};
+
+	std::unordered_map<HostedFileListKey, CacheEntry, HostedFileListKeyHash> Entries;
+	uint64_t UseCount;
+	uint64_t Hits;
+	uint64_t Misses;
+	uint64_t Invalidations;
+	uint64_t Sequence;
+
+	//  A row at this upload time, coming or going, moves everything after it along by one
+	inline static bool GetShiftedBy(const HostedFileListWindow& window, const std::string& uploadTime) { return !window.Full || (uploadTime <= window.LastUploadTime); }
+
+	template <typename Predicate>
+	void InvalidateWhere(Predicate&& predicate)
+	{
+		for (auto iter = Entries.begin(); iter != Entries.end();)
+		{
+			if (predicate((*iter).second.Window)) { iter = Entries.erase(iter); ++Invalidations; }
+			else ++iter;
+		}
+	}
+
+public:
+	HostedFileListCache() : UseCount(0), Hits(0), Misses(0), Invalidations(0), Sequence(0) {}
+
+	static HostedFileListKey MakeKey(int startIndex, const EncryptedData& encryptedUsername, HostedFileType type, HostedFileSubtype subtype)
+	{
+		std::string uploader;
+		if (encryptedUsername.size() != 0)
+		{
+			uploader = Groundfish::DecryptToString(encryptedUsername.data());
+			std::transform(uploader.begin(), uploader.end(), uploader.begin(), ::tolower);
+		}
+		return HostedFileListKey{ startIndex, uploader, type, subtype };
+	}
+
+	//  The list for the key, or nullptr if it has to be built (and then handed to Insert)
+	std::shared_ptr<const BroadcastFrame> Find(const HostedFileListKey& key)
+	{
+		auto entryIter = Entries.find(key);
+		if (entryIter == Entries.end()) { ++Misses; return nullptr; }
+
+		++Hits;
+		(*entryIter).second.LastUsed = ++UseCount;
+		return (*entryIter).second.Frame;
+	}
+
+	void Insert(const HostedFileListKey& key, std::shared_ptr<const BroadcastFrame> frame, HostedFileListWindow window)
+	{
+		if ((Entries.size() >= HOSTED_FILE_LIST_CACHE_SIZE) && (Entries.find(key) == Entries.end()))
+		{
+			auto oldest = Entries.begin();
+			for (auto iter = Entries.begin(); iter != Entries.end(); ++iter) if ((*iter).second.LastUsed < (*oldest).second.LastUsed) oldest = iter;
+			Entries.erase(oldest);
+		}
+		Entries[key] = CacheEntry{ frame, std::move(window), ++UseCount };
+	}
+
+	//  Called for every change to the FILES table, with the row as it was added or as it was before it was removed
+	inline void OnFileAdded(const HostedFileData& fileData) { ++Sequence; InvalidateWhere([&](const HostedFileListWindow& window) { return GetShiftedBy(window, fileData.FileUploadTime); }); }
+	inline void OnFileRemoved(const HostedFileData& fileData) { ++Sequence; InvalidateWhere([&](const HostedFileListWindow& window) { return GetShiftedBy(window, fileData.FileUploadTime); }); }
+	inline void OnFileChanged(const std::string& checksum)
+	{
+		++Sequence;
+		InvalidateWhere([&](const HostedFileListWindow& window) { return (std::find(window.Checksums.begin(), window.Checksums.end(), checksum) != window.Checksums.end()); });
+	}
+	inline void Clear() { ++Sequence; Invalidations += Entries.size(); Entries.clear(); }
+
+	//  Moved on by every change to the catalog, whether or not it reached a list in the cache
+	inline uint64_t GetSequence() const { return Sequence; }
+
+	inline size_t GetEntryCount() const { return Entries.size(); }
+	inline uint64_t GetHits() const { return Hits; }
+	inline uint64_t GetMisses() const { return Misses; }
+	inline uint64_t GetInvalidations() const { return Invalidations; }
+};
@@ -0,0 +1,594 @@
+#pragma once
+
+#include "Groundfish.h"
+#include "HostedFileData.h"
+#include "NPSQL.h"
+#include "Engine/JobSystem.h"
+#include "Engine/AsyncRuntime.h"
+#include "Engine/TimeString.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <sstream>
+
+constexpr auto REKEY_CHECKPOINT_FILE		= "./_HostedFiles/_rekey.checkpoint";
+constexpr auto REKEY_TEMP_EXTENSION			= ".rekey";
+constexpr auto REKEY_BLOCK_SIZE				= (1024 * 1024);
+constexpr auto REKEY_SLICE_SIZE				= (4 * REKEY_BLOCK_SIZE);	//  Bytes re-keyed by a single job before it hands the worker back
+constexpr auto REKEY_DEFAULT_RATE			= (8.0 * 1024.0 * 1024.0);	//  Bytes per second shared by all re-key jobs
+constexpr auto REKEY_BUSY_RATE_FRACTION		= 0.25;						//  Fraction of the rate allowed while any file transfer is running
+constexpr auto REKEY_MAX_ACTIVE_FILES		= 4;
+constexpr auto REKEY_ROWS_PER_UPDATE		= 16;
+constexpr auto REKEY_ROW_MAX_ATTEMPTS		= 3;						//  Tries at a row before it's left for the next run
+
+inline std::string GetHostedFilePath(std::string checksum) { return "./_HostedFiles/" + checksum + ".hostedfile"; }
+
+
+//  Token bucket checked before each re-key job is submitted, so the job as a whole never reads faster than the given rate
+class IORateLimiter
+{
+private:
+	double BytesPerSecond;
+	double AvailableBytes;
+	std::chrono::steady_clock::time_point LastRefill;
+
+public:
+	IORateLimiter(double bytesPerSecond) :
+		BytesPerSecond(bytesPerSecond),
+		AvailableBytes(0.0),
+		LastRefill(std::chrono::steady_clock::now())
+	{}
+
+	inline double GetRate() const { return BytesPerSecond; }
+	inline void SetRate(double bytesPerSecond) { BytesPerSecond = std::max<double>(bytesPerSecond, 1024.0); }
+
+	bool TryAcquire(uint64_t byteCount)
+	{
+		//  Refill the bucket, allowing at most one second of burst
+		auto now = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::duration<double>(now - LastRefill).count();
+		AvailableBytes = std::min<double>(AvailableBytes + (elapsed * BytesPerSecond), BytesPerSecond);
+		LastRefill = now;
+
+		//  Requests larger than the burst size are allowed to put the bucket into debt, which later requests pay off
+		if (AvailableBytes < std::min<double>(double(byteCount), BytesPerSecond)) return false;
+		AvailableBytes -= double(byteCount);
+		return true;
+	}
+};
+
+
+//  Walks the hosted file catalog after a word list rotation and moves every hosted file and encrypted FILES column onto the current word list
+class HostedFileReKeyJob
+{
+public:
+	enum ReKeyJobState { REKEY_STATE_IDLE, REKEY_STATE_RUNNING, REKEY_STATE_COMPLETE };
+
+private:
+	struct ReKeyFileItem
+	{
+		std::string Checksum;
+		int SourceVersion;
+		uint64_t FileSize;
+	};
+
+	//  Maps an encrypted byte under the source list straight to the same byte under the target list, for each word index
+	struct ReKeyTable
+	{
+		unsigned char Table[256][256];
+	};
+
+	//  A file part way through its re-key. Only one slice job touches it at a time, and the main thread only looks at it between jobs.
+	struct ReKeyFileProgress
+	{
+		ReKeyFileItem Item;
+		ReKeyTable* Table;
+		std::ifstream FileIn;
+		std::ofstream FileOut;
+		std::vector<unsigned char> Block;
+		uint64_t BytesRead;
+		unsigned char WordIndex;
+		bool Opened;
+		bool Failed;
+		JobHandle SliceJob;
+	};
+
+	ReKeyJobState JobState;
+	int TargetVersion;
+
+	std::unordered_map<std::string, bool> CompletedFiles;
+	std::unordered_map<std::string, bool> CompletedRows;
+	std::unordered_map<int, ReKeyTable*> ReKeyTables;
+
+	std::deque<std::string> PendingRows;
+	std::unordered_map<std::string, int> RowAttempts;
+	std::deque<ReKeyFileItem> PendingFiles;
+	std::vector<std::shared_ptr<ReKeyFileProgress>> ActiveFiles;
+	std::vector<ReKeyFileItem> SwapReadyFiles;
+
+	std::atomic<bool> Cancelled;
+	std::shared_ptr<bool> LifetimeToken;
+	IORateLimiter RateLimiter;
+	double BaseRate;
+
+	uint64_t FilesTotal;
+	uint64_t FilesCompleted;
+	uint64_t RowsTotal;
+	uint64_t RowsCompleted;
+	uint64_t RowsFailed;
+	uint64_t FilesFailed;
+	uint64_t BytesTotal;
+	std::atomic<uint64_t> BytesProcessed;
+
+	double StartTime;
+	double LastSampleTime;
+	uint64_t LastSampleBytes;
+	double Throughput;
+
+	//  Told about each catalog row once its columns have been re-keyed and written back
+	std::function<void(const std::string& checksum)> RowChangedCallback;
+
+public:
+	HostedFileReKeyJob() :
+		JobState(REKEY_STATE_IDLE),
+		TargetVersion(0),
+		Cancelled(false),
+		LifetimeToken(std::make_shared<bool>(true)),
+		RateLimiter(REKEY_DEFAULT_RATE),
+		BaseRate(REKEY_DEFAULT_RATE),
+		FilesTotal(0),
+		FilesCompleted(0),
+		RowsTotal(0),
+		RowsCompleted(0),
+		RowsFailed(0),
+		FilesFailed(0),
+		BytesTotal(0),
+		BytesProcessed(0),
+		StartTime(0.0),
+		LastSampleTime(0.0),
+		LastSampleBytes(0),
+		Throughput(0.0)
+	{}
+
+	~HostedFileReKeyJob() { CancelSliceJobs(); ClearReKeyTables(); }
+
+	//  Accessors & Modifiers
+	inline bool GetRunning() const { return (JobState == REKEY_STATE_RUNNING); }
+	inline ReKeyJobState GetJobState() const { return JobState; }
+	inline int GetTargetVersion() const { return TargetVersion; }
+	inline uint64_t GetFilesTotal() const { return FilesTotal; }
+	inline uint64_t GetFilesCompleted() const { return FilesCompleted; }
+	inline uint64_t GetRowsTotal() const { return RowsTotal; }
+	inline uint64_t GetRowsCompleted() const { return RowsCompleted; }
+	inline uint64_t GetRowsFailed() const { return RowsFailed; }
+	inline uint64_t GetFilesFailed() const { return FilesFailed; }
+	inline uint64_t GetBytesTotal() const { return BytesTotal; }
+	inline uint64_t GetBytesProcessed() const { return BytesProcessed; }
+	inline double GetPercentageComplete() const { return (BytesTotal == 0) ? ((RowsTotal == 0) ? 1.0 : double(RowsCompleted) / double(RowsTotal)) : double(BytesProcessed) / double(BytesTotal); }
+	inline double GetThroughput() const { return Throughput; }
+	inline double GetAverageThroughput() const { return double(BytesProcessed) / std::max<double>(AsyncScheduler::GetNow() - StartTime, 0.01); }
+	inline double GetRateLimit() const { return BaseRate; }
+	inline void SetRateLimit(double bytesPerSecond) { BaseRate = std::max<double>(bytesPerSecond, 1024.0); RateLimiter.SetRate(BaseRate); }
+	inline void SetRowChangedCallback(const std::function<void(const std::string& checksum)>& callback) { RowChangedCallback = callback; }
+
+	void Start(int targetVersion);
+	bool ResumeFromCheckpoint();
+	void Update(const std::unordered_map<std::string, int>& filesInUse);
+
+private:
+	void BuildWorkLists();
+	ReKeyTable* GetReKeyTable(int sourceVersion);
+	void ClearReKeyTables();
+	void SubmitSliceJobs();
+	void CancelSliceJobs();
+	void OnSliceComplete(std::shared_ptr<ReKeyFileProgress> progress);
+	void ReKeyFileSlice(ReKeyFileProgress& progress, uint64_t sliceSize);
+	bool ReKeyRow(std::string checksum);
+	void AppendCheckpoint(std::string entry);
+	void Finish();
+};
+
+
+//  Data stamped with version 0 is resolved by Groundfish to the list it was encrypted with, so the target is all the job needs.
+//  A job moves everything onto one list, so the word list mustn't be rotated again until it's complete.
+inline void HostedFileReKeyJob::Start(int targetVersion)
+{
+	assert(!GetRunning());
+
+	TargetVersion = targetVersion;
+	CompletedFiles.clear();
+	CompletedRows.clear();
+
+	//  Write a fresh checkpoint header, which is everything a restarted server needs to pick the job back up
+	std::ofstream checkpointFile(REKEY_CHECKPOINT_FILE, std::ios_base::trunc);
+	assert(checkpointFile.good() && !checkpointFile.bad());
+	checkpointFile << "REKEY " << TargetVersion << "\n";
+	checkpointFile.close();
+
+	BuildWorkLists();
+}
+
+
+inline bool HostedFileReKeyJob::ResumeFromCheckpoint()
+{
+	std::ifstream checkpointFile(REKEY_CHECKPOINT_FILE);
+	if (!checkpointFile.good()) return false;
+
+	std::string headerLine, header;
+	std::getline(checkpointFile, headerLine);
+	std::istringstream headerStream(headerLine);
+	headerStream >> header >> TargetVersion;
+	if (header != "REKEY") { checkpointFile.close(); return false; }
+
+	//  If the word list has rotated again since the checkpoint was written, the recorded progress is meaningless. Start over.
+	if (TargetVersion != int(Groundfish::CurrentVersion))
+	{
+		checkpointFile.close();
+		Start(int(Groundfish::CurrentVersion));
+		return true;
+	}
+
+	//  Each following line is either "F <checksum>" for a swapped file or "R <checksum>" for a re-keyed database row
+	CompletedFiles.clear();
+	CompletedRows.clear();
+	std::string entryType, checksum;
+	while (checkpointFile >> entryType >> checksum)
+	{
+		if (entryType == "F") CompletedFiles[checksum] = true;
+		else if (entryType == "R") CompletedRows[checksum] = true;
+	}
+	checkpointFile.close();
+
+	BuildWorkLists();
+	return true;
+}
+
+
+inline void HostedFileReKeyJob::BuildWorkLists()
+{
+	std::vector<std::string> checksumList;
+	NPSQL::GetHostedFileChecksums(checksumList);
+
+	CancelSliceJobs();
+	PendingRows.clear();
+	RowAttempts.clear();
+	PendingFiles.clear();
+	SwapReadyFiles.clear();
+	FilesTotal = FilesCompleted = 0;
+	RowsTotal = RowsCompleted = 0;
+	RowsFailed = FilesFailed = 0;
+	BytesTotal = 0;
+	BytesProcessed = 0;
+
+	for (auto checksum : checksumList)
+	{
+		++RowsTotal;
+		if (CompletedRows.find(checksum) != CompletedRows.end()) ++RowsCompleted;
+		else PendingRows.push_back(checksum);
+
+		//  Remove any temporary file left behind by a re-key that was interrupted part way through
+		auto filePath = GetHostedFilePath(checksum);
+		std::error_code error;
+		std::filesystem::remove(filePath + REKEY_TEMP_EXTENSION, error);
+
+		if (CompletedFiles.find(checksum) != CompletedFiles.end()) { ++FilesTotal; ++FilesCompleted; continue; }
+
+		//  Read the version stamp from the hosted file header. Files already on the target list are skipped.
+		std::ifstream hostedFile(filePath, std::ios_base::binary);
+		if (!hostedFile.good()) continue;
+		int fileVersion = 0;
+		uint64_t fileSize = 0;
+		hostedFile.read((char*)&fileVersion, sizeof(fileVersion));
+		hostedFile.read((char*)&fileSize, sizeof(fileSize));
+		hostedFile.close();
+
+		auto sourceVersion = Groundfish::ResolveVersion(fileVersion);
+		if (sourceVersion == TargetVersion) continue;
+
+		//  Build the translation table here on the main thread, as loading archived word lists is not thread-safe
+		if (GetReKeyTable(sourceVersion) == nullptr)
+		{
+			debugConsole->AddDebugConsoleLine("Re-key skipped " + checksum + ": word list version " + std::to_string(sourceVersion) + " is not archived");
+			continue;
+		}
+
+		++FilesTotal;
+		BytesTotal += fileSize;
+		PendingFiles.push_back(ReKeyFileItem{ checksum, sourceVersion, fileSize });
+	}
+
+	JobState = REKEY_STATE_RUNNING;
+	StartTime = LastSampleTime = AsyncScheduler::GetNow();
+	LastSampleBytes = 0;
+	Throughput = 0.0;
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - Re-keying " + std::to_string(PendingFiles.size()) + " hosted files and " + std::to_string(PendingRows.size()) + " file entries to word list " + std::to_string(TargetVersion));
+}
+
+
+inline HostedFileReKeyJob::ReKeyTable* HostedFileReKeyJob::GetReKeyTable(int sourceVersion)
+{
+	auto tableIter = ReKeyTables.find(sourceVersion);
+	if (tableIter != ReKeyTables.end()) return (*tableIter).second;
+	if (!Groundfish::GetWordListExists(sourceVersion)) return nullptr;
+
+	auto& sourceList = Groundfish::GetWordList(sourceVersion);
+	auto& targetList = Groundfish::GetWordList(TargetVersion);
+
+	auto newTable = new ReKeyTable;
+	for (auto i = 0; i < 256; ++i)
+		for (auto j = 0; j < 256; ++j)
+			newTable->Table[i][j] = targetList.WordList[i][sourceList.ReverseWordList[i][j]];
+
+	ReKeyTables[sourceVersion] = newTable;
+	return newTable;
+}
+
+
+inline void HostedFileReKeyJob::ClearReKeyTables()
+{
+	for (auto table : ReKeyTables) delete table.second;
+	ReKeyTables.clear();
+}
+
+
+inline void HostedFileReKeyJob::SubmitSliceJobs()
+{
+	//  Open up to the limit of files at once. The job system decides how many of their slices actually run in parallel.
+	while ((ActiveFiles.size() < REKEY_MAX_ACTIVE_FILES) && !PendingFiles.empty())
+	{
+		auto progress = std::make_shared<ReKeyFileProgress>();
+		progress->Item = PendingFiles.front();
+		progress->Table = ReKeyTables[progress->Item.SourceVersion];
+		progress->BytesRead = 0;
+		progress->WordIndex = 0;
+		progress->Opened = false;
+		progress->Failed = false;
+		progress->SliceJob = INVALID_JOB_HANDLE;
+		ActiveFiles.push_back(progress);
+		PendingFiles.pop_front();
+	}
+
+	//  Each idle file gets its next slice, for as long as the rate limiter allows it
+	for (auto progress : ActiveFiles)
+	{
+		if (progress->SliceJob != INVALID_JOB_HANDLE) continue;
+
+		auto sliceSize = std::min<uint64_t>(progress->Item.FileSize - progress->BytesRead, REKEY_SLICE_SIZE);
+		if (!RateLimiter.TryAcquire(sliceSize)) break;
+
+		//  Slices are always waited on before we're destroyed, but completions run later, so those check we're still around
+		std::weak_ptr<bool> lifetime = LifetimeToken;
+		progress->SliceJob = jobSystem.Submit(
+			[this, progress, sliceSize]() { ReKeyFileSlice(*progress, sliceSize); },
+			[this, progress, lifetime]() { if (!lifetime.expired()) OnSliceComplete(progress); },
+			JOB_PRIORITY_LOW);
+	}
+}
+
+
+inline void HostedFileReKeyJob::CancelSliceJobs()
+{
+	Cancelled = true;
+	for (auto progress : ActiveFiles)
+	{
+		if (progress->SliceJob != INVALID_JOB_HANDLE) jobSystem.WaitForJob(progress->SliceJob);
+		progress->FileIn.close();
+		progress->FileOut.close();
+		std::remove((GetHostedFilePath(progress->Item.Checksum) + REKEY_TEMP_EXTENSION).c_str());
+	}
+	ActiveFiles.clear();
+	Cancelled = false;
+}
+
+
+inline void HostedFileReKeyJob::OnSliceComplete(std::shared_ptr<ReKeyFileProgress> progress)
+{
+	//  A cancelled job has already dropped the file from its active list
+	auto activeIter = std::find(ActiveFiles.begin(), ActiveFiles.end(), progress);
+	if (activeIter == ActiveFiles.end()) return;
+	progress->SliceJob = INVALID_JOB_HANDLE;
+
+	//  A file that fails is left as it is, and not checkpointed, so the next run of the job tries it again
+	if (progress->Failed)
+	{
+		std::remove((GetHostedFilePath(progress->Item.Checksum) + REKEY_TEMP_EXTENSION).c_str());
+		debugConsole->AddDebugConsoleLine("Re-key failed for hosted file " + progress->Item.Checksum);
+		++FilesFailed;
+		ActiveFiles.erase(activeIter);
+		return;
+	}
+
+	//  Completed files wait for the main thread to swap them in, since it knows which files are being served
+	if (progress->Opened && !progress->FileOut.is_open())
+	{
+		SwapReadyFiles.push_back(progress->Item);
+		ActiveFiles.erase(activeIter);
+	}
+}
+
+
+//  Runs on a job system worker. Opens the file on its first slice, re-keys up to sliceSize bytes, and closes it once the last byte is written.
+inline void HostedFileReKeyJob::ReKeyFileSlice(ReKeyFileProgress& progress, uint64_t sliceSize)
+{
+	if (Cancelled) { progress.Failed = true; return; }
+
+	auto filePath = GetHostedFilePath(progress.Item.Checksum);
+	if (!progress.Opened)
+	{
+		progress.FileIn.open(filePath, std::ios_base::binary);
+		progress.FileOut.open(filePath + REKEY_TEMP_EXTENSION, std::ios_base::binary | std::ios_base::trunc);
+		progress.Opened = true;
+		if (!progress.FileIn.good() || !progress.FileOut.good()) { progress.Failed = true; return; }
+
+		int fileVersion = 0;
+		uint64_t fileSize = 0;
+		progress.FileIn.read((char*)&fileVersion, sizeof(fileVersion));
+		progress.FileIn.read((char*)&fileSize, sizeof(fileSize));
+		progress.FileIn.read((char*)&progress.WordIndex, sizeof(progress.WordIndex));
+
+		//  The word index sequence is identical under both lists, so the header only changes its version stamp
+		progress.FileOut.write((char*)&TargetVersion, sizeof(TargetVersion));
+		progress.FileOut.write((char*)&fileSize, sizeof(fileSize));
+		progress.FileOut.write((char*)&progress.WordIndex, sizeof(progress.WordIndex));
+		progress.Block.resize(REKEY_BLOCK_SIZE);
+	}
+
+	auto table = progress.Table;
+	auto wordIndex = progress.WordIndex;
+	uint64_t sliceRead = 0;
+	while (sliceRead < sliceSize)
+	{
+		if (Cancelled) { progress.Failed = true; return; }
+
+		auto bytesToRead = std::min<uint64_t>(sliceSize - sliceRead, REKEY_BLOCK_SIZE);
+		progress.FileIn.read((char*)progress.Block.data(), bytesToRead);
+		if (uint64_t(progress.FileIn.gcount()) != bytesToRead) { progress.Failed = true; return; }
+
+		for (uint64_t i = 0; i < bytesToRead; ++i) { progress.Block[i] = table->Table[wordIndex][progress.Block[i]]; ++wordIndex; }
+		progress.FileOut.write((char*)progress.Block.data(), bytesToRead);
+
+		sliceRead += bytesToRead;
+		BytesProcessed += bytesToRead;
+	}
+	progress.WordIndex = wordIndex;
+	progress.BytesRead += sliceRead;
+
+	if (progress.BytesRead < progress.Item.FileSize) return;
+	progress.FileIn.close();
+	progress.FileOut.close();
+	progress.Failed = !progress.FileOut.good();
+}
+
+
+//  Returns whether the row is done with: re-keyed, already on the target list, or no longer in the catalog
+inline bool HostedFileReKeyJob::ReKeyRow(std::string checksum)
+{
+	HostedFileData fileData;
+	if (NPSQL::GetFileData(checksum, fileData) == false) return !NPSQL::CheckIfFileExists(checksum);
+
+	//  Each column carries its own version stamp, so columns already on the target list are left alone. A column we can't
+	//  decrypt leaves the whole row as it was.
+	auto changed = false;
+	auto failed = false;
+	auto reKeyColumn = [this, &changed, &failed](EncryptedData& column)
+	{
+		if (column.size() < 9) { failed = true; return; }
+		auto sourceVersion = Groundfish::ResolveVersion(Groundfish::GetEncryptedVersion(column.data()));
+		if (sourceVersion == TargetVersion) return;
+		if (!Groundfish::GetWordListExists(sourceVersion)) { failed = true; return; }
+		column = Groundfish::ReEncrypt(column, Groundfish::GetWordList(sourceVersion));
+		changed = true;
+	};
+
+	reKeyColumn(fileData.EncryptedFileName);
+	reKeyColumn(fileData.EncryptedFileTitle);
+	reKeyColumn(fileData.EncryptedFileDescription);
+	reKeyColumn(fileData.EncryptedUploader);
+
+	if (failed) return false;
+	if (!changed) return true;
+	if (!NPSQL::UpdateFileEncryptedData(fileData)) return false;
+	if (RowChangedCallback) RowChangedCallback(checksum);
+	return true;
+}
+
+
+inline void HostedFileReKeyJob::AppendCheckpoint(std::string entry)
+{
+	std::ofstream checkpointFile(REKEY_CHECKPOINT_FILE, std::ios_base::app);
+	checkpointFile << entry << "\n";
+	checkpointFile.close();
+}
+
+
+inline void HostedFileReKeyJob::Update(const std::unordered_map<std::string, int>& filesInUse)
+{
+	if (!GetRunning()) return;
+
+	//  Back off while anyone is transferring, so the re-key never competes with live downloads for the disk
+	RateLimiter.SetRate(filesInUse.empty() ? BaseRate : (BaseRate * REKEY_BUSY_RATE_FRACTION));
+
+	//  Re-key a handful of database rows each frame, as SQL access stays on the main thread. Only rows that are done with are
+	//  checkpointed. One that fails goes to the back of the queue, and after a few tries it's left for the next run of the job.
+	for (auto i = 0; (i < REKEY_ROWS_PER_UPDATE) && !PendingRows.empty(); ++i)
+	{
+		auto checksum = PendingRows.front();
+		PendingRows.pop_front();
+		if (ReKeyRow(checksum))
+		{
+			AppendCheckpoint("R " + checksum);
+			++RowsCompleted;
+			continue;
+		}
+
+		if (++RowAttempts[checksum] < REKEY_ROW_MAX_ATTEMPTS) { PendingRows.push_back(checksum); continue; }
+		debugConsole->AddDebugConsoleLine("Re-key failed for file entry " + checksum + " after " + std::to_string(REKEY_ROW_MAX_ATTEMPTS) + " attempts");
+		++RowsFailed;
+	}
+
+	SubmitSliceJobs();
+
+	//  Swap in any re-keyed files that aren't currently open for a transfer. The rename replaces the old blob in one step.
+	std::vector<ReKeyFileItem> swapList;
+	swapList.swap(SwapReadyFiles);
+	for (auto item : swapList)
+	{
+		auto filePath = GetHostedFilePath(item.Checksum);
+		auto tempPath = filePath + REKEY_TEMP_EXTENSION;
+
+		//  If the file was deleted from the catalog while we worked on it, don't bring it back
+		if (!NPSQL::CheckIfFileExists(item.Checksum))
+		{
+			std::remove(tempPath.c_str());
+			++FilesCompleted;
+			continue;
+		}
+
+		std::error_code error;
+		if (filesInUse.find(filePath) == filesInUse.end()) std::filesystem::rename(tempPath, filePath, error);
+		else error = std::make_error_code(std::errc::device_or_resource_busy);
+
+		if (error)
+		{
+			SwapReadyFiles.push_back(item);
+			continue;
+		}
+
+		AppendCheckpoint("F " + item.Checksum);
+		++FilesCompleted;
+	}
+
+	//  Sample the throughput once a second for the UI
+	if (AsyncScheduler::GetNow() - LastSampleTime >= 1.0)
+	{
+		uint64_t bytesProcessed = BytesProcessed;
+		Throughput = double(bytesProcessed - LastSampleBytes) / (AsyncScheduler::GetNow() - LastSampleTime);
+		LastSampleBytes = bytesProcessed;
+		LastSampleTime = AsyncScheduler::GetNow();
+	}
+
+	//  The job is complete once every file has been through its last slice and nothing is left waiting on the main thread
+	if (PendingRows.empty() && PendingFiles.empty() && ActiveFiles.empty() && SwapReadyFiles.empty()) Finish();
+}
+
+
+inline void HostedFileReKeyJob::Finish()
+{
+	ClearReKeyTables();
+	JobState = REKEY_STATE_COMPLETE;
+
+	//  Anything that failed isn't in the checkpoint, so keeping it has the next server start try those again
+	if ((RowsFailed == 0) && (FilesFailed == 0)) std::remove(REKEY_CHECKPOINT_FILE);
+	else
+	{
+		debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - Re-key finished with " + std::to_string(RowsFailed) + " file entries and " + std::to_string(FilesFailed) + " hosted files still to do. They'll be tried again when the server restarts.");
+		return;
+	}
+
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - Re-key complete: " + std::to_string(FilesCompleted) + " hosted files now on word list " + std::to_string(TargetVersion));
+}
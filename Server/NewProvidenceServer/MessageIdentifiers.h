@@ -20,6 +20,29 @@ enum MessageIDs
 	MESSAGE_ID_FILE_PORTION_COMPLETE			= 14,	// File Portion Complete Check (two-way)
 	MESSAGE_ID_FILE_CHUNKS_REMAINING			= 15,	// File Chunks Remaining (two-way)
 	MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM	= 16,	// File Portion Complete Confirm (two-way)
+	MESSAGE_ID_FRAMING_VERSION					= 17,	// Framing Version offer, choice and confirmation (two-way, always sent with the framing in use)
+	MESSAGE_ID_DATA_CHANNEL_OFFER				= 18,	// Data Channel session ID, key and UDP port (server to client)
+	MESSAGE_ID_DATA_CHANNEL_HELLO				= 19,	// Data Channel Hello, sent over UDP and answered in kind (two-way)
+	MESSAGE_ID_DATA_CHANNEL_CONFIRM				= 20,	// Data Channel Confirm, once the server's hello has come back (client to server)
+	MESSAGE_ID_FILE_PARITY						= 21,	// File Portion Parity, for rebuilding lost chunks (two-way)
+	MESSAGE_ID_SESSION_TICKET					= 22,	// Session Ticket, for resuming the login on a new connection (server to client)
+	MESSAGE_ID_SESSION_RESUME_REQUEST			= 23,	// Session Resume Request, with the ticket and the last hosted file list sequence (client to server)
+	MESSAGE_ID_SESSION_RESUME_RESPONSE			= 24,	// Session Resume Response (server to client)
+	MESSAGE_ID_FILE_BUNDLE_REQUEST				= 25,	// File Bundle Request, for several files at once (client to server)
+	MESSAGE_ID_FILE_INLINE						= 26,	// Inline Files, sent whole in place of a File Send Initializer (server to client)
+	MESSAGE_ID_COLLECTION_REQUEST				= 27,	// Collection Request, for a set of files sent one after another (client to server)
+	MESSAGE_ID_COLLECTION_PROGRESS				= 28,	// Collection Progress, with the files and bytes still to come (server to client)
+};
+
+//  Message channels (syncronous with both client and server). Once both ends are on the channel framing, every frame says which
+//  channel it was sent on, and each end's send queue gives the control channel strict priority and shares the rest fairly.
+//  A file transfer's messages, both the file itself and the receiver's replies, all go on the channel for its direction.
+enum MessageChannels
+{
+	MESSAGE_CHANNEL_CONTROL						= 0,	// Pings, logins, chat, file lists and file requests (two-way)
+	MESSAGE_CHANNEL_DOWNLOAD					= 1,	// A file going from the server to the client, and the client's replies (two-way)
+	MESSAGE_CHANNEL_UPLOAD						= 2,	// A file going from the client to the server, and the server's replies (two-way)
+	MESSAGE_CHANNEL_COUNT
 };
 
 //  Login Response Identifiers
@@ -29,7 +52,17 @@ enum LoginResponseIdentifiers
 	LOGIN_RESPONSE_USERNAME_DOES_NOT_EXIST = 1,
 	LOGIN_RESPONSE_PASSWORD_INCORRECT = 2,
 	LOGIN_RESPONSE_VERSION_NUMBER_INCORRECT = 3,
-	LOGIN_RESPONSE_USER_ALREADY_LOGGED_IN = 4
+	LOGIN_RESPONSE_USER_ALREADY_LOGGED_IN = 4,
+	LOGIN_RESPONSE_SESSION_EXPIRED = 5
+};
+
+//  Inline File Results, one for each file asked for in a bundle
+enum FileInlineResults
+{
+	FILE_INLINE_SENT = 0,			//  The file is in the message
+	FILE_INLINE_NOT_FOUND = 1,		//  There's no such file
+	FILE_INLINE_TOO_LARGE = 2,		//  The file is too large to send inline, so it has to be asked for on its own
+	FILE_INLINE_DEFERRED = 3		//  The file would have gone over what one message can hold, so it has to be asked for again
 };
 
 //  Login Response Strings
@@ -38,6 +71,7 @@ std::string LoginResponses[] =
 	"Successfully logged in to server!",
 	"Failed to log in to server. Username did not exist. Try again.",
 	"Failed to log in to server. Password was incorrect. Try again.",
-	"Failed to log in to server. Client version was incorrect. Contact admin."
+	"Failed to log in to server. Client version was incorrect. Contact admin.",
 	"Failed to log in to server. User is already logged in. Try again.",
+	"Your session has expired. Log in again.",
 };
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "Engine/SQLWrapper.h"
 #include "HostedFileData.h"
 
+#include <list>
+
 constexpr auto UserDatabaseName = "UserDatabase";
 constexpr auto FileDatabaseName = "FileDatabase";
 
@@ -153,6 +155,22 @@ namespace NPSQL {
 		return true;
 	}
 
+	bool UpdateFileEncryptedData(HostedFileData& hfd)
+	{
+		auto setCommand = "NAME = '" + hfd.getFileNameString() + "', TITLE = '" + hfd.getFileTitleString() + "', DESCRIPTION = '" + hfd.getFileDescString() + "', UPLOADER = '" + hfd.getFileUploaderString() + "'";
+		return sqlWrapper.UpdateInTable(FileDatabaseName, "FILES", setCommand, "WHERE CHECKSUM = '" + hfd.FileTitleChecksum + "'");
+	}
+
+	bool GetHostedFileChecksums(std::vector<std::string>& outList)
+	{
+		SQLSelectData selectData;
+		if (sqlWrapper.SelectFromTable(FileDatabaseName, "CHECKSUM", "FILES", "", selectData, "CHECKSUM") == false) return false;
+
+		outList.clear();
+		for (auto dataEntry : selectData) outList.push_back(dataEntry.first);
+		return true;
+	}
+
 	bool RemoveFile(std::string fileChecksum)
 	{
 		return sqlWrapper.DeleteInTable(FileDatabaseName, "FILES", "WHERE CHECKSUM = '" + fileChecksum + "'");
@@ -1,53 +1,53 @@
 #pragma once
 
-#include "Server.h"
+#include "ServerCommands.h"
 #include "Engine/GUIObjectNode.h"
 #include "Engine/GUIListBox.h"
 
-Server ServerControl;
 GUIListBox* HostedFileListBox = nullptr;
 GUIListBox* CurrentUserList = nullptr;
+GUILabel* ReKeyProgressLabel = nullptr;
 
-void AddDebugCommand_AddUserData(void)
+inline GUIObjectNode* GetFileTypeIconFromID(HostedFileType id)
 {
-	//  AddUserData: ["AddUserData USER PASS"] adds a user to the server if they don't already exist 
-	debugConsole->AddDebugCommand("AddUserData", [=](std::string commandString) -> bool
+	switch (id)
 	{
-		auto firstSpace = commandString.find_first_of(' ');
-		auto lastSpace = commandString.find_last_of(' ');
-		auto fullCommand = (lastSpace != (commandString.length() - 1));
-
-		if ((firstSpace == -1) || (firstSpace != lastSpace) || !fullCommand)
-		{
-			debugConsole->AddDebugConsoleLine("Proper use of AddUserData command: \"AddUserData USER PASS\"");
-			return false;
-		}
-
-		auto username = commandString.substr(0, firstSpace);
-		auto password = commandString.substr(firstSpace + 1, commandString.length() - 1 - firstSpace);
-		debugConsole->AddDebugConsoleLine("Adding user data: (" + username + ")[" + password + "]");
-
-		ServerControl.AddUserLoginDetails(username, password);
+	case FILETYPE_MUSIC:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/MusicIcon.png");
+	case FILETYPE_VIDEO:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/VideoIcon.png");
+	case FILETYPE_GAMES:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/GamesIcon.png");
+	case FILETYPE_OTHER:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
+	default:					assert(false); return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");;
+	}
+}
 
-		return true;
-	});
+inline GUIObjectNode* GetFileSubTypeIconFromID(HostedFileSubtype id)
+{
+	switch (id)
+	{
+	case FILETYPE_MUSIC_LFHHRBTRST:			return GUIObjectNode::CreateObjectNode("./Assets/Textures/LHHRBTRSTIcon.png");
+	case FILETYPE_MUSIC_EDM_DANCE:			return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
+	case FILETYPE_MUSIC_OTHER:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
+	case FILETYPE_VIDEO_TV:					return GUIObjectNode::CreateObjectNode("./Assets/Textures/TelevisionIcon.png");
+	case FILETYPE_VIDEO_MOVIE:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/MovieIcon.png");
+	case FILETYPE_VIDEO_PORN:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/PornIcon.png");
+	case FILETYPE_VIDEO_OTHER:				return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
+	case FILETYPE_GAMES_MISCELLANEOUS:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
+	case FILETYPE_OTHER_MISCELLANEOUS:		return GUIObjectNode::CreateObjectNode("./Assets/Textures/UnknownIcon.png");
+	default:								return nullptr;
+	}
 }
 
 void DeleteHostedFile(GUIObjectNode* fileDeleteButton)
 {
 	auto fileChecksum = ((GUIButton*)fileDeleteButton)->GetObjectName();
-	ServerControl.DeleteHostedFile(fileChecksum);
+	networkThread.Post([fileChecksum]() { ServerControl.DeleteHostedFile(fileChecksum); });
 }
 
-void UpdateHostedFileList()
+void UpdateHostedFileList(const std::vector<HostedFileListEntry>& fileList)
 {
-	std::list<HostedFileData> dataList;
-	NPSQL::GetHostedFileList(dataList, 0, 100);
-	dataList.sort(CompareUploadsByTimeAdded);
-
 	//  Clear the hosted file list and rebuild it using the most recent data
 	HostedFileListBox->ClearItems();
-	for (HostedFileData fileData : dataList)
+	for (auto& fileData : fileList)
 	{
 		auto newFileDataEntry = GUIObjectNode::CreateObjectNode("");
 
@@ -75,8 +75,8 @@ void UpdateHostedFileList()
 		fileSubTypeImage->SetPosition(470, 8);
 		newFileDataEntry->AddChild(fileSubTypeImage);
 
-		//  Decrypt the file title and set the file title label
-		auto fileTitle = Groundfish::DecryptToString(fileData.EncryptedFileTitle.data());
+		//  Set the file title label (the server has already decrypted the title)
+		auto& fileTitle = fileData.FileTitle;
 		auto fileTitleLimitedString = fileTitle.substr(0, std::min<int>(40, fileTitle.length()));
 		auto fileTitleLabel = GUILabel::CreateLabel("Arial", fileTitleLimitedString.c_str(), 520, 8, 200, 24);
 		newFileDataEntry->AddChild(fileTitleLabel);
@@ -95,65 +95,104 @@ void UpdateHostedFileList()
 	}
 }
 
-void UpdateCurrentUserList(std::unordered_map<UserConnection*, bool> userConnectionList)
+void UpdateUserListEntry(GUIObjectNode* userEntry, const UserListEntry& user)
 {
+	auto userIDLabel = static_cast<GUILabel*>(userEntry->GetChildByName("UserIDLabel"));
+	assert(userIDLabel != nullptr);
+	userIDLabel->SetText(user.UserIdentifier);
+
+	auto userRttLabel = static_cast<GUILabel*>(userEntry->GetChildByName("UserRttLabel"));
+	assert(userRttLabel != nullptr);
+	userRttLabel->SetText(user.GetRoundTripTimeString());
+
+	auto userStatusLabel = static_cast<GUILabel*>(userEntry->GetChildByName("UserStatusLabel"));
+	assert(userStatusLabel != nullptr);
+	userStatusLabel->SetText(user.StatusString);
+}
+
+void AddCurrentUserEntry(const UserListEntry& user)
+{
+	auto newUserEntry = GUIObjectNode::CreateObjectNode("");
+	newUserEntry->SetObjectName(std::to_string(user.ConnectionID));
+
+	//  Create the user identifier label
+	auto userIDLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial"), "", 10, 8, 200, 24);
+	userIDLabel->SetObjectName("UserIDLabel");
+	newUserEntry->AddChild(userIDLabel);
+
+	//  Create the round trip time label
+	auto userRttLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial"), "", 230, 8, 120, 24);
+	userRttLabel->SetObjectName("UserRttLabel");
+	newUserEntry->AddChild(userRttLabel);
+
+	//  Create the user status label
+	auto userStatusLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial"), "", 360, 8, 200, 24);
+	userStatusLabel->SetObjectName("UserStatusLabel");
+	newUserEntry->AddChild(userStatusLabel);
+
+	UpdateUserListEntry(newUserEntry, user);
+
+	//  Add the entry into the Current User List
+	CurrentUserList->AddItem(newUserEntry);
+}
+
+void RemoveCurrentUserEntry(uint64_t connectionID)
+{
+	auto entryName = std::to_string(connectionID);
+	auto currentUserList = CurrentUserList->GetItemList();
+	for (auto iter = currentUserList.begin(); iter != currentUserList.end(); ++iter)
+	{
+		if ((*iter)->GetObjectName() != entryName) continue;
+		CurrentUserList->RemoveItem((*iter));
+		return;
+	}
+}
+
+void UpdateCurrentUserList(const std::vector<UserListEntry>& userList)
+{
+	//  Index the new list by connection, which is what each entry is named after
+	std::unordered_map<std::string, const UserListEntry*> newUsers;
+	for (auto& user : userList) newUsers[std::to_string(user.ConnectionID)] = &user;
+
 	//  Clear out any users no longer connected, and update existing users from the new data
 	auto currentUserList = CurrentUserList->GetItemList();
 	for (auto iter = currentUserList.begin(); iter != currentUserList.end();)
 	{
-		auto user = ServerControl.GetUserConnectionByIP((*iter)->GetObjectName());
+		auto userIter = newUsers.find((*iter)->GetObjectName());
 
 		//  If the user no longer exists in the current connected user list, delete the iterator and continue
-		if (user == nullptr)
+		if (userIter == newUsers.end())
 		{
 			CurrentUserList->RemoveItem((*iter));
 			iter = currentUserList.erase(iter);
 			continue;
 		}
 
-		//  Create the user identifier label
-		auto userIDLabel = static_cast<GUILabel*>((*iter)->GetChildByName("UserIDLabel"));
-		assert(userIDLabel != nullptr);
-		userIDLabel->SetText(user->UserIdentifier);
-
-		//  Create the user identifier label
-		auto userStatusLabel = static_cast<GUILabel*>((*iter)->GetChildByName("UserStatusLabel"));
-		assert(userStatusLabel != nullptr);
-		userStatusLabel->SetText(user->StatusString);
-
-		auto userIter = userConnectionList.find(user);
-		assert(userIter != userConnectionList.end());
-		userConnectionList.erase(userIter);
+		UpdateUserListEntry((*iter), *(*userIter).second);
+		newUsers.erase(userIter);
 
 		iter++;
 	}
 
-	//  If there are any new user connections, they should still be in the passed list. Add entries for each new user
-	for (auto iter = userConnectionList.begin(); iter != userConnectionList.end(); ++iter)
-	{
-		auto user = (*iter).first;
-		auto newUserEntry = GUIObjectNode::CreateObjectNode("");
-		newUserEntry->SetObjectName((*iter).first->IPAddress);
-		
-		//  Create the user identifier label
-		auto userIDLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial"), "", 10, 8, 200, 24);
-		userIDLabel->SetObjectName("UserIDLabel");
-		userIDLabel->SetText(user->UserIdentifier);
-		newUserEntry->AddChild(userIDLabel);
-
-		//  Create the user identifier label
-		auto userStatusLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial"), "", 360, 8, 200, 24);
-		userStatusLabel->SetObjectName("UserStatusLabel");
-		userStatusLabel->SetText(user->StatusString);
-		newUserEntry->AddChild(userStatusLabel);
+	//  If there are any new user connections, they should still be in the new list. Add entries for each new user
+	for (auto& user : userList)
+		if (newUsers.find(std::to_string(user.ConnectionID)) != newUsers.end()) AddCurrentUserEntry(user);
+}
 
-		//  Add the entry into the Current User List
-		CurrentUserList->AddItem(newUserEntry);
+void UpdateCurrentUserStatus(const UserListEntry& user)
+{
+	//  A status update can arrive for a user whose entry hasn't been made yet, or has just been removed, so just skip those
+	auto currentUserList = CurrentUserList->GetItemList();
+	for (auto iter = currentUserList.begin(); iter != currentUserList.end(); ++iter)
+	{
+		if ((*iter)->GetObjectName() != std::to_string(user.ConnectionID)) continue;
+		UpdateUserListEntry((*iter), user);
+		return;
 	}
 }
 
 
-class PrimaryDialogue : public GUIObjectNode
+class PrimaryDialogue : public GUIObjectNode, EventListener
 {
 public:
 	PrimaryDialogue();
@@ -168,6 +207,8 @@ private:
 
 	GUIObjectNode* MainProgramUINode = nullptr;
 
+	virtual void ReceiveEvent(EventData* eventData) override;
+
 public:
 	virtual void Update();
 };
@@ -178,15 +219,17 @@ inline PrimaryDialogue::PrimaryDialogue()
 	LoadMainProgramUI();
 	InitializeServer();
 
-	AddDebugCommand_AddUserData();
+	AddServerCommands();
 }
 
 
 void PrimaryDialogue::InitializeServer()
 {
-	assert(ServerControl.Initialize());
+	auto initialized = ServerControl.Initialize();
+	assert(initialized);
 
-	UpdateHostedFileList();
+	//  From here on the server runs on the network thread, and reports back through events
+	networkThread.Start([]() { ServerControl.MainProcess(); });
 }
 
 
@@ -200,9 +243,17 @@ void PrimaryDialogue::LoadMainProgramUI()
 	LoadHostedFileListUI();
 	LoadCurrentUserListUI();
 
-	//  Set the Server control callbacks
-	ServerControl.SetHostedFileListChangedCallback(UpdateHostedFileList);
-	ServerControl.SetUserConnectionListChangedCallback(UpdateCurrentUserList);
+	//  Create the re-key progress label, which stays empty unless a word list rotation is being applied
+	ReKeyProgressLabel = GUILabel::CreateLabel(fontManager.GetFont("Arial"), "", 10, 520, 320, 24);
+	MainProgramUINode->AddChild(ReKeyProgressLabel);
+
+	//  Listen for the events the Server control sends over from the network thread
+	eventManager.AddEventListener("HostedFileListChanged", this);
+	eventManager.AddEventListener("UserListChanged", this);
+	eventManager.AddEventListener("UserConnected", this);
+	eventManager.AddEventListener("UserDisconnected", this);
+	eventManager.AddEventListener("UserStatusChanged", this);
+	eventManager.AddEventListener("ReKeyProgress", this);
 }
 
 
@@ -268,9 +319,18 @@ void PrimaryDialogue::LoadCurrentUserListUI()
 }
 
 
+void PrimaryDialogue::ReceiveEvent(EventData* eventData)
+{
+	if (eventData->EventType == "HostedFileListChanged") UpdateHostedFileList(static_cast<HostedFileListChangedEventData*>(eventData)->FileList);
+	else if (eventData->EventType == "UserListChanged") UpdateCurrentUserList(static_cast<UserListChangedEventData*>(eventData)->UserList);
+	else if (eventData->EventType == "UserConnected") AddCurrentUserEntry(static_cast<UserConnectedEventData*>(eventData)->User);
+	else if (eventData->EventType == "UserDisconnected") RemoveCurrentUserEntry(static_cast<UserDisconnectedEventData*>(eventData)->ConnectionID);
+	else if (eventData->EventType == "UserStatusChanged") UpdateCurrentUserStatus(static_cast<UserStatusChangedEventData*>(eventData)->User);
+	else if (eventData->EventType == "ReKeyProgress") ReKeyProgressLabel->SetText(static_cast<ReKeyProgressEventData*>(eventData)->ProgressString);
+}
+
+
 void PrimaryDialogue::Update()
 {
 	GUIObjectNode::Update();
-
-	ServerControl.MainProcess();
 }
\ No newline at end of file
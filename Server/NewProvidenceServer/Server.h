@@ -1,23 +1,42 @@
 #pragma once
 
 #include "Engine/WinsockWrapper.h"
+#include "Engine/DatagramChannel.h"
+#include "Engine/MessageStream.h"
 #include "Engine/SimpleMD5.h"
 #include "Engine/SimpleSHA256.h"
 #include "Groundfish.h"
 #include "FileSendAndReceive.h"
 #include "HostedFileData.h"
 #include "NPSQL.h"
+#include "HostedFileReKey.h"
+#include "HostedFileListCache.h"
+#include "SessionTickets.h"
+#include "Engine/AsyncRuntime.h"
+#include "Engine/NetworkThread.h"
+#include "Engine/EventLoopGroup.h"
+#include "Engine/EventManager.h"
+#include "Engine/TimeString.h"
 
 #include <fstream>
 #include <ctime>
+#include <filesystem>
+#include <deque>
+#include <memory>
 
 constexpr auto VERSION_NUMBER				= "2019.03.02";
 
 constexpr auto NEW_PROVIDENCE_PORT			= 2347;
+constexpr auto DATA_CHANNEL_PORT			= NEW_PROVIDENCE_PORT + 1;		//  The first shard's UDP port for transfers. Each shard after it takes the next.
 
 constexpr auto LATEST_UPLOADS_SENT_COUNT	= 20;
 constexpr auto PING_INTERVAL_TIME			= 5.0;
 constexpr auto PINGS_BEFORE_DISCONNECT		= 30;
+constexpr auto REKEY_PROGRESS_INTERVAL_TIME	= 0.25;
+constexpr auto RECEIVE_TIME_BUDGET			= 0.005;		//  Seconds per pass spent handling received messages, before the rest wait a pass
+constexpr auto TRANSFER_PACING_CAP			= 1.0;			//  Fraction of a path's estimated bandwidth downloads are paced at (0 to not pace)
+
+static_assert((MESSAGE_CHANNEL_CONTROL == SEND_QUEUE_CONTROL_CHANNEL) && (MESSAGE_CHANNEL_COUNT <= SEND_QUEUE_CHANNEL_COUNT), "Every message channel needs a send queue channel, with control on the priority one");
 
 struct UserLoginDetails
 {
@@ -46,43 +65,95 @@ struct UserConnection
 	const std::string UserStatusStrings[USER_STATUS_COUNT] = { "Connected", "Logged In", "Downloading", "Uploading" };
 
 	UserConnection() :
+		ConnectionID(0),
 		SocketID(-1),
 		IPAddress(""),
-		LastPingTime(gameSeconds),
+		Network(nullptr),
+		LastPingTime(AsyncScheduler::GetNow()),
 		LastPingRequest(0.0),
+		RoundTripStartTime(0.0),
+		RoundTripRequests(0),
+		Rtt(std::make_shared<RttEstimator>()),
 		InboxCount(0),
 		UserIdentifier("UNKNOWN ID"),
 		Username("UNKNOWN USER"),
 		UserStatus(USER_STATUS_CONNECTED),
 		StatusString("Connected"),
 		UserFileSendTask(nullptr),
-		UserFileReceiveTask(nullptr)
+		UserFileReceiveTask(nullptr),
+		DataSession(nullptr),
+		DispatchQueued(false),
+		FramingVersion(0)
 	{}
 
-	UserConnection(int socketID, std::string ipAddress) :
+	UserConnection(uint64_t connectionID, int socketID, std::string ipAddress, WinsockWrapper* network) :
+		ConnectionID(connectionID),
 		SocketID(socketID),
 		IPAddress(ipAddress),
-		LastPingTime(gameSeconds),
+		Network(network),
+		LastPingTime(AsyncScheduler::GetNow()),
 		LastPingRequest(0.0),
+		RoundTripStartTime(0.0),
+		RoundTripRequests(0),
+		Rtt(std::make_shared<RttEstimator>()),
 		InboxCount(0),
 		UserIdentifier("UNKNOWN ID"),
 		Username("UNKNOWN USER"),
 		UserStatus(USER_STATUS_CONNECTED),
 		StatusString("Connected"),
 		UserFileSendTask(nullptr),
-		UserFileReceiveTask(nullptr)
+		UserFileReceiveTask(nullptr),
+		DataSession(nullptr),
+		DispatchQueued(false),
+		FramingVersion(0)
 	{}
 
-	inline void UpdatePingTime() { LastPingTime = gameSeconds; UpdatePingRequestTime(); }
-	inline void UpdatePingRequestTime() { LastPingRequest = gameSeconds; }
+	~UserConnection()
+	{
+		if (UserFileSendTask != nullptr) delete UserFileSendTask;
+		if (UserFileReceiveTask != nullptr) delete UserFileReceiveTask;
+	}
+
+	inline void UpdatePingTime() { LastPingTime = AsyncScheduler::GetNow(); UpdatePingRequestTime(); }
+	inline void UpdatePingRequestTime() { LastPingRequest = AsyncScheduler::GetNow(); }
+
+	//  The framing answer and each ping are requests the user answers straight away, so each is timed as a round trip sample.
+	//  A second request sent before the first is answered makes the answer ambiguous, so it isn't sampled (Karn's algorithm).
+	inline void StartRoundTrip() { RoundTripStartTime = AsyncScheduler::GetNow(); ++RoundTripRequests; }
+	inline void FinishRoundTrip()
+	{
+		if (RoundTripRequests == 1) Rtt->AddSample(AsyncScheduler::GetNow() - RoundTripStartTime);
+		RoundTripRequests = 0;
+	}
 	inline std::string GetUserStatusString() const { return UserStatusStrings[UserStatus]; }
 	inline void SetStatusIdle(int secondsSinceActive = 0) { StatusString = GetUserStatusString() + ", Idle (last activity " + std::to_string(secondsSinceActive) + " seconds ago)"; }
 	inline void SetStatusTransferring(bool download, std::string checksum, float percent, int kbps) { StatusString = StatusString = GetUserStatusString() + " file " + checksum + " [" + std::to_string(int(percent * 100.0f)) + "% @" + std::to_string(kbps) + " KB/s]"; }
 
+	//  Messages to and from this user are read and built in the connection's own buffers, never a shared one. Everything that
+	//  has arrived is read into the frame decoder in one go, and then taken out a message at a time into the receive buffer.
+	inline int ReceiveIncomingData() { return Network->ReceiveFrames(SocketID, &IncomingFrames); }
+	inline bool NextIncomingMessage() { return IncomingFrames.PopFrame(ReceiveBuffer); }
+	inline MessageWriter BeginMessage(unsigned char messageID) { return MessageWriter(SendBuffer, messageID); }
+	inline int SendOutgoingMessage() { return Network->SendMessageBuffer(SocketID, IPAddress.c_str(), NEW_PROVIDENCE_PORT, &SendBuffer); }
+
+	//  Sends a message the server has already composed once for everyone it's going to, such as the hosted file list
+	inline int SendBroadcast(const BroadcastFrame& frame) { return Network->SendBroadcastFrame(SocketID, frame); }
+
+	//  The connection's ID is unique for the life of the server. The socket ID is only unique within the shard's own wrapper.
+	uint64_t		ConnectionID;
 	int				SocketID;
 	std::string		IPAddress;
+	WinsockWrapper*	Network;
+	FrameDecoder	IncomingFrames;
+	SocketBuffer	ReceiveBuffer;
+	SocketBuffer	SendBuffer;
 	double			LastPingTime;
 	double			LastPingRequest;
+	double			RoundTripStartTime;
+	int				RoundTripRequests;
+
+	//  Shared with the transports of the user's transfers, which time their reminders by it and add samples of their own
+	std::shared_ptr<RttEstimator>	Rtt;
 
 	int				InboxCount;
 
@@ -95,66 +166,202 @@ struct UserConnection
 
 	FileSendTask*		UserFileSendTask = nullptr;
 	FileReceiveTask*	UserFileReceiveTask = nullptr;
+
+	//  The user's session on the shard's datagram channel, offered once they've logged in. Their transfers only go over it once
+	//  it's established, and otherwise stay on the connection.
+	std::shared_ptr<DatagramSession>	DataSession;
+
+	//  Pings the user while they're quiet, and finishes once they've been silent for too long
+	AsyncTask			KeepAlive;
+
+	//  Whether the connection is waiting in the server's dispatch queue, with messages left to handle or a close to act on
+	bool				DispatchQueued;
+
+	//  The framing chosen from the user's offer, or 0 if they haven't made one and are still on the legacy framing
+	int					FramingVersion;
+};
+
+
+//  Events the server sends to the UI. Everything in them is a copy, as the UI is on a different thread to the connections.
+struct UserListEntry
+{
+	uint64_t		ConnectionID;
+	std::string		IPAddress;
+	std::string		UserIdentifier;
+	std::string		StatusString;
+	double			RoundTripTime;		//  Smoothed, in seconds, or negative if there's no sample yet
+
+	UserListEntry() : ConnectionID(0), RoundTripTime(-1.0) {}
+	UserListEntry(const UserConnection* user) :
+		ConnectionID(user->ConnectionID),
+		IPAddress(user->IPAddress),
+		UserIdentifier(user->UserIdentifier),
+		StatusString(user->StatusString),
+		RoundTripTime(user->Rtt->GetHasSample() ? user->Rtt->GetSmoothedRtt() : -1.0)
+	{}
+
+	inline std::string GetRoundTripTimeString() const
+	{
+		if (RoundTripTime < 0.0) return "RTT -";
+		auto milliseconds = RoundTripTime * 1000.0;
+		char rttString[32];
+		snprintf(rttString, sizeof(rttString), (milliseconds < 10.0) ? "RTT %.1f ms" : "RTT %.0f ms", milliseconds);
+		return rttString;
+	}
+};
+
+//  The whole list at once, which is only sent when it's replaced outright (emptied on shutdown). Otherwise the UI is told
+//  about one connection at a time, and keeps its own list up to date from those.
+struct UserListChangedEventData : public EventData
+{
+	std::vector<UserListEntry> UserList;
+
+	UserListChangedEventData(std::string sender) : EventData::EventData("UserListChanged", sender) {}
+};
+
+struct UserConnectedEventData : public EventData
+{
+	UserListEntry User;
+
+	UserConnectedEventData(const UserListEntry& user, std::string sender) : EventData::EventData("UserConnected", sender), User(user) {}
+};
+
+struct UserDisconnectedEventData : public EventData
+{
+	uint64_t ConnectionID;
+
+	UserDisconnectedEventData(uint64_t connectionID, std::string sender) : EventData::EventData("UserDisconnected", sender), ConnectionID(connectionID) {}
+};
+
+//  A single user's status line changing, which is most often transfer progress
+struct UserStatusChangedEventData : public EventData
+{
+	UserListEntry User;
+
+	UserStatusChangedEventData(const UserListEntry& user, std::string sender) : EventData::EventData("UserStatusChanged", sender), User(user) {}
+};
+
+struct HostedFileListEntry
+{
+	std::string			FileTitleChecksum;
+	std::string			FileTitle;
+	uint64_t			FileSize;
+	HostedFileType		FileType;
+	HostedFileSubtype	FileSubType;
+};
+
+struct HostedFileListChangedEventData : public EventData
+{
+	std::vector<HostedFileListEntry> FileList;
+
+	HostedFileListChangedEventData(std::string sender) : EventData::EventData("HostedFileListChanged", sender) {}
+};
+
+struct ReKeyProgressEventData : public EventData
+{
+	std::string		ProgressString;
+
+	ReKeyProgressEventData(std::string progressString, std::string sender) : EventData::EventData("ReKeyProgress", sender), ProgressString(progressString) {}
 };
 
 
 //  Outgoing message send functions
 void SendMessage_PingRequest(UserConnection* user)
 {
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_PING_REQUEST, 0);
-	winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
+	user->BeginMessage(MESSAGE_ID_PING_REQUEST);
+	user->SendOutgoingMessage();
+	user->StartRoundTrip();
+}
+
+
+void SendMessage_FramingVersion(UserConnection* user, unsigned char framingVersion)
+{
+	auto message = user->BeginMessage(MESSAGE_ID_FRAMING_VERSION);
+	message.WriteChar(framingVersion);
+	user->SendOutgoingMessage();
+	user->StartRoundTrip();
 }
 
+void SendMessage_DataChannelOffer(UserConnection* user, int port)
+{
+	//  The key is encrypted like anything else private, so only a client holding the word list can make datagrams for the session
+	auto& session = *user->DataSession;
+	EncryptedData encryptedKey = Groundfish::Encrypt((const char*)(session.Key), DATAGRAM_SESSION_KEY_SIZE, 0, rand() % 256);
+
+	auto message = user->BeginMessage(MESSAGE_ID_DATA_CHANNEL_OFFER);
+	message.WriteLongInt(session.SessionID);
+	message.WriteInt(int(encryptedKey.size()));
+	message.WriteBytes(encryptedKey);
+	message.WriteUnsignedShort((unsigned short)(port));
+	user->SendOutgoingMessage();
+}
+
+void SendMessage_SessionTicket(UserConnection* user, const SessionTicket& ticket, uint64_t listSequence)
+{
+	//  The secret is encrypted like anything else private. The list sequence is where the lists sent along with the ticket are up to.
+	EncryptedData encryptedSecret = Groundfish::Encrypt((const char*)(ticket.Secret), SESSION_TICKET_SECRET_SIZE, 0, rand() % 256);
+
+	auto message = user->BeginMessage(MESSAGE_ID_SESSION_TICKET);
+	message.WriteLongInt(ticket.TicketID);
+	message.WriteInt(int(encryptedSecret.size()));
+	message.WriteBytes(encryptedSecret);
+	message.WriteLongInt(listSequence);
+	user->SendOutgoingMessage();
+}
+
+void SendMessage_SessionResumeResponse(LoginResponseIdentifiers response, UserConnection* user)
+{
+	auto message = user->BeginMessage(MESSAGE_ID_SESSION_RESUME_RESPONSE);
+	message.WriteInt((int)response);
+	user->SendOutgoingMessage();
+}
 
 void SendMessage_LoginResponse(LoginResponseIdentifiers response, UserConnection* user)
 {
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_USER_LOGIN_RESPONSE, 0);
-	winsockWrapper.WriteInt((int)response, 0);
+	auto message = user->BeginMessage(MESSAGE_ID_USER_LOGIN_RESPONSE);
+	message.WriteInt((int)response);
 
 	if (response == LOGIN_RESPONSE_SUCCESS)
 	{
-		winsockWrapper.WriteInt(user->InboxCount, 0);
-		winsockWrapper.WriteInt(int(user->NotificationsList.size()), 0);
+		message.WriteInt(user->InboxCount);
+		message.WriteInt(int(user->NotificationsList.size()));
 	}
 
-	winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
+	user->SendOutgoingMessage();
 }
 
 
 void SendMessage_InboxAndNotifications(UserConnection* user)
 {
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_USER_INBOX_AND_NOTIFICATIONS, 0);
-	winsockWrapper.WriteInt(user->InboxCount, 0);
+	auto message = user->BeginMessage(MESSAGE_ID_USER_INBOX_AND_NOTIFICATIONS);
+	message.WriteInt(user->InboxCount);
 	for (auto i = 0; i < user->InboxCount; ++i)
 	{
 		//  TODO: Write inbox item data
 	}
-	winsockWrapper.WriteInt(int(user->NotificationsList.size()), 0);
+	message.WriteInt(int(user->NotificationsList.size()));
 	for (auto notificationIter = user->NotificationsList.begin(); notificationIter != user->NotificationsList.end(); ++notificationIter)
 	{
-		winsockWrapper.WriteInt(int((*notificationIter).length()), 0);
-		winsockWrapper.WriteChars((unsigned char*)(*notificationIter).c_str(), int((*notificationIter).length()), 0);
+		message.WriteInt(int((*notificationIter).length()));
+		message.WriteBytes((*notificationIter).c_str(), int((*notificationIter).length()));
 	}
 
-	winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
+	user->SendOutgoingMessage();
 }
 
 
-void SendMessage_HostedFileList(UserConnection* user, int startIndex = 0, EncryptedData encryptedUsername = EncryptedData(), HostedFileType type = FILE_TYPE_COUNT, HostedFileSubtype subtype = FILE_SUBTYPE_COUNT)
+void WriteMessage_HostedFileList(SocketBuffer& buffer, int startIndex = 0, EncryptedData encryptedUsername = EncryptedData(), HostedFileType type = FILE_TYPE_COUNT, HostedFileSubtype subtype = FILE_SUBTYPE_COUNT, HostedFileListWindow* window = nullptr, uint64_t listSequence = 0)
 {
 	//  Message composition:
 	//  - (1 byte) unsigned char representing the message ID
 	//  - (2 bytes) unsigned short representing the starting index
 	//  - (2 bytes) unsigned short representing the list size (max 20)
 	//  - (1440 bytes) (1 + 1 + 1 + 49 + 1 + 19) x [list max (20)]
+	//  - (8 bytes) the hosted file list sequence the list was built at
 	//
-	//  Max message size = 1045 bytes
+	//  Max message size = 1053 bytes
 
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_HOSTED_FILE_LIST, 0);
+	MessageWriter message(buffer, MESSAGE_ID_HOSTED_FILE_LIST);
 
 	//  Grab the file data list and find out the list size we're going to send.
 	std::list<HostedFileData> hostedFileDataList;
@@ -162,6 +369,19 @@ void SendMessage_HostedFileList(UserConnection* user, int startIndex = 0, Encryp
 	hostedFileDataList.sort(CompareUploadsByTimeAdded);
 	auto listSize = hostedFileDataList.size();
 
+	//  Note which rows the list was built from, for the cache to tell which changes to the catalog reach it
+	if (window != nullptr)
+	{
+		window->Checksums.clear();
+		window->LastUploadTime.clear();
+		for (auto& fileData : hostedFileDataList)
+		{
+			window->Checksums.push_back(fileData.FileTitleChecksum);
+			window->LastUploadTime = std::max(window->LastUploadTime, fileData.FileUploadTime);
+		}
+		window->Full = (hostedFileDataList.size() >= size_t(LATEST_UPLOADS_SENT_COUNT));
+	}
+
 	//  Determine if we have enough uploads by the given user to fill the list size. If not, decrement the list size
 	if ((encryptedUsername.size() != 0) || (type != FILE_TYPE_COUNT) || (subtype != FILE_SUBTYPE_COUNT))
 	{
@@ -177,8 +397,8 @@ void SendMessage_HostedFileList(UserConnection* user, int startIndex = 0, Encryp
 		listSize = std::max<int>(std::min<int>(listSize, (uploadCount - startIndex)), 0);
 	}
 
-	winsockWrapper.WriteUnsignedShort(uint16_t(startIndex), 0);
-	winsockWrapper.WriteUnsignedShort(uint16_t(listSize), 0);
+	message.WriteUnsignedShort(uint16_t(startIndex));
+	message.WriteUnsignedShort(uint16_t(listSize));
 
 	if (listSize > 0)
 	{
@@ -195,38 +415,131 @@ void SendMessage_HostedFileList(UserConnection* user, int startIndex = 0, Encryp
 			if (--listSize < 0) break;
 			auto title = (*iter).EncryptedFileTitle;
 			assert(title.size() <= ENCRYPTED_TITLE_MAX_SIZE);
-			winsockWrapper.WriteChar((unsigned char)((*iter).FileType), 0);
-			winsockWrapper.WriteChar((unsigned char)((*iter).FileSubType), 0);
+			message.WriteChar((unsigned char)((*iter).FileType));
+			message.WriteChar((unsigned char)((*iter).FileSubType));
 
-			winsockWrapper.WriteChar((unsigned char)(title.size()), 0);
-			winsockWrapper.WriteChars(title.data(), int(title.size()), 0);
+			message.WriteChar((unsigned char)(title.size()));
+			message.WriteBytes(title);
 
-			winsockWrapper.WriteChar(uint8_t((*iter).EncryptedUploader.size()), 0);
-			winsockWrapper.WriteChars((*iter).EncryptedUploader.data(), (*iter).EncryptedUploader.size(), 0);
+			message.WriteChar(uint8_t((*iter).EncryptedUploader.size()));
+			message.WriteBytes((*iter).EncryptedUploader);
 		}
 	}
 
-	winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
+	message.WriteLongInt(listSequence);
+}
+
+
+//  The hosted file list is read from the database, so it's only ever built on the network thread. Shards are handed the frame.
+std::shared_ptr<const BroadcastFrame> ComposeMessage_HostedFileList(int startIndex = 0, EncryptedData encryptedUsername = EncryptedData(), HostedFileType type = FILE_TYPE_COUNT, HostedFileSubtype subtype = FILE_SUBTYPE_COUNT, HostedFileListWindow* window = nullptr, uint64_t listSequence = 0)
+{
+	SocketBuffer buffer;
+	WriteMessage_HostedFileList(buffer, startIndex, encryptedUsername, type, subtype, window, listSequence);
+	return BroadcastFrame::Create(buffer);
+}
+
+
+//  A chat line is encrypted once, on the network thread, and everyone it goes to is sent the same bytes
+std::shared_ptr<const BroadcastFrame> ComposeMessage_ChatString(const std::string& chatString)
+{
+	EncryptedData encryptedChatString = Groundfish::Encrypt(chatString.c_str(), int(chatString.length()) + 1, 0, rand() % 256);
+
+	SocketBuffer buffer;
+	{
+		MessageWriter message(buffer, MESSAGE_ID_ENCRYPTED_CHAT_STRING);
+		message.WriteInt(int(encryptedChatString.size()));
+		message.WriteBytes(encryptedChatString);
+	}
+	return BroadcastFrame::Create(buffer);
 }
 
 
 void SendMessage_FileRequestFailed(std::string fileID, std::string failureReason, UserConnection* user)
 {
 	//  Send a "File Request" message
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_REQUEST_FAILED, 0);
-	winsockWrapper.WriteString(fileID.c_str(), 0);
-	winsockWrapper.WriteString(failureReason.c_str(), 0);
-	winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
+	auto message = user->BeginMessage(MESSAGE_ID_FILE_REQUEST_FAILED);
+	message.WriteString(fileID);
+	message.WriteString(failureReason);
+	user->SendOutgoingMessage();
+}
+
+
+//  A file asked for, and whether it's being sent inline. One that is carries its hosted copy exactly as it's stored (still
+//  encrypted, with its word list stamped on it), so the server never decrypts it and the client decrypts it straight into place.
+struct InlineFile
+{
+	std::string			FileTitle;
+	FileInlineResults	Result = FILE_INLINE_NOT_FOUND;
+	EncryptedData		EncryptedFileName;
+	EncryptedData		Contents;
+
+	//  Bytes the file's entry takes up in a FILE_INLINE
+	inline int GetMessageSize() const { return int(FileTitle.size()) + 2 + ((Result == FILE_INLINE_SENT) ? (8 + int(EncryptedFileName.size()) + int(Contents.size())) : 0); }
+};
+
+constexpr auto FILE_INLINE_MESSAGE_HEADER_SIZE = 3;
+
+//  The largest FILE_INLINE a connection's framing can carry, up to the bundle limit
+inline int GetFileInlineMessageLimit(int framingVersion) { return (framingVersion >= FRAMING_VERSION_LARGE) ? FILE_INLINE_BUNDLE_MAX_SIZE : FRAME_LEGACY_MAX_MESSAGE_SIZE; }
+
+//  Reads a hosted file whole, if it's no larger than the inline limit. This is done on the network thread, where a re-key swaps
+//  its files in, so a file is never read half way through being replaced.
+bool ReadInlineFile(const HostedFileData& fileData, int inlineLimit, EncryptedData& contents)
+{
+	inlineLimit = std::min<int>(inlineLimit, FILE_INLINE_MAX_SIZE);
+	if (inlineLimit <= 0) return false;
+
+	std::error_code error;
+	auto filePath = GetHostedFilePath(fileData.FileTitleChecksum);
+	auto fileSize = std::filesystem::file_size(filePath, error);
+	if (error || (fileSize > uint64_t(inlineLimit))) return false;
+
+	std::ifstream file(filePath, std::ios_base::binary);
+	if (!file.good()) return false;
+	contents.resize(size_t(fileSize));
+	file.read((char*)contents.data(), std::streamsize(fileSize));
+	return (uint64_t(file.gcount()) == fileSize);
+}
+
+//  An answer to a file or bundle request, composed on the network thread and queued on the connection as it is. It goes on the
+//  download channel, so a large bundle shares the connection fairly rather than holding up control messages.
+std::shared_ptr<const BroadcastFrame> ComposeMessage_FileInline(const std::vector<InlineFile>& files)
+{
+	SocketBuffer buffer;
+	{
+		MessageWriter message(buffer, MESSAGE_ID_FILE_INLINE);
+		message.WriteUnsignedShort((uint16_t)(files.size()));
+		for (auto iter = files.begin(); iter != files.end(); ++iter)
+		{
+			message.WriteString((*iter).FileTitle);
+			message.WriteChar((unsigned char)((*iter).Result));
+			if ((*iter).Result != FILE_INLINE_SENT) continue;
+
+			message.WriteInt(int((*iter).EncryptedFileName.size()));
+			message.WriteBytes((*iter).EncryptedFileName);
+			message.WriteInt(int((*iter).Contents.size()));
+			message.WriteBytes((*iter).Contents);
+		}
+	}
+	return BroadcastFrame::Create(buffer, MESSAGE_CHANNEL_DOWNLOAD);
+}
+
+
+void SendMessage_CollectionProgress(uint64_t collectionID, int filesRemaining, uint64_t bytesRemaining, UserConnection* user)
+{
+	auto message = user->BeginMessage(MESSAGE_ID_COLLECTION_PROGRESS);
+	message.WriteLongInt(collectionID);
+	message.WriteInt(filesRemaining);
+	message.WriteLongInt(bytesRemaining);
+	user->SendOutgoingMessage();
 }
 
 
 void SendMessage_FileSendInitFailed(std::string failureReason, UserConnection* user)
 {
-	winsockWrapper.ClearBuffer(0);
-	winsockWrapper.WriteChar(MESSAGE_ID_FILE_SEND_FAILED, 0);
-	winsockWrapper.WriteString(failureReason.c_str(), 0);
-	winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
+	auto message = user->BeginMessage(MESSAGE_ID_FILE_SEND_FAILED);
+	message.WriteString(failureReason);
+	user->SendOutgoingMessage();
 }
 
 
@@ -288,63 +601,343 @@ void ReadUserNotifications(UserConnection* user)
 }
 
 
+//  An upload a user has asked to make, decrypted on their shard and checked against the hosted file list on the network thread
+struct UploadRequest
+{
+	std::string			FileName;
+	std::string			FileTitle;
+	std::string			FileDescription;
+	HostedFileType		FileTypeID;
+	HostedFileSubtype	FileSubTypeID;
+	uint64_t			FileSize;
+	uint64_t			FileChunkSize;
+	uint64_t			FileChunkBufferCount;
+};
 
-class Server
+
+//  A collection a user has asked for, kept on the network thread: the files still to send, in the order asked for, and what's
+//  left of it. Its files are sent one after the other as each finishes, with no request from the user in between.
+struct CollectionFile
+{
+	std::string			FileTitle;
+	HostedFileData		FileData;
+};
+
+struct CollectionTransfer
+{
+	uint64_t					CollectionID = 0;
+	std::deque<CollectionFile>	Files;
+	uint64_t					BytesRemaining = 0;
+	int							InlineLimit = 0;
+	int							MessageLimit = 0;
+};
+
+
+class Server;
+
+//  Who on a shard a broadcast goes to
+enum BroadcastAudience
+{
+	BROADCAST_TO_ALL,
+	BROADCAST_TO_LOGGED_IN,		//  Users who haven't logged in yet are skipped, and are sent what they need when they do
+};
+
+//  Server Shard: one event loop's share of the connections. A shard owns everything about its connections (their sockets,
+//  buffers, keep-alives and transfers), and does all of the work that's per connection: receiving and framing, decrypting and
+//  hashing, and sending. Nothing in a shard is touched from any other thread. Anything that involves other connections or the
+//  databases (logging in, the hosted file list, starting a transfer, chat) is posted to the server on the network thread, and
+//  the server posts its answer back to the connection.
+class ServerShard
 {
 private:
-	int		ServerSocketHandle;
-	std::string UserDatabaseName = "UserDatabase";
+	Server&			Coordinator;
+	const int		ShardIndex;
+	WinsockWrapper	Network;
+	DatagramEndpoint DataChannel;
+
+	std::unordered_map<uint64_t, UserConnection*> Connections;
+	std::unordered_map<int, UserConnection*> ConnectionsBySocket;
+	std::vector<int> ReadySockets;
+	std::deque<UserConnection*, PoolAllocator<UserConnection*>> DispatchQueue;
+	double ReceiveTimeBudget = RECEIVE_TIME_BUDGET;
+	double TransferPacingCap = TRANSFER_PACING_CAP;
+	bool DataChannelTransfers = true;
+
+	//  Hands a callback to the server, to run on the network thread
+	inline void PostToServer(const std::function<void(Server&)>& callback) { auto& coordinator = Coordinator; networkThread.Post([&coordinator, callback]() { callback(coordinator); }); }
+
+public:
+	ServerShard(Server& coordinator, int shardIndex);
+	~ServerShard() {}
+
+	ServerShard(const ServerShard&) = delete;
+	ServerShard& operator=(const ServerShard&) = delete;
+
+	inline int GetShardIndex(void) const { return ShardIndex; }
+
+	//  Everything from here on runs on the shard's own thread
+	bool Update(void);
+	void Shutdown(void);
+
+	void AddConnection(Socket* socket, uint64_t connectionID, std::string ipAddress);
+	void RunOnConnection(uint64_t connectionID, const std::function<void(ServerShard&, UserConnection*)>& callback);
+	void CompleteLogin(UserConnection* user, LoginResponseIdentifiers response, std::string userID, std::string username, std::shared_ptr<const BroadcastFrame> hostedFileList, SessionTicket ticket, uint64_t listSequence);
+	void CompleteResume(UserConnection* user, LoginResponseIdentifiers response, SessionTicket ticket, uint64_t listSequence, std::shared_ptr<const BroadcastFrame> hostedFileList, bool notificationsChanged);
+	void RemoveClient(UserConnection* user);
+	void SendBroadcast(const BroadcastFrame& frame, BroadcastAudience audience);
+	void BeginFileTransfer(HostedFileData& fileData, UserConnection* user, bool awaitReceiveReady = true);
+	void BeginFileReceive(const UploadRequest& request, UserConnection* user);
+	void LogSendQueues(void);
+	inline void SetReceiveTimeBudget(double seconds) { ReceiveTimeBudget = seconds; }
+	inline void SetTransferPacingCap(double capFraction) { TransferPacingCap = capFraction; }
+	inline void SetDataChannelTransfers(bool enabled) { DataChannelTransfers = enabled; }
+
+private:
+	void ReceiveMessages(void);
+	void ProcessMessage(UserConnection* user);
+	void ProcessDatagram(DatagramSession& session, std::unique_ptr<TransportMessage> message, const std::string& senderIP, int senderPort);
+	void OfferDataChannel(UserConnection* user);
+	AsyncTask KeepUserAlive(UserConnection* user);
+	void UpdateFileTransferPercentage(bool download, UserConnection* user);
+	void PostUserStatusChanged(UserConnection* user);
+};
+
+
+//  Connection Registry: the server's record of every connection, kept on the network thread. A connection's ID is its handle,
+//  never reused for the life of the server, and its entry stays where it is until the connection closes. Everything the server
+//  looks a connection up by has its own index, kept up to date as entries change, so no lookup walks the whole registry:
+//  - by user ID (the login checksum), for turning away a second login and finding a logged in user
+//  - by IP address, for everyone connected from one address
+//  - by shard, counting the connections and the logged in users on each, for placing connections and aiming broadcasts
+//  - by hosted file, counting the transfers reading each one, for the re-key to leave alone
+//  Sockets are indexed by the shards, as socket IDs only mean anything within a shard's own wrapper.
+class ConnectionRegistry
+{
+public:
+	struct ConnectionEntry
+	{
+		int				ShardIndex;
+		UserListEntry	User;				//  What the UI shows, as the shard last reported it
+		std::string		LoggedInUserID;		//  Set once the server accepts their login, which is ahead of the shard hearing about it
+		std::string		HostedFileInUse;
+	};
+
+private:
+	std::unordered_map<uint64_t, ConnectionEntry> Entries;
+	std::unordered_map<std::string, uint64_t> ByUserID;
+	std::unordered_map<std::string, std::vector<uint64_t>> ByIPAddress;
+	std::unordered_map<std::string, int> FilesInUse;
+	std::vector<int> ShardConnectionCounts;
+	std::vector<int> ShardLoggedInCounts;
+
+	void ReleaseHostedFile(ConnectionEntry& entry)
+	{
+		if (entry.HostedFileInUse.empty()) return;
+		auto fileIter = FilesInUse.find(entry.HostedFileInUse);
+		if ((fileIter != FilesInUse.end()) && (--(*fileIter).second <= 0)) FilesInUse.erase(fileIter);
+		entry.HostedFileInUse.clear();
+	}
+
+public:
+	inline void SetShardCount(int shardCount) { ShardConnectionCounts.assign(shardCount, 0); ShardLoggedInCounts.assign(shardCount, 0); }
+
+	ConnectionEntry& Add(uint64_t connectionID, int shardIndex, const std::string& ipAddress)
+	{
+		assert(Entries.find(connectionID) == Entries.end());
+		auto& entry = Entries[connectionID];
+		entry.ShardIndex = shardIndex;
+		entry.User.ConnectionID = connectionID;
+		entry.User.IPAddress = ipAddress;
+		ByIPAddress[ipAddress].push_back(connectionID);
+		++ShardConnectionCounts[shardIndex];
+		return entry;
+	}
+
+	void Remove(uint64_t connectionID)
+	{
+		auto entryIter = Entries.find(connectionID);
+		if (entryIter == Entries.end()) return;
+		auto& entry = (*entryIter).second;
+
+		if (!entry.LoggedInUserID.empty())
+		{
+			ByUserID.erase(entry.LoggedInUserID);
+			--ShardLoggedInCounts[entry.ShardIndex];
+		}
+
+		auto ipIter = ByIPAddress.find(entry.User.IPAddress);
+		if (ipIter != ByIPAddress.end())
+		{
+			auto& connectionIDs = (*ipIter).second;
+			connectionIDs.erase(std::find(connectionIDs.begin(), connectionIDs.end(), connectionID));
+			if (connectionIDs.empty()) ByIPAddress.erase(ipIter);
+		}
+
+		ReleaseHostedFile(entry);
+		--ShardConnectionCounts[entry.ShardIndex];
+		Entries.erase(entryIter);
+	}
+
+	void Clear()
+	{
+		Entries.clear();
+		ByUserID.clear();
+		ByIPAddress.clear();
+		FilesInUse.clear();
+		std::fill(ShardConnectionCounts.begin(), ShardConnectionCounts.end(), 0);
+		std::fill(ShardLoggedInCounts.begin(), ShardLoggedInCounts.end(), 0);
+	}
+
+	inline ConnectionEntry* Find(uint64_t connectionID) { auto entryIter = Entries.find(connectionID); return (entryIter == Entries.end()) ? nullptr : &(*entryIter).second; }
+	inline ConnectionEntry* FindByUserID(const std::string& userID) { auto userIter = ByUserID.find(userID); return (userIter == ByUserID.end()) ? nullptr : Find((*userIter).second); }
+	inline bool GetUserLoggedIn(const std::string& userID) const { return (ByUserID.find(userID) != ByUserID.end()); }
+
+	//  Everyone connected from the address, oldest connection first
+	inline const std::vector<uint64_t>& FindByIPAddress(const std::string& ipAddress) const
+	{
+		static const std::vector<uint64_t> NONE;
+		auto ipIter = ByIPAddress.find(ipAddress);
+		return (ipIter == ByIPAddress.end()) ? NONE : (*ipIter).second;
+	}
+
+	//  Takes the user ID for the connection, or returns false if someone else already has it
+	bool SetLoggedIn(uint64_t connectionID, const std::string& userID)
+	{
+		auto entry = Find(connectionID);
+		if ((entry == nullptr) || !entry->LoggedInUserID.empty() || GetUserLoggedIn(userID)) return false;
+		entry->LoggedInUserID = userID;
+		entry->User.UserIdentifier = userID;
+		ByUserID[userID] = connectionID;
+		++ShardLoggedInCounts[entry->ShardIndex];
+		return true;
+	}
 
-	std::function<void()> HostedFileListChangedCallback = nullptr;
-	std::function<void(std::unordered_map<UserConnection*, bool>)> UserConnectionListChangedCallback = nullptr;
+	//  Gives up the connection's user ID, for when the user has come back on another connection ahead of this one closing
+	void SetLoggedOut(uint64_t connectionID)
+	{
+		auto entry = Find(connectionID);
+		if ((entry == nullptr) || entry->LoggedInUserID.empty()) return;
+		ByUserID.erase(entry->LoggedInUserID);
+		entry->LoggedInUserID.clear();
+		--ShardLoggedInCounts[entry->ShardIndex];
+	}
 
-	std::unordered_map<UserConnection*, bool> UserConnectionsList;
+	//  The UI's copy of the user. Only the shard reports it, so it can lag behind the login, which the registry keeps on its own.
+	void UpdateUser(const UserListEntry& user)
+	{
+		auto entry = Find(user.ConnectionID);
+		if (entry == nullptr) return;
+		entry->User = user;
+		if (!entry->LoggedInUserID.empty()) entry->User.UserIdentifier = entry->LoggedInUserID;
+	}
 
-	inline UserConnection* FindUserByUserID(std::string userID)
+	void SetHostedFileInUse(uint64_t connectionID, const std::string& filePath)
 	{
-		for (auto iter = UserConnectionsList.begin(); iter != UserConnectionsList.end(); ++iter)
-			if ((*iter).first->UserIdentifier == userID) return (*iter).first;
-		return nullptr;
+		//  A connection reads one hosted file at a time, and whoever starts a transfer checks it isn't already reading one
+		auto entry = Find(connectionID);
+		if (entry == nullptr) return;
+		assert(entry->HostedFileInUse.empty());
+		ReleaseHostedFile(*entry);
+		entry->HostedFileInUse = filePath;
+		++FilesInUse[filePath];
 	}
+	inline void ClearHostedFileInUse(uint64_t connectionID) { auto entry = Find(connectionID); if (entry != nullptr) ReleaseHostedFile(*entry); }
+
+	inline const std::unordered_map<std::string, int>& GetFilesInUse() const { return FilesInUse; }
+	inline int GetShardConnectionCount(int shardIndex) const { return ShardConnectionCounts[shardIndex]; }
+	inline int GetShardLoggedInCount(int shardIndex) const { return ShardLoggedInCounts[shardIndex]; }
+	inline int GetLeastBusyShard() const { return int(std::min_element(ShardConnectionCounts.begin(), ShardConnectionCounts.end()) - ShardConnectionCounts.begin()); }
+	inline size_t GetConnectionCount() const { return Entries.size(); }
+
+	inline std::unordered_map<uint64_t, ConnectionEntry>::const_iterator begin() const { return Entries.begin(); }
+	inline std::unordered_map<uint64_t, ConnectionEntry>::const_iterator end() const { return Entries.end(); }
+};
+
+
+//  Server: listens for connections and hands each one to the least busy shard, then looks after everything the shards share.
+//  It runs on the network thread, and owns the databases, the list of who is connected and logged in, and the re-key job.
+//  Shards ask it for things by posting to the network thread, and it answers by posting to the connection's shard, so no
+//  map or list here is ever read from a shard.
+class Server
+{
+private:
+	int		ServerSocketHandle;
+	std::string UserDatabaseName = "UserDatabase";
+
+	int ShardCount;
+	std::vector<std::unique_ptr<ServerShard>> Shards;
+	EventLoopGroup ShardLoops;
+	uint64_t NextConnectionID;
+
+	ConnectionRegistry Connections;
+	std::vector<int> ReadySockets;
+	HostedFileReKeyJob ReKeyJob;
+	double LastReKeyProgressTime = 0.0;
+	HostedFileListCache FileListCache;
+	SessionTicketStore Tickets;
+	std::unordered_map<uint64_t, CollectionTransfer> Collections;	//  By connection ID
 
 public:
 	Server() :
-		ServerSocketHandle(-1)
+		ServerSocketHandle(-1),
+		ShardCount(EventLoopGroup::GetDefaultShardCount()),
+		NextConnectionID(1)
 	{}
 
-	~Server() {}
+	~Server() { ShardLoops.Stop(); }
 
-	inline void SetHostedFileListChangedCallback(const std::function<void()>& callback) { HostedFileListChangedCallback = callback; }
-	inline void SetUserConnectionListChangedCallback(const std::function<void(std::unordered_map<UserConnection*, bool>)>& callback) { UserConnectionListChangedCallback = callback; }
-	
 	bool Initialize(void);
 	void MainProcess(void);
 	void Shutdown(void);
 
 	void DeleteHostedFile(std::string fileChecksum);
-	inline UserConnection* GetUserConnectionByIP(std::string ip) const { for (auto i = UserConnectionsList.begin(); i != UserConnectionsList.end(); ++i) if ((*i).first->IPAddress == ip) return (*i).first; return nullptr; }
+	void LogSendQueues(void);
+	void LogFileListCache(void);
+	void LogConnectionsFrom(std::string ipAddress);
 
 	void AddUserLoginDetails(std::string username, std::string password);
 
+	bool RotateWordList(void);
+	inline void SetReKeyRateLimit(double bytesPerSecond) { ReKeyJob.SetRateLimit(bytesPerSecond); }
+	void SetReceiveTimeBudget(double seconds);
+	void SetTransferPacingCap(double capFraction);
+	void SetDataChannelTransfers(bool enabled);
+	inline const HostedFileReKeyJob& GetReKeyJob(void) const { return ReKeyJob; }
+
+	//  Only before Initialize(), which starts the shards
+	inline void SetShardCount(int shardCount) { assert(Shards.empty()); ShardCount = std::max<int>(1, shardCount); }
+	inline int GetShardCount(void) const { return ShardCount; }
+
+	//  Posted by the shards, and run on the network thread
+	void UpdateConnection(UserListEntry user);
+	void RemoveConnection(uint64_t connectionID);
+	void RequestLogin(uint64_t connectionID, std::string username, std::string passwordHash, std::string loginChecksum);
+	void RequestResume(uint64_t connectionID, uint64_t ticketID, std::vector<unsigned char> ticketSecret, uint64_t listSequence);
+	void RequestHostedFileList(uint64_t connectionID, EncryptedData encryptedUsername, HostedFileType type, HostedFileSubtype subtype, int startIndex);
+	void RequestFile(uint64_t connectionID, std::string fileTitle, int inlineLimit, int messageLimit);
+	void RequestFileBundle(uint64_t connectionID, std::vector<std::string> fileTitles, int inlineLimit, int messageLimit);
+	void RequestCollection(uint64_t connectionID, uint64_t collectionID, std::vector<std::string> fileTitles, int inlineLimit, int messageLimit);
+	void RequestUpload(uint64_t connectionID, UploadRequest request);
+	void FinishFileTransfer(uint64_t connectionID);
+	void AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileTitle, std::string fileDescription, int32_t fileTypeID, int32_t fileSubTypeID, std::string uploaderName);
+	void BroadcastChatString(std::string chatString);
+
 private:
-	void AddClient(int socketID, std::string ipAddress);
-	void RemoveClient(UserConnection* user);
 	void AcceptNewClients(void);
-	void ReceiveMessages(void);
-	void PingConnectedUsers(void);
-	void AttemptUserLogin(UserConnection* user, std::string& username, std::string& password);
+	void PostToConnection(uint64_t connectionID, const std::function<void(ServerShard&, UserConnection*)>& callback);
+	std::vector<bool> GetBroadcastShards(BroadcastAudience audience) const;
+	void Broadcast(std::shared_ptr<const BroadcastFrame> frame, BroadcastAudience audience, const std::vector<bool>& shards);
 
-	void AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileTitle, std::string fileDescription, int32_t fileTypeID, int32_t fileSubTypeID, UserConnection* user);
 	void AddHostedFileFromUnencrypted(std::string fileToAdd, std::string fileTitle, std::string fileDescription);
+	std::shared_ptr<const BroadcastFrame> GetHostedFileList(int startIndex = 0, EncryptedData encryptedUsername = EncryptedData(), HostedFileType type = FILE_TYPE_COUNT, HostedFileSubtype subtype = FILE_SUBTYPE_COUNT);
 	void SendOutHostedFileList(void);
 
-	void ContinueFileTransfers(void);
-	void BeginFileTransfer(HostedFileData& fileData, UserConnection* user);
-	void UpdateFileTransferPercentage(bool download, UserConnection* user);
-	void SendChatString(const char* chatString);
+	void PostUserListChanged(void);
+	void PostHostedFileListChanged(void);
+	void PostReKeyProgress(void);
 
-	inline const std::unordered_map<UserConnection*, bool> GetUserList(void) const { return UserConnectionsList; }
-	inline std::string	GetClientIP(UserConnection* user) { return user->IPAddress; }
+	void ContinueHostedFileReKey(void);
+	void ContinueCollection(uint64_t connectionID);
 };
 
 bool Server::Initialize(void)
@@ -364,11 +957,14 @@ bool Server::Initialize(void)
 	ServerSocketHandle = winsockWrapper.TCPListen(NEW_PROVIDENCE_PORT, 10, 1);
 	if (ServerSocketHandle == -1) return false;
 	winsockWrapper.SetNagle(ServerSocketHandle, true);
+	winsockWrapper.WatchSocket(ServerSocketHandle);
 
 	//  ensure there is an Inbox, Notifications, and Files folder
-	(void)  _wmkdir(L"_UserInbox");
-	(void) _wmkdir(L"_UserNotifications");
-	(void) _wmkdir(L"_HostedFiles");
+	std::error_code directoryError;
+	(void) std::filesystem::create_directory("_UserInbox", directoryError);
+	(void) std::filesystem::create_directory("_UserNotifications", directoryError);
+	(void) std::filesystem::create_directory("_HostedFiles", directoryError);
+	(void) std::filesystem::create_directory("WordLists", directoryError);
 
 	// Open the user and file database connections, and ensure we have the primary tables
 	NPSQL::OpenUserDatabaseConnection();
@@ -376,28 +972,41 @@ bool Server::Initialize(void)
 	NPSQL::CreateUserTable();
 	NPSQL::CreateFileTable();
 
+	//  If a re-key was interrupted by a shutdown, pick it back up from the checkpoint. Each row it re-keys changes the lists it's in.
+	ReKeyJob.SetRowChangedCallback([this](const std::string& checksum) { FileListCache.OnFileChanged(checksum); });
+	ReKeyJob.ResumeFromCheckpoint();
+
+	//  Start the shards. Each one is given its own connections from here on, as they're accepted.
+	for (auto i = 0; i < ShardCount; ++i) Shards.push_back(std::make_unique<ServerShard>(*this, i));
+	Connections.SetShardCount(ShardCount);
+	ShardLoops.Start(ShardCount, [this](int shardIndex) { return Shards[shardIndex]->Update(); }, [this](int shardIndex) { Shards[shardIndex]->Shutdown(); });
+	debugConsole->AddDebugConsoleLine("Running " + std::to_string(ShardCount) + " connection shards");
+
+	PostHostedFileListChanged();
 	return true;
 }
 
 
 void Server::MainProcess(void)
 {
+	//  The listening socket is the only one left on the network thread
+	winsockWrapper.UpdateReadySockets(ReadySockets);
+
 	// Accept Incoming Connections
 	AcceptNewClients();
 
-	// Receive messages
-	ReceiveMessages();
-
-	// Ping connected users
-	PingConnectedUsers();
-
-	//  Send files
-	ContinueFileTransfers();
+	//  Move hosted files onto the current word list, if a rotation is in progress
+	ContinueHostedFileReKey();
 }
 
 
 void Server::Shutdown(void)
 {
+	//  Stop the shards first, which closes every connection they hold
+	ShardLoops.Stop();
+	Shards.clear();
+	Connections.Clear();
+
 	//  Close the user and file database connections
 	NPSQL::CloseUserDatabaseConnection();
 	NPSQL::CloseFileDatabaseConnection();
@@ -407,6 +1016,68 @@ void Server::Shutdown(void)
 }
 
 
+void Server::LogSendQueues(void)
+{
+	debugConsole->AddDebugConsoleLine(std::to_string(Connections.GetConnectionCount()) + " send queues across " + std::to_string(Shards.size()) + " shards");
+	for (auto& shard : Shards)
+	{
+		auto shardPointer = shard.get();
+		ShardLoops.Post(shard->GetShardIndex(), [shardPointer]() { shardPointer->LogSendQueues(); });
+	}
+}
+
+
+void Server::LogConnectionsFrom(std::string ipAddress)
+{
+	auto& connectionIDs = Connections.FindByIPAddress(ipAddress);
+	debugConsole->AddDebugConsoleLine(std::to_string(connectionIDs.size()) + " connections from " + ipAddress);
+	for (auto connectionID : connectionIDs)
+	{
+		auto entry = Connections.Find(connectionID);
+		debugConsole->AddDebugConsoleLine("  [" + std::to_string(connectionID) + "][shard " + std::to_string(entry->ShardIndex) + "] " + (entry->LoggedInUserID.empty() ? std::string("not logged in") : entry->LoggedInUserID) + " - " + entry->User.StatusString);
+	}
+}
+
+
+void Server::LogFileListCache(void)
+{
+	debugConsole->AddDebugConsoleLine("Hosted file list cache: " + std::to_string(FileListCache.GetEntryCount()) + " lists, " + std::to_string(FileListCache.GetHits()) + " hits, " +
+		std::to_string(FileListCache.GetMisses()) + " built, " + std::to_string(FileListCache.GetInvalidations()) + " dropped by catalog changes");
+}
+
+
+void Server::SetReceiveTimeBudget(double seconds)
+{
+	for (auto& shard : Shards)
+	{
+		auto shardPointer = shard.get();
+		ShardLoops.Post(shard->GetShardIndex(), [shardPointer, seconds]() { shardPointer->SetReceiveTimeBudget(seconds); });
+	}
+}
+
+
+//  Only downloads started from here on are paced at the new cap
+void Server::SetTransferPacingCap(double capFraction)
+{
+	for (auto& shard : Shards)
+	{
+		auto shardPointer = shard.get();
+		ShardLoops.Post(shard->GetShardIndex(), [shardPointer, capFraction]() { shardPointer->SetTransferPacingCap(capFraction); });
+	}
+}
+
+
+//  Only transfers started from here on are affected. Those already going over a datagram channel carry on over it.
+void Server::SetDataChannelTransfers(bool enabled)
+{
+	for (auto& shard : Shards)
+	{
+		auto shardPointer = shard.get();
+		ShardLoops.Post(shard->GetShardIndex(), [shardPointer, enabled]() { shardPointer->SetDataChannelTransfers(enabled); });
+	}
+}
+
+
 void Server::DeleteHostedFile(std::string fileChecksum)
 {
 	//  If the file does not exist, exit out
@@ -417,8 +1088,11 @@ void Server::DeleteHostedFile(std::string fileChecksum)
 	std::remove(hostedFileName.c_str());
 
 	//  Updated the Hosted File Data List
+	HostedFileData fileData;
+	if (NPSQL::GetFileData(fileChecksum, fileData)) FileListCache.OnFileRemoved(fileData);
+	else FileListCache.Clear();
 	NPSQL::RemoveFile(fileChecksum);
-	if (HostedFileListChangedCallback != nullptr) HostedFileListChangedCallback();
+	PostHostedFileListChanged();
 	SendOutHostedFileList();
 }
 
@@ -447,6 +1121,7 @@ void Server::AddUserLoginDetails(std::string username, std::string password)
 
 	//  Add a new notification for a welcoming message
 	AddUserNotification(loginDataMD5, "Welcome to New Providence");
+	Tickets.OnNotificationsChanged(loginDataMD5);
 
 	//  Register the new user details to the user database
 	NPSQL::RegisterUser(username, sha256(password));
@@ -457,403 +1132,328 @@ void Server::AddUserLoginDetails(std::string username, std::string password)
 //	Client Connection Functions
 ////////////////////////////////////////
 
-void Server::AddClient(int socketID, std::string ipAddress)
-{
-	auto newConnection = new UserConnection(socketID, ipAddress);
-	UserConnectionsList[newConnection] = true;
-	
-	if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
-}
-
-void Server::RemoveClient(UserConnection* user)
-{
-	auto userIter = UserConnectionsList.find(user);
-	assert(userIter != UserConnectionsList.end());
-
-	if (user->UserStatus != UserConnection::USER_STATUS_CONNECTED)
-		debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - User logged out: " + user->Username);
-
-	delete user;
-	UserConnectionsList.erase(userIter);
-
-	if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
-}
-
 void Server::AcceptNewClients(void)
 {
+	if (!winsockWrapper.GetSocketReady(ServerSocketHandle)) return;
+
 	auto newClient = winsockWrapper.TCPAccept(ServerSocketHandle, 1);
 	while (newClient >= 0)
 	{
-		//  Add the new client using his 
-		AddClient(newClient, winsockWrapper.GetExteriorIP(newClient));
+		//  Hand the connection to whichever shard has the fewest, and let go of it here
+		auto shardIndex = Connections.GetLeastBusyShard();
+		auto connectionID = NextConnectionID++;
+		auto ipAddress = winsockWrapper.GetExteriorIP(newClient);
+		auto socket = winsockWrapper.DetachSocket(newClient);
+
+		auto& entry = Connections.Add(connectionID, shardIndex, ipAddress);
+		networkThread.PostEvent(std::make_unique<UserConnectedEventData>(entry.User, "Server"));
+
+		auto shard = Shards[shardIndex].get();
+		ShardLoops.Post(shardIndex, [shard, socket, connectionID, ipAddress]() { shard->AddConnection(socket, connectionID, ipAddress); });
 
 		// Check for another client connection
 		newClient = winsockWrapper.TCPAccept(ServerSocketHandle, 1);
 	}
 }
 
-void Server::ReceiveMessages(void)
+
+void Server::PostToConnection(uint64_t connectionID, const std::function<void(ServerShard&, UserConnection*)>& callback)
 {
-	for (auto userIter = UserConnectionsList.begin(); userIter != UserConnectionsList.end(); ++userIter)
-	{
-		auto user = (*userIter).first;
-		auto messageBufferSize = winsockWrapper.ReceiveMessagePacket(user->SocketID, 0);
+	//  A connection the server no longer knows about has already closed, so there's nobody to answer
+	auto entry = Connections.Find(connectionID);
+	if (entry == nullptr) return;
 
-		//  If no message has arrived, move on to the next connection
-		if (messageBufferSize < 0) continue;
+	auto shard = Shards[entry->ShardIndex].get();
+	ShardLoops.Post(shard->GetShardIndex(), [shard, connectionID, callback]() { shard->RunOnConnection(connectionID, callback); });
+}
 
-		//  If we receive a disconnection indicator, remove the user and move on to the next connection
-		if (messageBufferSize == 0)
-		{
-			RemoveClient(user);
-			break;
-		}
 
-		//  Update the last time we heard from this user
-		user->UpdatePingTime();
+void Server::UpdateConnection(UserListEntry user)
+{
+	auto entry = Connections.Find(user.ConnectionID);
+	if (entry == nullptr) return;
+	Connections.UpdateUser(user);
+	networkThread.PostEvent(std::make_unique<UserStatusChangedEventData>(entry->User, "Server"));
+}
 
-		char messageID = winsockWrapper.ReadChar(0);
-		switch (messageID)
-		{
-			case MESSAGE_ID_PING_RESPONSE:
-			{
-				//  NO DATA
 
-				user->SetStatusIdle(0);
-				if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
-				//  Do nothing, as we've already updated the last ping time of the user
-			}
-			break;
+void Server::RemoveConnection(uint64_t connectionID)
+{
+	auto entry = Connections.Find(connectionID);
+	if (entry == nullptr) return;
+
+	//  A user who drops off has a while to come back on their ticket
+	if (!entry->LoggedInUserID.empty()) Tickets.StartExpiry(entry->LoggedInUserID);
+	Collections.erase(connectionID);
+	Connections.Remove(connectionID);
+	networkThread.PostEvent(std::make_unique<UserDisconnectedEventData>(connectionID, "Server"));
+}
 
-			case MESSAGE_ID_ENCRYPTED_CHAT_STRING:
-			{
-				//  (int) Message Size [N]
-				//  (N-sized char array) Encrypted String
 
-				int messageSize = winsockWrapper.ReadInt(0);
+void Server::RequestLogin(uint64_t connectionID, std::string username, std::string passwordHash, std::string loginChecksum)
+{
+	if (Connections.Find(connectionID) == nullptr) return;
 
-				//  Decrypt using Groundfish
-				unsigned char encryptedChatString[256];
-				memcpy(encryptedChatString, winsockWrapper.ReadChars(0, messageSize), messageSize);
-				std::string decryptedString = Groundfish::DecryptToString(encryptedChatString);
+	//  If the user does not exist, or the given username is already assigned to a connected user, send a failure message
+	auto response = LOGIN_RESPONSE_SUCCESS;
+	if (!NPSQL::CheckUserPassword(username, passwordHash)) response = LOGIN_RESPONSE_PASSWORD_INCORRECT;
+	else if (Connections.GetUserLoggedIn(loginChecksum)) response = LOGIN_RESPONSE_USER_ALREADY_LOGGED_IN;
 
-				SendChatString(decryptedString.c_str());
-			}
-			break;
+	//  The user counts as logged in from here, so a second login on another shard is turned away even before this one completes
+	std::shared_ptr<const BroadcastFrame> hostedFileList;
+	SessionTicket ticket;
+	if (response == LOGIN_RESPONSE_SUCCESS)
+	{
+		Connections.SetLoggedIn(connectionID, loginChecksum);
+		hostedFileList = GetHostedFileList();
+		ticket = Tickets.Issue(loginChecksum, username);
+	}
 
-			case MESSAGE_ID_USER_LOGIN_REQUEST: // Player enters the server, sending their encrypted name and password
-			{
-				//  (int) Length of encrypted username (n1)
-				//  (n1-size chars array) Encrypted username
-				//  (int) Length of encrypted password (n2)
-				//  (n2-size chars array) Encrypted password
-
-				//  Grab the current client version number to ensure they have the up-to-date version
-				std::string versionString = winsockWrapper.ReadString(0);
-
-				//  Grab the username size and encrypted username, and decrypt it, then the password size and encrypted password, and decrypt it
-				auto usernameSize = winsockWrapper.ReadInt(0);
-				auto usernameArray = winsockWrapper.ReadChars(0, usernameSize);
-				std::string username = Groundfish::DecryptToString(usernameArray);
-
-				auto passwordSize = winsockWrapper.ReadInt(0);
-				auto passwordArray = winsockWrapper.ReadChars(0, passwordSize);
-				std::string password = Groundfish::DecryptToString(passwordArray);
-
-				if (versionString.compare(VERSION_NUMBER) != 0)
-				{
-					SendMessage_LoginResponse(LOGIN_RESPONSE_VERSION_NUMBER_INCORRECT, user);
-					break;
-				}
-
-				AttemptUserLogin(user, username, password);
-			}
-			break;
+	auto listSequence = FileListCache.GetSequence();
+	PostToConnection(connectionID, [response, loginChecksum, username, hostedFileList, ticket, listSequence](ServerShard& shard, UserConnection* user) { shard.CompleteLogin(user, response, loginChecksum, username, hostedFileList, ticket, listSequence); });
+}
 
-			case MESSAGE_ID_REQUEST_HOSTED_FILE_LIST:
-			{
-				//  Read the username to filter the list by (if any)
-				auto usernameSize = winsockWrapper.ReadUnsignedShort(0);
-				auto encryptedUsername = winsockWrapper.ReadChars(0, usernameSize);
-				auto encryptedUsernameVec = EncryptedData(encryptedUsername, encryptedUsername + usernameSize);
 
-				//  Read the type and subtype to filter for
-				auto type = HostedFileType(winsockWrapper.ReadChar(0));
-				auto subtype = HostedFileSubtype(winsockWrapper.ReadChar(0));
+void Server::RequestResume(uint64_t connectionID, uint64_t ticketID, std::vector<unsigned char> ticketSecret, uint64_t listSequence)
+{
+	if (Connections.Find(connectionID) == nullptr) return;
 
-				//  Read the starting index to begin the list at
-				auto startingIndex = int(winsockWrapper.ReadUnsignedShort(0));
+	SessionTicket ticket;
+	if (!Tickets.Redeem(ticketID, ticketSecret, ticket))
+	{
+		PostToConnection(connectionID, [](ServerShard& shard, UserConnection* user) { shard.CompleteResume(user, LOGIN_RESPONSE_SESSION_EXPIRED, SessionTicket(), 0, nullptr, false); });
+		return;
+	}
 
-				//  Send a hosted file data list with the given filters
-				SendMessage_HostedFileList(user, startingIndex, encryptedUsernameVec, type, subtype);
-			}
-			break;
+	//  The user's old connection is often still open, as a connection that dropped without a word takes a while to time out. The
+	//  ticket shows this is the same user, so the new connection takes over their login, and the old one is closed.
+	auto previousEntry = Connections.FindByUserID(ticket.UserID);
+	if (previousEntry != nullptr)
+	{
+		auto previousID = previousEntry->User.ConnectionID;
+		Connections.SetLoggedOut(previousID);
+		PostToConnection(previousID, [](ServerShard& shard, UserConnection* user) { shard.RemoveClient(user); });
+	}
+	Connections.SetLoggedIn(connectionID, ticket.UserID);
 
-			case MESSAGE_ID_FILE_REQUEST:
-			{
-				auto fileNameLength = winsockWrapper.ReadInt(0);
-				auto fileTitle = std::string((char*)winsockWrapper.ReadChars(0, fileNameLength), fileNameLength);
-
-				HostedFileData fileData;
-				if (NPSQL::GetFileData(md5(fileTitle), fileData) == false)
-				{
-					//  The file could not be found.
-					SendMessage_FileRequestFailed(fileTitle, "The specified file was not found.", user);
-					break;
-				}
-				else if (user->UserFileSendTask != nullptr)
-				{
-					//  The user is already downloading something.
-					SendMessage_FileRequestFailed(fileTitle, "User is currently already downloading a file.", user);
-					break;
-				}
-				else
-				{
-					BeginFileTransfer(fileData, user);
-					break;
-				}
-			}
-			break;
+	//  Only what's changed since they were last sent it: the hosted file list if the catalog has moved on from the last one they
+	//  saw, and their notifications if any have been added. Nothing is read from the user database.
+	auto currentSequence = FileListCache.GetSequence();
+	auto hostedFileList = (listSequence < currentSequence) ? GetHostedFileList() : nullptr;
+	auto notificationsChanged = ticket.NotificationsChanged;
+	auto nextTicket = Tickets.Issue(ticket.UserID, ticket.Username);
 
-			case MESSAGE_ID_FILE_SEND_INIT:
-			{
-				auto fileNameSize = winsockWrapper.ReadInt(0);
-				auto fileTitleSize = winsockWrapper.ReadInt(0);
-				auto fileDescriptionSize = winsockWrapper.ReadInt(0);
-
-				//  Decrypt the file name using Groundfish and save it off
-				auto decryptedFileNamePure = Groundfish::DecryptToString(winsockWrapper.ReadChars(0, fileNameSize));
-				auto decryptedFileName = "./_DownloadedFiles/" + decryptedFileNamePure;
-
-				//  Decrypt the file title using Groundfish and save it off
-				auto decryptedFileTitle = Groundfish::DecryptToString(winsockWrapper.ReadChars(0, fileTitleSize));
-				assert(decryptedFileTitle.length() <= UPLOAD_TITLE_MAX_LENGTH);
-
-				//  Determine whether a file with that title already exists in the hosted file list
-				if (NPSQL::CheckIfFileExists(md5(decryptedFileTitle)))
-				{
-					SendMessage_FileSendInitFailed("A file with that title already exists on the server. Try again.", user);
-					return;
-				}
-
-				//  Decrypt the file description using Groundfish and save it off
-				auto decryptedFileDescription = Groundfish::DecryptToString(winsockWrapper.ReadChars(0, fileDescriptionSize));
-
-				//  grab the file type and sub type
-				auto fileTypeID = HostedFileType(winsockWrapper.ReadUnsignedShort(0));
-				auto fileSubTypeID = HostedFileSubtype(winsockWrapper.ReadUnsignedShort(0));
-
-				//  Grab the file size, file chunk size, and buffer count
-				auto fileSize = winsockWrapper.ReadLongInt(0);
-				auto fileChunkSize = winsockWrapper.ReadLongInt(0);
-				auto fileChunkBufferCount = winsockWrapper.ReadLongInt(0);
-
-				if (user->UserFileReceiveTask != nullptr) return;
-
-				//  Create a new file receive task
-				(void) _wmkdir(L"_DownloadedFiles");
-				user->UserFileReceiveTask = new FileReceiveTask(decryptedFileName, decryptedFileTitle, decryptedFileDescription, fileTypeID, fileSubTypeID, fileSize, fileChunkSize, fileChunkBufferCount, "./_DownloadedFiles/_download.tempfile", user->SocketID, user->IPAddress, NEW_PROVIDENCE_PORT);
-				user->UserFileReceiveTask->SetDecryptWhenReceived(false);
-			}
-			break;
+	PostToConnection(connectionID, [nextTicket, currentSequence, hostedFileList, notificationsChanged](ServerShard& shard, UserConnection* user) { shard.CompleteResume(user, LOGIN_RESPONSE_SUCCESS, nextTicket, currentSequence, hostedFileList, notificationsChanged); });
+}
 
-			case MESSAGE_ID_FILE_RECEIVE_READY:
-			{
-				auto task = user->UserFileSendTask;
-				assert(task != nullptr);
 
-				task->SetFileTransferState(FileSendTask::CHUNK_STATE_SENDING);
-			}
-			break;
+void Server::RequestHostedFileList(uint64_t connectionID, EncryptedData encryptedUsername, HostedFileType type, HostedFileSubtype subtype, int startIndex)
+{
+	//  Send a hosted file data list with the given filters
+	auto hostedFileList = GetHostedFileList(startIndex, encryptedUsername, type, subtype);
+	PostToConnection(connectionID, [hostedFileList](ServerShard&, UserConnection* user) { user->SendBroadcast(*hostedFileList); });
+}
 
-			case MESSAGE_ID_FILE_PORTION:
-			{
-				if (user->UserFileReceiveTask == nullptr) break;
-
-				if (user->UserFileReceiveTask->ReceiveFileChunk())
-				{
-					assert(false); // ALERT: We should never be receiving a chunk after the file download is complete
-
-					//  If ReceiveFile returns true, the transfer is complete
-					delete user->UserFileReceiveTask;
-					user->UserFileReceiveTask = nullptr;
-
-	#if FILE_TRANSFER_DEBUGGING
-					debugConsole->AddDebugConsoleLine("FileReceiveTask deleted...");
-	#endif
-				}
-
-				//  Update the user's status message to show uploading status
-				auto titleChecksum = md5(user->UserFileReceiveTask->GetFileTitle());
-				auto percentageComplete = user->UserFileReceiveTask->GetPercentageComplete();
-				auto transferSpeed = int(float(user->UserFileReceiveTask->GetEstimatedTransferSpeed()) / 1024.0f);
-				user->UserStatus = UserConnection::USER_STATUS_UPLOADING;
-				user->SetStatusTransferring(false, titleChecksum, float(percentageComplete), transferSpeed);
-				if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
-			}
-			break;
 
-			case MESSAGE_ID_FILE_PORTION_COMPLETE:
-			{
-				auto portionIndex = winsockWrapper.ReadInt(0);
-				auto receiveTask = user->UserFileReceiveTask;
-
-				if (receiveTask == nullptr)
-				{
-					SendMessage_FilePortionCompleteConfirmation(portionIndex, user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT);
-					break;
-				}
-
-				(void) _wmkdir(L"_DownloadedFiles");
-				if (receiveTask->CheckFilePortionComplete(portionIndex))
-				{
-					//if (DownloadPercentCompleteCallback != nullptr) DownloadPercentCompleteCallback(FileReceive->GetPercentageComplete(), FileReceive->GetDownloadTime(), FileReceive->GetFileSize());
-
-					if (receiveTask->GetFileTransferComplete())
-					{
-						AddHostedFileFromEncrypted(receiveTask->GetFileName(), receiveTask->GetFileTitle(), receiveTask->GetFileDescription(), receiveTask->GetFileTypeID(), receiveTask->GetFileSubTypeID(), user);
-						debugConsole->AddDebugConsoleLine("Added hosted file: \"" + receiveTask->GetFileTitle() + "\"");
-
-						delete user->UserFileReceiveTask;
-						user->UserFileReceiveTask = nullptr;
-
-	#if FILE_TRANSFER_DEBUGGING
-						debugConsole->AddDebugConsoleLine("FileReceiveTask deleted...");
-	#endif
-
-						break;
-					}
-				}
-			}
-			break;
+void Server::RequestFile(uint64_t connectionID, std::string fileTitle, int inlineLimit, int messageLimit)
+{
+	auto entry = Connections.Find(connectionID);
+	if (entry == nullptr) return;
 
-			case MESSAGE_ID_FILE_CHUNKS_REMAINING:
-			{
-				auto task = user->UserFileSendTask;
-				assert(task != nullptr);
+	HostedFileData fileData;
+	if (NPSQL::GetFileData(md5(fileTitle), fileData) == false)
+	{
+		//  The file could not be found.
+		PostToConnection(connectionID, [fileTitle](ServerShard&, UserConnection* user) { SendMessage_FileRequestFailed(fileTitle, "The specified file was not found.", user); });
+		return;
+	}
 
-				auto chunkCount = winsockWrapper.ReadInt(0);
-				std::unordered_map<int, bool> chunksRemaining;
-				for (auto i = 0; i < chunkCount; ++i) chunksRemaining[winsockWrapper.ReadShort(0)] = true;
-				task->SetChunksRemaining(chunksRemaining);
-			}
-			break;
+	//  A small enough file is sent whole, in place of starting a transfer, and the client has it as soon as it arrives
+	InlineFile inlineFile{ fileTitle, FILE_INLINE_SENT, fileData.EncryptedFileName, {} };
+	if (ReadInlineFile(fileData, inlineLimit, inlineFile.Contents) && ((FILE_INLINE_MESSAGE_HEADER_SIZE + inlineFile.GetMessageSize()) <= messageLimit))
+	{
+		auto inlineMessage = ComposeMessage_FileInline(std::vector<InlineFile>{ inlineFile });
+		PostToConnection(connectionID, [inlineMessage](ServerShard&, UserConnection* user) { user->SendBroadcast(*inlineMessage); });
+		return;
+	}
 
-			case MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM:
-			{
-				auto portionIndex = winsockWrapper.ReadLongInt(0);
+	//  A user streams one file at a time. A second request can get here before the shard has even started the first transfer,
+	//  so it's turned away here, where the file the first is reading is still marked as in use. A collection's files are sent
+	//  one straight after another, so there's no room for anything else to be streamed until it's done either. Only files that
+	//  need a stream get this far, so small files still go inline whatever is being streamed.
+	if (!entry->HostedFileInUse.empty() || (Collections.find(connectionID) != Collections.end()))
+	{
+		PostToConnection(connectionID, [fileTitle](ServerShard&, UserConnection* user) { SendMessage_FileRequestFailed(fileTitle, "User is currently already downloading a file.", user); });
+		return;
+	}
 
-				auto task = user->UserFileSendTask;
-				if (task == nullptr) break;
+	//  The file is in use until the shard says the transfer has finished, or the connection closes, so a re-key leaves it alone
+	Connections.SetHostedFileInUse(connectionID, GetHostedFilePath(fileData.FileTitleChecksum));
+	PostToConnection(connectionID, [fileData](ServerShard& shard, UserConnection* user) mutable { shard.BeginFileTransfer(fileData, user); });
+}
 
-				if (task->GetFileTransferState() != FileSendTask::CHUNK_STATE_PENDING_COMPLETE) break;
 
-				task->ConfirmFilePortionSendComplete(portionIndex);
+void Server::RequestFileBundle(uint64_t connectionID, std::vector<std::string> fileTitles, int inlineLimit, int messageLimit)
+{
+	if (Connections.Find(connectionID) == nullptr) return;
 
-				//  Update the user list to reflect if we've updated % of file transferred
-				UpdateFileTransferPercentage(true, user);
-				if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
-			}
-			break;
+	//  Every file asked for gets an entry, in the order asked for, so the client knows which it still has to ask for. Room for
+	//  all of the entries is set aside first, and files are sent in order for as long as they fit in what's left.
+	auto messageSize = FILE_INLINE_MESSAGE_HEADER_SIZE;
+	std::vector<InlineFile> files(fileTitles.size());
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		files[i].FileTitle = fileTitles[i];
+		messageSize += files[i].GetMessageSize();
+	}
 
-			default:
-			{
-				std::string debugLine = "Unknown message ID received: " + std::to_string(messageID) + " from user " + user->Username;
-				debugConsole->AddDebugConsoleLine(debugLine);
-				//assert(false);
-			}
-			break;
+	for (auto iter = files.begin(); iter != files.end(); ++iter)
+	{
+		HostedFileData fileData;
+		if (NPSQL::GetFileData(md5((*iter).FileTitle), fileData) == false) continue;
+
+		if (!ReadInlineFile(fileData, inlineLimit, (*iter).Contents))
+		{
+			(*iter).Result = FILE_INLINE_TOO_LARGE;
+			continue;
 		}
+
+		(*iter).Result = FILE_INLINE_SENT;
+		(*iter).EncryptedFileName = fileData.EncryptedFileName;
+		auto entryContentSize = (*iter).GetMessageSize() - (int((*iter).FileTitle.size()) + 2);
+		if ((messageSize + entryContentSize) > messageLimit)
+		{
+			(*iter).Result = FILE_INLINE_DEFERRED;
+			(*iter).EncryptedFileName.clear();
+			(*iter).Contents.clear();
+			continue;
+		}
+		messageSize += entryContentSize;
 	}
+
+	auto inlineMessage = ComposeMessage_FileInline(files);
+	PostToConnection(connectionID, [inlineMessage](ServerShard&, UserConnection* user) { user->SendBroadcast(*inlineMessage); });
 }
 
 
-void Server::PingConnectedUsers(void)
+void Server::RequestCollection(uint64_t connectionID, uint64_t collectionID, std::vector<std::string> fileTitles, int inlineLimit, int messageLimit)
 {
-	for (auto userIter = UserConnectionsList.begin(); userIter != UserConnectionsList.end(); ++userIter)
+	auto entry = Connections.Find(connectionID);
+	if (entry == nullptr) return;
+
+	//  Files that can't be found are reported now, and the rest are sent in the order asked for. A new collection takes the place
+	//  of any the user had going, which is how a user who's come back on a new connection asks for what they're still missing.
+	auto& collection = Collections[connectionID];
+	collection = CollectionTransfer{ collectionID, {}, 0, inlineLimit, messageLimit };
+	for (auto iter = fileTitles.begin(); iter != fileTitles.end(); ++iter)
 	{
-		auto user = (*userIter).first;
-		auto timeSinceLastPing = gameSeconds - user->LastPingTime;
-		auto timeSinceLastRequest = gameSeconds - user->LastPingRequest;
-		if (timeSinceLastRequest < PING_INTERVAL_TIME) continue;
-		if (timeSinceLastPing < PING_INTERVAL_TIME) continue;
-
-		if (timeSinceLastPing > (PINGS_BEFORE_DISCONNECT * PING_INTERVAL_TIME))
+		CollectionFile file{ (*iter), {} };
+		if (NPSQL::GetFileData(md5(file.FileTitle), file.FileData) == false)
 		{
-			RemoveClient(user);
-			break;
-		}
-		else
-		{
-			SendMessage_PingRequest(user);
-			user->UpdatePingRequestTime();
-			user->SetStatusIdle(int(gameSeconds - user->LastPingTime));
-			if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
+			auto fileTitle = file.FileTitle;
+			PostToConnection(connectionID, [fileTitle](ServerShard&, UserConnection* user) { SendMessage_FileRequestFailed(fileTitle, "The specified file was not found.", user); });
+			continue;
 		}
+
+		collection.BytesRemaining += file.FileData.FileSize;
+		collection.Files.push_back(file);
 	}
+
+	//  If a download is already going, the collection follows on once it's finished
+	if (entry->HostedFileInUse.empty()) ContinueCollection(connectionID);
 }
 
 
-void Server::AttemptUserLogin(UserConnection* user, std::string& username, std::string& password)
+void Server::ContinueCollection(uint64_t connectionID)
 {
-	//  Lowercase the username and password
-	std::transform(username.begin(), username.end(), username.begin(), ::tolower);
-	std::transform(password.begin(), password.end(), password.begin(), ::tolower);
+	auto collectionIter = Collections.find(connectionID);
+	if (collectionIter == Collections.end()) return;
+	auto& collection = (*collectionIter).second;
 
-	//  If the user does not exist, send a failure message and return out
-	if (!NPSQL::CheckUserPassword(username, sha256(password)))
+	while (true)
 	{
-		SendMessage_LoginResponse(LOGIN_RESPONSE_PASSWORD_INCORRECT, user);
+		//  The user's told what's left before each file (or each message of small files) goes, so they can show the collection's
+		//  progress as a whole. Once there's nothing left, the last of these says so, and the collection is done.
+		auto collectionID = collection.CollectionID;
+		auto filesRemaining = int(collection.Files.size());
+		auto bytesRemaining = collection.BytesRemaining;
+		PostToConnection(connectionID, [collectionID, filesRemaining, bytesRemaining](ServerShard&, UserConnection* user) { SendMessage_CollectionProgress(collectionID, filesRemaining, bytesRemaining, user); });
+		if (collection.Files.empty())
+		{
+			Collections.erase(collectionIter);
+			return;
+		}
+
+		//  Small files at the front of the collection go together, in as few messages as they'll fit in
+		auto messageSize = FILE_INLINE_MESSAGE_HEADER_SIZE;
+		std::vector<InlineFile> inlineFiles;
+		while (!collection.Files.empty())
+		{
+			auto& file = collection.Files.front();
+			InlineFile inlineFile{ file.FileTitle, FILE_INLINE_SENT, file.FileData.EncryptedFileName, {} };
+			if (!ReadInlineFile(file.FileData, collection.InlineLimit, inlineFile.Contents)) break;
+			if ((messageSize + inlineFile.GetMessageSize()) > collection.MessageLimit) break;
+
+			messageSize += inlineFile.GetMessageSize();
+			inlineFiles.push_back(inlineFile);
+			collection.BytesRemaining -= std::min<uint64_t>(collection.BytesRemaining, file.FileData.FileSize);
+			collection.Files.pop_front();
+		}
+
+		if (!inlineFiles.empty())
+		{
+			auto inlineMessage = ComposeMessage_FileInline(inlineFiles);
+			PostToConnection(connectionID, [inlineMessage](ServerShard&, UserConnection* user) { user->SendBroadcast(*inlineMessage); });
+			continue;
+		}
+
+		//  Anything else is streamed, straight after whatever went before it, and the next goes once the shard says it's finished
+		auto fileData = collection.Files.front().FileData;
+		collection.BytesRemaining -= std::min<uint64_t>(collection.BytesRemaining, fileData.FileSize);
+		collection.Files.pop_front();
+		Connections.SetHostedFileInUse(connectionID, GetHostedFilePath(fileData.FileTitleChecksum));
+		PostToConnection(connectionID, [fileData](ServerShard& shard, UserConnection* user) mutable { shard.BeginFileTransfer(fileData, user, false); });
 		return;
 	}
+}
 
-	//  Locate the user entry in the login details list, if possible
-	auto loginDataChecksum = md5(username + password);
 
-	//  If the username given is already assigned to a connected user, send a failure message and return out
-	if (FindUserByUserID(loginDataChecksum) != nullptr)
+void Server::RequestUpload(uint64_t connectionID, UploadRequest request)
+{
+	//  Determine whether a file with that title already exists in the hosted file list
+	if (NPSQL::CheckIfFileExists(md5(request.FileTitle)))
 	{
-		SendMessage_LoginResponse(LOGIN_RESPONSE_USER_ALREADY_LOGGED_IN, user);
+		PostToConnection(connectionID, [](ServerShard&, UserConnection* user) { SendMessage_FileSendInitFailed("A file with that title already exists on the server. Try again.", user); });
 		return;
 	}
 
-	SendMessage_LoginResponse(LOGIN_RESPONSE_SUCCESS, user);
-
-	//  Set the user identifier and name
-	user->UserIdentifier = loginDataChecksum;
-	user->Username = username;
-	user->UserStatus = UserConnection::USER_STATUS_LOGGED_IN;
-	user->SetStatusIdle();
-	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - User logged in: " + user->Username);
+	PostToConnection(connectionID, [request](ServerShard& shard, UserConnection* user) { shard.BeginFileReceive(request, user); });
+}
 
-	//  Read the Inbox and Notifications data for the user
-	ReadUserInbox(user);
-	ReadUserNotifications(user);
-	SendMessage_InboxAndNotifications(user);
-	SendMessage_HostedFileList(user);
 
-	if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
+void Server::FinishFileTransfer(uint64_t connectionID)
+{
+	Connections.ClearHostedFileInUse(connectionID);
+	ContinueCollection(connectionID);
 }
 
 
 ////////////////////////////////////////
 //	Program Functionality
 ////////////////////////////////////////
-void Server::AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileTitle, std::string fileDescription, int32_t fileTypeID, int32_t fileSubTypeID, UserConnection* user)
+void Server::AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileTitle, std::string fileDescription, int32_t fileTypeID, int32_t fileSubTypeID, std::string uploaderName)
 {
 	assert(fileTitle.length() <= UPLOAD_TITLE_MAX_LENGTH);
 
 	//  Test that the file exists and is readable, and exit out if it is not
 	//  If the file isn't valid, attempt to re-open it for a quarter of a second
-	bool fileValid = false;
 	std::ifstream targetFile(fileToAdd, std::ios_base::binary);
-	float seconds = gameSecondsF;
+	auto seconds = AsyncScheduler::GetNow();
 	while (!targetFile.good() && targetFile.bad())
 	{
 		targetFile = std::ifstream(fileToAdd, std::ios_base::binary);
-		DetermineTimeSlice();
-		assert(gameSecondsF < seconds + 0.25f);
-		if (gameSecondsF > seconds + 0.25f) return;
+		assert(AsyncScheduler::GetNow() < seconds + 0.25);
+		if (AsyncScheduler::GetNow() > seconds + 0.25) return;
 	}
 	targetFile.close();
 
@@ -868,7 +1468,7 @@ void Server::AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileT
 
 	//  Find the file's primary name (no directories)
 	std::string pureFileName = fileToAdd;
-	if (fileToAdd.find_last_of('/') != -1) pureFileName = fileToAdd.substr(fileToAdd.find_last_of('/') + 1, fileToAdd.length() - fileToAdd.find_last_of('/') - 1);
+	if (fileToAdd.find_last_of('/') != std::string::npos) pureFileName = fileToAdd.substr(fileToAdd.find_last_of('/') + 1, fileToAdd.length() - fileToAdd.find_last_of('/') - 1);
 
 	//  If the file already exists in the Hosted File Data List, return out
 	auto fileTitleMD5 = md5(fileTitle);
@@ -880,7 +1480,7 @@ void Server::AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileT
 	newFile.EncryptedFileName = Groundfish::Encrypt(pureFileName.c_str(), int(pureFileName.length()), 0, rand() % 256);
 	newFile.EncryptedFileTitle = Groundfish::Encrypt(fileTitle.c_str(), int(fileTitle.length()), 0, rand() % 256);
 	newFile.EncryptedFileDescription = Groundfish::Encrypt(fileDescription.c_str(), int(fileDescription.length()), 0, rand() % 256);
-	newFile.EncryptedUploader = Groundfish::Encrypt(user->Username.c_str(), strlen(user->Username.c_str()), 0, rand() % 256);
+	newFile.EncryptedUploader = Groundfish::Encrypt(uploaderName.c_str(), int(uploaderName.length()), 0, rand() % 256);
 	newFile.FileSize = fileSize;
 	newFile.FileUploadTime = GetCurrentTimeString();
 	newFile.FileType = HostedFileType(fileTypeID);
@@ -894,7 +1494,8 @@ void Server::AddHostedFileFromEncrypted(std::string fileToAdd, std::string fileT
 	if (!fileExists) std::rename(fileToAdd.c_str(), hostedFileName.c_str());
 
 	NPSQL::AddFileData(newFile);
-	if (HostedFileListChangedCallback != nullptr) HostedFileListChangedCallback();
+	FileListCache.OnFileAdded(newFile);
+	PostHostedFileListChanged();
 
 	SendOutHostedFileList();
 }
@@ -906,15 +1507,13 @@ void Server::AddHostedFileFromUnencrypted(std::string fileToAdd, std::string fil
 
 	//  Test that the file exists and is readable, and exit out if it is not
 	//  If the file isn't valid, attempt to re-open it for a quarter of a second
-	bool fileValid = false;
 	std::ifstream targetFile(fileToAdd, std::ios_base::binary);
-	float seconds = gameSecondsF;
+	auto seconds = AsyncScheduler::GetNow();
 	while (targetFile.good() && targetFile.bad())
 	{
 		targetFile = std::ifstream(fileToAdd, std::ios_base::binary);
-		DetermineTimeSlice();
-		assert(gameSecondsF < seconds + 0.1f);
-		if (gameSecondsF > seconds + 0.1f) return;
+		assert(AsyncScheduler::GetNow() < seconds + 0.1);
+		if (AsyncScheduler::GetNow() > seconds + 0.1) return;
 	}
 	targetFile.close();
 
@@ -923,7 +1522,7 @@ void Server::AddHostedFileFromUnencrypted(std::string fileToAdd, std::string fil
 
 	//  Find the file's primary name (no directories)
 	std::string pureFileName = fileToAdd;
-	if (fileToAdd.find_last_of('/') != -1) pureFileName = fileToAdd.substr(fileToAdd.find_last_of('/') + 1, fileToAdd.length() - fileToAdd.find_last_of('/') - 1);
+	if (fileToAdd.find_last_of('/') != std::string::npos) pureFileName = fileToAdd.substr(fileToAdd.find_last_of('/') + 1, fileToAdd.length() - fileToAdd.find_last_of('/') - 1);
 
 	//  If the file already exists in the Hosted File Data List, return out
 	auto fileTitleMD5 = md5(fileTitle);
@@ -939,6 +1538,7 @@ void Server::AddHostedFileFromUnencrypted(std::string fileToAdd, std::string fil
 	newFile.FileSize = fileSize;
 	newFile.FileUploadTime = GetCurrentTimeString();
 	NPSQL::AddFileData(newFile);
+	FileListCache.OnFileAdded(newFile);
 
 	//  If the file is not already in /_HostedFiles then encrypt it and move it
 	auto hostedFileName = "./_HostedFiles/" + fileTitleMD5 + ".hostedfile";
@@ -953,105 +1553,905 @@ void Server::AddHostedFileFromUnencrypted(std::string fileToAdd, std::string fil
 
 void Server::SendOutHostedFileList(void)
 {
-	//  Send the latest uploads list to each connected user
-	for (auto userIter = UserConnectionsList.begin(); userIter != UserConnectionsList.end(); ++userIter)
+	//  Build the latest uploads list once for every logged in user. With nobody to send it to, the query isn't run at all.
+	auto shards = GetBroadcastShards(BROADCAST_TO_LOGGED_IN);
+	if (std::find(shards.begin(), shards.end(), true) == shards.end()) return;
+	Broadcast(GetHostedFileList(), BROADCAST_TO_LOGGED_IN, shards);
+}
+
+
+std::shared_ptr<const BroadcastFrame> Server::GetHostedFileList(int startIndex, EncryptedData encryptedUsername, HostedFileType type, HostedFileSubtype subtype)
+{
+	auto key = HostedFileListCache::MakeKey(startIndex, encryptedUsername, type, subtype);
+	auto hostedFileList = FileListCache.Find(key);
+	if (hostedFileList != nullptr) return hostedFileList;
+
+	HostedFileListWindow window;
+	hostedFileList = ComposeMessage_HostedFileList(startIndex, encryptedUsername, type, subtype, &window, FileListCache.GetSequence());
+	FileListCache.Insert(key, hostedFileList, std::move(window));
+	return hostedFileList;
+}
+
+
+std::vector<bool> Server::GetBroadcastShards(BroadcastAudience audience) const
+{
+	//  A user counts as logged in here before their shard has heard, which only means a shard may be posted to with no one to send to
+	std::vector<bool> shards(Shards.size(), false);
+	for (auto i = 0; i < int(Shards.size()); ++i)
+		shards[i] = (((audience == BROADCAST_TO_ALL) ? Connections.GetShardConnectionCount(i) : Connections.GetShardLoggedInCount(i)) != 0);
+	return shards;
+}
+
+
+void Server::Broadcast(std::shared_ptr<const BroadcastFrame> frame, BroadcastAudience audience, const std::vector<bool>& shards)
+{
+	//  Every shard is handed the same frame, and queues the same bytes on each of its connections in the audience
+	for (auto& shard : Shards)
+	{
+		if (!shards[shard->GetShardIndex()]) continue;
+		auto shardPointer = shard.get();
+		ShardLoops.Post(shard->GetShardIndex(), [shardPointer, frame, audience]() { shardPointer->SendBroadcast(*frame, audience); });
+	}
+}
+
+
+void Server::ContinueHostedFileReKey(void)
+{
+	if (!ReKeyJob.GetRunning()) return;
+
+	//  Hosted files currently being sent can't be swapped out from under their FileSendTask
+	ReKeyJob.Update(Connections.GetFilesInUse());
+	if (!ReKeyJob.GetRunning())
+	{
+		PostReKeyProgress();
+		PostHostedFileListChanged();
+		SendOutHostedFileList();
+	}
+	else if (AsyncScheduler::GetNow() - LastReKeyProgressTime >= REKEY_PROGRESS_INTERVAL_TIME) PostReKeyProgress();
+}
+
+
+bool Server::RotateWordList(void)
+{
+	//  A re-key moves everything onto one list, so another rotation has to wait until it's done
+	if (ReKeyJob.GetRunning()) return false;
+
+	//  Archive the outgoing word list and create a new one, then re-key everything hosted onto it in the background. Every
+	//  shard encrypts and decrypts with the current list, so they're all held still while it changes.
+	ShardLoops.RunExclusive([]() { Groundfish::UpdateWordList(); });
+	ReKeyJob.Start(int(Groundfish::CurrentVersion));
+	return true;
+}
+
+
+void Server::PostUserListChanged(void)
+{
+	auto listEvent = std::make_unique<UserListChangedEventData>("Server");
+	listEvent->UserList.reserve(Connections.GetConnectionCount());
+	for (auto iter = Connections.begin(); iter != Connections.end(); ++iter) listEvent->UserList.push_back((*iter).second.User);
+	networkThread.PostEvent(std::move(listEvent));
+}
+
+
+void Server::PostHostedFileListChanged(void)
+{
+	std::list<HostedFileData> dataList;
+	NPSQL::GetHostedFileList(dataList, 0, 100);
+	dataList.sort(CompareUploadsByTimeAdded);
+
+	//  Titles are decrypted here, as the word list can only be rotated from this thread
+	auto listEvent = std::make_unique<HostedFileListChangedEventData>("Server");
+	for (auto& fileData : dataList)
+		listEvent->FileList.push_back(HostedFileListEntry{ fileData.FileTitleChecksum, Groundfish::DecryptToString(fileData.EncryptedFileTitle.data()), fileData.FileSize, fileData.FileType, fileData.FileSubType });
+	networkThread.PostEvent(std::move(listEvent));
+}
+
+
+void Server::PostReKeyProgress(void)
+{
+	LastReKeyProgressTime = AsyncScheduler::GetNow();
+	if (ReKeyJob.GetJobState() == HostedFileReKeyJob::REKEY_STATE_IDLE) return;
+
+	char progressString[128];
+	auto failedCount = (unsigned long long)(ReKeyJob.GetRowsFailed() + ReKeyJob.GetFilesFailed());
+	if (ReKeyJob.GetRunning()) snprintf(progressString, 128, "RE-KEY: %llu/%llu files (%.1f%%) @ %.2f MB/s, %llu failed", (unsigned long long)(ReKeyJob.GetFilesCompleted()), (unsigned long long)(ReKeyJob.GetFilesTotal()), ReKeyJob.GetPercentageComplete() * 100.0, ReKeyJob.GetThroughput() / (1024.0 * 1024.0), failedCount);
+	else if (failedCount != 0) snprintf(progressString, 128, "RE-KEY: %llu failed, retried on restart (word list %d)", failedCount, ReKeyJob.GetTargetVersion());
+	else snprintf(progressString, 128, "RE-KEY: complete (word list %d)", ReKeyJob.GetTargetVersion());
+	networkThread.PostEvent(std::make_unique<ReKeyProgressEventData>(progressString, "Server"));
+}
+
+
+void Server::BroadcastChatString(std::string chatString)
+{
+	auto shards = GetBroadcastShards(BROADCAST_TO_LOGGED_IN);
+	if (std::find(shards.begin(), shards.end(), true) == shards.end()) return;
+	Broadcast(ComposeMessage_ChatString(chatString), BROADCAST_TO_LOGGED_IN, shards);
+}
+
+
+
+////////////////////////////////////////
+//	Shard Functions
+////////////////////////////////////////
+
+ServerShard::ServerShard(Server& coordinator, int shardIndex) :
+	Coordinator(coordinator),
+	ShardIndex(shardIndex),
+	DataChannel(Network)
+{
+	//  The shard's wrapper is set up here, and only used from the shard's thread once it starts
+	Network.WinsockInitialize();
+
+	//  Without a datagram port of its own, the shard's users just do all of their transfers over their connections
+	if (!DataChannel.Open(DATA_CHANNEL_PORT + shardIndex))
+		debugConsole->AddDebugConsoleLine("Shard " + std::to_string(shardIndex) + " could not open UDP port " + std::to_string(DATA_CHANNEL_PORT + shardIndex) + ", so its transfers will all use TCP");
+}
+
+
+bool ServerShard::Update(void)
+{
+	//  Find out which sockets have something waiting, so only those get serviced
+	Network.UpdateReadySockets(ReadySockets);
+	auto busy = (!ReadySockets.empty() || !DispatchQueue.empty());
+
+	// Receive messages
+	ReceiveMessages();
+
+	//  Then whatever has come in over the datagram channel
+	auto datagramCount = DataChannel.ReceiveAll([this](DatagramSession& session, std::unique_ptr<TransportMessage> message, const std::string& senderIP, int senderPort) { ProcessDatagram(session, std::move(message), senderIP, senderPort); });
+	busy = busy || (datagramCount != 0);
+
+	//  Everything this pass sent to each user goes out together
+	Network.FlushSendQueues();
+	return busy;
+}
+
+
+void ServerShard::Shutdown(void)
+{
+	//  The whole server is going down, so connections are closed without telling it
+	for (auto iter = Connections.begin(); iter != Connections.end(); ++iter)
 	{
-		auto user = (*userIter).first;
+		Network.CloseSocket((*iter).second->SocketID);
+		delete (*iter).second;
+	}
+	Connections.clear();
+	ConnectionsBySocket.clear();
+	DispatchQueue.clear();
+
+	DataChannel.Close();
+	Network.WinsockShutdown();
+}
 
-		//  If the user isn't logged in yet, skip over them. They'll get an update when they log in
-		if (user->UserStatus == UserConnection::USER_STATUS_CONNECTED) continue;
 
-		SendMessage_HostedFileList(user);
+void ServerShard::LogSendQueues(void)
+{
+	for (auto iter = Connections.begin(); iter != Connections.end(); ++iter)
+	{
+		auto user = (*iter).second;
+		auto sendQueue = Network.GetSendQueue(user->SocketID);
+		if (sendQueue == nullptr) continue;
+
+		//  Frames per write shows how well small messages are being coalesced
+		auto framesPerWrite = double(sendQueue->GetFramesQueued()) / double(std::max<uint64_t>(sendQueue->GetWriteCalls(), 1));
+		debugConsole->AddDebugConsoleLine("  [shard " + std::to_string(ShardIndex) + "][" + user->IPAddress + "] " + user->Username + " - " + std::to_string(sendQueue->GetQueuedBytes()) + " bytes queued (peak " + std::to_string(sendQueue->GetPeakQueuedBytes()) +
+			"), " + std::to_string(sendQueue->GetFramesQueued()) + " frames in " + std::to_string(sendQueue->GetWriteCalls()) + " writes (" + std::to_string(framesPerWrite) + " per write), " +
+			std::to_string(sendQueue->GetPartialWrites()) + " partial, " + std::to_string(sendQueue->GetQueuedBytes(MESSAGE_CHANNEL_CONTROL)) + " of the queued bytes control" +
+			(sendQueue->GetBackpressure(MESSAGE_CHANNEL_DOWNLOAD) ? ", holding back the download" : ""));
 	}
 }
 
 
-void Server::ContinueFileTransfers(void)
+void ServerShard::AddConnection(Socket* socket, uint64_t connectionID, std::string ipAddress)
+{
+	auto socketID = Network.AddSocket(socket);
+	auto newConnection = new UserConnection(connectionID, socketID, ipAddress, &Network);
+	Connections[connectionID] = newConnection;
+	ConnectionsBySocket[socketID] = newConnection;
+	Network.WatchSocket(socketID);
+
+	//  Keep the connection alive until it goes quiet for too long, then drop it
+	newConnection->KeepAlive = KeepUserAlive(newConnection);
+	newConnection->KeepAlive.SetOnComplete([this, newConnection]() { RemoveClient(newConnection); });
+	newConnection->KeepAlive.Start();
+
+	PostUserStatusChanged(newConnection);
+}
+
+
+void ServerShard::RemoveClient(UserConnection* user)
+{
+	if (user->UserStatus != UserConnection::USER_STATUS_CONNECTED)
+		debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - User logged out: " + user->Username);
+
+	auto connectionID = user->ConnectionID;
+	if (user->DispatchQueued) DispatchQueue.erase(std::find(DispatchQueue.begin(), DispatchQueue.end(), user));
+	Connections.erase(connectionID);
+	ConnectionsBySocket.erase(user->SocketID);
+	Network.CloseSocket(user->SocketID);
+	if (user->DataSession != nullptr) DataChannel.RemoveSession(user->DataSession->SessionID);
+	delete user;
+
+	PostToServer([connectionID](Server& server) { server.RemoveConnection(connectionID); });
+}
+
+
+void ServerShard::RunOnConnection(uint64_t connectionID, const std::function<void(ServerShard&, UserConnection*)>& callback)
+{
+	//  The connection may have closed while the server was answering it
+	auto connectionIter = Connections.find(connectionID);
+	if (connectionIter == Connections.end()) return;
+	callback(*this, (*connectionIter).second);
+}
+
+
+void ServerShard::ReceiveMessages(void)
 {
-	//  Find all file transfers and send a file chunk for each one if the file transfer is ready
-	for (auto userIter = UserConnectionsList.begin(); userIter != UserConnectionsList.end(); ++userIter)
+	//  Read everything that's arrived on each ready connection, and queue up the connections that now have whole messages
+	for (auto socketID : ReadySockets)
 	{
-		auto user = (*userIter).first;
-		if (user->UserFileSendTask == nullptr) continue;
+		auto userIter = ConnectionsBySocket.find(socketID);
+		if (userIter == ConnectionsBySocket.end()) continue;
 
-		//  If we haven't "started" the file send, do so now and return out
-		if (user->UserFileSendTask->FileSendStarted == false)
+		auto user = (*userIter).second;
+		auto receivedSize = user->ReceiveIncomingData();
+
+		//  If nothing has arrived, move on to the next connection
+		if (receivedSize < 0) continue;
+
+		//  If the connection was reset, remove the user and move on to the next connection
+		if (receivedSize == 0)
 		{
-			user->UserFileSendTask->StartFileSend();
+			RemoveClient(user);
 			continue;
 		}
 
-		//  If we aren't ready to send the file, continue out and wait for a ready signal
-		if (user->UserFileSendTask->GetFileTransferState() == FileSendTask::CHUNK_STATE_INITIALIZING) continue;
+		//  Update the last time we heard from this user
+		user->UpdatePingTime();
 
-		if (user->UserFileSendTask->GetFileTransferComplete())
+		if (!user->DispatchQueued && (user->IncomingFrames.GetFrameReady() || user->IncomingFrames.GetClosed()))
 		{
-			//  If the file send is complete, delete the file send task and move on
-			delete user->UserFileSendTask;
-			user->UserFileSendTask = nullptr;
+			user->DispatchQueued = true;
+			DispatchQueue.push_back(user);
+		}
+	}
 
-#if FILE_TRANSFER_DEBUGGING
-			debugConsole->AddDebugConsoleLine("FileSendTask deleted...");
-#endif
+	//  Handle every queued message, a connection at a time, until they're all done or the time budget runs out. A connection
+	//  that still has messages left goes to the back of the queue, so one busy upload can't keep everyone else waiting.
+	auto deadline = AsyncScheduler::GetNow() + ReceiveTimeBudget;
+	while (!DispatchQueue.empty())
+	{
+		auto user = DispatchQueue.front();
+		DispatchQueue.pop_front();
+		user->DispatchQueued = false;
+
+		auto outOfTime = false;
+		while (user->NextIncomingMessage())
+		{
+			ProcessMessage(user);
+			if ((outOfTime = (AsyncScheduler::GetNow() >= deadline))) break;
+		}
 
-			user->SetStatusIdle();
-			if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
-			break;
+		//  The user only goes once every message they sent before closing has been handled
+		if (user->IncomingFrames.GetFrameReady())
+		{
+			user->DispatchQueued = true;
+			DispatchQueue.push_back(user);
 		}
+		else if (user->IncomingFrames.GetClosed()) RemoveClient(user);
 
-		//  If we get this far, we have data to send. Send it and continue out
-		user->UserFileSendTask->SendFileChunk();
+		if (outOfTime) break;
 	}
 }
 
 
-void Server::BeginFileTransfer(HostedFileData& fileData, UserConnection* user)
+void ServerShard::ProcessMessage(UserConnection* user)
 {
+	//  A newer client may use channels we don't know about, and anything sent on them is ignored
+	if (user->IncomingFrames.GetFrameChannel() >= MESSAGE_CHANNEL_COUNT) return;
+
+	MessageReader message(user->ReceiveBuffer);
+	auto messageID = message.ReadChar();
+	switch (messageID)
+	{
+		case MESSAGE_ID_PING_RESPONSE:
+		{
+			//  NO DATA
+
+			//  We've already updated the last ping time of the user. A user in the middle of a transfer isn't idle, so their
+			//  transfer progress stays up, but the round trip time shown alongside it is updated either way.
+			user->FinishRoundTrip();
+			if ((user->UserFileSendTask == nullptr) && (user->UserFileReceiveTask == nullptr)) user->SetStatusIdle(0);
+			PostUserStatusChanged(user);
+		}
+		break;
+
+		case MESSAGE_ID_FRAMING_VERSION:
+		{
+			//  (char) Framing version
+			//  The client offers the newest framing it knows, we answer with the newest we both know (still in the legacy framing),
+			//  and the client confirms in that same framing once it has switched. Its messages after the confirmation use it.
+			//  This all happens on connecting, before there's a transfer whose frames could overtake the answer on another channel.
+
+			auto framingVersion = int(message.ReadChar());
+			if (message.GetFailed() || (framingVersion < FRAMING_VERSION_LEGACY)) break;
+
+			if (user->FramingVersion == 0)
+			{
+				user->FramingVersion = std::min(framingVersion, FRAMING_VERSION_LATEST);
+				SendMessage_FramingVersion(user, (unsigned char)(user->FramingVersion));
+				Network.SetFramingVersion(user->SocketID, user->FramingVersion);
+			}
+			else if (framingVersion == user->FramingVersion)
+			{
+				user->IncomingFrames.SetFramingVersion(framingVersion);
+				user->FinishRoundTrip();
+			}
+		}
+		break;
+
+		case MESSAGE_ID_ENCRYPTED_CHAT_STRING:
+		{
+			//  (int) Message Size [N]
+			//  (N-sized char array) Encrypted String
+
+			auto messageSize = message.ReadInt();
+			auto encryptedChatString = message.ReadBytes(messageSize);
+			if (message.GetFailed()) break;
+
+			//  Decrypt using Groundfish, and let the server pass it on to everyone
+			std::string decryptedString = Groundfish::DecryptToString(encryptedChatString.data());
+			PostToServer([decryptedString](Server& server) { server.BroadcastChatString(decryptedString); });
+		}
+		break;
+
+		case MESSAGE_ID_USER_LOGIN_REQUEST: // Player enters the server, sending their encrypted name and password
+		{
+			//  (int) Length of encrypted username (n1)
+			//  (n1-size chars array) Encrypted username
+			//  (int) Length of encrypted password (n2)
+			//  (n2-size chars array) Encrypted password
+
+			//  Grab the current client version number to ensure they have the up-to-date version
+			auto versionString = message.ReadString();
+
+			//  Grab the username size and encrypted username, then the password size and encrypted password
+			auto usernameSize = message.ReadInt();
+			auto usernameArray = message.ReadBytes(usernameSize);
+			auto passwordSize = message.ReadInt();
+			auto passwordArray = message.ReadBytes(passwordSize);
+			if (message.GetFailed()) break;
+
+			std::string username = Groundfish::DecryptToString(usernameArray.data());
+			std::string password = Groundfish::DecryptToString(passwordArray.data());
+
+			if (versionString.compare(VERSION_NUMBER) != 0)
+			{
+				SendMessage_LoginResponse(LOGIN_RESPONSE_VERSION_NUMBER_INCORRECT, user);
+				break;
+			}
+
+			//  Lowercase the username and password
+			std::transform(username.begin(), username.end(), username.begin(), ::tolower);
+			std::transform(password.begin(), password.end(), password.begin(), ::tolower);
+
+			//  The hashing is done here on the shard, and the server checks the result against the user database and everyone logged in
+			auto connectionID = user->ConnectionID;
+			auto passwordHash = sha256(password);
+			auto loginChecksum = md5(username + password);
+			PostToServer([connectionID, username, passwordHash, loginChecksum](Server& server) { server.RequestLogin(connectionID, username, passwordHash, loginChecksum); });
+		}
+		break;
+
+		case MESSAGE_ID_SESSION_RESUME_REQUEST: // A user back on a new connection, with the ticket from their last one in place of a login
+		{
+			//  (string) Client version number
+			//  (long) Ticket ID
+			//  (int) Length of encrypted ticket secret (n)
+			//  (n-size chars array) Encrypted ticket secret
+			//  (long) The hosted file list sequence of the latest list they have
+			auto versionString = message.ReadString();
+			auto ticketID = message.ReadLongInt();
+			auto secretSize = message.ReadInt();
+			auto encryptedSecret = message.ReadBytes(secretSize);
+			auto listSequence = message.ReadLongInt();
+			if (message.GetFailed() || (user->UserStatus != UserConnection::USER_STATUS_CONNECTED)) break;
+
+			if (versionString.compare(VERSION_NUMBER) != 0)
+			{
+				SendMessage_SessionResumeResponse(LOGIN_RESPONSE_VERSION_NUMBER_INCORRECT, user);
+				break;
+			}
+
+			//  The secret comes from a connection nobody has logged in on yet, so it's only decrypted once it's known to be whole
+			if (!Groundfish::GetEncryptedValid(encryptedSecret))
+			{
+				SendMessage_SessionResumeResponse(LOGIN_RESPONSE_SESSION_EXPIRED, user);
+				break;
+			}
+			auto ticketSecret = Groundfish::Decrypt(encryptedSecret.data());
+			if (ticketSecret.size() != size_t(SESSION_TICKET_SECRET_SIZE))
+			{
+				SendMessage_SessionResumeResponse(LOGIN_RESPONSE_SESSION_EXPIRED, user);
+				break;
+			}
+
+			auto connectionID = user->ConnectionID;
+			PostToServer([connectionID, ticketID, ticketSecret, listSequence](Server& server) { server.RequestResume(connectionID, ticketID, ticketSecret, listSequence); });
+		}
+		break;
+
+		case MESSAGE_ID_REQUEST_HOSTED_FILE_LIST:
+		{
+			//  Read the username to filter the list by (if any)
+			auto usernameSize = message.ReadUnsignedShort();
+			auto encryptedUsernameVec = message.ReadBytes(usernameSize);
+
+			//  Read the type and subtype to filter for
+			auto type = HostedFileType(message.ReadChar());
+			auto subtype = HostedFileSubtype(message.ReadChar());
+
+			//  Read the starting index to begin the list at
+			auto startingIndex = int(message.ReadUnsignedShort());
+			if (message.GetFailed()) break;
+
+			//  The server decrypts the filter for every request, before it looks in its cache, so it only gets one that's whole
+			if (!encryptedUsernameVec.empty() && !Groundfish::GetEncryptedValid(encryptedUsernameVec)) break;
+
+			//  The server sends back a hosted file data list with the given filters
+			auto connectionID = user->ConnectionID;
+			PostToServer([connectionID, encryptedUsernameVec, type, subtype, startingIndex](Server& server) { server.RequestHostedFileList(connectionID, encryptedUsernameVec, type, subtype, startingIndex); });
+		}
+		break;
+
+		case MESSAGE_ID_FILE_REQUEST:
+		{
+			auto fileNameLength = message.ReadInt();
+			auto fileTitle = message.ReadChars(fileNameLength);
+			auto inlineLimit = message.ReadInt();
+			if (message.GetFailed()) break;
+
+			if (user->UserStatus == UserConnection::USER_STATUS_CONNECTED)
+			{
+				SendMessage_FileRequestFailed(fileTitle, "You must be logged in to download a file.", user);
+				break;
+			}
+
+			//  The server looks the file up, and either sends it inline or starts the transfer back on this shard if it's found.
+			//  Whether the user is already streaming a file is only checked there, once it's known this one needs a stream.
+			auto connectionID = user->ConnectionID;
+			auto messageLimit = GetFileInlineMessageLimit(user->FramingVersion);
+			PostToServer([connectionID, fileTitle, inlineLimit, messageLimit](Server& server) { server.RequestFile(connectionID, fileTitle, inlineLimit, messageLimit); });
+		}
+		break;
+
+		case MESSAGE_ID_FILE_BUNDLE_REQUEST:
+		{
+			//  (int) The largest file the client will take inline
+			//  (unsigned short) The number of files asked for
+			//  (int, then chars) Each file's title
+			auto inlineLimit = message.ReadInt();
+			auto fileCount = int(message.ReadUnsignedShort());
+			if (message.GetFailed() || (fileCount > FILE_INLINE_BUNDLE_MAX_FILES)) break;
+			if (user->UserStatus == UserConnection::USER_STATUS_CONNECTED) break;
+
+			std::vector<std::string> fileTitles;
+			for (auto i = 0; (i < fileCount) && !message.GetFailed(); ++i)
+			{
+				auto fileTitleLength = message.ReadInt();
+				if ((fileTitleLength < 0) || (fileTitleLength > UPLOAD_TITLE_MAX_LENGTH)) break;
+				fileTitles.push_back(message.ReadChars(fileTitleLength));
+			}
+			if (message.GetFailed() || (int(fileTitles.size()) != fileCount)) break;
+
+			//  The server sends back whatever's small enough in one message, and says which have to be asked for on their own.
+			//  Nothing is streamed, so this can be asked for while a download is still going.
+			auto connectionID = user->ConnectionID;
+			auto messageLimit = GetFileInlineMessageLimit(user->FramingVersion);
+			PostToServer([connectionID, fileTitles, inlineLimit, messageLimit](Server& server) { server.RequestFileBundle(connectionID, fileTitles, inlineLimit, messageLimit); });
+		}
+		break;
+
+		case MESSAGE_ID_COLLECTION_REQUEST:
+		{
+			//  (long) The collection's ID, chosen by the client
+			//  (int) The largest file the client will take inline
+			//  (unsigned short) The number of files in the collection
+			//  (int, then chars) Each file's title, in the order they're wanted
+			auto collectionID = message.ReadLongInt();
+			auto inlineLimit = message.ReadInt();
+			auto fileCount = int(message.ReadUnsignedShort());
+			if (message.GetFailed() || (fileCount > FILE_COLLECTION_MAX_FILES)) break;
+			if (user->UserStatus == UserConnection::USER_STATUS_CONNECTED) break;
+
+			std::vector<std::string> fileTitles;
+			for (auto i = 0; (i < fileCount) && !message.GetFailed(); ++i)
+			{
+				auto fileTitleLength = message.ReadInt();
+				if ((fileTitleLength < 0) || (fileTitleLength > UPLOAD_TITLE_MAX_LENGTH)) break;
+				fileTitles.push_back(message.ReadChars(fileTitleLength));
+			}
+			if (message.GetFailed() || (int(fileTitles.size()) != fileCount)) break;
+
+			auto connectionID = user->ConnectionID;
+			auto messageLimit = GetFileInlineMessageLimit(user->FramingVersion);
+			PostToServer([connectionID, collectionID, fileTitles, inlineLimit, messageLimit](Server& server) { server.RequestCollection(connectionID, collectionID, fileTitles, inlineLimit, messageLimit); });
+		}
+		break;
+
+		case MESSAGE_ID_FILE_SEND_INIT:
+		{
+			auto fileNameSize = message.ReadInt();
+			auto fileTitleSize = message.ReadInt();
+			auto fileDescriptionSize = message.ReadInt();
+
+			//  Read the encrypted file name, title, and description
+			auto encryptedFileName = message.ReadBytes(fileNameSize);
+			auto encryptedFileTitle = message.ReadBytes(fileTitleSize);
+			auto encryptedFileDescription = message.ReadBytes(fileDescriptionSize);
+
+			//  grab the file type and sub type
+			auto fileTypeID = HostedFileType(message.ReadUnsignedShort());
+			auto fileSubTypeID = HostedFileSubtype(message.ReadUnsignedShort());
+
+			//  Grab the file size, file chunk size, and buffer count
+			auto fileSize = message.ReadLongInt();
+			auto fileChunkSize = message.ReadLongInt();
+			auto fileChunkBufferCount = message.ReadLongInt();
+			if (message.GetFailed()) break;
+
+			//  Only a logged in user can upload, and the sizes they give are what the receive task is built from, so they're
+			//  checked before anything is made from them
+			if (user->UserStatus == UserConnection::USER_STATUS_CONNECTED)
+			{
+				SendMessage_FileSendInitFailed("You must be logged in to upload a file.", user);
+				break;
+			}
+			if (user->UserFileReceiveTask != nullptr)
+			{
+				SendMessage_FileSendInitFailed("User is currently already uploading a file.", user);
+				break;
+			}
+			if (!FileReceiveTask::GetChunkLayoutValid(fileChunkSize, fileChunkBufferCount))
+			{
+				SendMessage_FileSendInitFailed("The file's chunk layout is not supported by the server.", user);
+				break;
+			}
+
+			if (!Groundfish::GetEncryptedValid(encryptedFileName) || !Groundfish::GetEncryptedValid(encryptedFileTitle) || !Groundfish::GetEncryptedValid(encryptedFileDescription))
+			{
+				SendMessage_FileSendInitFailed("The file's details could not be read.", user);
+				break;
+			}
+
+			//  Decrypt the file name using Groundfish and save it off
+			UploadRequest request;
+			request.FileName = "./_DownloadedFiles/" + Groundfish::DecryptToString(encryptedFileName.data());
+
+			//  Decrypt the file title using Groundfish and save it off
+			request.FileTitle = Groundfish::DecryptToString(encryptedFileTitle.data());
+			if (request.FileTitle.empty() || (request.FileTitle.length() > UPLOAD_TITLE_MAX_LENGTH))
+			{
+				SendMessage_FileSendInitFailed("The file title must be between 1 and " + std::to_string(UPLOAD_TITLE_MAX_LENGTH) + " characters.", user);
+				break;
+			}
+
+			//  Decrypt the file description using Groundfish and save it off
+			request.FileDescription = Groundfish::DecryptToString(encryptedFileDescription.data());
+
+			request.FileTypeID = fileTypeID;
+			request.FileSubTypeID = fileSubTypeID;
+			request.FileSize = fileSize;
+			request.FileChunkSize = fileChunkSize;
+			request.FileChunkBufferCount = fileChunkBufferCount;
+
+			//  The server checks the title isn't already hosted, and starts the upload back on this shard if it isn't
+			auto connectionID = user->ConnectionID;
+			PostToServer([connectionID, request](Server& server) { server.RequestUpload(connectionID, request); });
+		}
+		break;
+
+		case MESSAGE_ID_DATA_CHANNEL_CONFIRM:
+		{
+			//  NO DATA
+
+			//  The user has had our answer to their hello, so datagrams get through both ways, and transfers can go over them
+			if ((user->DataSession == nullptr) || !user->DataSession->GetPeerKnown()) break;
+			user->DataSession->Established = true;
+		}
+		break;
+
+		case MESSAGE_ID_FILE_RECEIVE_READY:
+		case MESSAGE_ID_FILE_CHUNKS_REMAINING:
+		case MESSAGE_ID_FILE_PORTION_COMPLETE_CONFIRM:
+		{
+			//  Replies about a file we're sending go to its send coroutine
+			if (user->UserFileSendTask == nullptr) break;
+			user->UserFileSendTask->Deliver(TransportMessage::Create(messageID, message.GetBuffer()));
+		}
+		break;
+
+		case MESSAGE_ID_FILE_PORTION:
+		case MESSAGE_ID_FILE_PORTION_COMPLETE:
+		{
+			//  Pieces of a file we're receiving go to its receive coroutine
+			if (user->UserFileReceiveTask != nullptr)
+			{
+				user->UserFileReceiveTask->Deliver(TransportMessage::Take(messageID, message.GetBuffer()));
+				break;
+			}
+
+			//  A reminder for an upload we've already finished means our last confirmation went missing, so send it again
+			if (messageID == MESSAGE_ID_FILE_PORTION_COMPLETE)
+			{
+				WinsockTransport transport(user->SocketID, user->IPAddress, NEW_PROVIDENCE_PORT, Network, MESSAGE_CHANNEL_UPLOAD, user->Rtt);
+				WriteMessage_FilePortionCompleteConfirmation(transport, message.ReadLongInt());
+				transport.Send();
+			}
+		}
+		break;
+
+		default:
+		{
+			std::string debugLine = "Unknown message ID received: " + std::to_string(messageID) + " from user " + user->Username;
+			debugConsole->AddDebugConsoleLine(debugLine);
+			//assert(false);
+		}
+		break;
+	}
+}
+
+
+void ServerShard::ProcessDatagram(DatagramSession& session, std::unique_ptr<TransportMessage> message, const std::string& senderIP, int senderPort)
+{
+	auto connectionIter = Connections.find(session.OwnerID);
+	if (connectionIter == Connections.end()) return;
+	auto user = (*connectionIter).second;
+
+	switch (message->MessageID)
+	{
+		case MESSAGE_ID_DATA_CHANNEL_HELLO:
+		{
+			//  A hello says where the user's datagrams are coming from (after any NAT in the way), and answering it shows them
+			//  ours get back. They keep sending them while they're connected, so the NAT keeps the way open. Only a hello newer
+			//  than any we've taken can move the peer, as an old one sent again could be coming from anyone.
+			if (message->Buffer.bytesleft() < 8) break;
+			if (!session.TakeHello(message->Buffer.readlint(), senderIP, senderPort)) break;
+			DatagramTransport transport(DataChannel, user->DataSession);
+			transport.BeginMessage(MESSAGE_ID_DATA_CHANNEL_HELLO);
+			transport.Send();
+		}
+		break;
+
+		case MESSAGE_ID_FILE_PORTION:
+		case MESSAGE_ID_FILE_PARITY:
+		{
+			//  Pieces of a file we're receiving go to its receive coroutine, the same as those that come over the connection
+			if (user->UserFileReceiveTask == nullptr) break;
+			user->UserFileReceiveTask->Deliver(std::move(message));
+		}
+		break;
+	}
+}
+
+
+void ServerShard::OfferDataChannel(UserConnection* user)
+{
+	if (!DataChannel.GetOpen() || (user->DataSession != nullptr)) return;
+
+	user->DataSession = DatagramSession::Create(user->ConnectionID);
+	DataChannel.AddSession(user->DataSession);
+	SendMessage_DataChannelOffer(user, DataChannel.GetPort());
+}
+
+
+AsyncTask ServerShard::KeepUserAlive(UserConnection* user)
+{
+	while (true)
+	{
+		//  Sleep until the user is due a ping. Hearing from them in the meantime pushes that back, so re-check when we wake.
+		auto secondsUntilPing = std::max<double>(user->LastPingTime, user->LastPingRequest) + PING_INTERVAL_TIME - AsyncScheduler::GetNow();
+		if (secondsUntilPing > 0.0)
+		{
+			co_await SleepFor(secondsUntilPing);
+			continue;
+		}
+
+		//  If they've been silent for too long, finish, and the connection is dropped
+		auto timeSinceLastPing = AsyncScheduler::GetNow() - user->LastPingTime;
+		if (timeSinceLastPing > (PINGS_BEFORE_DISCONNECT * PING_INTERVAL_TIME)) co_return;
+
+		SendMessage_PingRequest(user);
+		user->UpdatePingRequestTime();
+		user->SetStatusIdle(int(timeSinceLastPing));
+		PostUserStatusChanged(user);
+	}
+}
+
+
+void ServerShard::CompleteLogin(UserConnection* user, LoginResponseIdentifiers response, std::string userID, std::string username, std::shared_ptr<const BroadcastFrame> hostedFileList, SessionTicket ticket, uint64_t listSequence)
+{
+	SendMessage_LoginResponse(response, user);
+	if (response != LOGIN_RESPONSE_SUCCESS) return;
+
+	//  Set the user identifier and name
+	user->UserIdentifier = userID;
+	user->Username = username;
+	user->UserStatus = UserConnection::USER_STATUS_LOGGED_IN;
+	user->SetStatusIdle();
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - User logged in: " + user->Username);
+
+	//  Read the Inbox and Notifications data for the user
+	ReadUserInbox(user);
+	ReadUserNotifications(user);
+	SendMessage_InboxAndNotifications(user);
+	user->SendBroadcast(*hostedFileList);
+
+	//  Hand them a ticket, so if they lose the connection they can come back on a new one without logging in again
+	SendMessage_SessionTicket(user, ticket, listSequence);
+
+	//  Offer the user a datagram channel for their transfers. Until it's established (if it ever is), they go over TCP.
+	OfferDataChannel(user);
+
+	PostUserStatusChanged(user);
+}
+
+
+void ServerShard::CompleteResume(UserConnection* user, LoginResponseIdentifiers response, SessionTicket ticket, uint64_t listSequence, std::shared_ptr<const BroadcastFrame> hostedFileList, bool notificationsChanged)
+{
+	SendMessage_SessionResumeResponse(response, user);
+	if (response != LOGIN_RESPONSE_SUCCESS) return;
+
+	user->UserIdentifier = ticket.UserID;
+	user->Username = ticket.Username;
+	user->UserStatus = UserConnection::USER_STATUS_LOGGED_IN;
+	user->SetStatusIdle();
+	debugConsole->AddDebugConsoleLine(GetCurrentTimeString() + " - User resumed their session: " + user->Username);
+
+	//  They already have everything else from before they lost their connection
+	if (notificationsChanged)
+	{
+		ReadUserInbox(user);
+		ReadUserNotifications(user);
+		SendMessage_InboxAndNotifications(user);
+	}
+	if (hostedFileList != nullptr) user->SendBroadcast(*hostedFileList);
+	SendMessage_SessionTicket(user, ticket, listSequence);
+
+	//  The datagram channel session went with the old connection, so they're offered a new one
+	OfferDataChannel(user);
+
+	PostUserStatusChanged(user);
+}
+
+
+void ServerShard::SendBroadcast(const BroadcastFrame& frame, BroadcastAudience audience)
+{
+	for (auto iter = Connections.begin(); iter != Connections.end(); ++iter)
+	{
+		auto user = (*iter).second;
+		if ((audience == BROADCAST_TO_LOGGED_IN) && (user->UserStatus == UserConnection::USER_STATUS_CONNECTED)) continue;
+		user->SendBroadcast(frame);
+	}
+}
+
+
+void ServerShard::BeginFileTransfer(HostedFileData& fileData, UserConnection* user, bool awaitReceiveReady)
+{
+	//  The user may have asked twice before the server answered the first
+	if (user->UserFileSendTask != nullptr) return;
+
 	//  Decrypt the file name, the hosted file path, and the file title
 	auto fileName = Groundfish::DecryptToString(fileData.EncryptedFileName.data());
-	auto filePath = "./_HostedFiles/" + fileData.FileTitleChecksum + ".hostedfile";
+	auto filePath = GetHostedFilePath(fileData.FileTitleChecksum);
 	auto fileTitle = Groundfish::DecryptToString(fileData.EncryptedFileTitle.data());
 
 	//  Get the file type and sub-type
 	auto fileTypeID = fileData.FileType;
 	auto fileSubTypeID = fileData.FileSubType;
 
-	//  Add a new FileSendTask to our list, so it can manage itself
-	FileSendTask* newTask = new FileSendTask(fileName, fileTitle, filePath, fileTypeID, fileSubTypeID, user->SocketID, std::string(user->IPAddress), NEW_PROVIDENCE_PORT);
+	//  Add a new FileSendTask to our list, so it can manage itself. It sends on the download channel, so it only ever gets
+	//  what's left after control messages, and shares that fairly with the user's upload, if they have one going.
+	auto transport = std::make_shared<WinsockTransport>(user->SocketID, user->IPAddress, NEW_PROVIDENCE_PORT, Network, MESSAGE_CHANNEL_DOWNLOAD, user->Rtt);
+	FileSendTask* newTask = new FileSendTask(fileName, fileTitle, filePath, fileTypeID, fileSubTypeID, transport);
+	newTask->SetPacingCap(TransferPacingCap);
+	auto useDatagrams = DataChannelTransfers && (user->DataSession != nullptr) && user->DataSession->Established && (user->Rtt->GetSmoothedRtt() >= FILE_DATAGRAM_MIN_RTT);
+	if (useDatagrams) newTask->SetDataTransport(std::make_shared<DatagramTransport>(DataChannel, user->DataSession, user->Rtt));
+
+	//  Portions sent by datagram can overtake the initializer, so those still wait for the user to say they're ready for them
+	newTask->SetAwaitReceiveReady(awaitReceiveReady || useDatagrams);
+	newTask->SetPortionCompleteCallback([this, user]() { UpdateFileTransferPercentage(true, user); });
 	user->UserFileSendTask = newTask;
 	UpdateFileTransferPercentage(true, user);
+
+	//  Once the file send is complete, delete the file send task, set the user back to idle, and let the server know the file is free
+	newTask->StartFileSend([this, user, newTask]()
+	{
+		//  If the datagrams stopped getting through, the user's later transfers don't try them again
+		if (newTask->GetDataTransportFailed() && (user->DataSession != nullptr))
+		{
+			user->DataSession->Established = false;
+			debugConsole->AddDebugConsoleLine("Datagrams to " + user->Username + " stopped getting through, so their transfers will use TCP");
+		}
+
+		delete newTask;
+		user->UserFileSendTask = nullptr;
+
+#if FILE_TRANSFER_DEBUGGING
+		debugConsole->AddDebugConsoleLine("FileSendTask deleted...");
+#endif
+
+		auto connectionID = user->ConnectionID;
+		PostToServer([connectionID](Server& server) { server.FinishFileTransfer(connectionID); });
+
+		//  An upload still going keeps reporting its own progress
+		if (user->UserFileReceiveTask != nullptr) return;
+		user->SetStatusIdle();
+		PostUserStatusChanged(user);
+	});
 }
 
 
-void Server::UpdateFileTransferPercentage(bool download, UserConnection* user)
+void ServerShard::BeginFileReceive(const UploadRequest& request, UserConnection* user)
+{
+	//  A second upload can be asked for before the server has answered the first
+	if (user->UserFileReceiveTask != nullptr)
+	{
+		SendMessage_FileSendInitFailed("User is currently already uploading a file.", user);
+		return;
+	}
+
+	//  Create a new file receive task. Uploads on different connections can run at once, so each has its own temporary file.
+	std::error_code directoryError;
+	(void) std::filesystem::create_directory("_DownloadedFiles", directoryError);
+	auto transport = std::make_shared<WinsockTransport>(user->SocketID, user->IPAddress, NEW_PROVIDENCE_PORT, Network, MESSAGE_CHANNEL_UPLOAD, user->Rtt);
+	auto tempFileName = "./_DownloadedFiles/_download_" + std::to_string(user->ConnectionID) + ".tempfile";
+	auto receiveTask = new FileReceiveTask(request.FileName, request.FileTitle, request.FileDescription, request.FileTypeID, request.FileSubTypeID, request.FileSize, request.FileChunkSize, request.FileChunkBufferCount, tempFileName, transport);
+	receiveTask->SetDecryptWhenReceived(false);
+	receiveTask->SetPortionCompleteCallback([this, user]() { UpdateFileTransferPercentage(false, user); });
+	user->UserFileReceiveTask = receiveTask;
+
+	//  Once the upload is complete, have the server host it, and clean up the task
+	receiveTask->StartFileReceive([this, user, receiveTask]()
+	{
+		if (receiveTask->GetFileTransferComplete())
+		{
+			auto fileName = receiveTask->GetFileName();
+			auto fileTitle = receiveTask->GetFileTitle();
+			auto fileDescription = receiveTask->GetFileDescription();
+			auto fileTypeID = receiveTask->GetFileTypeID();
+			auto fileSubTypeID = receiveTask->GetFileSubTypeID();
+			auto uploaderName = user->Username;
+			PostToServer([fileName, fileTitle, fileDescription, fileTypeID, fileSubTypeID, uploaderName](Server& server) { server.AddHostedFileFromEncrypted(fileName, fileTitle, fileDescription, fileTypeID, fileSubTypeID, uploaderName); });
+			debugConsole->AddDebugConsoleLine("Added hosted file: \"" + fileTitle + "\"");
+		}
+
+		delete receiveTask;
+		user->UserFileReceiveTask = nullptr;
+
+#if FILE_TRANSFER_DEBUGGING
+		debugConsole->AddDebugConsoleLine("FileReceiveTask deleted...");
+#endif
+	});
+}
+
+
+void ServerShard::UpdateFileTransferPercentage(bool download, UserConnection* user)
 {
 	auto fileTitle = (download ? user->UserFileSendTask->GetFileTitle() : user->UserFileReceiveTask->GetFileTitle());
 	auto percentComplete = (download ? user->UserFileSendTask->GetPercentageComplete() : user->UserFileReceiveTask->GetPercentageComplete());
 	auto transferSpeed = (download ? user->UserFileSendTask->GetEstimatedTransferSpeed() : user->UserFileReceiveTask->GetEstimatedTransferSpeed());
 
-	HostedFileData fileData;
-	NPSQL::GetFileData(md5(fileTitle), fileData);
-	
-	//  Update the user and the UI user list
+	//  Update the user and the UI user list. The title checksum is worked out here rather than looked up, to keep the shard off the database.
 	user->UserStatus = download ? UserConnection::USER_STATUS_DOWNLOADING : UserConnection::USER_STATUS_UPLOADING;
-	user->SetStatusTransferring(download, fileData.FileTitleChecksum, float(percentComplete), int(float(transferSpeed) / 1024.0f));
-	if (UserConnectionListChangedCallback != nullptr) UserConnectionListChangedCallback(UserConnectionsList);
+	user->SetStatusTransferring(download, md5(fileTitle), float(percentComplete), int(float(transferSpeed) / 1024.0f));
+	PostUserStatusChanged(user);
 }
 
 
-void Server::SendChatString(const char* chatString)
+void ServerShard::PostUserStatusChanged(UserConnection* user)
 {
-	for (auto userIter = UserConnectionsList.begin(); userIter != UserConnectionsList.end(); ++userIter)
-	{
-		auto user = (*userIter).first;
-
-		//  Encrypt the string using Groundfish
-		EncryptedData encryptedChatString = Groundfish::Encrypt(chatString, int(strlen(chatString)) + 1, 0, rand() % 256);
-
-		winsockWrapper.ClearBuffer(0);
-		winsockWrapper.WriteChar(MESSAGE_ID_ENCRYPTED_CHAT_STRING, 0);
-		winsockWrapper.WriteInt(int(encryptedChatString.size()), 0);
-		winsockWrapper.WriteChars(encryptedChatString.data(), int(encryptedChatString.size()), 0);
-		winsockWrapper.SendMessagePacket(user->SocketID, user->IPAddress.c_str(), NEW_PROVIDENCE_PORT, 0);
-	}
+	//  The server keeps its own copy of each user's entry for the UI, and passes the change on
+	UserListEntry entry(user);
+	PostToServer([entry](Server& server) { server.UpdateConnection(entry); });
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "Server.h"
+
+//  Server Commands: the server instance and the console commands that drive it. Shared by the windowed server, which
+//  enters them through the debug console, and the headless server, which reads them from stdin. Commands run on
+//  whichever thread enters them, so anything that touches the server is posted over to the network thread.
+
+Server ServerControl;
+
+void AddDebugCommand_AddUserData(void)
+{
+	//  AddUserData: ["AddUserData USER PASS"] adds a user to the server if they don't already exist 
+	debugConsole->AddDebugCommand("AddUserData", [=](std::string commandString) -> bool
+	{
+		auto firstSpace = commandString.find_first_of(' ');
+		auto lastSpace = commandString.find_last_of(' ');
+		auto fullCommand = (lastSpace != (commandString.length() - 1));
+
+		if ((firstSpace == std::string::npos) || (firstSpace != lastSpace) || !fullCommand)
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of AddUserData command: \"AddUserData USER PASS\"");
+			return false;
+		}
+
+		auto username = commandString.substr(0, firstSpace);
+		auto password = commandString.substr(firstSpace + 1, commandString.length() - 1 - firstSpace);
+		debugConsole->AddDebugConsoleLine("Adding user data: (" + username + ")[" + password + "]");
+
+		networkThread.Post([username, password]() { ServerControl.AddUserLoginDetails(username, password); });
+
+		return true;
+	});
+}
+
+void AddDebugCommand_RotateWordList(void)
+{
+	//  RotateWordList: ["RotateWordList"] archives the current word list, creates a new one, and re-keys all hosted files onto it
+	debugConsole->AddDebugCommand("RotateWordList", [=](std::string) -> bool
+	{
+		//  The re-key job belongs to the network thread, so the check is made over there
+		networkThread.Post([]()
+		{
+			if (!ServerControl.RotateWordList())
+				debugConsole->AddDebugConsoleLine("A re-key is already in progress. Wait for it to complete before rotating again.");
+		});
+		return true;
+	});
+}
+
+void AddDebugCommand_ReKeyRateLimit(void)
+{
+	//  ReKeyRateLimit: ["ReKeyRateLimit MBPS"] sets the maximum disk read rate of the background re-key, in megabytes per second
+	debugConsole->AddDebugCommand("ReKeyRateLimit", [=](std::string commandString) -> bool
+	{
+		auto megabytesPerSecond = atof(commandString.c_str());
+		if (megabytesPerSecond <= 0.0)
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of ReKeyRateLimit command: \"ReKeyRateLimit MBPS\"");
+			return false;
+		}
+
+		networkThread.Post([megabytesPerSecond]() { ServerControl.SetReKeyRateLimit(megabytesPerSecond * 1024.0 * 1024.0); });
+		debugConsole->AddDebugConsoleLine("Re-key rate limit set to " + std::to_string(megabytesPerSecond) + " MB/s");
+		return true;
+	});
+}
+
+void AddDebugCommand_ReceiveTimeBudget(void)
+{
+	//  ReceiveTimeBudget: ["ReceiveTimeBudget MS"] sets how long each network pass may spend handling received messages, in milliseconds
+	debugConsole->AddDebugCommand("ReceiveTimeBudget", [=](std::string commandString) -> bool
+	{
+		auto milliseconds = atof(commandString.c_str());
+		if (milliseconds <= 0.0)
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of ReceiveTimeBudget command: \"ReceiveTimeBudget MS\"");
+			return false;
+		}
+
+		networkThread.Post([milliseconds]() { ServerControl.SetReceiveTimeBudget(milliseconds / 1000.0); });
+		debugConsole->AddDebugConsoleLine("Receive time budget set to " + std::to_string(milliseconds) + " ms");
+		return true;
+	});
+}
+
+void AddDebugCommand_TransferPacingCap(void)
+{
+	//  TransferPacingCap: ["TransferPacingCap FRACTION"] paces downloads at a fraction (0 to 1) of each path's estimated bandwidth, or not at all with 0
+	debugConsole->AddDebugCommand("TransferPacingCap", [=](std::string commandString) -> bool
+	{
+		auto capFraction = atof(commandString.c_str());
+		if (commandString.empty() || (capFraction < 0.0) || (capFraction > 1.0))
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of TransferPacingCap command: \"TransferPacingCap FRACTION\"");
+			return false;
+		}
+
+		networkThread.Post([capFraction]() { ServerControl.SetTransferPacingCap(capFraction); });
+		debugConsole->AddDebugConsoleLine((capFraction == 0.0) ? "Download pacing turned off" : ("Download pacing cap set to " + std::to_string(capFraction)));
+		return true;
+	});
+}
+
+void AddDebugCommand_DataChannelTransfers(void)
+{
+	//  DataChannelTransfers: ["DataChannelTransfers on|off"] sends downloads over each user's datagram channel (once they have one), or only ever over TCP
+	debugConsole->AddDebugCommand("DataChannelTransfers", [=](std::string commandString) -> bool
+	{
+		if ((commandString != "on") && (commandString != "off"))
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of DataChannelTransfers command: \"DataChannelTransfers on|off\"");
+			return false;
+		}
+
+		auto enabled = (commandString == "on");
+		networkThread.Post([enabled]() { ServerControl.SetDataChannelTransfers(enabled); });
+		debugConsole->AddDebugConsoleLine(enabled ? "Downloads will use datagram channels where they can" : "Downloads will only use TCP");
+		return true;
+	});
+}
+
+void AddDebugCommand_SendQueues(void)
+{
+	//  SendQueues: ["SendQueues"] lists how much is waiting to go out to each user, and how many frames each write has carried
+	debugConsole->AddDebugCommand("SendQueues", [=](std::string) -> bool
+	{
+		networkThread.Post([]() { ServerControl.LogSendQueues(); });
+		return true;
+	});
+}
+
+void AddDebugCommand_ConnectionsFrom(void)
+{
+	//  ConnectionsFrom: ["ConnectionsFrom IP"] lists every connection from the given address, and who is logged in on each
+	debugConsole->AddDebugCommand("ConnectionsFrom", [=](std::string commandString) -> bool
+	{
+		if (commandString.empty() || (commandString.find_first_of(' ') != std::string::npos))
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of ConnectionsFrom command: \"ConnectionsFrom IP\"");
+			return false;
+		}
+
+		networkThread.Post([commandString]() { ServerControl.LogConnectionsFrom(commandString); });
+		return true;
+	});
+}
+
+void AddDebugCommand_FileListCache(void)
+{
+	//  FileListCache: ["FileListCache"] shows how many hosted file list requests were answered from the cache, and how many were built
+	debugConsole->AddDebugCommand("FileListCache", [=](std::string) -> bool
+	{
+		networkThread.Post([]() { ServerControl.LogFileListCache(); });
+		return true;
+	});
+}
+
+void AddDebugCommand_DeleteHostedFile(void)
+{
+	//  DeleteHostedFile: ["DeleteHostedFile CHECKSUM"] removes a hosted file from the server and tells every client
+	debugConsole->AddDebugCommand("DeleteHostedFile", [=](std::string commandString) -> bool
+	{
+		if (commandString.empty() || (commandString.find_first_of(' ') != std::string::npos))
+		{
+			debugConsole->AddDebugConsoleLine("Proper use of DeleteHostedFile command: \"DeleteHostedFile CHECKSUM\"");
+			return false;
+		}
+
+		networkThread.Post([commandString]() { ServerControl.DeleteHostedFile(commandString); });
+		return true;
+	});
+}
+
+void AddServerCommands(void)
+{
+	AddDebugCommand_AddUserData();
+	AddDebugCommand_RotateWordList();
+	AddDebugCommand_ReKeyRateLimit();
+	AddDebugCommand_ReceiveTimeBudget();
+	AddDebugCommand_TransferPacingCap();
+	AddDebugCommand_DataChannelTransfers();
+	AddDebugCommand_SendQueues();
+	AddDebugCommand_FileListCache();
+	AddDebugCommand_ConnectionsFrom();
+	AddDebugCommand_DeleteHostedFile();
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Engine/AsyncRuntime.h"
+
+#include <string>
+#include <vector>
+#include <random>
+#include <unordered_map>
+
+constexpr auto SESSION_TICKET_SECRET_SIZE	= 32;
+constexpr auto SESSION_TICKET_LIFETIME		= 600.0;	//  Seconds a ticket can still be used for once its connection has closed
+
+//  Session Tickets: what lets a user who has lost their connection (a laptop waking up, a Wi-Fi blip) log back in on a new one
+//  in a single round trip, without their credentials. Each login hands the user a ticket: a random ID, and a random secret sent
+//  encrypted, which they present on the new connection in place of the login. A ticket is only taken with its secret, is used
+//  once (a resume hands out the next one), and replaces any ticket the user had before. It's good for as long as the user's
+//  connection is open, and for SESSION_TICKET_LIFETIME after it closes.
+//
+//  A ticket is a bearer credential, and users are told their own ticket IDs, so the IDs and secrets are drawn straight from the
+//  system's random source rather than a generator whose state could be worked out from the tickets it has handed out.
+//
+//  The store lives on the network thread, along with everything else the server keeps about its users.
+
+struct SessionTicket
+{
+	uint64_t		TicketID = 0;
+	unsigned char	Secret[SESSION_TICKET_SECRET_SIZE] = {};
+	std::string		UserID;
+	std::string		Username;
+	double			ExpiryTime = 0.0;				//  0 while the user's connection is still open
+	bool			NotificationsChanged = false;	//  Whether the user's notifications have changed since they were last sent them
+};
+
+
+class SessionTicketStore
+{
+private:
+	std::unordered_map<uint64_t, SessionTicket> Tickets;
+	std::unordered_map<std::string, uint64_t> TicketsByUserID;
+	std::random_device RandomDevice;
+	double Lifetime;
+
+	inline uint64_t GenerateTicketID() { return (uint64_t(RandomDevice()) << 32) | uint64_t(RandomDevice()); }
+
+	inline SessionTicket* FindByUserID(const std::string& userID)
+	{
+		auto userIter = TicketsByUserID.find(userID);
+		return (userIter == TicketsByUserID.end()) ? nullptr : &Tickets[(*userIter).second];
+	}
+
+	void Remove(uint64_t ticketID)
+	{
+		auto ticketIter = Tickets.find(ticketID);
+		if (ticketIter == Tickets.end()) return;
+		TicketsByUserID.erase((*ticketIter).second.UserID);
+		Tickets.erase(ticketIter);
+	}
+
+	void RemoveExpired(double now)
+	{
+		for (auto iter = Tickets.begin(); iter != Tickets.end();)
+		{
+			auto& ticket = (*iter).second;
+			if ((ticket.ExpiryTime == 0.0) || (ticket.ExpiryTime > now)) { ++iter; continue; }
+			TicketsByUserID.erase(ticket.UserID);
+			iter = Tickets.erase(iter);
+		}
+	}
+
+	//  Compares every byte, however early a mismatch is, so the time taken says nothing about the secret
+	static bool GetSecretMatches(const SessionTicket& ticket, const std::vector<unsigned char>& secret)
+	{
+		if (secret.size() != size_t(SESSION_TICKET_SECRET_SIZE)) return false;
+		unsigned char difference = 0;
+		for (auto i = 0; i < SESSION_TICKET_SECRET_SIZE; ++i) difference |= (unsigned char)(ticket.Secret[i] ^ secret[i]);
+		return (difference == 0);
+	}
+
+public:
+	explicit SessionTicketStore(double lifetime = SESSION_TICKET_LIFETIME) : Lifetime(lifetime) {}
+
+	//  A new ticket for the user, in place of any they had
+	const SessionTicket& Issue(const std::string& userID, const std::string& username)
+	{
+		RemoveExpired(AsyncScheduler::GetNow());
+		auto previous = FindByUserID(userID);
+		if (previous != nullptr) Remove(previous->TicketID);
+
+		auto ticketID = GenerateTicketID();
+		while ((ticketID == 0) || (Tickets.find(ticketID) != Tickets.end())) ticketID = GenerateTicketID();
+
+		auto& ticket = Tickets[ticketID];
+		ticket.TicketID = ticketID;
+		for (auto& secretByte : ticket.Secret) secretByte = (unsigned char)(RandomDevice());
+		ticket.UserID = userID;
+		ticket.Username = username;
+		TicketsByUserID[userID] = ticketID;
+		return ticket;
+	}
+
+	//  Takes the ticket out of the store and hands it back, if it's there, hasn't expired, and the secret is its own. Anything
+	//  else leaves the store as it was, so a wrong guess at someone's secret can't be used to throw their ticket away.
+	bool Redeem(uint64_t ticketID, const std::vector<unsigned char>& secret, SessionTicket& redeemed)
+	{
+		RemoveExpired(AsyncScheduler::GetNow());
+		auto ticketIter = Tickets.find(ticketID);
+		if ((ticketIter == Tickets.end()) || !GetSecretMatches((*ticketIter).second, secret)) return false;
+
+		redeemed = (*ticketIter).second;
+		Remove(ticketID);
+		return true;
+	}
+
+	//  The user's connection has closed, so their ticket starts running out
+	inline void StartExpiry(const std::string& userID)
+	{
+		auto ticket = FindByUserID(userID);
+		if ((ticket != nullptr) && (ticket->ExpiryTime == 0.0)) ticket->ExpiryTime = AsyncScheduler::GetNow() + Lifetime;
+	}
+
+	inline void OnNotificationsChanged(const std::string& userID)
+	{
+		auto ticket = FindByUserID(userID);
+		if (ticket != nullptr) ticket->NotificationsChanged = true;
+	}
+
+	inline size_t GetTicketCount() const { return Tickets.size(); }
+};
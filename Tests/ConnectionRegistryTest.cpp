@@ -0,0 +1,183 @@
+//  Connection registry test
+//  Drives the server's ConnectionRegistry through connections arriving and leaving, logging in and out, and reading hosted
+//  files, and checks after every step that each of its indexes says the same as a walk over the entries would: who is on
+//  each address (oldest first), who holds each user ID, how many connections and logged in users each shard has, and how
+//  many transfers are reading each file. Nothing may be left behind in any index once a connection has gone.
+//
+//  Exits with 0 if every case passed, and 1 if any didn't.
+
+#include "Engine/MemoryManager.h"
+#include "Engine/HeadlessConsole.h"
+#include "Server.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+constexpr int REGISTRY_TEST_SHARD_COUNT = 3;
+
+
+//  Walks the entries to work out what each index should say, and compares
+std::string GetIndexMismatch(const ConnectionRegistry& registry, const std::vector<std::string>& ipAddresses, const std::vector<std::string>& userIDs)
+{
+	std::vector<int> connectionCounts(REGISTRY_TEST_SHARD_COUNT, 0);
+	std::vector<int> loggedInCounts(REGISTRY_TEST_SHARD_COUNT, 0);
+	std::unordered_map<std::string, int> filesInUse;
+	for (auto& entryPair : registry)
+	{
+		auto& entry = entryPair.second;
+		++connectionCounts[entry.ShardIndex];
+		if (!entry.LoggedInUserID.empty()) ++loggedInCounts[entry.ShardIndex];
+		if (!entry.HostedFileInUse.empty()) ++filesInUse[entry.HostedFileInUse];
+	}
+
+	for (auto i = 0; i < REGISTRY_TEST_SHARD_COUNT; ++i)
+	{
+		if (registry.GetShardConnectionCount(i) != connectionCounts[i]) return "shard " + std::to_string(i) + " counts " + std::to_string(registry.GetShardConnectionCount(i)) + " connections, not " + std::to_string(connectionCounts[i]);
+		if (registry.GetShardLoggedInCount(i) != loggedInCounts[i]) return "shard " + std::to_string(i) + " counts " + std::to_string(registry.GetShardLoggedInCount(i)) + " logged in, not " + std::to_string(loggedInCounts[i]);
+	}
+	if (registry.GetFilesInUse() != filesInUse) return "the files in use don't match the transfers";
+
+	for (auto& ipAddress : ipAddresses)
+	{
+		std::vector<uint64_t> expected;
+		for (auto& entryPair : registry) if (entryPair.second.User.IPAddress == ipAddress) expected.push_back(entryPair.first);
+		std::sort(expected.begin(), expected.end());
+		if (registry.FindByIPAddress(ipAddress) != expected) return "the connections from " + ipAddress + " don't match";
+	}
+
+	for (auto& userID : userIDs)
+	{
+		const ConnectionRegistry::ConnectionEntry* holder = nullptr;
+		for (auto& entryPair : registry) if (entryPair.second.LoggedInUserID == userID) holder = &entryPair.second;
+		if (registry.GetUserLoggedIn(userID) != (holder != nullptr)) return "user " + userID + " is " + (holder != nullptr ? "logged in, but not found" : "found, but not logged in");
+	}
+	return "";
+}
+
+
+bool RunIPAddressCase()
+{
+	ConnectionRegistry registry;
+	registry.SetShardCount(REGISTRY_TEST_SHARD_COUNT);
+	const std::vector<std::string> ipAddresses = { "10.0.0.1", "10.0.0.2", "10.0.0.3" };
+	std::string failure;
+
+	//  Connection IDs only go up, so the order they're added in is oldest first
+	registry.Add(1, 0, ipAddresses[0]);
+	registry.Add(2, 1, ipAddresses[1]);
+	registry.Add(3, 2, ipAddresses[0]);
+	registry.Add(4, 0, ipAddresses[0]);
+	failure = GetIndexMismatch(registry, ipAddresses, {});
+	if (failure.empty() && (registry.FindByIPAddress(ipAddresses[0]) != std::vector<uint64_t>{ 1, 3, 4 })) failure = "the first address doesn't list its connections oldest first";
+	if (failure.empty() && !registry.FindByIPAddress(ipAddresses[2]).empty()) failure = "an address no one is on has connections";
+
+	//  Leaving from the middle, the end, and the only one on an address
+	if (failure.empty()) { registry.Remove(3); failure = GetIndexMismatch(registry, ipAddresses, {}); }
+	if (failure.empty() && (registry.FindByIPAddress(ipAddresses[0]) != std::vector<uint64_t>{ 1, 4 })) failure = "removing a connection left the address out of order";
+	if (failure.empty()) { registry.Remove(4); registry.Remove(2); failure = GetIndexMismatch(registry, ipAddresses, {}); }
+	if (failure.empty() && !registry.FindByIPAddress(ipAddresses[1]).empty()) failure = "an address kept a connection that had gone";
+
+	//  Removing one that isn't there changes nothing, and a new connection on a known address goes on the end
+	if (failure.empty()) { registry.Remove(99); registry.Add(5, 1, ipAddresses[0]); failure = GetIndexMismatch(registry, ipAddresses, {}); }
+	if (failure.empty() && (registry.FindByIPAddress(ipAddresses[0]) != std::vector<uint64_t>{ 1, 5 })) failure = "a new connection didn't go on the end of its address";
+	if (failure.empty() && (registry.GetLeastBusyShard() != 2)) failure = "shard " + std::to_string(registry.GetLeastBusyShard()) + " was taken as the least busy, not 2";
+
+	if (!failure.empty()) { printf("FAIL connections by IP address: %s\n", failure.c_str()); return false; }
+	printf("PASS connections by IP address: %d connections left\n", int(registry.GetConnectionCount()));
+	return true;
+}
+
+
+bool RunLoginCase()
+{
+	ConnectionRegistry registry;
+	registry.SetShardCount(REGISTRY_TEST_SHARD_COUNT);
+	const std::vector<std::string> ipAddresses = { "10.0.0.1" };
+	const std::vector<std::string> userIDs = { "alice", "bob" };
+	std::string failure;
+
+	registry.Add(1, 0, ipAddresses[0]);
+	registry.Add(2, 1, ipAddresses[0]);
+	registry.Add(3, 1, ipAddresses[0]);
+	if (!registry.SetLoggedIn(1, "alice")) failure = "the first login was turned away";
+	else if (registry.SetLoggedIn(2, "alice")) failure = "a second login as the same user was taken";
+	else if (registry.SetLoggedIn(1, "bob")) failure = "a connection logged in twice";
+	else if (!registry.SetLoggedIn(2, "bob")) failure = "a second user's login was turned away";
+	if (failure.empty()) failure = GetIndexMismatch(registry, ipAddresses, userIDs);
+	if (failure.empty() && ((registry.FindByUserID("alice") == nullptr) || (registry.FindByUserID("alice")->User.ConnectionID != 1))) failure = "the user wasn't found on their connection";
+
+	//  The shard's report of the user mustn't take away the login the registry holds
+	if (failure.empty())
+	{
+		UserListEntry user;
+		user.ConnectionID = 1;
+		user.IPAddress = ipAddresses[0];
+		user.StatusString = "Idle";
+		registry.UpdateUser(user);
+		if (registry.Find(1)->User.UserIdentifier != "alice") failure = "updating the user lost their user ID";
+	}
+
+	//  Coming back on a new connection ahead of the old one closing, then the old one closing
+	if (failure.empty())
+	{
+		registry.SetLoggedOut(1);
+		if (!registry.SetLoggedIn(3, "alice")) failure = "the user couldn't log in again once logged out";
+		else { registry.Remove(1); failure = GetIndexMismatch(registry, ipAddresses, userIDs); }
+	}
+	if (failure.empty() && ((registry.FindByUserID("alice") == nullptr) || (registry.FindByUserID("alice")->User.ConnectionID != 3))) failure = "closing the old connection took the login from the new one";
+
+	if (failure.empty()) { registry.Remove(2); registry.Remove(3); failure = GetIndexMismatch(registry, ipAddresses, userIDs); }
+	if (failure.empty() && (registry.GetUserLoggedIn("alice") || registry.GetUserLoggedIn("bob"))) failure = "a user was still logged in once their connection had gone";
+
+	if (!failure.empty()) { printf("FAIL logins: %s\n", failure.c_str()); return false; }
+	printf("PASS logins: one login per user, handed between connections\n");
+	return true;
+}
+
+
+bool RunHostedFileCase()
+{
+	ConnectionRegistry registry;
+	registry.SetShardCount(REGISTRY_TEST_SHARD_COUNT);
+	const std::vector<std::string> ipAddresses = { "10.0.0.1", "10.0.0.2" };
+	std::string failure;
+
+	registry.Add(1, 0, ipAddresses[0]);
+	registry.Add(2, 1, ipAddresses[1]);
+	registry.Add(3, 2, ipAddresses[1]);
+	registry.SetHostedFileInUse(1, "Hosted/a");
+	registry.SetHostedFileInUse(2, "Hosted/a");
+	registry.SetHostedFileInUse(3, "Hosted/b");
+	failure = GetIndexMismatch(registry, ipAddresses, {});
+	if (failure.empty() && (registry.GetFilesInUse().at("Hosted/a") != 2)) failure = "two transfers of one file weren't both counted";
+
+	if (failure.empty()) { registry.ClearHostedFileInUse(1); registry.ClearHostedFileInUse(1); failure = GetIndexMismatch(registry, ipAddresses, {}); }
+	if (failure.empty() && (registry.GetFilesInUse().at("Hosted/a") != 1)) failure = "finishing a transfer twice took two from the count";
+
+	if (failure.empty()) { registry.Remove(2); registry.Remove(3); failure = GetIndexMismatch(registry, ipAddresses, {}); }
+	if (failure.empty() && !registry.GetFilesInUse().empty()) failure = "a file was still in use once every transfer's connection had gone";
+
+	if (failure.empty())
+	{
+		registry.SetLoggedIn(1, "alice");
+		registry.SetHostedFileInUse(1, "Hosted/c");
+		registry.Clear();
+		if ((registry.GetConnectionCount() != 0) || registry.GetUserLoggedIn("alice") || !registry.GetFilesInUse().empty() || !registry.FindByIPAddress(ipAddresses[0]).empty()) failure = "clearing left something behind";
+		else failure = GetIndexMismatch(registry, ipAddresses, { "alice" });
+	}
+
+	if (!failure.empty()) { printf("FAIL hosted files in use: %s\n", failure.c_str()); return false; }
+	printf("PASS hosted files in use: counted per transfer, released as connections go\n");
+	return true;
+}
+
+
+int main()
+{
+	auto failedCount = 0;
+	if (!RunIPAddressCase()) ++failedCount;
+	if (!RunLoginCase()) ++failedCount;
+	if (!RunHostedFileCase()) ++failedCount;
+	return (failedCount != 0) ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+//  Data channel test
+//  Checks the two things the UDP data channel leans on. First the Reed-Solomon parity: blocks of data shards are encoded,
+//  then every number of shards up to the parity count is thrown away (data, parity, or a mix of both, chosen at random as
+//  well as all from the data) and the block has to be rebuilt byte for byte. One shard more than the parity can cover has
+//  to be refused, with the data left as it was.
+//
+//  Then the hellos: a client endpoint sends hellos through a relay socket to a server endpoint over loopback, and the server
+//  takes them the way ServerShard::ProcessDatagram does. Copies of hellos it has already taken, sent again from another
+//  socket, still carry a good tag but must not move the peer. A copy with a byte changed must be rejected outright, and a
+//  newer hello from a new address must move the peer there.
+//
+//  Exits with 0 if every case passed, and 1 if any didn't.
+
+#include "Engine/MemoryManager.h"
+#include "Engine/ReedSolomon.h"
+#include "Engine/DatagramChannel.h"
+#include "MessageIdentifiers.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+constexpr int PARITY_TEST_TRIALS			= 25;		//  Random sets of shards thrown away, for each number of them
+constexpr int DATAGRAM_TEST_FIRST_PORT		= 47300;	//  Where the test starts looking for free UDP ports
+constexpr int DATAGRAM_TEST_PORT_RANGE		= 200;
+constexpr double DATAGRAM_TEST_TIMEOUT		= 2.0;		//  Seconds to wait for a datagram sent over loopback
+
+struct ParityCase
+{
+	int DataCount;
+	int ParityCount;
+	size_t ShardSize;
+};
+
+
+//  Throws away the given shards of an encoded block (filling the data ones with junk), repairs it, and checks what comes back
+bool RepairMatches(const std::vector<std::vector<uint8_t>>& original, const std::vector<std::vector<uint8_t>>& parity, const ParityCase& parityCase, const std::vector<int>& lost, bool& repaired)
+{
+	auto data = original;
+	std::vector<bool> dataPresent(size_t(parityCase.DataCount), true);
+	std::vector<bool> parityPresent(size_t(parityCase.ParityCount), true);
+	for (auto shard : lost)
+	{
+		if (shard < parityCase.DataCount)
+		{
+			dataPresent[size_t(shard)] = false;
+			std::fill(data[size_t(shard)].begin(), data[size_t(shard)].end(), uint8_t(0xA5));
+		}
+		else parityPresent[size_t(shard - parityCase.DataCount)] = false;
+	}
+	auto damaged = data;
+
+	std::vector<uint8_t*> dataPointers;
+	std::vector<const uint8_t*> parityPointers;
+	for (auto& shard : data) dataPointers.push_back(shard.data());
+	for (auto& shard : parity) parityPointers.push_back(shard.data());
+
+	repaired = ReedSolomon::Repair(dataPointers.data(), dataPresent, parityCase.DataCount, parityPointers.data(), parityPresent, parityCase.ParityCount, parityCase.ShardSize);
+	return repaired ? (data == original) : (data == damaged);
+}
+
+
+bool RunParityCase(const ParityCase& parityCase, std::mt19937& generator)
+{
+	auto shardCount = parityCase.DataCount + parityCase.ParityCount;
+	std::vector<std::vector<uint8_t>> data(size_t(parityCase.DataCount), std::vector<uint8_t>(parityCase.ShardSize));
+	std::vector<std::vector<uint8_t>> parity(size_t(parityCase.ParityCount), std::vector<uint8_t>(parityCase.ShardSize));
+	for (auto& shard : data)
+		for (auto& byte : shard) byte = uint8_t(generator());
+
+	std::vector<const uint8_t*> dataPointers;
+	std::vector<uint8_t*> parityPointers;
+	for (auto& shard : data) dataPointers.push_back(shard.data());
+	for (auto& shard : parity) parityPointers.push_back(shard.data());
+	ReedSolomon::Encode(dataPointers.data(), parityCase.DataCount, parityPointers.data(), parityCase.ParityCount, parityCase.ShardSize);
+
+	char caseName[96];
+	snprintf(caseName, sizeof(caseName), "%d data and %d parity shards of %zu bytes", parityCase.DataCount, parityCase.ParityCount, parityCase.ShardSize);
+
+	std::vector<int> shards(static_cast<size_t>(shardCount));
+	for (auto i = 0; i < shardCount; ++i) shards[size_t(i)] = i;
+
+	auto repaired = false;
+	for (auto lostCount = 0; lostCount <= parityCase.ParityCount; ++lostCount)
+	{
+		//  The worst case, where every shard lost is data and all of it has to come from parity
+		std::vector<int> lost(shards.begin(), shards.begin() + std::min(lostCount, parityCase.DataCount));
+		if (!RepairMatches(data, parity, parityCase, lost, repaired) || !repaired)
+		{
+			printf("FAIL %s: losing the first %d data shards wasn't repaired\n", caseName, int(lost.size()));
+			return false;
+		}
+
+		for (auto trial = 0; trial < PARITY_TEST_TRIALS; ++trial)
+		{
+			std::shuffle(shards.begin(), shards.end(), generator);
+			lost.assign(shards.begin(), shards.begin() + lostCount);
+			if (!RepairMatches(data, parity, parityCase, lost, repaired) || !repaired)
+			{
+				printf("FAIL %s: losing %d shards at random wasn't repaired\n", caseName, lostCount);
+				return false;
+			}
+			std::sort(shards.begin(), shards.end());
+		}
+	}
+
+	//  One data shard more than there is parity for can't be rebuilt, and the data mustn't be touched trying
+	if (parityCase.ParityCount < parityCase.DataCount)
+	{
+		std::vector<int> lost(shards.begin(), shards.begin() + parityCase.ParityCount + 1);
+		if (!RepairMatches(data, parity, parityCase, lost, repaired) || repaired)
+		{
+			printf("FAIL %s: losing %d data shards was %s\n", caseName, int(lost.size()), repaired ? "taken as repaired" : "refused, but the data was changed");
+			return false;
+		}
+	}
+
+	printf("PASS %s: up to %d lost shards repaired%s\n", caseName, parityCase.ParityCount, (parityCase.ParityCount < parityCase.DataCount) ? ", one more refused" : "");
+	return true;
+}
+
+
+//  A UDP socket on the first free port from DATAGRAM_TEST_FIRST_PORT, or -1
+int OpenTestSocket(WinsockWrapper& network, int& port)
+{
+	for (port = DATAGRAM_TEST_FIRST_PORT; port < DATAGRAM_TEST_FIRST_PORT + DATAGRAM_TEST_PORT_RANGE; ++port)
+	{
+		auto socketID = network.UDPConnect(port, 1);
+		if (socketID >= 0) return socketID;
+	}
+	return -1;
+}
+
+bool OpenTestEndpoint(DatagramEndpoint& endpoint)
+{
+	for (auto port = DATAGRAM_TEST_FIRST_PORT; port < DATAGRAM_TEST_FIRST_PORT + DATAGRAM_TEST_PORT_RANGE; ++port)
+		if (endpoint.Open(port)) return true;
+	return false;
+}
+
+//  Waits for a datagram on a raw socket, returning false if none came
+bool ReceiveRaw(WinsockWrapper& network, int socketID, SocketBuffer& buffer)
+{
+	std::string senderIP;
+	auto senderPort = 0;
+	auto startTime = std::chrono::steady_clock::now();
+	while (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() < DATAGRAM_TEST_TIMEOUT)
+	{
+		if (network.ReceiveDatagram(socketID, &buffer, senderIP, senderPort) > 0) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+
+bool RunHelloCase()
+{
+	WinsockWrapper network;
+	network.WinsockInitialize(0);
+
+	DatagramEndpoint serverEndpoint(network);
+	DatagramEndpoint clientEndpoint(network);
+	auto relayPort = 0;
+	auto replayPort = 0;
+	auto relaySocket = OpenTestSocket(network, relayPort);
+	auto replaySocket = OpenTestSocket(network, replayPort);
+	if (!OpenTestEndpoint(serverEndpoint) || !OpenTestEndpoint(clientEndpoint) || (relaySocket < 0) || (replaySocket < 0))
+	{
+		printf("FAIL replayed hellos: could not open the UDP sockets\n");
+		return false;
+	}
+
+	//  Both ends share the session, as the TCP side would have set up. The client sends to the relay, which passes each on.
+	auto serverSession = DatagramSession::Create(1);
+	auto clientSession = std::make_shared<DatagramSession>(*serverSession);
+	clientSession->PeerIP = "127.0.0.1";
+	clientSession->PeerPort = relayPort;
+	serverEndpoint.AddSession(serverSession);
+	clientEndpoint.AddSession(clientSession);
+
+	//  Takes hellos the way ServerShard::ProcessDatagram does, returning how many came in with a good tag, and how many were taken
+	auto helloTaken = 0;
+	auto receiveHellos = [&]()
+	{
+		auto received = 0;
+		auto startTime = std::chrono::steady_clock::now();
+		while ((received == 0) && (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() < DATAGRAM_TEST_TIMEOUT))
+		{
+			helloTaken = 0;
+			received = serverEndpoint.ReceiveAll([&](DatagramSession& session, std::unique_ptr<TransportMessage> message, const std::string& senderIP, int senderPort)
+			{
+				if ((message->MessageID != MESSAGE_ID_DATA_CHANNEL_HELLO) || (message->Buffer.bytesleft() < 8)) return;
+				if (session.TakeHello(message->Buffer.readlint(), senderIP, senderPort)) ++helloTaken;
+			});
+			if (received == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return received;
+	};
+
+	//  The client sends its next hello, and the relay captures it and passes it on from the given socket
+	auto sendHello = [&](int forwardSocket, SocketBuffer& captured)
+	{
+		DatagramTransport transport(clientEndpoint, clientSession);
+		transport.BeginMessage(MESSAGE_ID_DATA_CHANNEL_HELLO).writelint(++clientSession->HelloSequence);
+		transport.Send();
+		if (!ReceiveRaw(network, relaySocket, captured)) return false;
+		return (network.SendMessageBuffer(forwardSocket, "127.0.0.1", serverEndpoint.GetPort(), &captured) > 0);
+	};
+	auto resend = [&](SocketBuffer& captured) { return (network.SendMessageBuffer(replaySocket, "127.0.0.1", serverEndpoint.GetPort(), &captured) > 0); };
+
+	SocketBuffer firstHello;
+	SocketBuffer secondHello;
+	std::string failure;
+	if (!sendHello(relaySocket, firstHello) || (receiveHellos() != 1) || (helloTaken != 1) || (serverSession->PeerPort != relayPort))
+		failure = "the first hello wasn't taken";
+	else if (!sendHello(relaySocket, secondHello) || (receiveHellos() != 1) || (helloTaken != 1) || (serverSession->HelloSequence != 2))
+		failure = "the second hello wasn't taken";
+	else if (!resend(firstHello) || (receiveHellos() != 1) || (helloTaken != 0) || (serverSession->PeerPort != relayPort))
+		failure = "a replayed older hello moved the peer";
+	else if (!resend(secondHello) || (receiveHellos() != 1) || (helloTaken != 0) || (serverSession->PeerPort != relayPort))
+		failure = "a replayed copy of the latest hello moved the peer";
+	else
+	{
+		//  A changed byte in the message has to fail the tag, so the endpoint drops it without handing it over
+		auto rejectedBefore = serverEndpoint.GetDatagramsRejected();
+		secondHello.m_BufferData[secondHello.m_BufferUtilizedCount - 1] ^= 0x01;
+		resend(secondHello);
+		auto startTime = std::chrono::steady_clock::now();
+		auto received = 0;
+		while ((serverEndpoint.GetDatagramsRejected() == rejectedBefore) && (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() < DATAGRAM_TEST_TIMEOUT))
+		{
+			received += serverEndpoint.ReceiveAll([&](DatagramSession&, std::unique_ptr<TransportMessage>, const std::string&, int) {});
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		if ((received != 0) || (serverEndpoint.GetDatagramsRejected() != rejectedBefore + 1))
+			failure = "a hello with a changed byte wasn't rejected";
+		else if (!sendHello(replaySocket, firstHello) || (receiveHellos() != 1) || (helloTaken != 1) || (serverSession->PeerPort != replayPort))
+			failure = "a newer hello from a new address didn't move the peer";
+	}
+
+	network.CloseSocket(relaySocket);
+	network.CloseSocket(replaySocket);
+	if (!failure.empty()) { printf("FAIL replayed hellos: %s\n", failure.c_str()); return false; }
+	printf("PASS replayed hellos: %d hellos taken, replays ignored, a changed copy rejected\n", int(serverSession->HelloSequence));
+	return true;
+}
+
+
+int main()
+{
+	const ParityCase parityCases[] =
+	{
+		{ 1, 1, 100 },
+		{ 4, 2, 1000 },
+		{ 10, 4, 1327 },
+		{ 32, 8, 1024 },
+		{ 3, 5, 64 },
+		{ 200, 56, 48 },
+	};
+
+	std::mt19937 generator(1);
+	auto failedCount = 0;
+	for (auto& parityCase : parityCases)
+		if (!RunParityCase(parityCase, generator)) ++failedCount;
+
+	if (!RunHelloCase()) ++failedCount;
+
+	return (failedCount != 0) ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+//  File transfer test
+//  Sends files with the real FileSendTask and FileReceiveTask over a pair of in-memory transports, and checks each file that
+//  arrives is byte for byte the one sent. The connection is always lossless, as TCP is. Each file also goes with a datagram
+//  transport beside it, losing some of what's sent over it, and losing all of it, which the sender has to notice and finish
+//  the file over the connection.
+//
+//  Exits with 0 if every transfer completed and matched, and 1 if any didn't.
+
+#include "Engine/MemoryManager.h"
+
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+//  Groundfish reports file task failures through the debug console, so route those lines to stderr
+struct TestConsole { void AddDebugConsoleLine(std::string line) { fprintf(stderr, "%s\n", line.c_str()); } };
+TestConsole testConsole;
+TestConsole* debugConsole = &testConsole;
+
+#include "FileSendAndReceive.h"
+
+constexpr double TRANSFER_TEST_TIMEOUT		= 60.0;		//  Seconds before a transfer is taken to have hung
+constexpr double TRANSFER_TEST_STEP_SLEEP	= 0.0001;	//  Seconds slept between passes of the loop
+
+
+struct TransferCase
+{
+	std::string Name;
+	uint64_t FileSize;
+	bool UseDatagrams;
+	int DatagramLossPercentage;
+};
+
+
+bool GetFilesMatch(const std::string& firstFileName, const std::string& secondFileName)
+{
+	std::ifstream firstFile(firstFileName, std::ios_base::binary);
+	std::ifstream secondFile(secondFileName, std::ios_base::binary);
+	if (!firstFile.good() || !secondFile.good()) return false;
+
+	std::string firstContents((std::istreambuf_iterator<char>(firstFile)), std::istreambuf_iterator<char>());
+	std::string secondContents((std::istreambuf_iterator<char>(secondFile)), std::istreambuf_iterator<char>());
+	return (firstContents == secondContents);
+}
+
+
+bool RunTransfer(const TransferCase& transferCase)
+{
+	{
+		std::ofstream sourceFile("transfer_source.bin", std::ios_base::binary | std::ios_base::trunc);
+		for (uint64_t i = 0; i < transferCase.FileSize; ++i) sourceFile.put(char(rand() % 256));
+	}
+	std::remove("transfer_destination.bin");
+
+	//  The connection, one end for each side, and the datagram path, which only carries the sender's chunks and parity
+	std::shared_ptr<InMemoryTransport> senderEnd, receiverEnd, senderDataEnd, receiverDataEnd;
+	InMemoryTransport::CreatePair(senderEnd, receiverEnd);
+	InMemoryTransport::CreatePair(senderDataEnd, receiverDataEnd);
+	senderDataEnd->SetLossPercentage(transferCase.DatagramLossPercentage);
+
+	FileSendTask sender("transfer_destination.bin", "test", "transfer_source.bin", HostedFileType(0), HostedFileSubtype(0), senderEnd);
+	if (transferCase.UseDatagrams) sender.SetDataTransport(senderDataEnd);
+	std::unique_ptr<FileReceiveTask> receiver;
+	auto received = false;
+	auto sent = false;
+
+	receiverEnd->SetReceiveCallback([&](std::unique_ptr<TransportMessage> message)
+	{
+		if (message->MessageID == MESSAGE_ID_FILE_SEND_INIT)
+		{
+			receiver = std::make_unique<FileReceiveTask>("transfer_destination.bin", "test", "", HostedFileType(0), HostedFileSubtype(0), transferCase.FileSize, FILE_CHUNK_SIZE, FILE_CHUNK_BUFFER_COUNT, "transfer_destination.tmp", receiverEnd);
+			receiver->StartFileReceive([&]() { received = true; });
+		}
+		else if (receiver != nullptr) receiver->Deliver(std::move(message));
+	});
+	receiverDataEnd->SetReceiveCallback([&](std::unique_ptr<TransportMessage> message) { if (receiver != nullptr) receiver->Deliver(std::move(message)); });
+	senderEnd->SetReceiveCallback([&](std::unique_ptr<TransportMessage> message) { sender.Deliver(std::move(message)); });
+
+	auto startTime = AsyncScheduler::GetNow();
+	sender.StartFileSend([&]() { sent = true; });
+	while (!(received && sent) && (AsyncScheduler::GetNow() - startTime < TRANSFER_TEST_TIMEOUT))
+	{
+		asyncScheduler.Update();
+		jobSystem.ProcessCompletedJobs();
+		std::this_thread::sleep_for(std::chrono::duration<double>(TRANSFER_TEST_STEP_SLEEP));
+	}
+
+	auto complete = received && sent && (receiver != nullptr) && receiver->GetFileTransferComplete();
+	auto matches = complete && GetFilesMatch("transfer_source.bin", "transfer_destination.bin");
+	auto fellBack = sender.GetDataTransportFailed();
+	printf("%s %s: %llu bytes in %.2fs, %llu of %llu datagrams dropped%s\n", matches ? "PASS" : "FAIL", transferCase.Name.c_str(), (unsigned long long)(transferCase.FileSize), AsyncScheduler::GetNow() - startTime,
+		(unsigned long long)(senderDataEnd->GetMessagesDropped()), (unsigned long long)(senderDataEnd->GetMessagesSent()), fellBack ? ", finished over the connection" : "");
+	if (!complete) printf("     the transfer didn't complete (received %d, sent %d)\n", int(received), int(sent));
+	else if (!matches) printf("     the file that arrived doesn't match the one sent\n");
+
+	//  Losing every datagram has to be noticed, or the file would never have arrived
+	if (transferCase.UseDatagrams && (transferCase.DatagramLossPercentage == 100) && !fellBack)
+	{
+		printf("     every datagram was lost, but the sender never gave up on them\n");
+		return false;
+	}
+	return matches;
+}
+
+
+int main()
+{
+	//  Work in a scratch folder, since the transfer writes its files to the working directory
+	auto workingFolder = std::filesystem::temp_directory_path() / "NewProvidenceTests";
+	std::filesystem::create_directories(workingFolder);
+	std::filesystem::current_path(workingFolder);
+
+	const TransferCase transferCases[] =
+	{
+		{ "connection, one short chunk", 1000, false, 0 },
+		{ "connection, whole portions", 2 * FILE_SEND_BUFFER_SIZE, false, 0 },
+		{ "connection, partial last portion", (2 * FILE_SEND_BUFFER_SIZE) + 12345, false, 0 },
+		{ "datagrams, no loss", (2 * FILE_SEND_BUFFER_SIZE) + 12345, true, 0 },
+		{ "datagrams, 2% loss", (2 * FILE_SEND_BUFFER_SIZE) + 12345, true, 2 },
+		{ "datagrams, 15% loss", (2 * FILE_SEND_BUFFER_SIZE) + 12345, true, 15 },
+		{ "datagrams, all lost", FILE_SEND_BUFFER_SIZE + 777, true, 100 },
+	};
+
+	srand(1);
+	auto failedCount = 0;
+	for (auto& transferCase : transferCases)
+		if (!RunTransfer(transferCase)) ++failedCount;
+
+	jobSystem.Shutdown();
+	return (failedCount != 0) ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+//  Message framing test
+//  Sends framed messages between the two ends of a POSIX socket pair through a WinsockWrapper, the way the server's
+//  connections do. Messages are queued and flushed on one end, and the other end waits for epoll to say it's ready, reads
+//  into a frame decoder, and takes frames out. Every frame that comes out is checked against the message sent: its size,
+//  every byte of it, its channel, and that it came in the order sent on that channel.
+//
+//  The legacy, varint and channel framings are each sent two ways. Queued, through the send queues with small socket buffers,
+//  so sends are written in part and frames arrive in pieces, large frames included. Trickled, written straight to the socket
+//  with every header byte on its own and a receive in between, so every header arrives split. The connection also starts on
+//  the legacy framing and moves to the channel framing part way, a reader that only takes one frame at a time lets the decoder
+//  fill, and headers that can't be valid have to mark the stream corrupt. Linux only, as it relies on epoll readiness.
+//
+//  Exits with 0 if every case passed, and 1 if any didn't.
+
+#include "Engine/MemoryManager.h"
+#include "Engine/WinsockWrapper.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <sys/socket.h>
+
+constexpr double FRAMING_TEST_TIMEOUT	= 30.0;		//  Seconds before a case is taken to have stalled
+constexpr int FRAMING_TEST_SOCKET_BUFFER	= 4096;		//  Small, so sends go out in part and frames arrive in pieces
+
+struct FramedMessage
+{
+	int Size;
+	int Channel;
+	uint32_t Seed;
+};
+
+struct FramingCase
+{
+	std::string Name;
+	int FramingVersion;					//  The framing the connection starts on
+	int UpgradeVersion;					//  The framing it moves to after UpgradeAfter messages, or 0 to stay put
+	int UpgradeAfter;
+	bool Trickled;
+	bool PopOneAtATime;
+	std::vector<FramedMessage> Messages;
+};
+
+
+//  The bytes of a message, different for every seed, so a frame with the right size but the wrong contents is caught
+inline char GetPayloadByte(uint32_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return char(state >> 24);
+}
+
+void FillPayload(SocketBuffer& buffer, const FramedMessage& message)
+{
+	buffer.clear();
+	buffer.reserve(message.Size);
+	auto state = message.Seed;
+	for (auto i = 0; i < message.Size; ++i) buffer.m_BufferData[i] = GetPayloadByte(state);
+	buffer.m_BufferUtilizedCount = buffer.m_WritePosition = message.Size;
+}
+
+bool GetPayloadMatches(const SocketBuffer& buffer, const FramedMessage& message)
+{
+	if (buffer.m_BufferUtilizedCount != message.Size) return false;
+	auto state = message.Seed;
+	for (auto i = 0; i < message.Size; ++i)
+		if (buffer.m_BufferData[i] != GetPayloadByte(state)) return false;
+	return true;
+}
+
+inline int GetMessageFramingVersion(const FramingCase& framingCase, int messageIndex)
+{
+	return ((framingCase.UpgradeVersion != 0) && (messageIndex >= framingCase.UpgradeAfter)) ? framingCase.UpgradeVersion : framingCase.FramingVersion;
+}
+
+
+//  Runs one case from a fresh socket pair, returning whether every message arrived as sent
+bool RunFramingCase(const FramingCase& framingCase)
+{
+	int handles[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, handles) != 0) { printf("FAIL %s: could not open a socket pair\n", framingCase.Name.c_str()); return false; }
+
+	WinsockWrapper wrapper;
+	wrapper.WinsockInitialize(0);
+	MANAGE_MEMORY_NEW("WinsockWrapper", sizeof(Socket));
+	auto sendID = wrapper.AddSocket(new Socket(handles[0]));
+	MANAGE_MEMORY_NEW("WinsockWrapper", sizeof(Socket));
+	auto receiveID = wrapper.AddSocket(new Socket(handles[1]));
+	wrapper.SetSync(sendID, 1);
+	wrapper.SetSync(receiveID, 1);
+	wrapper.SetBufferSizes(sendID, FRAMING_TEST_SOCKET_BUFFER, FRAMING_TEST_SOCKET_BUFFER);
+	wrapper.SetBufferSizes(receiveID, FRAMING_TEST_SOCKET_BUFFER, FRAMING_TEST_SOCKET_BUFFER);
+	wrapper.SetFramingVersion(sendID, framingCase.FramingVersion);
+	wrapper.WatchSocket(sendID);
+	wrapper.WatchSocket(receiveID);
+
+	FrameDecoder decoder;
+	decoder.SetFramingVersion(framingCase.FramingVersion);
+
+	//  What each channel is still waiting on, in the order it was sent
+	std::deque<int> expected[SEND_QUEUE_CHANNEL_COUNT];
+	for (auto i = 0; i < int(framingCase.Messages.size()); ++i) expected[framingCase.Messages[i].Channel].push_back(i);
+
+	//  The stream a trickled case writes, with where each header starts and ends, so each header byte goes on its own
+	std::vector<char> stream;
+	std::vector<std::pair<size_t, size_t>> headerSpans;
+	if (framingCase.Trickled)
+	{
+		SocketBuffer payload;
+		for (auto i = 0; i < int(framingCase.Messages.size()); ++i)
+		{
+			auto& message = framingCase.Messages[i];
+			char header[FRAME_HEADER_MAX_SIZE];
+			auto headerSize = EncodeFrameHeader(GetMessageFramingVersion(framingCase, i), message.Size, header, message.Channel);
+			headerSpans.push_back(std::make_pair(stream.size(), stream.size() + size_t(headerSize)));
+			stream.insert(stream.end(), header, header + headerSize);
+			FillPayload(payload, message);
+			stream.insert(stream.end(), payload.m_BufferData, payload.m_BufferData + message.Size);
+		}
+	}
+	const int bodyPieceSizes[] = { 1, 7, 300, 4096, 2, 65536 };
+	size_t streamSent = 0;
+	size_t headerIndex = 0;
+	size_t bodyPieceIndex = 0;
+
+	SocketBuffer outgoing;
+	SocketBuffer incoming;
+	std::vector<int> readySockets;
+	auto messagesQueued = 0;
+	auto messagesReceived = 0;
+	uint64_t frameBytesTaken = 0;
+	uint64_t partialWrites = 0;
+	uint64_t partialReads = 0;
+	auto sendClosed = false;
+	std::string failure;
+
+	auto startTime = std::chrono::steady_clock::now();
+	while (failure.empty())
+	{
+		if (std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() > FRAMING_TEST_TIMEOUT) { failure = "stalled"; break; }
+		wrapper.UpdateReadySockets(readySockets);
+
+		//  Send: queue what the send queues will take and flush, or write the next piece of the stream
+		if (!sendClosed && !framingCase.Trickled)
+		{
+			while (messagesQueued < int(framingCase.Messages.size()))
+			{
+				auto& message = framingCase.Messages[messagesQueued];
+				if (wrapper.GetSendBackpressure(sendID, message.Channel)) break;
+				auto framingVersion = GetMessageFramingVersion(framingCase, messagesQueued);
+				char header[FRAME_HEADER_MAX_SIZE];
+				auto headerSize = EncodeFrameHeader(framingVersion, message.Size, header, message.Channel);
+				wrapper.SetFramingVersion(sendID, framingVersion);
+				FillPayload(outgoing, message);
+				if (wrapper.SendMessageBuffer(sendID, "", 0, &outgoing, message.Channel) != (headerSize + message.Size))
+				{
+					failure = "a message couldn't be queued";
+					break;
+				}
+				++messagesQueued;
+			}
+
+			wrapper.FlushSendQueues();
+			if (!wrapper.GetSendQueue(sendID)->GetEmpty()) ++partialWrites;
+			else if (messagesQueued == int(framingCase.Messages.size())) { wrapper.CloseSocket(sendID); sendClosed = true; }
+		}
+		else if (!sendClosed)
+		{
+			size_t pieceSize = 1;
+			if ((headerIndex < headerSpans.size()) && (streamSent >= headerSpans[headerIndex].second)) ++headerIndex;
+			auto inHeader = (headerIndex < headerSpans.size()) && (streamSent >= headerSpans[headerIndex].first);
+			if (!inHeader)
+			{
+				auto bodyEnd = (headerIndex < headerSpans.size()) ? headerSpans[headerIndex].first : stream.size();
+				pieceSize = std::min<size_t>(size_t(bodyPieceSizes[bodyPieceIndex++ % (sizeof(bodyPieceSizes) / sizeof(int))]), bodyEnd - streamSent);
+			}
+
+			if (streamSent < stream.size())
+			{
+				auto sent = send(wrapper.GetSocketID(sendID), stream.data() + streamSent, pieceSize, MSG_NOSIGNAL);
+				if (sent > 0) streamSent += size_t(sent);
+				if ((sent < 0) && (errno != EWOULDBLOCK)) { failure = "the stream couldn't be written"; break; }
+				if ((sent >= 0) && (size_t(sent) < pieceSize)) ++partialWrites;
+			}
+			if (streamSent == stream.size()) { wrapper.CloseSocket(sendID); sendClosed = true; }
+		}
+
+		//  Receive: read only once epoll has said there's something to read, then take out what has arrived
+		if (wrapper.GetSocketReady(receiveID))
+		{
+			auto received = wrapper.ReceiveFrames(receiveID, &decoder);
+			if ((received < 0) && (received != -1)) { failure = "the receive failed"; break; }
+		}
+		if (decoder.GetCorrupt()) { failure = "the decoder found a corrupt header"; break; }
+
+		while (decoder.PopFrame(incoming))
+		{
+			if (messagesReceived >= int(framingCase.Messages.size())) { failure = "more frames arrived than were sent"; break; }
+			auto channel = decoder.GetFrameChannel();
+			auto framingVersion = GetMessageFramingVersion(framingCase, messagesReceived);
+			if ((framingVersion < FRAMING_VERSION_CHANNELS) && (channel != 0)) { failure = "a frame without a channel came out on channel " + std::to_string(channel); break; }
+			if ((channel < 0) || (channel >= SEND_QUEUE_CHANNEL_COUNT) || expected[channel].empty()) { failure = "a frame came out on channel " + std::to_string(channel) + ", which had nothing more sent on it"; break; }
+
+			auto messageIndex = expected[channel].front();
+			auto& message = framingCase.Messages[messageIndex];
+			if (incoming.m_BufferUtilizedCount != message.Size) { failure = "message " + std::to_string(messageIndex) + " came out as " + std::to_string(incoming.m_BufferUtilizedCount) + " bytes, where " + std::to_string(message.Size) + " were sent"; break; }
+			if (!GetPayloadMatches(incoming, message)) { failure = "message " + std::to_string(messageIndex) + " came out with the right size but the wrong bytes"; break; }
+			expected[channel].pop_front();
+
+			char header[FRAME_HEADER_MAX_SIZE];
+			frameBytesTaken += uint64_t(EncodeFrameHeader(framingVersion, message.Size, header, message.Channel) + message.Size);
+			++messagesReceived;
+
+			//  The receiving end moves to the new framing once it has taken out the last frame sent on the old one
+			if ((framingCase.UpgradeVersion != 0) && (messagesReceived == framingCase.UpgradeAfter)) decoder.SetFramingVersion(framingCase.UpgradeVersion);
+			if (framingCase.PopOneAtATime) break;
+		}
+		if (decoder.GetBytesReceived() > frameBytesTaken) ++partialReads;
+
+		//  Done once every message is out and the close has been seen behind them
+		if ((messagesReceived == int(framingCase.Messages.size())) && decoder.GetClosed())
+		{
+			if (decoder.GetBufferedBytes() != 0) failure = "bytes were left over after the last frame";
+			break;
+		}
+		if (decoder.GetClosed() && !decoder.GetFrameReady() && !wrapper.GetSocketReady(receiveID) && (messagesReceived < int(framingCase.Messages.size()))) { failure = "the connection closed with messages missing"; break; }
+	}
+
+	wrapper.CloseSocket(receiveID);
+	if (!sendClosed) wrapper.CloseSocket(sendID);
+
+	//  Without sends written in part and frames arriving in pieces, the case hasn't tested what it's here for
+	if (failure.empty() && (partialReads == 0)) failure = "every frame arrived whole, so nothing was read in pieces";
+	if (failure.empty() && !framingCase.Trickled && (partialWrites == 0)) failure = "every send was written whole";
+
+	printf("%s %s: %d of %d messages, %llu bytes, %llu partial writes, %llu partial reads\n", failure.empty() ? "PASS" : "FAIL", framingCase.Name.c_str(), messagesReceived, int(framingCase.Messages.size()),
+		(unsigned long long)(decoder.GetBytesReceived()), (unsigned long long)(partialWrites), (unsigned long long)(partialReads));
+	if (!failure.empty()) printf("     %s\n", failure.c_str());
+	return failure.empty();
+}
+
+
+//  Writes bytes that can't be a valid header, and checks the decoder marks the stream corrupt and takes nothing out
+bool RunCorruptHeaderCase(const std::string& name, int framingVersion, const std::vector<unsigned char>& bytes)
+{
+	int handles[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, handles) != 0) { printf("FAIL %s: could not open a socket pair\n", name.c_str()); return false; }
+
+	WinsockWrapper wrapper;
+	wrapper.WinsockInitialize(0);
+	MANAGE_MEMORY_NEW("WinsockWrapper", sizeof(Socket));
+	auto receiveID = wrapper.AddSocket(new Socket(handles[1]));
+	wrapper.SetSync(receiveID, 1);
+	wrapper.WatchSocket(receiveID);
+
+	FrameDecoder decoder;
+	decoder.SetFramingVersion(framingVersion);
+	auto written = send(handles[0], bytes.data(), bytes.size(), MSG_NOSIGNAL);
+
+	std::vector<int> readySockets;
+	SocketBuffer incoming;
+	auto frameTaken = false;
+	for (auto pass = 0; (pass < 10) && !decoder.GetCorrupt(); ++pass)
+	{
+		wrapper.UpdateReadySockets(readySockets);
+		if (wrapper.GetSocketReady(receiveID)) wrapper.ReceiveFrames(receiveID, &decoder);
+		if (decoder.PopFrame(incoming)) frameTaken = true;
+	}
+
+	wrapper.CloseSocket(receiveID);
+	close(handles[0]);
+
+	auto passed = (written == ssize_t(bytes.size())) && decoder.GetCorrupt() && decoder.GetClosed() && !frameTaken;
+	printf("%s %s\n", passed ? "PASS" : "FAIL", name.c_str());
+	if (!passed) printf("     corrupt %d, closed %d, frame taken out %d\n", int(decoder.GetCorrupt()), int(decoder.GetClosed()), int(frameTaken));
+	return passed;
+}
+
+
+//  Message sizes either side of where each framing's header grows, and of where frames stop going through the ring
+std::vector<FramedMessage> BuildMessages(const std::vector<int>& sizes, int repeats, bool mixChannels, uint32_t& seed)
+{
+	std::vector<FramedMessage> messages;
+	for (auto repeat = 0; repeat < repeats; ++repeat)
+		for (auto i = 0; i < int(sizes.size()); ++i)
+		{
+			FramedMessage message;
+			message.Size = sizes[(i * 7 + repeat) % sizes.size()];
+			message.Seed = ++seed * 2654435761u;
+			message.Channel = mixChannels ? int(message.Seed >> 29) : SEND_QUEUE_CONTROL_CHANNEL;
+			messages.push_back(message);
+		}
+	return messages;
+}
+
+
+int main()
+{
+	const std::vector<int> legacySizes = { 0, 1, 2, 127, 128, 255, 256, 1000, 8192, 16383, 16384, FRAME_DIRECT_THRESHOLD, FRAME_DIRECT_THRESHOLD + 1, 50000, FRAME_LEGACY_MAX_MESSAGE_SIZE };
+	const std::vector<int> varintSizes = { 0, 1, 127, 128, 16383, 16384, FRAME_DIRECT_THRESHOLD + 1, FRAME_LEGACY_MAX_MESSAGE_SIZE, FRAME_LEGACY_MAX_MESSAGE_SIZE + 1, 200000, 2097151, 2097152 };
+	const std::vector<int> trickleSizes = { 0, 1, 127, 128, 300, 16383, 16384, FRAME_DIRECT_THRESHOLD + 1 };
+
+	uint32_t seed = 1;
+	std::vector<FramingCase> framingCases;
+	framingCases.push_back({ "legacy framing, queued", FRAMING_VERSION_LEGACY, 0, 0, false, false, BuildMessages(legacySizes, 8, false, seed) });
+	framingCases.push_back({ "legacy framing, trickled", FRAMING_VERSION_LEGACY, 0, 0, true, false, BuildMessages(legacySizes, 2, false, seed) });
+	framingCases.push_back({ "varint framing, queued", FRAMING_VERSION_LARGE, 0, 0, false, false, BuildMessages(varintSizes, 4, false, seed) });
+	framingCases.push_back({ "varint framing, trickled", FRAMING_VERSION_LARGE, 0, 0, true, false, BuildMessages(trickleSizes, 4, false, seed) });
+	framingCases.push_back({ "channel framing, queued", FRAMING_VERSION_CHANNELS, 0, 0, false, false, BuildMessages(varintSizes, 6, true, seed) });
+	framingCases.push_back({ "channel framing, trickled", FRAMING_VERSION_CHANNELS, 0, 0, true, false, BuildMessages(trickleSizes, 4, true, seed) });
+	framingCases.push_back({ "channel framing, one frame taken out at a time", FRAMING_VERSION_CHANNELS, 0, 0, false, true, BuildMessages(legacySizes, 4, true, seed) });
+	framingCases.push_back({ "legacy framing moving to channel framing", FRAMING_VERSION_LEGACY, FRAMING_VERSION_CHANNELS, int(legacySizes.size()) * 2, false, false, BuildMessages(legacySizes, 4, false, seed) });
+
+	auto failedCount = 0;
+	for (auto& framingCase : framingCases)
+		if (!RunFramingCase(framingCase)) ++failedCount;
+
+	//  Five length bytes that all say another follows, and a length past the largest message allowed
+	if (!RunCorruptHeaderCase("varint header that never ends", FRAMING_VERSION_LARGE, { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 })) ++failedCount;
+	if (!RunCorruptHeaderCase("varint length past the largest message", FRAMING_VERSION_CHANNELS, { 0x81, 0x80, 0x80, 0x08, 0x00, 0x00 })) ++failedCount;
+
+	return (failedCount != 0) ? 1 : 0;
+}
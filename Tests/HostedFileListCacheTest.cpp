@@ -0,0 +1,154 @@
+//  Hosted file list cache test
+//  Fills a HostedFileListCache with the lists a server would have built over a catalog of 45 files, listed oldest first:
+//  two full pages, a short last page, and a copy of the first page with an uploader filter. Then uploads, deletes and re-keys
+//  are reported to it the way the server reports them, and after each one the lists it drops have to be exactly the ones
+//  whose window the change reached, with every other list still answered from the cache. Every change has to move the list
+//  sequence on, whether or not it dropped anything.
+//
+//  Exits with 0 if every case passed, and 1 if any didn't.
+
+#include "Engine/MemoryManager.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//  Groundfish reports through the debug console, so route those lines to stderr
+struct TestConsole { void AddDebugConsoleLine(std::string line) { fprintf(stderr, "%s\n", line.c_str()); } };
+TestConsole testConsole;
+TestConsole* debugConsole = &testConsole;
+
+#include "HostedFileListCache.h"
+
+constexpr int LIST_TEST_PAGE_SIZE		= 20;	//  As LATEST_UPLOADS_SENT_COUNT, the rows in a full page
+constexpr int LIST_TEST_FILE_COUNT		= 45;	//  Two full pages and a short one
+
+enum ListChangeKind
+{
+	LIST_CHANGE_UPLOAD,
+	LIST_CHANGE_DELETE,
+	LIST_CHANGE_REKEY,				//  The row changed in place
+};
+
+struct ListChange
+{
+	std::string Name;
+	ListChangeKind Kind;
+	int FileIndex;					//  The file's place in the catalog, oldest first, or -1 for one newer than any
+	std::vector<int> Dropped;		//  Which of the lists (from CachedList) the change has to drop
+};
+
+enum CachedList
+{
+	LIST_FIRST_PAGE,
+	LIST_SECOND_PAGE,
+	LIST_LAST_PAGE,
+	LIST_FIRST_PAGE_FILTERED,
+	LIST_COUNT
+};
+
+
+//  Upload times that sort the same as the catalog does, oldest first
+inline std::string GetUploadTime(int fileIndex) { char uploadTime[32]; snprintf(uploadTime, sizeof(uploadTime), "2020-01-01 00:%02d:00", fileIndex); return uploadTime; }
+inline std::string GetChecksum(int fileIndex) { return "checksum" + std::to_string(fileIndex); }
+
+HostedFileListKey GetKey(int list)
+{
+	switch (list)
+	{
+		case LIST_SECOND_PAGE:			return HostedFileListKey{ LIST_TEST_PAGE_SIZE, "", FILE_TYPE_COUNT, FILE_SUBTYPE_COUNT };
+		case LIST_LAST_PAGE:			return HostedFileListKey{ 2 * LIST_TEST_PAGE_SIZE, "", FILE_TYPE_COUNT, FILE_SUBTYPE_COUNT };
+		case LIST_FIRST_PAGE_FILTERED:	return HostedFileListKey{ 0, "alice", FILE_TYPE_COUNT, FILE_SUBTYPE_COUNT };
+		default:						return HostedFileListKey{ 0, "", FILE_TYPE_COUNT, FILE_SUBTYPE_COUNT };
+	}
+}
+
+//  The window a list is built from, as WriteMessage_HostedFileList records it, with a frame to stand in for the message
+void InsertList(HostedFileListCache& cache, int list)
+{
+	auto key = GetKey(list);
+	HostedFileListWindow window;
+	for (auto i = key.StartIndex; (i < key.StartIndex + LIST_TEST_PAGE_SIZE) && (i < LIST_TEST_FILE_COUNT); ++i)
+	{
+		window.Checksums.push_back(GetChecksum(i));
+		window.LastUploadTime = std::max(window.LastUploadTime, GetUploadTime(i));
+	}
+	window.Full = (window.Checksums.size() >= size_t(LIST_TEST_PAGE_SIZE));
+
+	SocketBuffer message;
+	message.writeint(list);
+	cache.Insert(key, BroadcastFrame::Create(message), std::move(window));
+}
+
+
+bool RunListChange(const ListChange& change)
+{
+	HostedFileListCache cache;
+	for (auto list = 0; list < LIST_COUNT; ++list) InsertList(cache, list);
+	for (auto list = 0; list < LIST_COUNT; ++list)
+	{
+		if (cache.Find(GetKey(list)) == nullptr)
+		{
+			printf("FAIL %s: list %d wasn't found straight after it was added\n", change.Name.c_str(), list);
+			return false;
+		}
+	}
+
+	HostedFileData fileData;
+	fileData.FileTitleChecksum = (change.FileIndex < 0) ? "checksum-new" : GetChecksum(change.FileIndex);
+	fileData.FileUploadTime = (change.FileIndex < 0) ? GetUploadTime(59) : GetUploadTime(change.FileIndex);
+	auto sequenceBefore = cache.GetSequence();
+	if (change.Kind == LIST_CHANGE_UPLOAD) cache.OnFileAdded(fileData);
+	else if (change.Kind == LIST_CHANGE_DELETE) cache.OnFileRemoved(fileData);
+	else cache.OnFileChanged(fileData.FileTitleChecksum);
+
+	std::string failure;
+	if (cache.GetSequence() != sequenceBefore + 1) failure = "the list sequence didn't move on";
+	else if (cache.GetInvalidations() != uint64_t(change.Dropped.size())) failure = std::to_string(cache.GetInvalidations()) + " lists were dropped, not " + std::to_string(change.Dropped.size());
+	for (auto list = 0; (list < LIST_COUNT) && failure.empty(); ++list)
+	{
+		auto shouldDrop = (std::find(change.Dropped.begin(), change.Dropped.end(), list) != change.Dropped.end());
+		auto found = (cache.Find(GetKey(list)) != nullptr);
+		if (found == shouldDrop) failure = "list " + std::to_string(list) + (shouldDrop ? " was kept" : " was dropped");
+	}
+
+	if (!failure.empty()) { printf("FAIL %s: %s\n", change.Name.c_str(), failure.c_str()); return false; }
+	printf("PASS %s: %d of %d lists dropped\n", change.Name.c_str(), int(change.Dropped.size()), int(LIST_COUNT));
+	return true;
+}
+
+
+int main()
+{
+	const ListChange changes[] =
+	{
+		{ "upload, newer than every file", LIST_CHANGE_UPLOAD, -1, { LIST_LAST_PAGE } },
+		{ "upload, dated inside the second page", LIST_CHANGE_UPLOAD, 25, { LIST_SECOND_PAGE, LIST_LAST_PAGE } },
+		{ "upload, dated inside the first page", LIST_CHANGE_UPLOAD, 3, { LIST_FIRST_PAGE, LIST_SECOND_PAGE, LIST_LAST_PAGE, LIST_FIRST_PAGE_FILTERED } },
+		{ "delete, from the last page", LIST_CHANGE_DELETE, 42, { LIST_LAST_PAGE } },
+		{ "delete, the newest file of the second page", LIST_CHANGE_DELETE, 39, { LIST_SECOND_PAGE, LIST_LAST_PAGE } },
+		{ "delete, from the first page", LIST_CHANGE_DELETE, 0, { LIST_FIRST_PAGE, LIST_SECOND_PAGE, LIST_LAST_PAGE, LIST_FIRST_PAGE_FILTERED } },
+		{ "re-key, a row in the second page", LIST_CHANGE_REKEY, 30, { LIST_SECOND_PAGE } },
+		{ "re-key, a row in the first page", LIST_CHANGE_REKEY, 7, { LIST_FIRST_PAGE, LIST_FIRST_PAGE_FILTERED } },
+		{ "re-key, a row no list holds", LIST_CHANGE_REKEY, -1, {} },
+	};
+
+	auto failedCount = 0;
+	for (auto& change : changes)
+		if (!RunListChange(change)) ++failedCount;
+
+	//  Clearing the cache (for a change it can't place) drops everything, and still moves the sequence on
+	HostedFileListCache cache;
+	for (auto list = 0; list < LIST_COUNT; ++list) InsertList(cache, list);
+	auto sequenceBefore = cache.GetSequence();
+	cache.Clear();
+	if ((cache.GetEntryCount() != 0) || (cache.GetSequence() != sequenceBefore + 1) || (cache.Find(GetKey(LIST_FIRST_PAGE)) != nullptr))
+	{
+		printf("FAIL clear: %d lists left\n", int(cache.GetEntryCount()));
+		++failedCount;
+	}
+	else printf("PASS clear: every list dropped\n");
+
+	return (failedCount != 0) ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+//  Session ticket test
+//  Issues tickets from a SessionTicketStore and presents them back the ways a resume can: with the right secret, with a
+//  wrong one, a short one or for a ticket that isn't there, twice, after the user has been issued a newer one, and after
+//  the ticket has run out. Only the right secret for a live ticket may be taken, only once, and a failed attempt must leave
+//  the ticket as it was. The store is given a short lifetime, so expiry can be seen without waiting out the real one.
+//
+//  Exits with 0 if every case passed, and 1 if any didn't.
+
+#include "Engine/MemoryManager.h"
+#include "SessionTickets.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+constexpr double TICKET_TEST_LIFETIME = 0.5;	//  Seconds, long enough for a redeem straight after closing, short to wait out
+
+
+inline std::vector<unsigned char> GetSecret(const SessionTicket& ticket) { return std::vector<unsigned char>(ticket.Secret, ticket.Secret + SESSION_TICKET_SECRET_SIZE); }
+
+
+bool RunRedeemCase()
+{
+	SessionTicketStore store(TICKET_TEST_LIFETIME);
+	auto ticket = store.Issue("alice-id", "alice");
+	auto otherTicket = store.Issue("bob-id", "bob");
+	auto secret = GetSecret(ticket);
+	SessionTicket redeemed;
+	std::string failure;
+
+	auto wrongSecret = secret;
+	wrongSecret[SESSION_TICKET_SECRET_SIZE - 1] ^= 0x01;
+	auto shortSecret = secret;
+	shortSecret.pop_back();
+	auto longSecret = secret;
+	longSecret.push_back(0);
+
+	if ((ticket.TicketID == 0) || (ticket.TicketID == otherTicket.TicketID) || (secret == GetSecret(otherTicket))) failure = "two tickets were issued with the same ID or secret";
+	else if (store.Redeem(ticket.TicketID, wrongSecret, redeemed)) failure = "a wrong secret was taken";
+	else if (store.Redeem(ticket.TicketID, shortSecret, redeemed) || store.Redeem(ticket.TicketID, longSecret, redeemed)) failure = "a secret of the wrong size was taken";
+	else if (store.Redeem(ticket.TicketID, std::vector<unsigned char>(), redeemed)) failure = "an empty secret was taken";
+	else if (store.Redeem(ticket.TicketID + 1, secret, redeemed)) failure = "a ticket that was never issued was taken";
+	else if (store.Redeem(otherTicket.TicketID, secret, redeemed)) failure = "one user's secret was taken for another's ticket";
+	else if (store.GetTicketCount() != 2) failure = "failed attempts changed the store";
+	else if (!store.Redeem(ticket.TicketID, secret, redeemed)) failure = "the right secret wasn't taken after the failed attempts";
+	else if ((redeemed.UserID != "alice-id") || (redeemed.Username != "alice")) failure = "the ticket taken was for someone else";
+	else if (store.Redeem(ticket.TicketID, secret, redeemed)) failure = "a ticket was taken twice";
+	else if (store.GetTicketCount() != 1) failure = "a redeemed ticket was left in the store";
+
+	if (!failure.empty()) { printf("FAIL issue and redeem: %s\n", failure.c_str()); return false; }
+	printf("PASS issue and redeem: taken once with its own secret, and nothing else\n");
+	return true;
+}
+
+
+bool RunReissueCase()
+{
+	SessionTicketStore store(TICKET_TEST_LIFETIME);
+	auto firstTicket = store.Issue("alice-id", "alice");
+	auto secondTicket = store.Issue("alice-id", "alice");
+	SessionTicket redeemed;
+	std::string failure;
+
+	//  A new login, or a resume handing out the next ticket, replaces the last one
+	if (store.GetTicketCount() != 1) failure = std::to_string(store.GetTicketCount()) + " tickets kept for one user";
+	else if (store.Redeem(firstTicket.TicketID, GetSecret(firstTicket), redeemed)) failure = "a replaced ticket was taken";
+	else if (!store.Redeem(secondTicket.TicketID, GetSecret(secondTicket), redeemed)) failure = "the newest ticket wasn't taken";
+
+	if (!failure.empty()) { printf("FAIL reissue: %s\n", failure.c_str()); return false; }
+	printf("PASS reissue: only the newest ticket is good\n");
+	return true;
+}
+
+
+bool RunExpiryCase()
+{
+	SessionTicketStore store(TICKET_TEST_LIFETIME);
+	auto closedTicket = store.Issue("alice-id", "alice");
+	auto quickTicket = store.Issue("bob-id", "bob");
+	auto openTicket = store.Issue("carol-id", "carol");
+	SessionTicket redeemed;
+	std::string failure;
+
+	//  Alice's and Bob's connections close, Carol's stays open
+	store.StartExpiry("alice-id");
+	store.StartExpiry("bob-id");
+	if (!store.Redeem(quickTicket.TicketID, GetSecret(quickTicket), redeemed)) failure = "a ticket wasn't taken straight after its connection closed";
+	else
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(TICKET_TEST_LIFETIME * 1.5));
+
+		//  Closing again can't put the clock back
+		store.StartExpiry("alice-id");
+		if (store.Redeem(closedTicket.TicketID, GetSecret(closedTicket), redeemed)) failure = "a ticket was taken after it ran out";
+		else if (store.GetTicketCount() != 1) failure = "a ticket that ran out was left in the store";
+		else if (!store.Redeem(openTicket.TicketID, GetSecret(openTicket), redeemed)) failure = "a ticket ran out while its connection was open";
+	}
+
+	if (!failure.empty()) { printf("FAIL expiry: %s\n", failure.c_str()); return false; }
+	printf("PASS expiry: good while connected and for %.1fs after, then gone\n", TICKET_TEST_LIFETIME);
+	return true;
+}
+
+
+int main()
+{
+	auto failedCount = 0;
+	if (!RunRedeemCase()) ++failedCount;
+	if (!RunReissueCase()) ++failedCount;
+	if (!RunExpiryCase()) ++failedCount;
+	return (failedCount != 0) ? 1 : 0;
+}